@@ -18,6 +18,12 @@ namespace WASCap
 
         public const int MaxChannels = 32;
 
+        public const int MaxStages = 24;
+        public const int TimeBuckets = 16;
+        private const int StatisticsVersion = 2;
+        private const int StageNameLength = 16;
+        private const int StageStatsSize = StageNameLength + (6 + TimeBuckets) * sizeof(long);
+
         [StructLayout(LayoutKind.Sequential, Pack = 4)]
         private struct ChannelVolumeArray
         {
@@ -55,6 +61,37 @@ namespace WASCap
             float Channel31;
         }
 
+        [StructLayout(LayoutKind.Sequential, Pack = 4)]
+        internal unsafe struct StageStats
+        {
+            public fixed byte Name[StageNameLength];
+            public long Blocks;
+            public long Frames;
+            public long DroppedBlocks;
+            public long Discontinuities;
+            public long BusyTime;
+            public fixed long BusyTimeHistogram[TimeBuckets];
+            public long DeadlineMisses;
+        }
+
+        [StructLayout(LayoutKind.Sequential, Pack = 4)]
+        private unsafe struct Statistics
+        {
+            public int Version;
+            public int StageCount;
+            public long NetworkPackets;
+            public long NetworkBytes;
+            public long NetworkSendErrors;
+            public long DeadlineBlocks;
+            public long DeadlineMisses;
+            public long DeadlineNearMisses;
+            public long RecentDeadlineMisses;
+            public long RecentDeadlineNearMisses;
+            public long LastDeadlineMissTime;
+            public long LastDeadlineMissDuration;
+            public fixed byte Stages[MaxStages * StageStatsSize];
+        }
+
         [StructLayout(LayoutKind.Sequential, Pack = 4)]
         private struct ShmContents
         {
@@ -75,6 +112,8 @@ namespace WASCap
             public int ChannelMask;
             public long LastFrameTickCount;
             public float LastFrameMaxAmplitude;
+            public float LastFrameLatency;
+            public Statistics Statistics;
         }
 
         static readonly Dictionary<EChannel, ChannelFactory> channelFactories;
@@ -292,6 +331,59 @@ namespace WASCap
             set => shmBlock->LastFrameMaxAmplitude = value;
         }
 
+        public unsafe float LastFrameLatency => shmBlock->LastFrameLatency;
+
+        public unsafe bool HasStatistics => StatisticsVersion == Volatile.Read(ref shmBlock->Statistics.Version);
+
+        public unsafe long NetworkPacketsSent => Interlocked.Read(ref shmBlock->Statistics.NetworkPackets);
+
+        public unsafe long NetworkBytesSent => Interlocked.Read(ref shmBlock->Statistics.NetworkBytes);
+
+        public unsafe long NetworkSendErrors => Interlocked.Read(ref shmBlock->Statistics.NetworkSendErrors);
+
+        // Blocks timed at the head of the chain against how long they last.
+        public unsafe long DeadlineBlocks => Interlocked.Read(ref shmBlock->Statistics.DeadlineBlocks);
+
+        public unsafe long DeadlineMisses => Interlocked.Read(ref shmBlock->Statistics.DeadlineMisses);
+
+        // Blocks that took more than 80% of how long they last without missing.
+        public unsafe long DeadlineNearMisses => Interlocked.Read(ref shmBlock->Statistics.DeadlineNearMisses);
+
+        // Over the last 1024 blocks.
+        public unsafe long RecentDeadlineMisses => Interlocked.Read(ref shmBlock->Statistics.RecentDeadlineMisses);
+
+        public unsafe long RecentDeadlineNearMisses => Interlocked.Read(ref shmBlock->Statistics.RecentDeadlineNearMisses);
+
+        // In 100 ns units.
+        public unsafe long LastDeadlineMissTime => Interlocked.Read(ref shmBlock->Statistics.LastDeadlineMissTime);
+
+        public unsafe long LastDeadlineMissDuration => Interlocked.Read(ref shmBlock->Statistics.LastDeadlineMissDuration);
+
+        public unsafe StageStatistics[] Stages
+        {
+            get
+            {
+                if (!HasStatistics)
+                {
+                    return new StageStatistics[0];
+                }
+
+                // Slots with an empty name were freed by the stages of a chain that was replaced.
+                int stageCount = Math.Min(Volatile.Read(ref shmBlock->Statistics.StageCount), MaxStages);
+                List<StageStatistics> stages = new List<StageStatistics>(stageCount);
+                StageStats* stageStats = (StageStats*)shmBlock->Statistics.Stages;
+                for (int i = 0; i < stageCount; ++i)
+                {
+                    if (0 != (stageStats + i)->Name[0])
+                    {
+                        stages.Add(new StageStatistics(stageStats + i));
+                    }
+                }
+
+                return stages.ToArray();
+            }
+        }
+
         public unsafe Channel[] Channels
         {
             get
@@ -404,6 +496,51 @@ namespace WASCap
             }
         }
 
+        // A snapshot of the counters of a stage. The last stage of the chain comes first, unless the chain took slots
+        // that the stages of the one it replaced freed.
+        public class StageStatistics
+        {
+            public string Name { get; }
+
+            public long Blocks { get; }
+
+            public long Frames { get; }
+
+            public long DroppedBlocks { get; }
+
+            public long Discontinuities { get; }
+
+            // Wall clock time, preemption included, in 100 ns units.
+            public long BusyTime { get; }
+
+            // Bucket 0 counts blocks under 1 us, bucket n those from 2^(n-1) us to 2^n us, and the last one all the longer ones.
+            public long[] BusyTimeHistogram { get; }
+
+            // Blocks that missed their deadline while they spent the longest in this stage.
+            public long DeadlineMisses { get; }
+
+            internal unsafe StageStatistics(StageStats* stats)
+            {
+                int nameLength = 0;
+                while (nameLength < StageNameLength && 0 != stats->Name[nameLength])
+                {
+                    ++nameLength;
+                }
+                Name = new string((sbyte*)stats->Name, 0, nameLength);
+                Blocks = Interlocked.Read(ref stats->Blocks);
+                Frames = Interlocked.Read(ref stats->Frames);
+                DroppedBlocks = Interlocked.Read(ref stats->DroppedBlocks);
+                Discontinuities = Interlocked.Read(ref stats->Discontinuities);
+                BusyTime = Interlocked.Read(ref stats->BusyTime);
+                BusyTimeHistogram = new long[TimeBuckets];
+                for (int i = 0; i < TimeBuckets; ++i)
+                {
+                    BusyTimeHistogram[i] = Interlocked.Read(ref stats->BusyTimeHistogram[i]);
+                }
+                DeadlineMisses = Interlocked.Read(ref stats->DeadlineMisses);
+            }
+        }
+
         private class ChannelFactory
         {
             readonly MethodInfo volumeGetter;
@@ -9,9 +9,47 @@
 
 #include "main.h"
 #include "string_format.h"
+#include "trace.h"
 #include "win32_helper.h"
 #include "errors.h"
 
+// Spans that each thread keeps, about a minute of blocks for a stage every 10 ms, a few megabytes.
+#define TRACE_EVENTS_PER_THREAD (1 << 16)
+
+namespace
+{
+	// Reports an error the way the user asked to see them.
+	void report(const wascap::command_line_arguments& arguments, const char* what)
+	{
+		if (arguments.use_message_box) {
+			MessageBoxA(nullptr, what, "WASCap", MB_ICONERROR);
+		}
+		else {
+			fprintf(stderr, "%s\n", what);
+		}
+	}
+
+	int verb_main(const wascap::command_line_arguments& arguments)
+	{
+		switch (arguments.verb) {
+		case wascap::help:
+			return wascap::help_main(arguments, nullptr);
+		case wascap::list:
+			return wascap::list_main(arguments);
+		case wascap::capture:
+			return wascap::capture_main(arguments);
+		case wascap::serve:
+			return wascap::serve_main(arguments);
+		case wascap::host:
+			return wascap::host_main(arguments);
+		default:
+			report(arguments, "Verb not implemented (in main)");
+
+			return 2;
+		}
+	}
+}
+
 int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow)
 {
 	setvbuf(stderr, nullptr, _IONBF, 0);
@@ -40,37 +78,33 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 		return 2;
 	}
 
+	int result;
 	try {
+		if (!arguments.trace_path.empty()) {
+			wascap::trace::enable(TRACE_EVENTS_PER_THREAD);
+		}
+
 		if (arguments.lifetime_process) {
 			CloseHandle(WIN32_CHECK(CreateThread(nullptr, 0, wascap::bind_lifetime, arguments.lifetime_process, 0, nullptr)));
 		}
 
-		switch (arguments.verb) {
-		case wascap::help:
-			return wascap::help_main(arguments, nullptr);
-		case wascap::list:
-			return wascap::list_main(arguments);
-		case wascap::capture:
-			return wascap::capture_main(arguments);
-		default:
-			if (arguments.use_message_box) {
-				MessageBoxA(nullptr, "Verb not implemented (in main)", "WASCap", MB_ICONERROR);
-			}
-			else {
-				fprintf(stderr, "Verb not implemented (in main)\n");
-			}
-
-			return 2;
-		}
+		result = verb_main(arguments);
 	}
 	catch (const std::exception& e) {
-		if (arguments.use_message_box) {
-			MessageBoxA(nullptr, e.what(), "WASCap", MB_ICONERROR);
+		report(arguments, e.what());
+
+		result = 1;
+	}
+
+	// The spans that led to a failure are the ones worth looking at, so they are written whatever the result.
+	if (!arguments.trace_path.empty() && wascap::trace::is_enabled()) {
+		try {
+			wascap::trace::dump(arguments.trace_path);
 		}
-		else {
-			fprintf(stderr, "%s\n", e.what());
+		catch (const std::exception& e) {
+			report(arguments, e.what());
 		}
-
-		return 1;
 	}
+
+	return result;
 }
\ No newline at end of file
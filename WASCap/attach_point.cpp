@@ -0,0 +1,143 @@
+#include "stdafx.h"
+
+#include "attach_point.h"
+#include "realtime_check.h"
+
+namespace
+{
+	// The end of the conversion stages, which passes their frames on to a chain it does not own.
+	// Blocks larger than the chain was prepared for are cut to size, each piece described as a block of its own.
+	class attached_sink : public wascap::sink::sink
+	{
+		wascap::sink::sink& m_chain;
+		// Source frames per chain frame, which stream positions count in.
+		double m_position_scale;
+		wascap::sink::block_info m_info;
+		bool m_discontinuity;
+
+		void begin_piece(size_t offset)
+		{
+			wascap::sink::block_info info = m_info;
+			if (0 != info.capture_time) {
+				info.capture_time += (offset * 10000000ULL) / samplerate();
+			}
+			info.stream_position += (UINT64)(offset * m_position_scale);
+			info.discontinuity = (0 == offset) && (info.discontinuity || m_discontinuity);
+			m_discontinuity = false;
+
+			m_chain.begin_block(info);
+		}
+
+	public:
+		attached_sink(wascap::sink::sink& chain, size_t source_samplerate)
+			: sink(chain.samplerate(), chain.channel_mask(), chain.layout()), m_chain(chain), m_position_scale((double)source_samplerate / (double)chain.samplerate()), m_info(), m_discontinuity(true)
+		{
+		}
+
+		virtual bool can_play() const
+		{
+			return m_chain.can_play();
+		}
+
+		virtual bool is_open() const
+		{
+			return m_chain.is_open();
+		}
+
+		virtual bool is_playing() const
+		{
+			return m_chain.is_playing();
+		}
+
+		virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const
+		{
+			return m_chain.buffer_level(queued_frames, capacity_frames);
+		}
+
+		// The chain is already prepared.
+		virtual void prepare(wascap::sink::buffer_pool& pool, size_t max_frames)
+		{
+			sink::prepare(pool, max_frames);
+		}
+
+		virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const
+		{
+			return m_chain.writable_frames(frames, retry_after_ms);
+		}
+
+		virtual void latency_meters(std::vector<const wascap::sink::latency_meter*>& meters) const
+		{
+			m_chain.latency_meters(meters);
+		}
+
+		virtual void begin_block(const wascap::sink::block_info& info)
+		{
+			m_info = info;
+		}
+
+		virtual bool process(const float* samples, size_t frames)
+		{
+			size_t max_piece_frames = m_chain.max_frames();
+			size_t ch = channels();
+
+			bool played = false;
+			for (size_t offset = 0; offset < frames; offset += max_piece_frames) {
+				begin_piece(offset);
+				played |= m_chain.process(samples + (offset * ch), min(frames - offset, max_piece_frames));
+			}
+
+			return played;
+		}
+
+		virtual bool process_silence(size_t frames)
+		{
+			size_t max_piece_frames = m_chain.max_frames();
+
+			bool played = false;
+			for (size_t offset = 0; offset < frames; offset += max_piece_frames) {
+				begin_piece(offset);
+				played |= m_chain.process_silence(min(frames - offset, max_piece_frames));
+			}
+
+			return played;
+		}
+
+		virtual void flush()
+		{
+			m_chain.flush();
+		}
+	};
+}
+
+wascap::sink::attach_point::attach_point(std::unique_ptr<sink> chain, size_t max_frames, resampler_quality quality, DWORD matrix_channel_mask, const std::vector<float>& coefficients)
+	: m_pool(), m_chain(std::move(chain)), m_quality(quality), m_matrix_channel_mask(matrix_channel_mask), m_coefficients(coefficients)
+{
+	m_chain->prepare(m_pool, max_frames);
+}
+
+wascap::sink::sink& wascap::sink::attach_point::attach(size_t samplerate, DWORD channel_mask, size_t max_frames)
+{
+	m_head.reset();
+	m_head_pool = std::make_unique<buffer_pool>();
+
+	// Channels are mapped on whichever side of the resampler has fewer of them.
+	std::unique_ptr<sink> s = std::make_unique<attached_sink>(*m_chain, samplerate);
+	bool map_first = __popcnt(channel_mask) > s->channels();
+	if (map_first && samplerate != s->samplerate()) {
+		s = realtime_checked(std::make_unique<samplerate_convert_sink>(std::move(s), samplerate, m_quality));
+	}
+	if (channel_mask == m_matrix_channel_mask && !m_coefficients.empty()) {
+		s = realtime_checked(std::make_unique<channel_convert_sink>(std::move(s), channel_mask, m_coefficients));
+	}
+	else if (channel_mask != s->channel_mask()) {
+		s = realtime_checked(std::make_unique<channel_convert_sink>(std::move(s), channel_mask));
+	}
+	if (samplerate != s->samplerate()) {
+		s = realtime_checked(std::make_unique<samplerate_convert_sink>(std::move(s), samplerate, m_quality));
+	}
+
+	s->prepare(*m_head_pool, max_frames);
+	m_head = std::move(s);
+
+	return *m_head;
+}
\ No newline at end of file
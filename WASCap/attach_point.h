@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "base_sink.h"
+#include "buffer_pool.h"
+#include "convert_sink.h"
+#include "no_copy.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		// Where a source attaches to a chain that outlives it. The chain keeps the format it was built for, and each
+		// source that attaches gets conversion stages of its own in front of it. Replacing the source with one of
+		// another format thus rebuilds only those, while the stages of the chain carry on with their state and outputs.
+		class attach_point : util::no_copy_no_move
+		{
+			// Declared before the chain, which borrows its buffers.
+			buffer_pool m_pool;
+			std::unique_ptr<sink> m_chain;
+			resampler_quality m_quality;
+			// The mixing matrix, and the source layout it maps.
+			DWORD m_matrix_channel_mask;
+			std::vector<float> m_coefficients;
+			// The conversion stages of the current source, which end in the chain.
+			std::unique_ptr<buffer_pool> m_head_pool;
+			std::unique_ptr<sink> m_head;
+
+		public:
+			// The chain is prepared for packets of up to max_frames at its own format, and no packet that reaches it
+			// is ever larger, whatever the source. Sources in the layout of the matrix, if any, are mapped with it;
+			// the others get the default mapping.
+			attach_point(std::unique_ptr<sink> chain, size_t max_frames, resampler_quality quality, DWORD matrix_channel_mask = 0, const std::vector<float>& coefficients = std::vector<float>());
+
+			inline sink& chain() const { return *m_chain; }
+
+			// Replaces the conversion stages with ones that take packets of up to max_frames in the given format, and
+			// returns the sink the source should feed. The first block through it is a discontinuity.
+			// Frames still in the stages it replaces are dropped.
+			sink& attach(size_t samplerate, DWORD channel_mask, size_t max_frames);
+		};
+	}
+}
\ No newline at end of file
@@ -1,13 +1,100 @@
 #include "stdafx.h"
 
+#include <stdexcept>
+
 #include "base_sink.h"
+#include "string_format.h"
+
+#define SILENCE_SAMPLES 16384
+
+namespace
+{
+	const float silence[SILENCE_SAMPLES] = { 0.0f };
+}
+
+wascap::sink::sink::sink(size_t samplerate, DWORD channel_mask, frame_layout layout)
+	: m_samplerate(samplerate), m_channel_mask(channel_mask), m_layout(layout), m_max_frames(0), m_silence(silence)
+{
+}
 
 wascap::sink::sink::~sink()
 {
 }
 
-wascap::sink::null_sink::null_sink(size_t samplerate, DWORD channel_mask)
-	: sink(samplerate, channel_mask)
+void wascap::sink::sink::require_layout(frame_layout layout) const
+{
+	if (layout != m_layout) {
+		throw std::runtime_error((frame_layout::planar == layout) ? "Sink requires planar frames" : "Sink requires interleaved frames");
+	}
+}
+
+void wascap::sink::sink::require_frames(size_t frames) const
+{
+	if (frames > m_max_frames) {
+		throw std::length_error(util::string_format("Packet of %d frames exceeds the %d frames the sink was prepared for", frames, m_max_frames));
+	}
+}
+
+bool wascap::sink::sink::buffer_level(size_t&, size_t&) const
+{
+	return false;
+}
+
+void wascap::sink::sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	m_max_frames = max_frames;
+
+	// Pool buffers start zeroed, and nothing writes to this one.
+	if (max_frames * channels() > SILENCE_SAMPLES) {
+		m_silence = pool.allocate(max_frames * channels());
+	}
+}
+
+bool wascap::sink::sink::writable_frames(size_t&, DWORD&) const
+{
+	return false;
+}
+
+void wascap::sink::sink::latency_meters(std::vector<const latency_meter*>&) const
+{
+}
+
+void wascap::sink::sink::begin_block(const block_info&)
+{
+}
+
+bool wascap::sink::sink::process_silence(size_t frames)
+{
+	// Blocks longer than the shared zeros need the ones prepare took from the pool.
+	if (frames * channels() > SILENCE_SAMPLES) {
+		require_frames(frames);
+	}
+
+	return process(m_silence, frames);
+}
+
+wascap::sink::process_result wascap::sink::sink::try_process(const float* samples, size_t frames, const block_info& info)
+{
+	process_result result = { false, frames, false, 0 };
+
+	size_t writable;
+	DWORD retry_after_ms;
+	if (writable_frames(writable, retry_after_ms) && writable < frames) {
+		result.consumed_frames = writable;
+		result.would_block = true;
+		result.retry_after_ms = retry_after_ms;
+	}
+
+	if (result.consumed_frames > 0) {
+		begin_block(info);
+		result.played = info.silent ? process_silence(result.consumed_frames) : process(samples, result.consumed_frames);
+	}
+
+	return result;
+}
+
+wascap::sink::null_sink::null_sink(size_t samplerate, DWORD channel_mask, frame_layout layout)
+	: sink(samplerate, channel_mask, layout)
 {
 }
 
@@ -26,7 +113,12 @@ bool wascap::sink::null_sink::is_playing() const
 	return false;
 }
 
-bool wascap::sink::null_sink::process(const float* samples, size_t frames)
+bool wascap::sink::null_sink::process(const float*, size_t)
+{
+	return true;
+}
+
+bool wascap::sink::null_sink::process_silence(size_t)
 {
 	return true;
 }
@@ -36,22 +128,27 @@ void wascap::sink::null_sink::flush()
 }
 
 wascap::sink::chain_sink::chain_sink(std::unique_ptr<sink> next)
-	: sink(next->samplerate(), next->channel_mask()), m_next(std::move(next))
+	: sink(next->samplerate(), next->channel_mask(), next->layout()), m_next(std::move(next))
 {
 }
 
 wascap::sink::chain_sink::chain_sink(std::unique_ptr<sink> next, size_t samplerate)
-	: sink(samplerate, next->channel_mask()), m_next(std::move(next))
+	: sink(samplerate, next->channel_mask(), next->layout()), m_next(std::move(next))
 {
 }
 
 wascap::sink::chain_sink::chain_sink(std::unique_ptr<sink> next, DWORD channel_mask)
-	: sink(next->samplerate(), channel_mask), m_next(std::move(next))
+	: sink(next->samplerate(), channel_mask, next->layout()), m_next(std::move(next))
 {
 }
 
 wascap::sink::chain_sink::chain_sink(std::unique_ptr<sink> next, size_t samplerate, DWORD channel_mask)
-	: sink(samplerate, channel_mask), m_next(std::move(next))
+	: sink(samplerate, channel_mask, next->layout()), m_next(std::move(next))
+{
+}
+
+wascap::sink::chain_sink::chain_sink(std::unique_ptr<sink> next, frame_layout layout)
+	: sink(next->samplerate(), next->channel_mask(), layout), m_next(std::move(next))
 {
 }
 
@@ -70,6 +167,41 @@ bool wascap::sink::chain_sink::is_playing() const
 	return m_next->is_playing();
 }
 
+bool wascap::sink::chain_sink::buffer_level(size_t& queued_frames, size_t& capacity_frames) const
+{
+	return m_next->buffer_level(queued_frames, capacity_frames);
+}
+
+void wascap::sink::chain_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	sink::prepare(pool, max_frames);
+
+	m_next->prepare(pool, max_frames);
+}
+
+bool wascap::sink::chain_sink::writable_frames(size_t& frames, DWORD& retry_after_ms) const
+{
+	if (!m_next->writable_frames(frames, retry_after_ms)) {
+		return false;
+	}
+
+	if (samplerate() != m_next->samplerate()) {
+		frames = (size_t)(((unsigned long long)frames * samplerate()) / m_next->samplerate());
+	}
+
+	return true;
+}
+
+void wascap::sink::chain_sink::latency_meters(std::vector<const latency_meter*>& meters) const
+{
+	m_next->latency_meters(meters);
+}
+
+void wascap::sink::chain_sink::begin_block(const block_info& info)
+{
+	m_next->begin_block(info);
+}
+
 bool wascap::sink::chain_sink::process(const float* samples, size_t frames)
 {
 	return m_next->process(samples, frames);
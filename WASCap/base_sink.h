@@ -1,10 +1,11 @@
 #pragma once
 
-#include <windows.h>
-#include <intrin.h>
 #include <memory>
+#include <vector>
 
+#include "buffer_pool.h"
 #include "no_copy.h"
+#include "platform.h"
 
 namespace wascap
 {
@@ -12,13 +13,54 @@ namespace wascap
 	{
 		constexpr size_t MAX_CHANNELS = sizeof(DWORD) << 3;
 
+		// Planar blocks hold one plane per channel, back to back, each exactly as long as the block.
+		enum class frame_layout
+		{
+			interleaved,
+			planar,
+		};
+
+		// What the source knows about a block, handed down the chain ahead of its frames.
+		struct block_info
+		{
+			// When the first frame was captured, in 100 ns units of the performance counter, or 0 when unknown.
+			UINT64 capture_time;
+			// Position of the first frame in the captured stream, in frames at the source rate.
+			UINT64 stream_position;
+			// The block does not follow the previous one, after a glitch or dropped frames.
+			bool discontinuity;
+			// The source flagged the block as silence.
+			bool silent;
+		};
+
+		class latency_meter;
+
+		// What became of a block given to try_process.
+		struct process_result
+		{
+			// Whether an output played the frames, as process returns.
+			bool played;
+			// Frames taken from the front of the block; the caller presents the rest again later.
+			size_t consumed_frames;
+			// Set when an output had no room for the rest of the block.
+			bool would_block;
+			// How long the outputs expect to need to make room for another packet, when they would block.
+			DWORD retry_after_ms;
+		};
+
 		class sink : util::no_copy_no_move
 		{
 			size_t m_samplerate;
 			DWORD m_channel_mask;
+			frame_layout m_layout;
+			size_t m_max_frames;
+			// Zeros for a whole block, which the default process_silence feeds to process.
+			const float* m_silence;
 
 		protected:
-			inline sink(size_t samplerate, DWORD channel_mask) : m_samplerate(samplerate), m_channel_mask(channel_mask) { }
+			sink(size_t samplerate, DWORD channel_mask, frame_layout layout);
+
+			void require_frames(size_t frames) const;
 
 		public:
 			virtual ~sink();
@@ -26,20 +68,48 @@ namespace wascap
 			inline size_t samplerate() const { return m_samplerate; }
 			inline size_t channels() const { return __popcnt(m_channel_mask); }
 			inline DWORD channel_mask() const { return m_channel_mask; }
+			inline frame_layout layout() const { return m_layout; }
+			inline size_t max_frames() const { return m_max_frames; }
+
+			void require_layout(frame_layout layout) const;
 
 			virtual bool can_play() const = 0;
 
 			virtual bool is_open() const = 0;
 			virtual bool is_playing() const = 0;
 
+			// Frames queued downstream that have not been played yet, for sinks that drain at their own clock rate.
+			virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const;
+
+			// Called once, before the first packet, with the largest packet the sink will ever be given.
+			// Sinks take their scratch buffers from the pool here and prepare the rest of the chain.
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			// Frames the outputs can take without blocking, and how long until they can take another packet.
+			// Returns false when the sink never blocks.
+			virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const;
+
+			// Collects the meters of the outputs that measure the latency of the blocks they emit.
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			// Describes the frames given to the next call to process.
+			virtual void begin_block(const block_info& info);
 			virtual bool process(const float* samples, size_t frames) = 0;
+			// Takes a block of zeros. By default, feeds actual zeros to process, in one call so that stages that keep
+			// state from block to block see it once; stages that know what silence becomes through them pass it on
+			// without touching samples.
+			virtual bool process_silence(size_t frames);
 			virtual void flush() = 0;
+
+			// Processes as much of an interleaved block as the outputs can take without blocking.
+			// Blocks the source flags as silent go through process_silence, and their samples are never read.
+			process_result try_process(const float* samples, size_t frames, const block_info& info);
 		};
 
 		class null_sink : public sink
 		{
 		public:
-			null_sink(size_t samplerate, DWORD channel_mask);
+			null_sink(size_t samplerate, DWORD channel_mask, frame_layout layout = frame_layout::interleaved);
 
 			virtual bool can_play() const;
 
@@ -47,6 +117,7 @@ namespace wascap
 			virtual bool is_playing() const;
 
 			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
 			virtual void flush();
 		};
 
@@ -59,6 +130,7 @@ namespace wascap
 			chain_sink(std::unique_ptr<sink> next, size_t samplerate);
 			chain_sink(std::unique_ptr<sink> next, DWORD channel_mask);
 			chain_sink(std::unique_ptr<sink> next, size_t samplerate, DWORD channel_mask);
+			chain_sink(std::unique_ptr<sink> next, frame_layout layout);
 
 			inline sink& next() const { return *m_next; }
 
@@ -68,6 +140,17 @@ namespace wascap
 			virtual bool is_open() const;
 			virtual bool is_playing() const;
 
+			virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const;
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			// Converts the room behind a change of rate to frames at this sink's rate at the nominal ratio, rounding down.
+			// Resamplers override it with the ratio they actually run at and the frames they hold.
+			virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const;
+
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			virtual void begin_block(const block_info& info);
 			virtual bool process(const float* samples, size_t frames);
 			virtual void flush();
 		};
@@ -0,0 +1,236 @@
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#include <psapi.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "bench.h"
+#include "deadline_sink.h"
+#include "errors.h"
+#include "string_format.h"
+
+#ifdef _WIN32
+#pragma comment (lib, "psapi.lib")
+#endif
+
+// Measurements this short are dominated by the clock and by the first blocks.
+#define BENCH_MIN_BLOCKS 3
+
+wascap::bench::loopback_receiver::loopback_receiver(util::shared_wsa wsa)
+	: m_socket(wsa, AF_INET, SOCK_DGRAM, IPPROTO_UDP), m_port()
+{
+	struct addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	util::wsa_addrinfo addr(wsa, "127.0.0.1", "0", hints);
+	m_socket.bind(addr.addr());
+
+	sockaddr_in bound = {};
+	socklen_t length = sizeof(bound);
+	WSA_CHECK(getsockname(m_socket, (sockaddr*)&bound, &length));
+	m_port = util::string_format("%u", (unsigned int)ntohs(bound.sin_port));
+}
+
+wascap::bench::discard_sink::discard_sink(std::unique_ptr<sink> next)
+	: chain_sink(std::move(next))
+{
+}
+
+bool wascap::bench::discard_sink::can_play() const
+{
+	return true;
+}
+
+bool wascap::bench::discard_sink::is_playing() const
+{
+	return true;
+}
+
+std::vector<wascap::bench::named_chain> wascap::bench::capture_chains()
+{
+	std::vector<named_chain> chains;
+
+	named_chain resample_network = { "resample-network", false, sink::chain_options() };
+	resample_network.options.with_network_sink = true;
+	chains.push_back(resample_network);
+
+	named_chain volume_network = { "volume-network", true, sink::chain_options() };
+	volume_network.options.with_network_sink = true;
+	volume_network.options.with_compiled_pipeline = false;
+	volume_network.options.with_shm_tap_sink = false;
+	volume_network.options.with_shm_averaging_sink = false;
+	chains.push_back(volume_network);
+
+	named_chain full = { "full", true, sink::chain_options() };
+	full.options.with_network_sink = true;
+	full.options.with_compiled_pipeline = false;
+	chains.push_back(full);
+
+	// Where there is no compiled pipeline for the channels, capture falls back to the chain above.
+	named_chain full_compiled = { "full-compiled", true, sink::chain_options() };
+	full_compiled.options.with_network_sink = true;
+	chains.push_back(full_compiled);
+
+	// The network on the benchmark thread, and the render output on a worker behind its queue.
+	named_chain full_tee = { "full-tee", true, sink::chain_options() };
+	full_tee.options.with_network_sink = true;
+	full_tee.options.with_was_sink = true;
+	chains.push_back(full_tee);
+
+	for (named_chain& chain : chains) {
+		chain.options.samplerate = BENCH_CHAIN_SAMPLERATE;
+		chain.options.peer_address = "127.0.0.1";
+	}
+
+	return chains;
+}
+
+// Each stage is checked in WASCAP_REALTIME_CHECK builds, as capture checks them.
+std::unique_ptr<wascap::sink::sink> wascap::bench::build_chain(const named_chain& chain, const chain_context& context, std::vector<sink::queue_sink*>& queues)
+{
+	sink::chain_options options = chain.options;
+	options.peer_service = context.port;
+	options.resampler_quality = context.resampler_quality;
+
+	sink::render_output_factory render_output = [](size_t samplerate, DWORD channel_mask) -> std::unique_ptr<sink::sink> {
+		return std::make_unique<discard_sink>(std::make_unique<sink::null_sink>(samplerate, channel_mask));
+	};
+	std::shared_ptr<shmctl::shmctl> shmctl = chain.with_control_block ? context.shmctl : nullptr;
+
+	std::unique_ptr<sink::sink> s = sink::plan_chain(options, render_output, shmctl, context.samplerate, context.channel_mask, queues);
+	return std::make_unique<sink::deadline_sink>(std::move(s), shmctl);
+}
+
+std::vector<float> wascap::bench::make_signal(DWORD channel_mask, size_t frames)
+{
+	const double PI = 3.14159265358979323846;
+
+	size_t channels = __popcnt(channel_mask);
+	std::vector<float> samples(frames * channels);
+	for (size_t f = 0; f < frames; ++f) {
+		for (size_t c = 0; c < channels; ++c) {
+			samples[(f * channels) + c] = (float)(0.5 * sin(2.0 * PI * (double)f * (double)(c + 1) / 97.0));
+		}
+	}
+
+	return samples;
+}
+
+wascap::bench::measurement wascap::bench::measure(sink::sink& chain, const float* samples, size_t block_frames, const bench_options& options, perf_counters* counters)
+{
+	sink::block_info info = { 0, 0, false, false };
+
+	// One block ahead of the clock, so that caches and lazily built state are warm.
+	chain.try_process(samples, block_frames, info);
+	info.stream_position += block_frames;
+
+	measurement result = {};
+	for (double& events : result.counters.events) {
+		events = -1.0;
+	}
+	if (nullptr != counters) {
+		counters->start();
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	do {
+		chain.try_process(samples, block_frames, info);
+		info.stream_position += block_frames;
+		++result.blocks;
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (result.blocks < BENCH_MIN_BLOCKS || result.seconds < options.min_seconds);
+	if (nullptr != counters) {
+		result.counters = counters->stop();
+	}
+	result.frames = result.blocks * block_frames;
+
+	chain.flush();
+
+	return result;
+}
+
+bool wascap::bench::matches_filter(const bench_options& options, const char* name)
+{
+	return options.filter.empty() || std::string(name).find(options.filter) != std::string::npos;
+}
+
+double wascap::bench::percentile(const std::vector<double>& sorted, double fraction)
+{
+	if (sorted.empty()) {
+		return 0.0;
+	}
+
+	return sorted[min(sorted.size() - 1, (size_t)(fraction * (double)sorted.size()))];
+}
+
+#ifndef _WIN32
+namespace
+{
+	// A line of /proc/self/status, such as VmRSS or VmHWM, in kilobytes; 0 when it is missing.
+	size_t proc_status_kb(const char* field)
+	{
+		FILE* status = fopen("/proc/self/status", "r");
+		if (nullptr == status) {
+			return 0;
+		}
+
+		size_t field_length = strlen(field);
+		size_t kb = 0;
+		char line[256];
+		while (nullptr != fgets(line, sizeof(line), status)) {
+			if (0 == strncmp(line, field, field_length) && ':' == line[field_length]) {
+				kb = (size_t)strtoull(line + field_length + 1, nullptr, 10);
+				break;
+			}
+		}
+		fclose(status);
+
+		return kb;
+	}
+}
+#endif
+
+size_t wascap::bench::rss_kb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	counters.cb = sizeof(counters);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+
+	return counters.WorkingSetSize / 1024;
+#else
+	return proc_status_kb("VmRSS");
+#endif
+}
+
+void wascap::bench::reset_peak_rss()
+{
+#ifndef _WIN32
+	// Linux starts the peak over at the current resident set when 5 is written there.
+	FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+	if (nullptr != clear_refs) {
+		fputs("5", clear_refs);
+		fclose(clear_refs);
+	}
+#endif
+}
+
+size_t wascap::bench::peak_rss_kb()
+{
+#ifdef _WIN32
+	return rss_kb();
+#else
+	return proc_status_kb("VmHWM");
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base_sink.h"
+#include "chain_planner.h"
+#include "convert_sink.h"
+#include "fixture.h"
+#include "no_copy.h"
+#include "shmctl_sink.h"
+#include "wsa_helper.h"
+
+// The format of the chains, as the deployments configure them; sources of other rates get a resampler in front.
+#define BENCH_CHAIN_SAMPLERATE 48000
+// The tap of the control block of each chain.
+#define BENCH_TAP_BYTES (1 << 20)
+// Cycles, instructions, L1 data cache read misses, last level cache misses and branch misses.
+#define BENCH_COUNTER_EVENTS 5
+
+namespace wascap
+{
+	namespace bench
+	{
+		struct bench_options
+		{
+			// Only the cases whose stage or chain name contains it run; all of them when it is empty.
+			std::string filter;
+			// Each measurement lasts at least this long, and at least a few blocks.
+			double min_seconds = 0.05;
+			sink::resampler_quality resampler_quality = sink::resampler_quality::medium;
+
+			// The recording chains play, as raw floats in the given format, or a WAV file when the samplerate is 0.
+			std::string input;
+			size_t raw_samplerate = 0;
+			DWORD raw_channel_mask = 0;
+			// Chains that run side by side on the one benchmark thread, each with a source and control block of its own.
+			size_t streams = 1;
+			// Latency runs play the recording in real time, for at most this long, with a marker every interval.
+			double latency_seconds = 10.0;
+			size_t marker_interval_ms = 100;
+			// Whether stage runs count hardware events as well.
+			bool counters = false;
+		};
+
+		struct counter_values
+		{
+			// Scaled up for the time the system had an event off the processor to count others; negative for the events
+			// that are not available.
+			double events[BENCH_COUNTER_EVENTS];
+		};
+
+		struct measurement
+		{
+			size_t blocks;
+			size_t frames;
+			double seconds;
+			// Over the timed blocks, when the measurement had counters.
+			counter_values counters;
+		};
+
+		// The hardware events of the calling thread in user space, through perf_event_open, which only Linux has.
+		// Events the processor or the system do not count are reported as such, and only a lack of all of them throws.
+		// The events count as one group, led by the cycles, so that the processor counts them all over the same time.
+		class perf_counters : util::no_copy_no_move
+		{
+			int m_events[BENCH_COUNTER_EVENTS];
+			// The descriptor of the group leader, and the events in the order the group reads them.
+			int m_leader;
+			size_t m_members[BENCH_COUNTER_EVENTS];
+			size_t m_member_count;
+
+		public:
+			perf_counters();
+			~perf_counters();
+
+			// Clears the counts and starts counting.
+			void start();
+			counter_values stop();
+		};
+
+		// A UDP socket on an ephemeral loopback port, for network stages to send to. Unless a harness reads it, the datagrams
+		// that do not fit its receive buffer are dropped by the system, as they would be by a slow receiver.
+		class loopback_receiver : util::no_copy_no_move
+		{
+			util::wsa_socket m_socket;
+			std::string m_port;
+
+		public:
+			explicit loopback_receiver(util::shared_wsa wsa);
+
+			inline const std::string& port() const { return m_port; }
+			inline SOCKET socket() const { return m_socket; }
+		};
+
+		// Plays whatever reaches it, so that the sources keep going at the end of the chains.
+		class discard_sink : public sink::chain_sink
+		{
+		public:
+			discard_sink(std::unique_ptr<sink> next);
+
+			virtual bool can_play() const;
+			virtual bool is_playing() const;
+		};
+
+		// What the chain of a stream sends its frames to, and the frames it takes.
+		struct chain_context
+		{
+			const std::string& port;
+			std::shared_ptr<shmctl::shmctl> shmctl;
+			size_t samplerate;
+			DWORD channel_mask;
+			sink::resampler_quality resampler_quality;
+		};
+
+		// A chain as capture plans it from its command line, at BENCH_CHAIN_SAMPLERATE, with its network output sent to
+		// the port of the context and its render output, if any, played by a discard_sink.
+		struct named_chain
+		{
+			const char* name;
+			// Without one, the chain has none of the stages of the control block.
+			bool with_control_block;
+			sink::chain_options options;
+		};
+
+		// The chains capture builds with a network output, from the shortest to the longest.
+		std::vector<named_chain> capture_chains();
+		// The chain for frames in the format of the context, behind the deadline stage that capture puts at its head.
+		// Output queues go to queues.
+		std::unique_ptr<sink::sink> build_chain(const named_chain& chain, const chain_context& context, std::vector<sink::queue_sink*>& queues);
+
+		// Interleaved tones in the given format, a different one on every channel.
+		std::vector<float> make_signal(DWORD channel_mask, size_t frames);
+
+		// Feeds a prepared chain blocks of block_frames from the samples, as a source would, until the options are satisfied.
+		// Frames count at the rate of the head of the chain; the flush at the end is not timed. The counters, when given,
+		// count the timed blocks.
+		measurement measure(sink::sink& chain, const float* samples, size_t block_frames, const bench_options& options, perf_counters* counters = nullptr);
+
+		bool matches_filter(const bench_options& options, const char* name);
+
+		// The value under which the given fraction of the sorted values fall.
+		double percentile(const std::vector<double>& sorted, double fraction);
+		// The resident set of the process, in kilobytes.
+		size_t rss_kb();
+		// Starts over the peak that peak_rss_kb reports, where the system allows it.
+		void reset_peak_rss();
+		// The largest resident set of the process since reset_peak_rss, in kilobytes. Windows cannot start it over, so
+		// there it reports the current resident set instead, which the chains keep for as long as they run.
+		size_t peak_rss_kb();
+
+		// The tab-separated columns that follow the time of a measurement with counters: instructions per cycle, and the
+		// events per frame. The values begin with a tab, and the events that are not available print as -.
+		const char* counter_header();
+		void print_counters(const counter_values& counters, size_t frames);
+
+		int bench_stages_main(const bench_options& options);
+		int bench_chains_main(const bench_options& options);
+		int bench_latency_main(const bench_options& options);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "stdafx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "buffer_pool.h"
+#include "dsp_kernels.h"
+#include "file_source.h"
+
+namespace bench = wascap::bench;
+namespace fixture = wascap::fixture;
+namespace sink = wascap::sink;
+namespace source = wascap::source;
+namespace util = wascap::util;
+
+namespace
+{
+	// One file played through one chain, with a control block of its own.
+	struct stream
+	{
+		fixture::control_block control { BENCH_TAP_BYTES };
+		std::unique_ptr<source::file_source> file;
+		sink::buffer_pool pool;
+		std::vector<sink::queue_sink*> queues;
+		std::unique_ptr<sink::sink> chain;
+	};
+
+	void run_chain(const bench::bench_options& options, const bench::named_chain& chain, const bench::loopback_receiver& receiver)
+	{
+		if (!bench::matches_filter(options, chain.name)) {
+			return;
+		}
+
+		// What the chains of this run add to the process, whatever those before them left behind.
+		bench::reset_peak_rss();
+		size_t base_rss_kb = bench::rss_kb();
+
+		std::vector<std::unique_ptr<stream>> streams;
+		for (size_t i = 0; i < options.streams; ++i) {
+			std::unique_ptr<stream> s = std::make_unique<stream>();
+			s->file = std::make_unique<source::file_source>(options.input, options.raw_samplerate, options.raw_channel_mask, false);
+
+			bench::chain_context context = { receiver.port(), s->control.get(), s->file->samplerate(), s->file->channel_mask(), options.resampler_quality };
+			s->chain = bench::build_chain(chain, context, s->queues);
+			s->chain->prepare(s->pool, s->file->max_packet_frames());
+			s->file->start(*s->chain);
+			streams.push_back(std::move(s));
+		}
+
+		// The streams take turns, one packet each, as if they shared a core; every packet is a block with a deadline.
+		std::vector<double> block_us;
+		size_t remaining = streams.size();
+		std::vector<bool> done(streams.size(), false);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while (remaining > 0) {
+			for (size_t i = 0; i < streams.size(); ++i) {
+				if (done[i]) {
+					continue;
+				}
+
+				size_t stop_after_frames = SIZE_MAX;
+				DWORD wait_ms = 0;
+				std::chrono::steady_clock::time_point block_start = std::chrono::steady_clock::now();
+				bool more = streams[i]->file->poll(*streams[i]->chain, stop_after_frames, wait_ms);
+				std::chrono::steady_clock::time_point block_end = std::chrono::steady_clock::now();
+				if (more) {
+					block_us.push_back(std::chrono::duration<double, std::micro>(block_end - block_start).count());
+				}
+				else {
+					streams[i]->file->stop(*streams[i]->chain);
+					done[i] = true;
+					--remaining;
+				}
+			}
+		}
+		double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::sort(block_us.begin(), block_us.end());
+		const source::file_source& file = *streams.front()->file;
+		double audio_s = (double)file.position() / (double)file.samplerate();
+		// How many times faster than real time all the streams together play, so 1 is just enough for them to keep up.
+		double realtime_factor = (wall_s > 0.0) ? (audio_s / wall_s) : 0.0;
+		size_t peak_rss_kb = bench::peak_rss_kb();
+		size_t chain_rss_kb = (peak_rss_kb > base_rss_kb) ? (peak_rss_kb - base_rss_kb) : 0;
+		printf("%s\t%zu\t%zu\t0x%x\t%zu\t%.3f\t%.3f\t%.2f\t%.1f\t%.1f\t%.1f\t%.1f\t%zu\n", chain.name, streams.size(), file.samplerate(), (unsigned int)file.channel_mask(),
+			block_us.size(), audio_s, wall_s, realtime_factor, bench::percentile(block_us, 0.5), bench::percentile(block_us, 0.99), bench::percentile(block_us, 0.999),
+			block_us.empty() ? 0.0 : block_us.back(), chain_rss_kb);
+		fflush(stdout);
+	}
+}
+
+int wascap::bench::bench_chains_main(const bench_options& options)
+{
+	fprintf(stderr, "Kernels: %s\n", sink::dsp::instruction_set_name(sink::dsp::supported_instruction_set()));
+
+	loopback_receiver receiver(util::make_shared_wsa());
+
+	printf("chain\tstreams\tsamplerate\tchannel_mask\tblocks\taudio_seconds\twall_seconds\trealtime_factor\tp50_us\tp99_us\tp999_us\tmax_us\tchain_rss_kb\n");
+
+	for (const named_chain& chain : capture_chains()) {
+		run_chain(options, chain, receiver);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include "stdafx.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include "bench.h"
+
+#ifdef __linux__
+namespace
+{
+	const char* event_names[BENCH_COUNTER_EVENTS] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+
+	struct event_config
+	{
+		UINT32 type;
+		UINT64 config;
+	};
+
+	const event_config event_configs[BENCH_COUNTER_EVENTS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	};
+
+	// What PERF_FORMAT_GROUP reads from the leader: how long the group was enabled and actually counted, then the
+	// count of each event in the order they joined the group.
+	struct group_reading
+	{
+		UINT64 events;
+		UINT64 time_enabled;
+		UINT64 time_running;
+		UINT64 values[BENCH_COUNTER_EVENTS];
+	};
+
+	int open_event(const event_config& event, int group)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = event.type;
+		attr.config = event.config;
+		// The members follow the leader, which starts and stops the whole group.
+		attr.disabled = (group < 0) ? 1 : 0;
+		// What the stages do, which the default perf_event_paranoid of 2 lets any process count of itself.
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+	}
+}
+#endif
+
+wascap::bench::perf_counters::perf_counters()
+	: m_leader(-1), m_member_count(0)
+{
+	for (int& e : m_events) {
+		e = -1;
+	}
+
+#ifdef __linux__
+	// The cycles lead the group, unless the processor does not count them, in which case the first event that opens does.
+	int error = 0;
+	for (size_t i = 0; i < BENCH_COUNTER_EVENTS; ++i) {
+		m_events[i] = open_event(event_configs[i], m_leader);
+		if (m_events[i] >= 0) {
+			if (m_leader < 0) {
+				m_leader = m_events[i];
+			}
+			m_members[m_member_count++] = i;
+		}
+		else {
+			error = errno;
+			fprintf(stderr, "Counter %s: not available (%s)\n", event_names[i], strerror(error));
+		}
+	}
+
+	if (m_leader < 0) {
+		throw std::system_error(error, std::generic_category(), "No hardware counters: perf_event_open failed for every event");
+	}
+#else
+	throw std::runtime_error("Hardware counters need perf_event_open, which only Linux has");
+#endif
+}
+
+wascap::bench::perf_counters::~perf_counters()
+{
+#ifdef __linux__
+	// The members first, then the leader.
+	for (size_t i = BENCH_COUNTER_EVENTS; i-- > 0;) {
+		if (m_events[i] >= 0) {
+			close(m_events[i]);
+		}
+	}
+#endif
+}
+
+void wascap::bench::perf_counters::start()
+{
+#ifdef __linux__
+	ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+wascap::bench::counter_values wascap::bench::perf_counters::stop()
+{
+	counter_values values;
+	for (size_t i = 0; i < BENCH_COUNTER_EVENTS; ++i) {
+		values.events[i] = -1.0;
+	}
+
+#ifdef __linux__
+	ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	group_reading reading;
+	ssize_t expected = (ssize_t)(offsetof(group_reading, values) + (m_member_count * sizeof(UINT64)));
+	if (read(m_leader, &reading, sizeof(reading)) < expected || reading.events != m_member_count || 0 == reading.time_running) {
+		return values;
+	}
+
+	// The system shares the counters of the processor between more events than it has, and counts each group for part
+	// of the time; the events of a group are scaled alike, so their ratios stay exact.
+	double scale = (double)reading.time_enabled / (double)reading.time_running;
+	for (size_t m = 0; m < m_member_count; ++m) {
+		values.events[m_members[m]] = (double)reading.values[m] * scale;
+	}
+#endif
+
+	return values;
+}
+
+const char* wascap::bench::counter_header()
+{
+	return "\tipc\tcycles_per_frame\tinstructions_per_frame\tl1d_misses_per_frame\tllc_misses_per_frame\tbranch_misses_per_frame";
+}
+
+void wascap::bench::print_counters(const counter_values& counters, size_t frames)
+{
+	const double* events = counters.events;
+	if (events[0] > 0.0 && events[1] >= 0.0) {
+		printf("\t%.2f", events[1] / events[0]);
+	}
+	else {
+		printf("\t-");
+	}
+
+	for (size_t i = 0; i < BENCH_COUNTER_EVENTS; ++i) {
+		if (events[i] >= 0.0 && frames > 0) {
+			printf("\t%.3f", events[i] / (double)frames);
+		}
+		else {
+			printf("\t-");
+		}
+	}
+}
\ No newline at end of file
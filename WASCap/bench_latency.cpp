@@ -0,0 +1,300 @@
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#include <sys/socket.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.h"
+#include "buffer_pool.h"
+#include "dsp_kernels.h"
+#include "errors.h"
+#include "file_source.h"
+#include "latency_meter.h"
+#include "realtime_check.h"
+
+// The recording is scaled down under the markers, so that they remain the loudest samples whatever the chain does to both.
+#define MARKER_AMPLITUDE 1.0f
+#define MARKER_PROGRAM_GAIN 0.125f
+// How far from where it is due the peak of a marker is looked for, in chain frames; resamplers delay it by a few taps.
+#define MARKER_SEARCH_FRAMES 256
+// A peak counts as a marker only when it is this much louder than anything received away from the markers.
+#define MARKER_MIN_CONTRAST 2.0f
+// The receiver waits this long at a time for datagrams before checking whether the run is over.
+#define RECEIVER_POLL_MS 20
+// Samplerate, bits, channel count and channel mask, as network_sender writes them.
+#define NETWORK_HEADER_BYTES 5
+#define MAX_DATAGRAM_BYTES 2048
+
+namespace bench = wascap::bench;
+namespace fixture = wascap::fixture;
+namespace sink = wascap::sink;
+namespace source = wascap::source;
+namespace util = wascap::util;
+
+namespace
+{
+	// Scales the frames down and puts an impulse on every channel at each multiple of the interval in the stream,
+	// noting when the block that holds each marker reached it. Blocks without a capture time are given that one too.
+	class marker_sink : public sink::chain_sink
+	{
+		size_t m_interval_frames;
+		// The time each marker was injected at, by marker number.
+		std::vector<UINT64>& m_injected;
+		float* m_marked;
+		UINT64 m_position;
+		UINT64 m_block_time;
+
+	public:
+		marker_sink(std::unique_ptr<sink> next, size_t interval_frames, std::vector<UINT64>& injected)
+			: chain_sink(std::move(next)), m_interval_frames(interval_frames), m_injected(injected), m_marked(nullptr), m_position(0), m_block_time(0)
+		{
+		}
+
+		virtual void prepare(wascap::sink::buffer_pool& pool, size_t max_frames)
+		{
+			m_marked = pool.allocate(max_frames * channels());
+
+			chain_sink::prepare(pool, max_frames);
+		}
+
+		virtual void begin_block(const wascap::sink::block_info& info)
+		{
+			m_position = info.stream_position;
+			m_block_time = wascap::sink::capture_clock();
+
+			wascap::sink::block_info marked = info;
+			if (0 == marked.capture_time) {
+				marked.capture_time = m_block_time;
+			}
+			chain_sink::begin_block(marked);
+		}
+
+		virtual bool process(const float* samples, size_t frames)
+		{
+			size_t ch = channels();
+			for (size_t i = 0; i < frames * ch; ++i) {
+				m_marked[i] = samples[i] * MARKER_PROGRAM_GAIN;
+			}
+
+			// From the first marker at or after the start of the block.
+			for (UINT64 marker = (m_position + m_interval_frames - 1) / m_interval_frames; marker * m_interval_frames < m_position + frames; ++marker) {
+				size_t f = (size_t)(marker * m_interval_frames - m_position);
+				for (size_t c = 0; c < ch; ++c) {
+					m_marked[(f * ch) + c] = MARKER_AMPLITUDE;
+				}
+
+				if (m_injected.size() <= marker) {
+					m_injected.resize((size_t)marker + 1, 0);
+				}
+				m_injected[(size_t)marker] = m_block_time;
+			}
+			m_position += frames;
+
+			return chain_sink::process(m_marked, frames);
+		}
+	};
+
+	// When the datagram that held the peak around where a marker is due arrived.
+	struct arrival
+	{
+		UINT64 marker;
+		UINT64 time;
+		float peak;
+	};
+
+	// Reads the datagrams a network output sends to the loopback on a thread of its own, and counts their frames. Around
+	// each place a marker is due in the stream, it keeps when the datagram with the largest sample of the first channel
+	// arrived. Markers are thus told apart by where they are, and need no code of their own.
+	class marker_receiver : util::no_copy_no_move
+	{
+		bench::loopback_receiver m_receiver;
+		// Chain frames between markers, which need not be a whole number after a resampler.
+		double m_marker_frames;
+		std::vector<arrival> m_arrivals;
+		// The largest sample of the first channel received away from the markers.
+		float m_program_peak;
+		std::string m_error;
+		std::atomic<bool> m_stopping;
+		std::thread m_thread;
+
+		void receive()
+		{
+			char datagram[MAX_DATAGRAM_BYTES];
+			float samples[MAX_DATAGRAM_BYTES / sizeof(float)];
+			UINT64 frames_received = 0;
+			arrival peak_arrival = { 0, 0, 0.0f };
+
+			for (;;) {
+				fd_set readable;
+				FD_ZERO(&readable);
+				FD_SET(m_receiver.socket(), &readable);
+				timeval timeout = { 0, RECEIVER_POLL_MS * 1000 };
+				if (0 == WSA_CHECK_U(select((int)m_receiver.socket() + 1, &readable, nullptr, nullptr, &timeout))) {
+					if (m_stopping) {
+						break;
+					}
+					continue;
+				}
+
+				int bytes = WSA_CHECK_U(recv(m_receiver.socket(), datagram, sizeof(datagram), 0));
+				UINT64 now = sink::capture_clock();
+				size_t channels = (bytes > NETWORK_HEADER_BYTES) ? (unsigned char)datagram[2] : 0;
+				if (0 == channels) {
+					continue;
+				}
+
+				size_t frames = (bytes - NETWORK_HEADER_BYTES) / (sizeof(float) * channels);
+				memcpy(samples, datagram + NETWORK_HEADER_BYTES, frames * channels * sizeof(float));
+				for (size_t f = 0; f < frames; ++f) {
+					double position = (double)(frames_received + f);
+					UINT64 marker = (UINT64)llround(position / m_marker_frames);
+					float sample = fabs(samples[f * channels]);
+					if (fabs(position - ((double)marker * m_marker_frames)) > MARKER_SEARCH_FRAMES) {
+						m_program_peak = max(m_program_peak, sample);
+						continue;
+					}
+
+					if (marker != peak_arrival.marker) {
+						if (peak_arrival.peak > 0.0f) {
+							m_arrivals.push_back(peak_arrival);
+						}
+						peak_arrival.marker = marker;
+						peak_arrival.peak = 0.0f;
+					}
+					if (sample > peak_arrival.peak) {
+						peak_arrival.peak = sample;
+						peak_arrival.time = now;
+					}
+				}
+				frames_received += frames;
+			}
+
+			if (peak_arrival.peak > 0.0f) {
+				m_arrivals.push_back(peak_arrival);
+			}
+		}
+
+	public:
+		marker_receiver(util::shared_wsa wsa, double marker_frames)
+			: m_receiver(wsa), m_marker_frames(marker_frames), m_arrivals(), m_program_peak(0.0f), m_error(), m_stopping(false), m_thread()
+		{
+			m_thread = std::thread([this]() {
+				try {
+					receive();
+				}
+				catch (const std::exception& e) {
+					m_error = e.what();
+				}
+			});
+		}
+
+		~marker_receiver()
+		{
+			if (m_thread.joinable()) {
+				m_stopping = true;
+				m_thread.join();
+			}
+		}
+
+		inline const std::string& port() const { return m_receiver.port(); }
+		inline float program_peak() const { return m_program_peak; }
+
+		// Reads what is still in flight, and returns the markers found, in the order they arrived.
+		const std::vector<arrival>& stop()
+		{
+			m_stopping = true;
+			m_thread.join();
+			if (!m_error.empty()) {
+				throw std::runtime_error(m_error);
+			}
+
+			return m_arrivals;
+		}
+	};
+
+	void run_chain(const bench::bench_options& options, const bench::named_chain& named, util::shared_wsa wsa)
+	{
+		const char* name = named.name;
+		if (!bench::matches_filter(options, name)) {
+			return;
+		}
+
+		fixture::control_block control(BENCH_TAP_BYTES);
+		source::file_source file(options.input, options.raw_samplerate, options.raw_channel_mask, true);
+		size_t interval_frames = max(1, file.samplerate() * options.marker_interval_ms / 1000);
+		marker_receiver receiver(wsa, (double)interval_frames * BENCH_CHAIN_SAMPLERATE / (double)file.samplerate());
+
+		// The markers go in at the rate of the source, so that the resampler is part of what is measured.
+		bench::chain_context context = { receiver.port(), control.get(), file.samplerate(), file.channel_mask(), options.resampler_quality };
+		std::vector<sink::queue_sink*> queues;
+		std::unique_ptr<sink::sink> chain = bench::build_chain(named, context, queues);
+		std::vector<UINT64> injected;
+		chain = std::make_unique<marker_sink>(std::move(chain), interval_frames, injected);
+		sink::buffer_pool pool;
+		chain->prepare(pool, file.max_packet_frames());
+
+		size_t stop_after_frames = (size_t)(options.latency_seconds * (double)file.samplerate());
+		DWORD wait_ms = 0;
+		file.start(*chain);
+		while (file.poll(*chain, stop_after_frames, wait_ms)) {
+			if (wait_ms > 0) {
+				Sleep(wait_ms);
+			}
+		}
+		file.stop(*chain);
+
+		std::vector<double> latency_us;
+		for (const arrival& a : receiver.stop()) {
+			// Peaks that do not stand out are what remains of the recording where a marker went missing.
+			bool detected = a.peak > MARKER_MIN_CONTRAST * receiver.program_peak();
+			if (detected && a.marker < injected.size() && 0 != injected[(size_t)a.marker] && a.time >= injected[(size_t)a.marker]) {
+				latency_us.push_back((double)(a.time - injected[(size_t)a.marker]) / 10.0);
+			}
+		}
+		std::sort(latency_us.begin(), latency_us.end());
+
+		// Jitter as the standard deviation of the latency.
+		double mean_us = 0.0;
+		for (double l : latency_us) {
+			mean_us += l;
+		}
+		mean_us = latency_us.empty() ? 0.0 : (mean_us / (double)latency_us.size());
+		double variance = 0.0;
+		for (double l : latency_us) {
+			variance += (l - mean_us) * (l - mean_us);
+		}
+		double jitter_us = latency_us.empty() ? 0.0 : sqrt(variance / (double)latency_us.size());
+
+		printf("%s\t%zu\t0x%x\t%zu\t%zu\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", name, file.samplerate(), (unsigned int)file.channel_mask(), injected.size(), latency_us.size(),
+			latency_us.empty() ? 0.0 : latency_us.front(), bench::percentile(latency_us, 0.5), bench::percentile(latency_us, 0.99), latency_us.empty() ? 0.0 : latency_us.back(),
+			mean_us, jitter_us);
+		fflush(stdout);
+	}
+}
+
+int wascap::bench::bench_latency_main(const bench_options& options)
+{
+	fprintf(stderr, "Kernels: %s\n", sink::dsp::instruction_set_name(sink::dsp::supported_instruction_set()));
+
+	util::shared_wsa wsa = util::make_shared_wsa();
+
+	printf("chain\tsamplerate\tchannel_mask\tmarkers\treceived\tmin_us\tp50_us\tp99_us\tmax_us\tmean_us\tjitter_us\n");
+
+	for (const named_chain& chain : capture_chains()) {
+		run_chain(options, chain, wsa);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "fixture.h"
+#include "realtime_check.h"
+#include "string_format.h"
+
+namespace
+{
+	enum class bench_verb
+	{
+		stages,
+		chains,
+		latency,
+	};
+
+	struct bench_arguments
+	{
+		bench_verb verb = bench_verb::stages;
+		wascap::bench::bench_options options;
+	};
+
+	const char* usage =
+		"Usage: wascap_bench stages [filter <name>] [min-ms <n>] [resampler fast|medium|high] [counters]\n"
+		"       wascap_bench chains <file> [raw <samplerate> <channel-mask>] [streams <n>] [filter <name>] [resampler fast|medium|high]\n"
+		"       wascap_bench latency <file> [raw <samplerate> <channel-mask>] [seconds <n>] [interval-ms <n>] [filter <name>] [resampler fast|medium|high]\n"
+		"\n"
+		"stages: drives each sink stage on its own, in front of a null sink, across samplerates, channel masks and block sizes.\n"
+		"chains: plays a recording, as a WAV file or raw 32-bit floats, through the chains capture builds, with as many\n"
+		"        streams side by side on one thread, and reports the real-time factor, the time per block and the memory the\n"
+		"        chains add to the process at their peak.\n"
+		"latency: plays a recording in real time through the same chains, 10 seconds by default, with a marker impulse every\n"
+		"         interval, 100 ms by default, and reports how long each took from the head of the chain to a receiver on\n"
+		"         the loopback, and how much that varies.\n"
+		"\n"
+		"Results go to stdout as tab-separated values with a header line.\n"
+		"filter runs only the cases whose stage or chain name contains the given text.\n"
+		"min-ms sets how long each case runs at least, 50 ms by default.\n"
+		"counters adds the instructions per cycle, and the cycles, instructions, L1 data and last level cache misses and\n"
+		"branch misses per frame of each stage, which Linux counts in the processor for the stage runs.\n";
+
+	void parse_bench_arguments(bench_arguments& arguments, const std::vector<std::string>& args)
+	{
+		auto current = args.begin() + 1;
+		if (current == args.end()) {
+			throw std::invalid_argument("Missing benchmark");
+		}
+		std::string verb = *current++;
+		if (verb == "stages") {
+			arguments.verb = bench_verb::stages;
+		}
+		else if (verb == "chains" || verb == "latency") {
+			arguments.verb = (verb == "chains") ? bench_verb::chains : bench_verb::latency;
+			if (current == args.end()) {
+				throw std::invalid_argument("Missing input");
+			}
+			arguments.options.input = *current++;
+			// Each stream and each chain opens the file again.
+			if (arguments.options.input == "-") {
+				throw std::invalid_argument("Standard input cannot be benchmarked");
+			}
+		}
+		else {
+			throw std::invalid_argument(wascap::util::string_format("Unrecognized benchmark: %s", verb));
+		}
+
+		auto next = [&](const char* what) -> const std::string& {
+			if (current == args.end()) {
+				throw std::invalid_argument(wascap::util::string_format("Missing %s", what));
+			}
+			return *current++;
+		};
+
+		while (current != args.end()) {
+			std::string word = *current++;
+			if (word == "filter") {
+				arguments.options.filter = next("filter");
+			}
+			else if (word == "min-ms") {
+				arguments.options.min_seconds = (double)wascap::fixture::parse_number(next("duration")) / 1000.0;
+			}
+			else if (word == "resampler") {
+				arguments.options.resampler_quality = wascap::fixture::parse_resampler_quality(next("resampler quality"));
+			}
+			else if (word == "counters" && arguments.verb == bench_verb::stages) {
+				arguments.options.counters = true;
+			}
+			else if (word == "raw" && arguments.verb != bench_verb::stages) {
+				arguments.options.raw_samplerate = wascap::fixture::parse_number(next("raw samplerate"));
+				arguments.options.raw_channel_mask = (DWORD)wascap::fixture::parse_number(next("raw channel mask"));
+				if (0 == arguments.options.raw_samplerate || 0 == arguments.options.raw_channel_mask) {
+					throw std::invalid_argument("Raw input without frames");
+				}
+			}
+			else if (word == "streams" && arguments.verb == bench_verb::chains) {
+				arguments.options.streams = wascap::fixture::parse_number(next("stream count"));
+				if (0 == arguments.options.streams) {
+					throw std::invalid_argument("Stream count must be positive");
+				}
+			}
+			else if (word == "seconds" && arguments.verb == bench_verb::latency) {
+				arguments.options.latency_seconds = (double)wascap::fixture::parse_number(next("duration"));
+				if (0.0 == arguments.options.latency_seconds) {
+					throw std::invalid_argument("Duration must be positive");
+				}
+			}
+			else if (word == "interval-ms" && arguments.verb == bench_verb::latency) {
+				arguments.options.marker_interval_ms = wascap::fixture::parse_number(next("marker interval"));
+				if (0 == arguments.options.marker_interval_ms) {
+					throw std::invalid_argument("Marker interval must be positive");
+				}
+			}
+			else {
+				throw std::invalid_argument(wascap::util::string_format("Unrecognized argument: %s", word));
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	bench_arguments arguments;
+	try {
+		parse_bench_arguments(arguments, std::vector<std::string>(argv, argv + argc));
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n\n%s", e.what(), usage);
+		return 2;
+	}
+
+	int result = 0;
+	try {
+		switch (arguments.verb) {
+		case bench_verb::stages:
+			result = wascap::bench::bench_stages_main(arguments.options);
+			break;
+		case bench_verb::chains:
+			result = wascap::bench::bench_chains_main(arguments.options);
+			break;
+		case bench_verb::latency:
+			result = wascap::bench::bench_latency_main(arguments.options);
+			break;
+		}
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	// Checking builds fail on the first violation, so that a change that makes a stage unsafe fails its benchmark run.
+	if (wascap::realtime::is_checking()) {
+		size_t violations = wascap::realtime::violations();
+		fprintf(stderr, "Real-time violations: %zu\n", violations);
+		if (violations > 0 && 0 == result) {
+			result = 1;
+		}
+	}
+
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "buffer_pool.h"
+#include "convert_sink.h"
+#include "dsp_kernels.h"
+#include "network_sink.h"
+#include "realtime_check.h"
+#include "shmctl_sink.h"
+
+// The rate of the stages that do not convert it, which the network stage can send as is.
+#define BENCH_SAMPLERATE 48000
+
+namespace bench = wascap::bench;
+namespace fixture = wascap::fixture;
+namespace sink = wascap::sink;
+namespace util = wascap::util;
+
+namespace
+{
+	const size_t samplerates[] = { 44100, 48000, 96000, 192000 };
+	// From mono to 7.1, and the 32 channels a mask can hold.
+	const DWORD channel_masks[] = { 0x4, 0x3, 0x33, 0x3f, 0x63f, 0xffffffff };
+	const size_t block_durations_ms[] = { 10, 100, 1000 };
+
+	// Puts the stage in front of the end of its chain.
+	typedef std::function<std::unique_ptr<sink::sink>(std::unique_ptr<sink::sink> next)> stage_factory;
+
+	void run_case(const bench::bench_options& options, bench::perf_counters* counters, const char* stage, size_t source_samplerate, DWORD source_channel_mask, size_t target_samplerate, DWORD target_channel_mask, size_t block_ms, const stage_factory& factory)
+	{
+		size_t block_frames = source_samplerate * block_ms / 1000;
+
+		sink::buffer_pool pool;
+		std::unique_ptr<sink::sink> chain = sink::realtime_checked(factory(std::make_unique<sink::null_sink>(target_samplerate, target_channel_mask)));
+		chain->prepare(pool, block_frames);
+
+		std::vector<float> samples = bench::make_signal(source_channel_mask, block_frames);
+		bench::measurement m = bench::measure(*chain, samples.data(), block_frames, options, counters);
+
+		double ns_per_frame = (m.seconds * 1e9) / (double)m.frames;
+		printf("%s\t%zu\t%zu\t0x%x\t0x%x\t%zu\t%zu\t%zu\t%zu\t%.3f\t%.0f", stage, source_samplerate, target_samplerate, (unsigned int)source_channel_mask, (unsigned int)target_channel_mask,
+			block_ms, block_frames, m.blocks, m.frames, ns_per_frame, (double)m.frames / m.seconds);
+		if (nullptr != counters) {
+			bench::print_counters(m.counters, m.frames);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	// Runs a stage that keeps the format, for every channel mask and block size.
+	void run_format_cases(const bench::bench_options& options, bench::perf_counters* counters, const char* stage, const stage_factory& factory)
+	{
+		if (!bench::matches_filter(options, stage)) {
+			return;
+		}
+
+		for (DWORD channel_mask : channel_masks) {
+			for (size_t block_ms : block_durations_ms) {
+				run_case(options, counters, stage, BENCH_SAMPLERATE, channel_mask, BENCH_SAMPLERATE, channel_mask, block_ms, factory);
+			}
+		}
+	}
+}
+
+int wascap::bench::bench_stages_main(const bench_options& options)
+{
+	fprintf(stderr, "Kernels: %s\n", sink::dsp::instruction_set_name(sink::dsp::supported_instruction_set()));
+
+	// Opened once for all the cases, on the thread that runs them.
+	std::unique_ptr<perf_counters> counters;
+	if (options.counters) {
+		counters = std::make_unique<perf_counters>();
+	}
+
+	printf("stage\tsource_samplerate\ttarget_samplerate\tsource_channel_mask\ttarget_channel_mask\tblock_ms\tblock_frames\tblocks\tframes\tns_per_frame\tframes_per_second%s\n",
+		counters ? counter_header() : "");
+
+	if (matches_filter(options, "samplerate")) {
+		for (size_t source_samplerate : samplerates) {
+			for (size_t target_samplerate : samplerates) {
+				if (source_samplerate == target_samplerate) {
+					continue;
+				}
+				for (DWORD channel_mask : channel_masks) {
+					for (size_t block_ms : block_durations_ms) {
+						run_case(options, counters.get(), "samplerate", source_samplerate, channel_mask, target_samplerate, channel_mask, block_ms, [&](std::unique_ptr<sink::sink> next) -> std::unique_ptr<sink::sink> {
+							return std::make_unique<sink::samplerate_convert_sink>(std::move(next), source_samplerate, options.resampler_quality);
+						});
+					}
+				}
+			}
+		}
+	}
+
+	if (matches_filter(options, "channels")) {
+		for (DWORD source_channel_mask : channel_masks) {
+			for (DWORD target_channel_mask : channel_masks) {
+				if (source_channel_mask == target_channel_mask) {
+					continue;
+				}
+				for (size_t block_ms : block_durations_ms) {
+					run_case(options, counters.get(), "channels", BENCH_SAMPLERATE, source_channel_mask, BENCH_SAMPLERATE, target_channel_mask, block_ms, [&](std::unique_ptr<sink::sink> next) -> std::unique_ptr<sink::sink> {
+						return std::make_unique<sink::channel_convert_sink>(std::move(next), source_channel_mask);
+					});
+				}
+			}
+		}
+	}
+
+	fixture::control_block control(BENCH_TAP_BYTES);
+	run_format_cases(options, counters.get(), "flow-control", [&](std::unique_ptr<sink::sink> next) -> std::unique_ptr<sink::sink> {
+		return std::make_unique<sink::shmctl_flow_control_sink>(std::move(next), control.get());
+	});
+	run_format_cases(options, counters.get(), "averaging", [&](std::unique_ptr<sink::sink> next) -> std::unique_ptr<sink::sink> {
+		return std::make_unique<sink::shmctl_averaging_sink>(std::move(next), control.get());
+	});
+	run_format_cases(options, counters.get(), "volume", [&](std::unique_ptr<sink::sink> next) -> std::unique_ptr<sink::sink> {
+		return std::make_unique<sink::shmctl_volume_sink>(std::move(next), control.get());
+	});
+	run_format_cases(options, counters.get(), "tap", [&](std::unique_ptr<sink::sink> next) -> std::unique_ptr<sink::sink> {
+		return std::make_unique<sink::shmctl_tap_sink>(std::move(next), control.get());
+	});
+
+	if (matches_filter(options, "network")) {
+		util::shared_wsa wsa = util::make_shared_wsa();
+		bench::loopback_receiver receiver(wsa);
+		run_format_cases(options, counters.get(), "network", [&](std::unique_ptr<sink::sink> next) -> std::unique_ptr<sink::sink> {
+			return std::make_unique<sink::network_sink>(std::move(next), wsa, "", "127.0.0.1", receiver.port());
+		});
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#include "stdafx.h"
+
+#include <cstdint>
+
+#include "buffer_pool.h"
+#include "platform.h"
+
+#define BUFFER_POOL_BLOCK_FLOATS 65536
+#define BUFFER_POOL_ALIGNMENT_FLOATS 16
+
+wascap::sink::buffer_pool::buffer_pool()
+	: m_blocks(), m_cursor(nullptr), m_remaining(0), m_allocated(0)
+{
+}
+
+float* wascap::sink::buffer_pool::allocate(size_t count)
+{
+	// Round up so that the next buffer starts on a cache line as well.
+	count = (count + BUFFER_POOL_ALIGNMENT_FLOATS - 1) & ~(size_t)(BUFFER_POOL_ALIGNMENT_FLOATS - 1);
+
+	if (count > m_remaining) {
+		size_t block_floats = max((size_t)BUFFER_POOL_BLOCK_FLOATS, count) + BUFFER_POOL_ALIGNMENT_FLOATS;
+		m_blocks.push_back(std::make_unique<float[]>(block_floats));
+
+		float* block = m_blocks.back().get();
+		size_t misalignment = ((uintptr_t)block / sizeof(float)) % BUFFER_POOL_ALIGNMENT_FLOATS;
+		size_t padding = (0 == misalignment) ? 0 : (BUFFER_POOL_ALIGNMENT_FLOATS - misalignment);
+		m_cursor = block + padding;
+		m_remaining = block_floats - padding;
+	}
+
+	float* buffer = m_cursor;
+	m_cursor += count;
+	m_remaining -= count;
+	m_allocated += count;
+
+	return buffer;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "no_copy.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		// Scratch memory shared by the sinks of one chain.
+		// Sinks carve their buffers out of it while the chain is prepared, so that processing a packet never touches the heap.
+		// Buffers are zeroed, aligned on a cache line, and stay valid for the lifetime of the pool.
+		class buffer_pool : util::no_copy_no_move
+		{
+			std::vector<std::unique_ptr<float[]>> m_blocks;
+			float* m_cursor;
+			size_t m_remaining;
+			size_t m_allocated;
+
+		public:
+			buffer_pool();
+
+			inline size_t allocated() const { return m_allocated; }
+
+			float* allocate(size_t count);
+		};
+	}
+}
@@ -0,0 +1,240 @@
+#include "stdafx.h"
+
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <thread>
+
+#include "capture_session.h"
+#include "thread_helper.h"
+#include "trace.h"
+
+#define MAX_PAUSED_WAIT_MS 100
+// How long to wait before trying again to open a source, when the last attempt failed.
+#define REOPEN_RETRY_MS 1000
+
+namespace
+{
+	// Leaves SIZE_MAX, which counts nothing, as it is.
+	size_t rescale_frames(size_t frames, size_t from_samplerate, size_t to_samplerate)
+	{
+		if (SIZE_MAX == frames) {
+			return frames;
+		}
+
+		return (size_t)(((unsigned long long)frames * to_samplerate) / from_samplerate);
+	}
+
+	struct session_worker
+	{
+		std::vector<wascap::source::capture_session*> sessions;
+		std::thread thread;
+	};
+
+	void session_worker_proc(session_worker& worker)
+	{
+		// The sources, and the WAS sinks of the chains, hold free-threaded audio clients.
+		wascap::util::audio_thread_scope audio_thread;
+		wascap::trace::register_thread();
+
+		for (;;) {
+			bool active = false;
+			DWORD min_wait_ms = INFINITE;
+			for (wascap::source::capture_session* session : worker.sessions) {
+				DWORD wait_ms;
+				if (!session->is_done() && session->poll(wait_ms)) {
+					active = true;
+					min_wait_ms = min(min_wait_ms, wait_ms);
+				}
+			}
+			if (!active) {
+				break;
+			}
+			// The shortest wait serves every session in time, at the cost of polling the others early.
+			if (min_wait_ms > 0) {
+				Sleep(min_wait_ms);
+			}
+		}
+	}
+}
+
+wascap::source::capture_session::capture_session(const std::string& name, std::unique_ptr<source_provider> provider, std::unique_ptr<source> source, std::unique_ptr<sink::sink> chain, size_t stop_after_frames, sink::resampler_quality quality, DWORD matrix_channel_mask, const std::vector<float>& coefficients)
+	: m_name(name), m_provider(std::move(provider)), m_source(std::move(source)), m_attach(std::move(chain), m_source->max_packet_frames(), quality, matrix_channel_mask, coefficients), m_head(nullptr),
+	m_stop_after_frames(stop_after_frames), m_repeat(SIZE_MAX == stop_after_frames), m_paused_backoff(m_source->poll_interval_ms(), MAX_PAUSED_WAIT_MS), m_done(false)
+{
+	if (!m_attach.chain().can_play()) {
+		throw std::runtime_error("Unable to play");
+	}
+
+	m_head = &m_attach.attach(m_source->samplerate(), m_source->channel_mask(), m_source->max_packet_frames());
+	m_stop_after_frames = rescale_frames(m_stop_after_frames, m_attach.chain().samplerate(), m_source->samplerate());
+}
+
+wascap::source::capture_session::~capture_session()
+{
+	if (m_source && m_source->is_capturing()) {
+		m_source->abort();
+	}
+}
+
+void wascap::source::capture_session::detach()
+{
+	if (m_source->is_capturing()) {
+		m_source->abort();
+	}
+	m_stop_after_frames = rescale_frames(m_stop_after_frames, m_source->samplerate(), m_attach.chain().samplerate());
+	m_source.reset();
+}
+
+bool wascap::source::capture_session::reattach()
+{
+	try {
+		std::unique_ptr<source> source = m_provider->open();
+		m_head = &m_attach.attach(source->samplerate(), source->channel_mask(), source->max_packet_frames());
+		m_stop_after_frames = rescale_frames(m_stop_after_frames, m_attach.chain().samplerate(), source->samplerate());
+		m_source = std::move(source);
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "Session %s unable to open a source: %s\n", m_name.c_str(), e.what());
+
+		return false;
+	}
+
+	fprintf(stderr, "Session %s attached to a source at %zu Hz, channel mask 0x%x\n", m_name.c_str(), m_source->samplerate(), (unsigned int)m_source->channel_mask());
+
+	return true;
+}
+
+bool wascap::source::capture_session::poll(DWORD& wait_ms)
+{
+	if (m_done) {
+		return false;
+	}
+
+	sink::sink& chain = m_attach.chain();
+	try {
+		if (!m_source) {
+			if (!chain.is_open()) {
+				m_done = true;
+				return false;
+			}
+			if (!reattach()) {
+				wait_ms = REOPEN_RETRY_MS;
+				return true;
+			}
+		}
+		else if (m_provider && m_provider->is_stale()) {
+			detach();
+			wait_ms = 0;
+			return true;
+		}
+
+		if (!m_source->is_capturing()) {
+			if (!chain.is_open() || (!m_repeat && !chain.is_playing())) {
+				m_done = true;
+				return false;
+			}
+			if (!chain.is_playing()) {
+				wait_ms = m_paused_backoff.idle_wait();
+				return true;
+			}
+
+			m_source->start(*m_head);
+			m_paused_backoff.reset();
+		}
+
+		if (m_source->poll(*m_head, m_stop_after_frames, wait_ms)) {
+			return true;
+		}
+
+		m_source->stop(*m_head);
+		if (!m_repeat) {
+			m_done = true;
+			return false;
+		}
+
+		// Whether the chain closed or paused, the next poll finds out at once.
+		wait_ms = 0;
+		return true;
+	}
+	catch (const source_lost& e) {
+		if (m_provider) {
+			fprintf(stderr, "Session %s lost its source: %s\n", m_name.c_str(), e.what());
+			detach();
+			wait_ms = 0;
+			return true;
+		}
+		m_failure = std::current_exception();
+	}
+	catch (...) {
+		m_failure = std::current_exception();
+	}
+
+	if (m_source && m_source->is_capturing()) {
+		m_source->abort();
+	}
+	m_done = true;
+
+	return false;
+}
+
+void wascap::source::capture_session::run()
+{
+	DWORD wait_ms;
+	while (poll(wait_ms)) {
+		if (wait_ms > 0) {
+			Sleep(wait_ms);
+		}
+	}
+
+	if (m_failure) {
+		std::rethrow_exception(m_failure);
+	}
+}
+
+size_t wascap::source::run_sessions(const std::vector<capture_session*>& sessions, size_t workers)
+{
+	workers = max((size_t)1, min(workers, sessions.size()));
+
+	// Sessions are dealt round-robin, so that each thread serves a similar share of them.
+	std::vector<session_worker> threads(workers);
+	for (size_t i = 0; i < sessions.size(); ++i) {
+		threads[i % workers].sessions.push_back(sessions[i]);
+	}
+
+	try {
+		for (session_worker& worker : threads) {
+			worker.thread = std::thread(session_worker_proc, std::ref(worker));
+		}
+	}
+	catch (...) {
+		// The threads that did start still use their sessions.
+		for (session_worker& worker : threads) {
+			if (worker.thread.joinable()) {
+				worker.thread.join();
+			}
+		}
+		throw;
+	}
+	for (session_worker& worker : threads) {
+		worker.thread.join();
+	}
+
+	size_t failures = 0;
+	for (const capture_session* session : sessions) {
+		if (session->has_failed()) {
+			++failures;
+			try {
+				std::rethrow_exception(session->failure());
+			}
+			catch (const std::exception& e) {
+				fprintf(stderr, "Session %s failed: %s\n", session->name().c_str(), e.what());
+			}
+			catch (...) {
+				fprintf(stderr, "Session %s failed\n", session->name().c_str());
+			}
+		}
+	}
+
+	return failures;
+}
\ No newline at end of file
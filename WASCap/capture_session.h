@@ -0,0 +1,66 @@
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "attach_point.h"
+#include "base_sink.h"
+#include "convert_sink.h"
+#include "idle_backoff.h"
+#include "no_copy.h"
+#include "source.h"
+
+namespace wascap
+{
+	namespace source
+	{
+		// A source and the chain it feeds, captured by polling so that one thread can serve several sessions.
+		// With a provider, the session outlives its source: a lost or stale source gives way to a new one, which
+		// attaches to the same chain through conversion stages of its own.
+		class capture_session : public util::no_copy_no_move
+		{
+			std::string m_name;
+			std::unique_ptr<source_provider> m_provider;
+			std::unique_ptr<source> m_source;
+			sink::attach_point m_attach;
+			// The sink the current source feeds.
+			sink::sink* m_head;
+			// SIZE_MAX runs until the chain closes; a finite count captures once. Counted at the rate of the current
+			// source, and at the rate of the chain while there is none.
+			size_t m_stop_after_frames;
+			bool m_repeat;
+			// Nothing captures while paused, so the wait may grow longer than during silence.
+			util::idle_backoff m_paused_backoff;
+			bool m_done;
+			std::exception_ptr m_failure;
+
+			// Drops the current source, without flushing the chain that carries on.
+			void detach();
+			bool reattach();
+
+		public:
+			// The chain keeps its format whatever the source, and each source, the first one included, attaches through
+			// conversion stages of its own; the mixing matrix, if any, maps sources in its layout. The provider, if any,
+			// opens the sources that replace the first. stop_after_frames counts frames at the rate of the chain.
+			capture_session(const std::string& name, std::unique_ptr<source_provider> provider, std::unique_ptr<source> source, std::unique_ptr<sink::sink> chain, size_t stop_after_frames, sink::resampler_quality quality, DWORD matrix_channel_mask = 0, const std::vector<float>& coefficients = std::vector<float>());
+			~capture_session();
+
+			inline const std::string& name() const { return m_name; }
+			inline const sink::sink& chain() const { return m_attach.chain(); }
+			inline bool is_done() const { return m_done; }
+			inline bool has_failed() const { return (bool)m_failure; }
+			inline std::exception_ptr failure() const { return m_failure; }
+
+			// Captures what is ready, starting and stopping the source as the chain plays and pauses. Returns false once
+			// the session is done, otherwise sets how long it may wait before polling again. Failures end the session.
+			bool poll(DWORD& wait_ms);
+			// Polls on the calling thread until the session is done, and rethrows its failure.
+			void run();
+		};
+
+		// Polls the sessions on a number of threads until they are all done, and returns how many failed.
+		size_t run_sessions(const std::vector<capture_session*>& sessions, size_t workers);
+	}
+}
\ No newline at end of file
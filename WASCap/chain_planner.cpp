@@ -0,0 +1,164 @@
+#include "stdafx.h"
+
+#include <cmath>
+
+#include "chain_planner.h"
+#include "network_sink.h"
+#include "pipeline_sink.h"
+#include "realtime_check.h"
+#include "stdout_sink.h"
+#include "tee_sink.h"
+#include "trace.h"
+#include "wsa_helper.h"
+
+std::unique_ptr<wascap::sink::sink> wascap::sink::measured(std::unique_ptr<sink> s, const std::shared_ptr<shmctl::shmctl>& shmctl, const char* stage)
+{
+	s = realtime_checked(std::move(s));
+
+	if (trace::is_enabled()) {
+		s = std::make_unique<trace_sink>(std::move(s), stage);
+	}
+
+	if (!shmctl) {
+		return s;
+	}
+
+	return std::make_unique<shmctl_stats_sink>(std::move(s), shmctl, stage);
+}
+
+std::unique_ptr<wascap::sink::sink> wascap::sink::network_output(std::unique_ptr<sink> s, const std::string& bind_address, const std::string& peer_address, const std::string& peer_service, const std::shared_ptr<shmctl::shmctl>& shmctl)
+{
+	util::shared_wsa wsa = util::make_shared_wsa();
+
+	std::unique_ptr<network_sink> network = std::make_unique<network_sink>(std::move(s), wsa, bind_address, peer_address, peer_service);
+	if (shmctl) {
+		network->publish_stats(shmctl);
+	}
+
+	return measured(std::move(network), shmctl, "network");
+}
+
+std::unique_ptr<wascap::sink::sink> wascap::sink::queued_output(std::unique_ptr<sink> s, float queue_ms, const chain_options& options, std::vector<queue_sink*>& queues)
+{
+	size_t capacity_frames = (size_t)ceil(s->samplerate() * queue_ms / 1000.0);
+	if (0 == capacity_frames) {
+		return s;
+	}
+
+	std::unique_ptr<queue_sink> queue = std::make_unique<queue_sink>(std::move(s), capacity_frames, options.queue_overflow);
+	queues.push_back(queue.get());
+
+	return queue;
+}
+
+std::unique_ptr<wascap::sink::sink> wascap::sink::plan_chain(const chain_options& options, const render_output_factory& render_output, const std::shared_ptr<shmctl::shmctl>& shmctl, size_t source_samplerate, DWORD source_channel_mask, std::vector<queue_sink*>& queues)
+{
+	size_t chain_samplerate = (options.samplerate != SIZE_MAX) ? options.samplerate : source_samplerate;
+	DWORD chain_channel_mask = (options.channel_mask != 0) ? options.channel_mask : source_channel_mask;
+
+	std::unique_ptr<sink> s;
+
+	// With more than one output, each gets a branch of its own, with its own conversions from the chain format.
+	size_t outputs = (options.with_was_sink ? 1 : 0) + (options.with_network_sink ? 1 : 0) + (options.with_stdout_sink ? 1 : 0);
+	bool with_tee = options.parallel_outputs && outputs > 1;
+
+	size_t before_was_samplerate = (options.with_network_sink && !with_tee) ? network_sink::adjust_samplerate(chain_samplerate) : chain_samplerate;
+
+	// The compiled pipeline takes over the channel mapping when no resampler runs before it, and the network output
+	// when no resampler runs after it. The dynamic chain handles every other shape.
+	bool fuse_mapping = source_samplerate == chain_samplerate;
+	DWORD pipeline_channel_mask = fuse_mapping ? source_channel_mask : chain_channel_mask;
+	bool with_compiled_pipeline = options.with_compiled_pipeline && shmctl && !options.planar_frames
+		&& has_compiled_pipeline(__popcnt(pipeline_channel_mask), __popcnt(chain_channel_mask));
+	bool fuse_network = with_compiled_pipeline && options.with_network_sink && !with_tee && chain_samplerate == before_was_samplerate;
+	bool with_stdout_stage = options.with_stdout_sink && !with_tee;
+
+	if (with_tee) {
+		// The first branch runs on the capture thread: the network is quickest, and the render device slowest.
+		std::vector<std::unique_ptr<sink>> branches;
+		if (options.with_network_sink) {
+			s = std::make_unique<null_sink>(network_sink::adjust_samplerate(chain_samplerate), chain_channel_mask);
+			s = network_output(std::move(s), options.bind_address, options.peer_address, options.peer_service, shmctl);
+			if (chain_samplerate != s->samplerate()) {
+				s = measured(std::make_unique<samplerate_convert_sink>(std::move(s), chain_samplerate, options.resampler_quality), shmctl, "samplerate");
+			}
+			branches.push_back(std::move(s));
+		}
+		if (options.with_stdout_sink) {
+			s = std::make_unique<null_sink>(chain_samplerate, chain_channel_mask);
+			s = measured(std::make_unique<stdout_sink>(std::move(s)), shmctl, "stdout");
+			branches.push_back(queued_output(std::move(s), options.output_queue_ms, options, queues));
+		}
+		if (options.with_was_sink) {
+			branches.push_back(queued_output(measured(render_output(chain_samplerate, chain_channel_mask), shmctl, "was"), options.output_queue_ms, options, queues));
+		}
+
+		s = std::make_unique<tee_sink>(std::move(branches), shmctl);
+	}
+	else {
+		if (options.with_was_sink) {
+			s = queued_output(measured(render_output(before_was_samplerate, chain_channel_mask), shmctl, "was"), options.output_queue_ms, options, queues);
+		}
+		else {
+			s = std::make_unique<null_sink>(before_was_samplerate, chain_channel_mask);
+		}
+
+		if (options.with_network_sink && !fuse_network) {
+			s = network_output(std::move(s), options.bind_address, options.peer_address, options.peer_service, shmctl);
+		}
+
+		if (chain_samplerate != s->samplerate()) {
+			s = measured(std::make_unique<samplerate_convert_sink>(std::move(s), chain_samplerate, options.resampler_quality), shmctl, "samplerate");
+		}
+	}
+
+	if (with_compiled_pipeline) {
+		pipeline_stages stages;
+		stages.averaging = options.with_shm_averaging_sink;
+		stages.tap = options.with_shm_tap_sink;
+		stages.to_stdout = with_stdout_stage;
+		if (fuse_network) {
+			util::shared_wsa wsa = util::make_shared_wsa();
+
+			stages.network = std::make_unique<network_sender>(wsa, s->samplerate(), s->channel_mask(), options.bind_address, options.peer_address, options.peer_service);
+			stages.network->publish_stats(shmctl);
+		}
+
+		s = measured(make_pipeline_sink(std::move(s), shmctl, pipeline_channel_mask, fuse_mapping ? options.mixing_matrix : std::vector<float>(), std::move(stages)), shmctl, "pipeline");
+	}
+	else {
+		if (with_stdout_stage) {
+			s = measured(std::make_unique<stdout_sink>(std::move(s)), shmctl, "stdout");
+		}
+
+		if (shmctl && options.with_shm_tap_sink) {
+			s = measured(std::make_unique<shmctl_tap_sink>(std::move(s), shmctl), shmctl, "tap");
+		}
+
+		// Outputs take interleaved frames; the processing stages before them may work on planar frames instead.
+		if (options.planar_frames) {
+			s = std::make_unique<interleave_sink>(std::move(s));
+		}
+
+		if (shmctl) {
+			s = measured(std::make_unique<shmctl_volume_sink>(std::move(s), shmctl), shmctl, "volume");
+			if (options.with_shm_averaging_sink) {
+				s = measured(std::make_unique<shmctl_averaging_sink>(std::move(s), shmctl), shmctl, "averaging");
+			}
+			s = measured(std::make_unique<shmctl_flow_control_sink>(std::move(s), shmctl), shmctl, "flow-control");
+		}
+	}
+
+	if (source_samplerate != s->samplerate()) {
+		s = measured(std::make_unique<samplerate_convert_sink>(std::move(s), source_samplerate, options.resampler_quality), shmctl, "samplerate");
+	}
+	if (source_channel_mask != s->channel_mask() || (!options.mixing_matrix.empty() && !(with_compiled_pipeline && fuse_mapping))) {
+		s = measured(std::make_unique<channel_convert_sink>(std::move(s), source_channel_mask, options.mixing_matrix), shmctl, "channels");
+	}
+
+	if (options.planar_frames) {
+		s = std::make_unique<deinterleave_sink>(std::move(s));
+	}
+
+	return s;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base_sink.h"
+#include "convert_sink.h"
+#include "queue_sink.h"
+#include "shmctl_sink.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		// The options that shape the chain of a capture when no sink graph is given, as the command line sets them.
+		struct chain_options
+		{
+			std::string bind_address = "";
+			std::string peer_address = "";
+			std::string peer_service = "";
+
+			// The format of the chain, or SIZE_MAX and 0 for that of the source.
+			size_t samplerate = SIZE_MAX;
+			DWORD channel_mask = 0;
+			std::vector<float> mixing_matrix;
+
+			wascap::sink::resampler_quality resampler_quality = wascap::sink::resampler_quality::medium;
+			bool planar_frames = false;
+			bool with_compiled_pipeline = true;
+
+			bool with_network_sink = false;
+			bool with_stdout_sink = false;
+			bool with_was_sink = false;
+			bool with_shm_tap_sink = true;
+			bool with_shm_averaging_sink = true;
+			bool parallel_outputs = true;
+			float output_queue_ms = 200.0f;
+			wascap::sink::overflow_policy queue_overflow = wascap::sink::overflow_policy::drop_oldest;
+		};
+
+		// The render output of a chain, behind the conversions from the given frames to its own format.
+		typedef std::function<std::unique_ptr<sink>(size_t samplerate, DWORD channel_mask)> render_output_factory;
+
+		// Publishes what goes through the stage in the statistics of the control block, when there is one,
+		// and records its blocks as spans when tracing. The stage name is kept, so it must outlive the chain.
+		std::unique_ptr<sink> measured(std::unique_ptr<sink> s, const std::shared_ptr<shmctl::shmctl>& shmctl, const char* stage);
+		std::unique_ptr<sink> network_output(std::unique_ptr<sink> s, const std::string& bind_address, const std::string& peer_address, const std::string& peer_service, const std::shared_ptr<shmctl::shmctl>& shmctl);
+		// Moves an output that may block onto a thread of its own, unless the queue is disabled.
+		std::unique_ptr<sink> queued_output(std::unique_ptr<sink> s, float queue_ms, const chain_options& options, std::vector<queue_sink*>& queues);
+
+		// The chain that takes the frames of the source, as the options describe it, on the control block, which may be
+		// null. The render output is only asked for when the options have one. Output queues go to queues.
+		std::unique_ptr<sink> plan_chain(const chain_options& options, const render_output_factory& render_output, const std::shared_ptr<shmctl::shmctl>& shmctl, size_t source_samplerate, DWORD source_channel_mask, std::vector<queue_sink*>& queues);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Mono, stereo, quad, 5.1 and 7.1: the channel counts that the kernels and the compiled pipelines specialize for.
+#define CHANNEL_LAYOUTS 5
+
+namespace wascap
+{
+	namespace sink
+	{
+		// The place of the channel count among the specialized layouts, or SIZE_MAX for any other count.
+		inline size_t layout_index(size_t channels)
+		{
+			switch (channels) {
+			case 1:
+				return 0;
+			case 2:
+				return 1;
+			case 4:
+				return 2;
+			case 6:
+				return 3;
+			case 8:
+				return 4;
+			default:
+				return SIZE_MAX;
+			}
+		}
+
+		// The same, with every other count after the specialized layouts, for tables that end with kernels of any count.
+		inline size_t layout_or_any_index(size_t channels)
+		{
+			size_t index = layout_index(channels);
+
+			return (SIZE_MAX == index) ? CHANNEL_LAYOUTS : index;
+		}
+	}
+}
\ No newline at end of file
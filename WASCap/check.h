@@ -0,0 +1,26 @@
+#pragma once
+
+#include "convert_sink.h"
+
+namespace wascap
+{
+	namespace check
+	{
+		struct drift_options
+		{
+			size_t samplerate = 48000;
+			// How much faster the render clock runs than the capture clock.
+			double drift_ppm = 0.0;
+			double duration = 3600.0;
+			sink::resampler_quality resampler_quality = sink::resampler_quality::medium;
+		};
+
+		// Each returns 0 when the check passes, and prints what it found on stdout as tab-separated values.
+		int check_allocations_main();
+		int check_kernels_main();
+		int check_pipelines_main();
+		int check_reattach_main();
+		// Reports the buffer level and the adjustment of drift compensation over time, and only fails on errors.
+		int simulate_drift_main(const drift_options& options);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,239 @@
+#include "stdafx.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "base_sink.h"
+#include "buffer_pool.h"
+#include "check.h"
+#include "convert_sink.h"
+#include "fixture.h"
+#include "latency_meter.h"
+#include "pipeline_sink.h"
+#include "queue_sink.h"
+#include "realtime_check.h"
+#include "shmctl_sink.h"
+#include "string_format.h"
+#include "tee_sink.h"
+
+#define CHECK_MAX_PACKET_FRAMES 1024
+#define CHECK_PACKETS 2000
+#define CHECK_PACKETS_PER_RUN 250
+#define CHECK_TAP_BYTES 65536
+
+#ifndef WASCAP_REALTIME_CHECK
+namespace
+{
+	std::atomic<size_t> heap_allocations(0);
+}
+
+// Every operator new in the process is counted, so that the check can observe allocations it did not make itself.
+// Only the check executable takes it over; WASCap itself keeps the operator new of the runtime.
+void* operator new(size_t size)
+{
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void* p = malloc((0 == size) ? 1 : size);
+	if (nullptr == p) {
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+#endif
+
+namespace
+{
+	size_t heap_allocation_count()
+	{
+#ifdef WASCAP_REALTIME_CHECK
+		// Real-time checking builds count them in the operator new they take over.
+		return wascap::realtime::allocations();
+#else
+		return heap_allocations.load(std::memory_order_relaxed);
+#endif
+	}
+
+	// Reports a buffer that stays half full, so that drift compensation settles on its steady-state path.
+	class half_full_sink : public wascap::sink::chain_sink
+	{
+	public:
+		half_full_sink(std::unique_ptr<sink> next)
+			: chain_sink(std::move(next))
+		{
+		}
+
+		virtual bool can_play() const
+		{
+			return true;
+		}
+
+		virtual bool is_playing() const
+		{
+			return true;
+		}
+
+		virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const
+		{
+			capacity_frames = samplerate() / 10;
+			queued_frames = capacity_frames / 2;
+
+			return true;
+		}
+	};
+
+	// Counts the blocks that reach the output as samples rather than as silence.
+	class sample_counting_sink : public wascap::sink::null_sink
+	{
+		std::atomic<size_t>& m_sample_blocks;
+
+	public:
+		sample_counting_sink(size_t samplerate, DWORD channel_mask, std::atomic<size_t>& sample_blocks)
+			: null_sink(samplerate, channel_mask), m_sample_blocks(sample_blocks)
+		{
+		}
+
+		virtual bool process(const float* samples, size_t frames)
+		{
+			m_sample_blocks.fetch_add(1, std::memory_order_relaxed);
+
+			return null_sink::process(samples, frames);
+		}
+	};
+
+	struct scenario
+	{
+		const char* name;
+		size_t source_samplerate;
+		DWORD source_channel_mask;
+		size_t target_samplerate;
+		DWORD target_channel_mask;
+		bool planar_frames;
+		bool with_drift_compensation;
+		bool compiled_pipeline;
+		bool with_tee;
+		bool with_queue;
+		// Flags every block as silent, which the tee must hand to its worker branch as silence.
+		bool silent_blocks;
+	};
+
+	const scenario scenarios[] = {
+		{ "passthrough", 48000, 0x3, 48000, 0x3, false, false, false, false, false, false },
+		{ "resample", 44100, 0x3, 48000, 0x3, false, false, false, false, false, false },
+		{ "downmix", 48000, 0x63f, 44100, 0x3, false, false, false, false, false, false },
+		{ "downmix-compiled", 48000, 0x63f, 44100, 0x3, false, false, true, false, false, false },
+		{ "upmix-planar", 44100, 0x3, 48000, 0x3f, true, false, false, false, false, false },
+		{ "drift", 48000, 0x3, 48000, 0x3, false, true, false, false, false, false },
+		{ "drift-compiled", 48000, 0x3, 48000, 0x3, false, true, true, false, false, false },
+		{ "drift-tee", 48000, 0x3, 48000, 0x3, false, true, false, true, false, false },
+		{ "drift-queued-tee", 48000, 0x3, 48000, 0x3, false, true, false, true, true, false },
+		{ "drift-tee-silent", 48000, 0x3, 48000, 0x3, false, true, false, true, false, true },
+		{ "drift-planar", 44100, 0x3f, 48000, 0x3, true, true, false, false, false, false },
+	};
+
+	std::unique_ptr<wascap::sink::sink> build_chain(const scenario& sc, const std::shared_ptr<wascap::shmctl::shmctl>& shmctl, std::atomic<size_t>& sample_blocks)
+	{
+		namespace sink = wascap::sink;
+
+		std::unique_ptr<sink::sink> s = std::make_unique<sink::null_sink>(sc.target_samplerate, sc.target_channel_mask);
+		if (sc.with_drift_compensation) {
+			s = std::make_unique<half_full_sink>(std::move(s));
+			s = std::make_unique<sink::drift_compensation_sink>(std::move(s), sc.source_samplerate);
+		}
+		else if (sc.source_samplerate != s->samplerate()) {
+			s = std::make_unique<sink::samplerate_convert_sink>(std::move(s), sc.source_samplerate);
+		}
+		if (sc.with_queue) {
+			// Room for a few packets, so that the capture side sometimes drops the oldest frames.
+			s = std::make_unique<sink::queue_sink>(std::move(s), 4 * CHECK_MAX_PACKET_FRAMES, sink::overflow_policy::drop_oldest);
+		}
+		if (sc.with_tee) {
+			// A second output that takes the frames as they are, on a worker thread.
+			std::vector<std::unique_ptr<sink::sink>> branches;
+			branches.push_back(std::move(s));
+			branches.push_back(std::make_unique<sample_counting_sink>(sc.source_samplerate, sc.target_channel_mask, sample_blocks));
+			s = std::make_unique<sink::tee_sink>(std::move(branches));
+		}
+		if (sc.compiled_pipeline) {
+			sink::pipeline_stages stages;
+			stages.averaging = true;
+			stages.tap = true;
+			s = sink::make_pipeline_sink(std::move(s), shmctl, sc.source_channel_mask, std::vector<float>(), std::move(stages));
+		}
+		else {
+			s = std::make_unique<sink::shmctl_tap_sink>(std::move(s), shmctl);
+			if (sc.planar_frames) {
+				s = std::make_unique<sink::interleave_sink>(std::move(s));
+			}
+			s = std::make_unique<sink::shmctl_volume_sink>(std::move(s), shmctl);
+			s = std::make_unique<sink::shmctl_averaging_sink>(std::move(s), shmctl);
+			s = std::make_unique<sink::shmctl_flow_control_sink>(std::move(s), shmctl);
+			if (sc.source_channel_mask != s->channel_mask()) {
+				s = std::make_unique<sink::channel_convert_sink>(std::move(s), sc.source_channel_mask);
+			}
+		}
+		if (sc.planar_frames) {
+			s = std::make_unique<sink::deinterleave_sink>(std::move(s));
+		}
+
+		return s;
+	}
+}
+
+int wascap::check::check_allocations_main()
+{
+	fixture::control_block control(CHECK_TAP_BYTES);
+	const std::shared_ptr<shmctl::shmctl>& shmctl = control.get();
+
+	std::vector<float> packet(CHECK_MAX_PACKET_FRAMES * sink::MAX_CHANNELS);
+	for (size_t i = 0; i < packet.size(); ++i) {
+		packet[i] = (float)sin(i * 0.01);
+	}
+
+	fixture::result_table results("scenario\tpackets\tpool_floats\tallocations\tsample_blocks");
+
+	for (const scenario& sc : scenarios) {
+		sink::buffer_pool pool;
+		std::atomic<size_t> sample_blocks(0);
+		std::unique_ptr<sink::sink> s = build_chain(sc, shmctl, sample_blocks);
+		s->prepare(pool, CHECK_MAX_PACKET_FRAMES);
+
+		// Packet sizes follow a fixed pseudo-random sequence up to the prepared maximum, with a flush between runs.
+		// Blocks carry a capture time, so that the latency meters measure them too.
+		fixture::pseudo_random random;
+		sink::block_info info = { 0, 0, false, sc.silent_blocks };
+		size_t allocations_before = heap_allocation_count();
+		for (size_t p = 0; p < CHECK_PACKETS; ++p) {
+			size_t frames = random.next_frames(CHECK_MAX_PACKET_FRAMES);
+			info.capture_time = sink::capture_clock();
+			s->try_process(packet.data(), frames, info);
+			info.stream_position += frames;
+			if ((p + 1) % CHECK_PACKETS_PER_RUN == 0) {
+				s->flush();
+			}
+		}
+		size_t allocations = heap_allocation_count() - allocations_before;
+
+		// Silent blocks must reach the worker branch of the tee as silence, never as zeros.
+		size_t branch_sample_blocks = sample_blocks.load(std::memory_order_relaxed);
+		bool passed = 0 == allocations && (!sc.silent_blocks || 0 == branch_sample_blocks);
+		results.row(passed, util::string_format("%s\t%d\t%zu\t%zu\t%zu", sc.name, CHECK_PACKETS, pool.allocated(), allocations, branch_sample_blocks));
+	}
+
+	return results.exit_code();
+}
@@ -0,0 +1,152 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "base_sink.h"
+#include "check.h"
+#include "dsp_kernels.h"
+#include "fixture.h"
+#include "string_format.h"
+
+#define CHECK_MAX_FRAMES 67
+#define CHECK_TAPS 64
+#define CHECK_PLANE_PADDING 5
+
+namespace dsp = wascap::sink::dsp;
+
+namespace
+{
+	// Channel counts with a specialized kernel, and a few that take the generic path.
+	const size_t channel_counts[] = { 1, 2, 3, 4, 5, 6, 7, 8, 12, 32 };
+
+	class kernel_checker
+	{
+		size_t m_channels;
+		dsp::kernels m_reference;
+		dsp::kernels m_candidate;
+		wascap::fixture::pseudo_random m_random;
+		size_t m_mismatches;
+
+		std::vector<float> random_block(size_t count)
+		{
+			std::vector<float> block(count);
+			for (float& sample : block) {
+				sample = m_random.next_sample() * 1.5f;
+			}
+
+			return block;
+		}
+
+		void compare(const std::vector<float>& expected, const std::vector<float>& actual)
+		{
+			if (0 != memcmp(expected.data(), actual.data(), expected.size() * sizeof(float))) {
+				++m_mismatches;
+			}
+		}
+
+	public:
+		kernel_checker(size_t channels, dsp::instruction_set isa)
+			: m_channels(channels), m_reference(dsp::select_kernels(channels, dsp::instruction_set::scalar)), m_candidate(dsp::select_kernels(channels, isa)), m_mismatches(0)
+		{
+		}
+
+		inline size_t mismatches() const { return m_mismatches; }
+
+		void check(size_t frames)
+		{
+			size_t samples = frames * m_channels;
+			std::vector<float> source = random_block(samples);
+			std::vector<float> gains = random_block(m_channels);
+
+			{
+				std::vector<float> expected(samples);
+				std::vector<float> actual(samples);
+				m_reference.gain(expected.data(), source.data(), frames, gains.data(), m_channels);
+				m_candidate.gain(actual.data(), source.data(), frames, gains.data(), m_channels);
+				compare(expected, actual);
+
+				std::vector<float> accumulated = random_block(samples);
+				expected = accumulated;
+				actual = accumulated;
+				m_reference.accumulate(expected.data(), source.data(), frames, gains.data(), m_channels);
+				m_candidate.accumulate(actual.data(), source.data(), frames, gains.data(), m_channels);
+				compare(expected, actual);
+			}
+
+			{
+				// Peak scans must skip NaNs and treat both zeros alike.
+				std::vector<float> peaked = source;
+				if (samples > 2) {
+					peaked[samples / 2] = NAN;
+					peaked[samples / 3] = -0.0f;
+				}
+				std::vector<float> expected(m_channels, 0.0f);
+				std::vector<float> actual(m_channels, 0.0f);
+				m_reference.peak(expected.data(), peaked.data(), frames, m_channels);
+				m_candidate.peak(actual.data(), peaked.data(), frames, m_channels);
+				compare(expected, actual);
+			}
+
+			{
+				std::vector<float> expected(samples);
+				std::vector<float> actual(samples);
+				std::vector<float> expected_last = random_block(m_channels);
+				std::vector<float> actual_last = expected_last;
+				m_reference.average(expected.data(), source.data(), frames, expected_last.data(), 0.9, m_channels);
+				m_candidate.average(actual.data(), source.data(), frames, actual_last.data(), 0.9, m_channels);
+				compare(expected, actual);
+				compare(expected_last, actual_last);
+			}
+
+			{
+				size_t plane_stride = frames + CHECK_PLANE_PADDING;
+				std::vector<float> expected(plane_stride * m_channels, 0.0f);
+				std::vector<float> actual(plane_stride * m_channels, 0.0f);
+				m_reference.deinterleave(expected.data(), source.data(), frames, plane_stride, m_channels);
+				m_candidate.deinterleave(actual.data(), source.data(), frames, plane_stride, m_channels);
+				compare(expected, actual);
+
+				std::vector<float> planes = expected;
+				expected.assign(samples, 0.0f);
+				actual.assign(samples, 0.0f);
+				m_reference.interleave(expected.data(), planes.data(), frames, plane_stride, m_channels);
+				m_candidate.interleave(actual.data(), planes.data(), frames, plane_stride, m_channels);
+				compare(expected, actual);
+				compare(source, actual);
+			}
+
+			{
+				size_t taps = min((frames / 4) * 4, (size_t)CHECK_TAPS);
+				std::vector<float> a = random_block(taps);
+				std::vector<float> b = random_block(taps);
+				std::vector<float> expected(1, m_reference.dot_product(a.data(), b.data(), taps));
+				std::vector<float> actual(1, m_candidate.dot_product(a.data(), b.data(), taps));
+				compare(expected, actual);
+			}
+		}
+	};
+}
+
+int wascap::check::check_kernels_main()
+{
+	dsp::instruction_set supported = dsp::supported_instruction_set();
+
+	fixture::result_table results("isa\tchannels\tmismatches");
+
+	for (int isa = (int)dsp::instruction_set::sse2; isa <= (int)supported; ++isa) {
+		for (size_t channels : channel_counts) {
+			kernel_checker checker(channels, (dsp::instruction_set)isa);
+
+			// Every block length up to a few vectors, so that each kernel goes through its tail handling.
+			for (size_t frames = 0; frames <= CHECK_MAX_FRAMES; ++frames) {
+				checker.check(frames);
+			}
+
+			results.row(0 == checker.mismatches(), util::string_format("%s\t%zu\t%zu", dsp::instruction_set_name((dsp::instruction_set)isa), channels, checker.mismatches()));
+		}
+	}
+
+	return results.exit_code();
+}
@@ -0,0 +1,134 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "fixture.h"
+#include "string_format.h"
+
+namespace
+{
+	enum class check_verb
+	{
+		allocations,
+		kernels,
+		pipelines,
+		reattach,
+		simulate_drift,
+	};
+
+	struct check_arguments
+	{
+		check_verb verb = check_verb::allocations;
+		wascap::check::drift_options drift;
+	};
+
+	const char* usage =
+		"Usage: wascap_check allocations|kernels|pipelines|reattach\n"
+		"       wascap_check simulate-drift [samplerate <n>] [drift <ppm>] [duration <seconds>] [resampler fast|medium|high]\n"
+		"\n"
+		"allocations: runs chains of every kind over packets of random sizes, and fails if a stage allocates once prepared.\n"
+		"kernels: compares the vector kernels the processor supports with the scalar ones, bit for bit.\n"
+		"pipelines: compares the compiled pipelines with the chains of stages they stand for, across channel layouts.\n"
+		"reattach: has one session lose and replace its source in other formats, and checks what reaches the chain.\n"
+		"simulate-drift: plays through drift compensation into a device whose clock runs faster by the given drift,\n"
+		"                0 ppm for an hour at 48000 Hz by default, and reports the buffer level every minute.\n"
+		"\n"
+		"Results go to stdout as tab-separated values with a header line, and the exit code is 0 when the check passes.\n";
+
+	void parse_check_arguments(check_arguments& arguments, const std::vector<std::string>& args)
+	{
+		auto current = args.begin() + 1;
+		if (current == args.end()) {
+			throw std::invalid_argument("Missing check");
+		}
+		std::string verb = *current++;
+		if (verb == "allocations") {
+			arguments.verb = check_verb::allocations;
+		}
+		else if (verb == "kernels") {
+			arguments.verb = check_verb::kernels;
+		}
+		else if (verb == "pipelines") {
+			arguments.verb = check_verb::pipelines;
+		}
+		else if (verb == "reattach") {
+			arguments.verb = check_verb::reattach;
+		}
+		else if (verb == "simulate-drift") {
+			arguments.verb = check_verb::simulate_drift;
+		}
+		else {
+			throw std::invalid_argument(wascap::util::string_format("Unrecognized check: %s", verb));
+		}
+
+		auto next = [&](const char* what) -> const std::string& {
+			if (current == args.end()) {
+				throw std::invalid_argument(wascap::util::string_format("Missing %s", what));
+			}
+			return *current++;
+		};
+
+		while (current != args.end()) {
+			std::string word = *current++;
+			if (arguments.verb != check_verb::simulate_drift) {
+				throw std::invalid_argument(wascap::util::string_format("Unrecognized argument: %s", word));
+			}
+
+			if (word == "samplerate") {
+				arguments.drift.samplerate = wascap::fixture::parse_number(next("samplerate"));
+				if (0 == arguments.drift.samplerate) {
+					throw std::invalid_argument("Samplerate must be positive");
+				}
+			}
+			else if (word == "drift") {
+				arguments.drift.drift_ppm = std::stod(next("drift in ppm"));
+			}
+			else if (word == "duration") {
+				arguments.drift.duration = std::stod(next("duration"));
+			}
+			else if (word == "resampler") {
+				arguments.drift.resampler_quality = wascap::fixture::parse_resampler_quality(next("resampler quality"));
+			}
+			else {
+				throw std::invalid_argument(wascap::util::string_format("Unrecognized argument: %s", word));
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	check_arguments arguments;
+	try {
+		parse_check_arguments(arguments, std::vector<std::string>(argv, argv + argc));
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n\n%s", e.what(), usage);
+		return 2;
+	}
+
+	try {
+		switch (arguments.verb) {
+		case check_verb::allocations:
+			return wascap::check::check_allocations_main();
+		case check_verb::kernels:
+			return wascap::check::check_kernels_main();
+		case check_verb::pipelines:
+			return wascap::check::check_pipelines_main();
+		case check_verb::reattach:
+			return wascap::check::check_reattach_main();
+		case check_verb::simulate_drift:
+			return wascap::check::simulate_drift_main(arguments.drift);
+		}
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 1;
+}
\ No newline at end of file
@@ -0,0 +1,214 @@
+#include "stdafx.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base_sink.h"
+#include "buffer_pool.h"
+#include "check.h"
+#include "convert_sink.h"
+#include "fixture.h"
+#include "pipeline_sink.h"
+#include "shmctl_sink.h"
+#include "string_format.h"
+
+#define CHECK_MAX_PACKET_FRAMES 480
+// Long enough that a 7.1 block of zeros is longer than the zeros every sink shares.
+#define CHECK_LONG_PACKET_FRAMES 4096
+#define CHECK_PACKETS 400
+#define CHECK_PACKETS_PER_RUN 100
+#define CHECK_TAP_BYTES 65536
+
+namespace fixture = wascap::fixture;
+namespace sink = wascap::sink;
+namespace shmctl = wascap::shmctl;
+
+namespace
+{
+	// Keeps everything it is given, as an output would.
+	class record_sink : public sink::sink
+	{
+		std::vector<float> m_recorded;
+
+	public:
+		record_sink(size_t samplerate, DWORD channel_mask)
+			: sink(samplerate, channel_mask, wascap::sink::frame_layout::interleaved)
+		{
+		}
+
+		inline const std::vector<float>& recorded() const { return m_recorded; }
+		inline void clear() { m_recorded.clear(); }
+
+		virtual bool can_play() const
+		{
+			return true;
+		}
+
+		virtual bool is_open() const
+		{
+			return true;
+		}
+
+		virtual bool is_playing() const
+		{
+			return true;
+		}
+
+		virtual bool process(const float* samples, size_t frames)
+		{
+			m_recorded.insert(m_recorded.end(), samples, samples + (frames * channels()));
+
+			return true;
+		}
+
+		virtual void flush()
+		{
+		}
+	};
+
+	// Settings that keep every stage busy: uneven channel volumes, a limiter that engages, averaging, and a tap.
+	void initialize(volatile shmctl::shm_contents* shmblock, bool with_averaging)
+	{
+		shmblock->tap_write_cursor = 0;
+		shmblock->master_volume = 0.9f;
+		for (size_t c = 0; c < sink::MAX_CHANNELS; ++c) {
+			shmblock->channel_volumes[c] = 1.0f - (c * 0.03f);
+		}
+		shmblock->saturation_threshold = 1.0f;
+		shmblock->silence_threshold = 0.0001f;
+		shmblock->averaging_weight = with_averaging ? 0.3f : 0.0f;
+		shmblock->saturation_debounce_factor = 2.0f;
+		shmblock->saturation_recovery_factor = 1.001f;
+		shmblock->saturation_debounce_volume = 1.0f;
+		shmblock->saturation_effective_volume = 1.0f;
+	}
+
+	// Whatever the volume stage leaves in the control block must match too.
+	bool same_state(volatile shmctl::shm_contents* expected, volatile shmctl::shm_contents* actual)
+	{
+		return expected->tap_write_cursor == actual->tap_write_cursor
+			&& expected->saturation_debounce_volume == actual->saturation_debounce_volume
+			&& expected->saturation_effective_volume == actual->saturation_effective_volume
+			&& expected->last_frame_max_amplitude == actual->last_frame_max_amplitude
+			&& expected->samplerate == actual->samplerate
+			&& expected->channel_mask == actual->channel_mask
+			&& 0 == memcmp((const char*)expected + expected->tap_offset, (const char*)actual + actual->tap_offset, CHECK_TAP_BYTES);
+	}
+
+	// Mono, stereo, quad, 5.1 and 7.1.
+	const DWORD channel_masks[] = { 0x4, 0x3, 0x33, 0x3f, 0x63f };
+
+	class pipeline_checker
+	{
+		fixture::control_block m_dynamic_control;
+		fixture::control_block m_fused_control;
+		fixture::pseudo_random m_random;
+
+	public:
+		pipeline_checker()
+			: m_dynamic_control(CHECK_TAP_BYTES), m_fused_control(CHECK_TAP_BYTES)
+		{
+		}
+
+		// Returns the number of packets after which the fused pipeline and the dynamic chain disagreed.
+		size_t check(DWORD source_channel_mask, DWORD target_channel_mask, const std::vector<float>& coefficients, bool with_averaging, size_t max_packet_frames)
+		{
+			const std::shared_ptr<shmctl::shmctl>& dynamic_shmctl = m_dynamic_control.get();
+			const std::shared_ptr<shmctl::shmctl>& fused_shmctl = m_fused_control.get();
+			initialize(dynamic_shmctl->get(), with_averaging);
+			initialize(fused_shmctl->get(), with_averaging);
+
+			std::unique_ptr<record_sink> dynamic_record = std::make_unique<record_sink>(48000, target_channel_mask);
+			std::unique_ptr<record_sink> fused_record = std::make_unique<record_sink>(48000, target_channel_mask);
+			record_sink& dynamic_recorded = *dynamic_record;
+			record_sink& fused_recorded = *fused_record;
+
+			std::unique_ptr<sink::sink> dynamic = std::make_unique<sink::shmctl_tap_sink>(std::move(dynamic_record), dynamic_shmctl);
+			dynamic = std::make_unique<sink::shmctl_volume_sink>(std::move(dynamic), dynamic_shmctl);
+			dynamic = std::make_unique<sink::shmctl_averaging_sink>(std::move(dynamic), dynamic_shmctl);
+			dynamic = std::make_unique<sink::shmctl_flow_control_sink>(std::move(dynamic), dynamic_shmctl);
+			if (source_channel_mask != target_channel_mask || !coefficients.empty()) {
+				dynamic = std::make_unique<sink::channel_convert_sink>(std::move(dynamic), source_channel_mask, coefficients);
+			}
+
+			sink::pipeline_stages stages;
+			stages.averaging = true;
+			stages.tap = true;
+			std::unique_ptr<sink::sink> fused = sink::make_pipeline_sink(std::move(fused_record), fused_shmctl, source_channel_mask, coefficients, std::move(stages));
+
+			sink::buffer_pool dynamic_pool;
+			sink::buffer_pool fused_pool;
+			dynamic->prepare(dynamic_pool, max_packet_frames);
+			fused->prepare(fused_pool, max_packet_frames);
+
+			size_t source_channels = __popcnt(source_channel_mask);
+			std::vector<float> packet(max_packet_frames * source_channels);
+			std::vector<float> zeros(max_packet_frames * source_channels, 0.0f);
+
+			size_t mismatches = 0;
+			for (size_t p = 0; p < CHECK_PACKETS; ++p) {
+				// Loud packets drive the limiter, and every seventh one is quiet enough to be dropped as silence.
+				float scale = (p % 7 == 6) ? 0.00001f : 1.5f;
+				size_t frames = m_random.next_frames(max_packet_frames);
+				for (size_t i = 0; i < frames * source_channels; ++i) {
+					packet[i] = m_random.next_sample() * scale;
+				}
+
+				// Every eleventh packet is flagged as silent, which the fused pipeline must take as the dynamic chain takes zeros.
+				bool dynamic_result, fused_result;
+				if (p % 11 == 10) {
+					dynamic_result = dynamic->process(zeros.data(), frames);
+					fused_result = fused->process_silence(frames);
+				}
+				else {
+					dynamic_result = dynamic->process(packet.data(), frames);
+					fused_result = fused->process(packet.data(), frames);
+				}
+				if ((p + 1) % CHECK_PACKETS_PER_RUN == 0) {
+					dynamic->flush();
+					fused->flush();
+				}
+
+				if (dynamic_result != fused_result || dynamic_recorded.recorded() != fused_recorded.recorded() || !same_state(dynamic_shmctl->get(), fused_shmctl->get())) {
+					++mismatches;
+				}
+				dynamic_recorded.clear();
+				fused_recorded.clear();
+			}
+
+			return mismatches;
+		}
+	};
+}
+
+int wascap::check::check_pipelines_main()
+{
+	pipeline_checker checker;
+
+	fixture::result_table results("source\ttarget\tmatrix\taveraging\tpacket\tmismatches");
+
+	auto report = [&](DWORD source_channel_mask, DWORD target_channel_mask, const std::vector<float>& coefficients, size_t max_packet_frames = CHECK_MAX_PACKET_FRAMES) {
+		for (bool with_averaging : { false, true }) {
+			size_t mismatches = checker.check(source_channel_mask, target_channel_mask, coefficients, with_averaging, max_packet_frames);
+			results.row(0 == mismatches, util::string_format("%08x\t%08x\t%s\t%s\t%zu\t%zu", (unsigned int)source_channel_mask, (unsigned int)target_channel_mask, coefficients.empty() ? "no" : "yes", with_averaging ? "yes" : "no", max_packet_frames, mismatches));
+		}
+	};
+
+	// Every layout pair with the default mapping, which goes through unmapped on the diagonal.
+	for (DWORD source_channel_mask : channel_masks) {
+		for (DWORD target_channel_mask : channel_masks) {
+			report(source_channel_mask, target_channel_mask, std::vector<float>());
+		}
+	}
+
+	// A matrix between identical layouts still has to be applied.
+	report(0x3, 0x3, { 0.7f, 0.3f, -0.2f, 1.1f });
+	report(0x3f, 0x3, { 0.5f, 0.0f, 0.35f, 0.1f, 0.3f, 0.0f, 0.0f, 0.5f, 0.35f, 0.1f, 0.0f, 0.3f });
+
+	// Silence the limiter recovers over must still be one block to it when the block is long.
+	report(0x63f, 0x63f, std::vector<float>(), CHECK_LONG_PACKET_FRAMES);
+
+	return results.exit_code();
+}
\ No newline at end of file
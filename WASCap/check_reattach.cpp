@@ -0,0 +1,229 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base_sink.h"
+#include "capture_session.h"
+#include "check.h"
+#include "fixture.h"
+#include "shmctl_sink.h"
+#include "string_format.h"
+#include "synthetic_source.h"
+
+#define CHECK_CHAIN_SAMPLERATE 48000
+#define CHECK_CHAIN_CHANNEL_MASK 0x3
+#define CHECK_FREQUENCY 200.0
+#define CHECK_AMPLITUDE 0.5f
+#define CHECK_RMS_TOLERANCE 0.01
+// Resamplers start on half a filter of silence, and the frames still in them are lost when their source is.
+#define CHECK_FRAME_TOLERANCE 256
+
+namespace fixture = wascap::fixture;
+namespace sink = wascap::sink;
+namespace shmctl = wascap::shmctl;
+namespace source = wascap::source;
+namespace util = wascap::util;
+
+namespace
+{
+	struct segment_stats
+	{
+		size_t frames;
+		double sum_of_squares;
+	};
+
+	// Measures what it is given, one segment per discontinuity, and checks that no block exceeds its preparation.
+	class measure_sink : public sink::sink
+	{
+		std::vector<segment_stats> m_segments;
+		size_t m_oversized_blocks;
+
+	public:
+		measure_sink(size_t samplerate, DWORD channel_mask)
+			: sink(samplerate, channel_mask, wascap::sink::frame_layout::interleaved), m_oversized_blocks(0)
+		{
+		}
+
+		inline const std::vector<segment_stats>& segments() const { return m_segments; }
+		inline size_t oversized_blocks() const { return m_oversized_blocks; }
+
+		virtual bool can_play() const
+		{
+			return true;
+		}
+
+		virtual bool is_open() const
+		{
+			return true;
+		}
+
+		virtual bool is_playing() const
+		{
+			return true;
+		}
+
+		virtual void begin_block(const wascap::sink::block_info& info)
+		{
+			if (info.discontinuity || m_segments.empty()) {
+				m_segments.push_back({ 0, 0.0 });
+			}
+		}
+
+		virtual bool process(const float* samples, size_t frames)
+		{
+			if (frames > max_frames()) {
+				++m_oversized_blocks;
+			}
+
+			segment_stats& segment = m_segments.back();
+			for (size_t i = 0; i < frames * channels(); ++i) {
+				segment.sum_of_squares += (double)samples[i] * (double)samples[i];
+			}
+			segment.frames += frames;
+
+			return true;
+		}
+
+		virtual void flush()
+		{
+		}
+	};
+
+	// How a source ends: lost, replaced once stale, or still running when the session has taken all its frames.
+	enum class segment_end
+	{
+		lost,
+		stale,
+		last,
+	};
+
+	struct segment
+	{
+		size_t samplerate;
+		DWORD channel_mask;
+		size_t packet_frames;
+		size_t frames;
+		segment_end end;
+	};
+
+	// Same format as the chain in packets larger than it was prepared for, resampling both ways with channels mapped
+	// on either side, and back to the first format.
+	const std::vector<segment> same_format_first = {
+		{ 48000, 0x3, 480, 48000, segment_end::lost },
+		{ 44100, 0x3f, 441, 44100, segment_end::stale },
+		{ 96000, 0x4, 1000, 96000, segment_end::lost },
+		{ 48000, 0x3, 960, 48000, segment_end::stale },
+		{ 32000, 0x63f, 320, 32000, segment_end::last },
+	};
+
+	// The chain keeps its own format from the start, so a first source in another one is converted once, as are
+	// the sources after it, and the session lasts as long in chain frames whatever the rate of each source.
+	const std::vector<segment> other_format_first = {
+		{ 44100, 0x3f, 441, 44100, segment_end::lost },
+		{ 48000, 0x3, 480, 48000, segment_end::stale },
+		{ 96000, 0x4, 960, 96000, segment_end::last },
+	};
+
+	// Opens the sources of the segments in turn.
+	class segment_provider : public wascap::source::source_provider
+	{
+		const std::vector<segment>& m_segments;
+		size_t m_next;
+		const wascap::source::synthetic_source* m_current;
+
+	public:
+		segment_provider(const std::vector<segment>& segments)
+			: m_segments(segments), m_next(0), m_current(nullptr)
+		{
+		}
+
+		virtual std::unique_ptr<wascap::source::source> open()
+		{
+			if (m_next == m_segments.size()) {
+				throw std::runtime_error("No more segments");
+			}
+
+			const segment& sg = m_segments[m_next++];
+			std::unique_ptr<wascap::source::synthetic_source> source = std::make_unique<wascap::source::synthetic_source>(sg.samplerate, sg.channel_mask, sg.packet_frames, (sg.end == segment_end::lost) ? sg.frames : SIZE_MAX, CHECK_FREQUENCY, CHECK_AMPLITUDE);
+			m_current = source.get();
+
+			return source;
+		}
+
+		virtual bool is_stale()
+		{
+			const segment& sg = m_segments[m_next - 1];
+
+			return sg.end == segment_end::stale && m_current->position() >= sg.frames;
+		}
+	};
+}
+
+namespace
+{
+	// Runs a session through the segments in turn, and adds a row to the results for each.
+	void check_segments(fixture::result_table& results, const char* name, const std::vector<segment>& segments)
+	{
+		fixture::control_block control(0);
+		const std::shared_ptr<shmctl::shmctl>& shmctl = control.get();
+
+		// Stages whose state lives across the swaps: the averaging history, and the limiter state in the control block.
+		// At full volume, the level of each segment tells whether its conversion went right.
+		volatile shmctl::shm_contents* shmblock = control.contents();
+		shmblock->master_volume = 1.0f;
+		shmblock->averaging_weight = 0.3f;
+
+		std::unique_ptr<measure_sink> measure = std::make_unique<measure_sink>(CHECK_CHAIN_SAMPLERATE, CHECK_CHAIN_CHANNEL_MASK);
+		const measure_sink& measured = *measure;
+		std::unique_ptr<sink::sink> s = std::move(measure);
+		s = std::make_unique<sink::shmctl_volume_sink>(std::move(s), shmctl);
+		s = std::make_unique<sink::shmctl_averaging_sink>(std::move(s), shmctl);
+
+		// The session counts frames at the rate of the chain.
+		size_t total_frames = 0;
+		for (const segment& sg : segments) {
+			total_frames += (size_t)(((unsigned long long)sg.frames * CHECK_CHAIN_SAMPLERATE) / sg.samplerate);
+		}
+
+		std::unique_ptr<source::source_provider> provider = std::make_unique<segment_provider>(segments);
+		std::unique_ptr<source::source> first = provider->open();
+		source::capture_session session("check", std::move(provider), std::move(first), std::move(s), total_frames, sink::resampler_quality::medium);
+		session.run();
+
+		double expected_rms = CHECK_AMPLITUDE / sqrt(2.0);
+		for (size_t i = 0; i < segments.size(); ++i) {
+			const segment& sg = segments[i];
+			size_t expected_frames = (size_t)(((unsigned long long)sg.frames * CHECK_CHAIN_SAMPLERATE) / sg.samplerate);
+			if (i >= measured.segments().size()) {
+				results.row(false, util::string_format("%s\t%zu\t%zu\t0x%x\t%zu\t-\t%zu\t-", name, i, sg.samplerate, (unsigned int)sg.channel_mask, sg.packet_frames, expected_frames));
+				continue;
+			}
+
+			const segment_stats& stats = measured.segments()[i];
+			double rms = (0 == stats.frames) ? 0.0 : sqrt(stats.sum_of_squares / (double)(stats.frames * __popcnt(CHECK_CHAIN_CHANNEL_MASK)));
+			bool passed = stats.frames + CHECK_FRAME_TOLERANCE >= expected_frames && stats.frames <= expected_frames + CHECK_FRAME_TOLERANCE && fabs(rms - expected_rms) <= CHECK_RMS_TOLERANCE;
+			results.row(passed, util::string_format("%s\t%zu\t%zu\t0x%x\t%zu\t%zu\t%zu\t%.4f", name, i, sg.samplerate, (unsigned int)sg.channel_mask, sg.packet_frames, stats.frames, expected_frames, rms));
+		}
+
+		if (measured.segments().size() != segments.size()) {
+			results.fail(util::string_format("%s: expected %zu segments, measured %zu", name, segments.size(), measured.segments().size()));
+		}
+		if (measured.oversized_blocks() > 0) {
+			results.fail(util::string_format("%s: %zu blocks exceeded the prepared size", name, measured.oversized_blocks()));
+		}
+	}
+}
+
+int wascap::check::check_reattach_main()
+{
+	fixture::result_table results("first\tsegment\tsamplerate\tchannel_mask\tpacket_frames\tframes\texpected_frames\trms");
+
+	check_segments(results, "same", same_format_first);
+	check_segments(results, "other", other_format_first);
+
+	return results.exit_code();
+}
\ No newline at end of file
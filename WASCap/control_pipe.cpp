@@ -0,0 +1,83 @@
+#include "stdafx.h"
+
+#include <windows.h>
+#include <system_error>
+
+#include "control_pipe.h"
+#include "errors.h"
+
+#define CONTROL_PIPE_BUFFER_BYTES 4096
+
+wascap::util::control_pipe::control_pipe(const std::string& name)
+	: m_connected(false)
+{
+	std::string path = "\\\\.\\pipe\\" + name;
+	HANDLE pipe = CreateNamedPipeA(path.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, CONTROL_PIPE_BUFFER_BYTES, CONTROL_PIPE_BUFFER_BYTES, 0, nullptr);
+	if (INVALID_HANDLE_VALUE == pipe) {
+		throw std::system_error(win32_last_error(), "CreateNamedPipeA");
+	}
+	m_pipe.reset(pipe);
+}
+
+bool wascap::util::control_pipe::read_line(std::string& line)
+{
+	for (;;) {
+		size_t end = m_buffer.find('\n');
+		if (end != std::string::npos) {
+			line = m_buffer.substr(0, (end > 0 && m_buffer[end - 1] == '\r') ? (end - 1) : end);
+			m_buffer.erase(0, end + 1);
+
+			return true;
+		}
+
+		if (!m_connected) {
+			if (!ConnectNamedPipe(m_pipe.get(), nullptr)) {
+				DWORD error = GetLastError();
+				if (ERROR_OPERATION_ABORTED == error) {
+					return false;
+				}
+				if (ERROR_PIPE_CONNECTED != error) {
+					throw std::system_error(win32_last_error(), "ConnectNamedPipe");
+				}
+			}
+			m_connected = true;
+		}
+
+		char chunk[CONTROL_PIPE_BUFFER_BYTES];
+		DWORD read;
+		if (!ReadFile(m_pipe.get(), chunk, sizeof(chunk), &read, nullptr)) {
+			DWORD error = GetLastError();
+			if (ERROR_OPERATION_ABORTED == error) {
+				return false;
+			}
+			if (ERROR_BROKEN_PIPE != error) {
+				throw std::system_error(win32_last_error(), "ReadFile");
+			}
+
+			// The client went away, along with the line it did not finish.
+			DisconnectNamedPipe(m_pipe.get());
+			m_connected = false;
+			m_buffer.clear();
+			continue;
+		}
+		m_buffer.append(chunk, read);
+	}
+}
+
+void wascap::util::control_pipe::write_line(const std::string& line)
+{
+	std::string data = line + "\n";
+	size_t offset = 0;
+	while (offset < data.size()) {
+		DWORD written;
+		if (!WriteFile(m_pipe.get(), data.data() + offset, (DWORD)(data.size() - offset), &written, nullptr)) {
+			DWORD error = GetLastError();
+			if (ERROR_BROKEN_PIPE == error || ERROR_NO_DATA == error) {
+				return;
+			}
+
+			throw std::system_error(win32_last_error(), "WriteFile");
+		}
+		offset += written;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "no_copy.h"
+#include "win32_helper.h"
+
+namespace wascap
+{
+	namespace util
+	{
+		// The server end of a local named pipe, which takes commands one line at a time and answers each with a line.
+		// It serves one client at a time, and waits for the next one when a client goes away.
+		class control_pipe : no_copy_no_move
+		{
+			unique_handle m_pipe;
+			bool m_connected;
+			std::string m_buffer;
+
+		public:
+			// The pipe is \\.\pipe\ followed by the name.
+			explicit control_pipe(const std::string& name);
+
+			// Waits for a client if needed, then for its next line, which comes without its end.
+			// Returns false when another thread cancels the wait through CancelSynchronousIo.
+			bool read_line(std::string& line);
+			// Answers the current client; an answer to a client that went away is lost.
+			void write_line(const std::string& line);
+		};
+	}
+}
\ No newline at end of file
@@ -1,10 +1,16 @@
 #include "stdafx.h"
 
-#include <intrin.h>
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <vector>
 
 #include "convert_sink.h"
+#include "platform.h"
+#include "string_format.h"
 
 using wascap::sink::MAX_CHANNELS;
 
@@ -15,17 +21,112 @@ namespace
 		return (b == 0) ? a : gcd(b, a % b);
 	}
 
-	size_t fill_sink_buffer(float* dest, size_t destcap, size_t& destlen, const float*& src, size_t& srclen, size_t channels)
+	struct resampler_profile
 	{
-		size_t n = min(destcap - destlen, srclen);
-		if (n > 0) {
-			memcpy(dest, src, n * channels * sizeof(float));
-			destlen += n;
-			srclen -= n;
-			src += n * channels;
+		size_t half_taps;
+		size_t max_phases;
+		double kaiser_beta;
+		double rolloff;
+	};
+
+	// Indexed by wascap::sink::resampler_quality.
+	const resampler_profile resampler_profiles[] = {
+		{ 4, 64, 5.0, 0.85 },
+		{ 16, 256, 8.0, 0.91 },
+		{ 32, 512, 10.0, 0.95 },
+	};
+
+	constexpr double PI = 3.14159265358979323846;
+
+	// Phase resolution of variable-ratio resamplers, about 2.3e-4 ppm.
+	constexpr uint64_t VARIABLE_PHASE_DENOMINATOR = 1ULL << 32;
+
+	// Drift compensation loop tuning, with levels measured in seconds of queued audio.
+	// The loop has a natural frequency of sqrt(I) = 0.01 rad/s and a damping ratio of P / (2 sqrt(I)) = 0.9.
+	constexpr double DRIFT_LEVEL_SMOOTHING = 1.0;
+	constexpr double DRIFT_PROPORTIONAL_GAIN = 1.8e-2;
+	constexpr double DRIFT_INTEGRAL_GAIN = 1e-4;
+	constexpr double DRIFT_MAX_ADJUSTMENT = 1e-3;
+
+	double bessel_i0(double x)
+	{
+		double sum = 1.0;
+		double term = 1.0;
+		double half_x = x * 0.5;
+		for (size_t k = 1; term > sum * 1e-12; ++k) {
+			double factor = half_x / k;
+			term *= factor * factor;
+			sum += term;
+		}
+
+		return sum;
+	}
+
+	double windowed_sinc(double x, double cutoff, double half_width, double kaiser_beta)
+	{
+		double ratio = x / half_width;
+		if (ratio <= -1.0 || ratio >= 1.0) {
+			return 0.0;
+		}
+
+		double window = bessel_i0(kaiser_beta * sqrt(1.0 - ratio * ratio)) / bessel_i0(kaiser_beta);
+		double y = 2.0 * cutoff * x;
+		double sinc = (0.0 == y) ? 1.0 : (sin(PI * y) / (PI * y));
+
+		return 2.0 * cutoff * sinc * window;
+	}
+
+	// Polyphase tables by quality, reduced source and target rates, and whether the ratio is variable.
+	// Sessions hosted in one process often convert between the same rates, and a high-quality table runs to megabytes.
+	typedef std::tuple<size_t, size_t, size_t, bool> coefficient_key;
+
+	// 44100 to 48000 Hz and 88200 to 96000 Hz take the same table, whatever rates the caller passes.
+	coefficient_key make_coefficient_key(wascap::sink::resampler_quality quality, size_t source_samplerate, size_t target_samplerate, bool variable_ratio)
+	{
+		size_t divisor = gcd(source_samplerate, target_samplerate);
+
+		return coefficient_key((size_t)quality, source_samplerate / divisor, target_samplerate / divisor, variable_ratio);
+	}
+
+	std::mutex coefficient_cache_lock;
+	std::map<coefficient_key, std::weak_ptr<const float[]>> coefficient_cache;
+
+	std::shared_ptr<const float[]> make_coefficients(const resampler_profile& profile, size_t phases, size_t half_taps, double cutoff)
+	{
+		size_t taps = half_taps * 2;
+		std::shared_ptr<float[]> coefficients(new float[(phases + 1) * taps]);
+		for (size_t r = 0; r <= phases; ++r) {
+			double fraction = (double)r / (double)phases;
+			float* row = &coefficients[r * taps];
+			double sum = 0.0;
+			for (size_t k = 0; k < taps; ++k) {
+				double coefficient = windowed_sinc(fraction + (double)half_taps - 1.0 - (double)k, cutoff, (double)half_taps, profile.kaiser_beta);
+				row[k] = (float)coefficient;
+				sum += coefficient;
+			}
+			for (size_t k = 0; k < taps; ++k) {
+				row[k] = (float)(row[k] / sum);
+			}
 		}
 
-		return n;
+		return coefficients;
+	}
+
+	std::shared_ptr<const float[]> shared_coefficients(const coefficient_key& key, const resampler_profile& profile, size_t phases, size_t half_taps, double cutoff)
+	{
+		std::lock_guard<std::mutex> lock(coefficient_cache_lock);
+
+		std::shared_ptr<const float[]> coefficients = coefficient_cache[key].lock();
+		if (!coefficients) {
+			// Tables that no converter uses any more are dropped as new ones come in.
+			for (auto i = coefficient_cache.begin(); i != coefficient_cache.end();) {
+				i = i->second.expired() ? coefficient_cache.erase(i) : std::next(i);
+			}
+			coefficients = make_coefficients(profile, phases, half_taps, cutoff);
+			coefficient_cache[key] = coefficients;
+		}
+
+		return coefficients;
 	}
 
 #define NONE MAX_CHANNELS
@@ -61,151 +162,414 @@ size_t wascap::util::unpack_channel_mask(unsigned long* channels, size_t max_cha
 	return n_channels;
 }
 
-wascap::sink::samplerate_convert_sink::samplerate_convert_sink(std::unique_ptr<sink> next, size_t samplerate)
-	: chain_sink(std::move(next), samplerate), m_target_samplerate(this->next().samplerate()), m_source_samplerate(samplerate), m_mappings(nullptr), m_buffer(nullptr), m_frames_in_buffer(0)
+wascap::sink::samplerate_convert_sink::samplerate_convert_sink(std::unique_ptr<sink> next, size_t samplerate, resampler_quality quality)
+	: samplerate_convert_sink(std::move(next), samplerate, quality, false)
+{
+}
+
+wascap::sink::samplerate_convert_sink::samplerate_convert_sink(std::unique_ptr<sink> next, size_t samplerate, resampler_quality quality, bool variable_ratio)
+	: chain_sink(std::move(next), samplerate), m_target_samplerate(this->next().samplerate()), m_source_samplerate(samplerate), m_half_taps(0), m_taps(0), m_phases(0), m_coefficients(nullptr), m_history(nullptr), m_history_capacity(0), m_frames_in_history(0), m_read_index(0), m_phase_denominator(0), m_phase_step(0), m_phase(0), m_max_adjustment(0.0), m_converted(nullptr), m_kernels(dsp::select_kernels(channels()))
 {
 	size_t divisor = gcd(m_target_samplerate, m_source_samplerate);
 	m_source_samplerate /= divisor;
 	m_target_samplerate /= divisor;
-	m_mappings = std::make_unique<lerp[]>(m_target_samplerate);
-	for (size_t i = 0; i < m_target_samplerate; ++i) {
-		float j = (i == 0) ? 0.0f : (i * (m_source_samplerate - 1) / (float)(m_target_samplerate - 1));
-		lerp& mapping(m_mappings[i]);
-		mapping.first_index = (size_t)j;
-		mapping.second_index = mapping.first_index + 1;
-		mapping.second_ratio = j - mapping.first_index;
-		mapping.first_ratio = 1.0f - mapping.second_ratio;
-		if (0.0f == mapping.second_ratio) {
-			mapping.second_index = mapping.first_index;
-		}
+
+	const resampler_profile& profile = resampler_profiles[(size_t)quality];
+
+	// When downsampling, the filter is stretched so that the transition band stays the same relative to the output rate.
+	size_t stretch = (m_source_samplerate + m_target_samplerate - 1) / m_target_samplerate;
+	m_half_taps = profile.half_taps * stretch;
+	m_taps = m_half_taps * 2;
+
+	// The polyphase table is bounded: past max_phases, intermediate phases are interpolated from their neighbours.
+	// A variable ratio can land on any phase, so it always uses the full table.
+	if (variable_ratio) {
+		m_phases = profile.max_phases;
+		m_phase_denominator = VARIABLE_PHASE_DENOMINATOR;
+		m_phase_step = (m_source_samplerate * VARIABLE_PHASE_DENOMINATOR) / m_target_samplerate;
+		m_max_adjustment = DRIFT_MAX_ADJUSTMENT;
+	}
+	else {
+		m_phases = min(m_target_samplerate, profile.max_phases);
+		m_phase_denominator = m_target_samplerate;
+		m_phase_step = m_source_samplerate;
 	}
-	m_buffer = std::make_unique<float[]>(m_source_samplerate * channels());
+
+	double cutoff = 0.5 * profile.rolloff * min(1.0, (double)m_target_samplerate / (double)m_source_samplerate);
+	m_coefficients = shared_coefficients(make_coefficient_key(quality, m_source_samplerate, m_target_samplerate, variable_ratio), profile, m_phases, m_half_taps, cutoff);
 }
 
-void wascap::sink::samplerate_convert_sink::convert(float*& destination, const float*& source)
+void wascap::sink::samplerate_convert_sink::prepare(buffer_pool& pool, size_t max_frames)
 {
+	sink::prepare(pool, max_frames);
+
+	// Between packets, fewer than a filter's worth of frames stay in the history; flushing adds half a filter more.
+	m_history_capacity = max_frames + m_taps + m_half_taps;
+	m_history = pool.allocate(m_history_capacity * channels());
+	reset_history();
+
+	// The most output frames come from a full history at the slowest step the ratio adjustment allows.
+	uint64_t min_phase_step = max((uint64_t)1, (uint64_t)((double)m_source_samplerate * (double)m_phase_denominator * (1.0 - m_max_adjustment) / (double)m_target_samplerate));
+	size_t max_converted_frames = (size_t)(((uint64_t)(m_history_capacity - m_taps + 1) * m_phase_denominator) / min_phase_step) + 1;
+	m_converted = pool.allocate(max_converted_frames * next().channels());
+
+	next().prepare(pool, max_converted_frames);
+}
+
+void wascap::sink::samplerate_convert_sink::reset_history()
+{
+	// Start with half a filter of silence, so that the first output frame is centered on the first input frame.
 	size_t ch = channels();
+	for (size_t c = 0; c < ch; ++c) {
+		memset(&m_history[c * m_history_capacity], 0, (m_half_taps - 1) * sizeof(float));
+	}
+	m_frames_in_history = m_half_taps - 1;
+	m_read_index = 0;
+	m_phase = 0;
+}
 
-	for (size_t i = 0; i < m_target_samplerate; ++i) {
-		lerp& mapping(m_mappings[i]);
+void wascap::sink::samplerate_convert_sink::set_ratio_adjustment(double adjustment)
+{
+	// A positive adjustment consumes input faster, producing fewer output frames.
+	adjustment = max(-m_max_adjustment, min(m_max_adjustment, adjustment));
+	m_phase_step = (uint64_t)((double)m_source_samplerate * (double)m_phase_denominator * (1.0 + adjustment) / (double)m_target_samplerate + 0.5);
+}
+
+bool wascap::sink::samplerate_convert_sink::writable_frames(size_t& frames, DWORD& retry_after_ms) const
+{
+	if (!next().writable_frames(frames, retry_after_ms)) {
+		return false;
+	}
+
+	// convert produces an output frame for each step whose filter fits in the history, so the history may grow until
+	// the step past the last frame that fits would need it.
+	long long fitting = (long long)((((uint64_t)frames * m_phase_step) + m_phase) / m_phase_denominator) + (long long)(m_read_index + m_taps - 1) - (long long)m_frames_in_history;
+	frames = (fitting > 0) ? (size_t)fitting : 0;
+
+	return true;
+}
+
+size_t wascap::sink::samplerate_convert_sink::convert()
+{
+	if (m_read_index + m_taps > m_frames_in_history) {
+		return 0;
+	}
+
+	size_t ch = channels();
+
+	size_t available = m_frames_in_history - m_taps + 1 - m_read_index;
+	size_t frames = (size_t)(((uint64_t)available * m_phase_denominator - 1 - m_phase) / m_phase_step) + 1;
+
+	size_t frame_stride = (frame_layout::planar == layout()) ? 1 : ch;
+	size_t channel_stride = (frame_layout::planar == layout()) ? frames : 1;
+
+	float* destination = m_converted;
+	for (size_t i = 0; i < frames; ++i) {
+		uint64_t position = m_phase * m_phases;
+		const float* row = &m_coefficients[(size_t)(position / m_phase_denominator) * m_taps];
+		uint64_t remainder = position % m_phase_denominator;
+		if (0 == remainder) {
+			for (size_t c = 0; c < ch; ++c) {
+				destination[c * channel_stride] = m_kernels.dot_product(row, &m_history[(c * m_history_capacity) + m_read_index], m_taps);
+			}
+		}
+		else {
+			float second_ratio = (float)remainder / (float)m_phase_denominator;
+			float first_ratio = 1.0f - second_ratio;
+			for (size_t c = 0; c < ch; ++c) {
+				const float* source = &m_history[(c * m_history_capacity) + m_read_index];
+				destination[c * channel_stride] = m_kernels.dot_product(row, source, m_taps) * first_ratio + m_kernels.dot_product(row + m_taps, source, m_taps) * second_ratio;
+			}
+		}
+		destination += frame_stride;
+
+		m_phase += m_phase_step;
+		m_read_index += (size_t)(m_phase / m_phase_denominator);
+		m_phase %= m_phase_denominator;
+	}
+
+	size_t consumed = min(m_read_index, m_frames_in_history);
+	if (consumed > 0) {
 		for (size_t c = 0; c < ch; ++c) {
-			destination[(i * ch) + c] = source[(mapping.first_index * ch) + c] * mapping.first_ratio + source[(mapping.second_index * ch) + c] * mapping.second_ratio;
+			float* history = &m_history[c * m_history_capacity];
+			memmove(history, history + consumed, (m_frames_in_history - consumed) * sizeof(float));
 		}
+		m_frames_in_history -= consumed;
+		m_read_index -= consumed;
 	}
 
-	destination += m_target_samplerate * ch;
-	source += m_source_samplerate * ch;
+	return frames;
 }
 
 bool wascap::sink::samplerate_convert_sink::process(const float* samples, size_t frames)
 {
-	size_t ch = channels();
+	require_frames(frames);
 
-	if (m_frames_in_buffer > 0) {
-		fill_sink_buffer(m_buffer.get(), m_source_samplerate, m_frames_in_buffer, samples, frames, ch);
+	size_t ch = channels();
+	if (frame_layout::planar == layout()) {
+		for (size_t c = 0; c < ch; ++c) {
+			memcpy(&m_history[(c * m_history_capacity) + m_frames_in_history], samples + (c * frames), frames * sizeof(float));
+		}
+	}
+	else {
+		m_kernels.deinterleave(&m_history[m_frames_in_history], samples, frames, m_history_capacity, ch);
 	}
+	m_frames_in_history += frames;
 
-	size_t full_buffers = (m_frames_in_buffer + frames) / m_source_samplerate;
-	if (0 == full_buffers) {
+	size_t converted_frames = convert();
+	if (0 == converted_frames) {
 		return false;
 	}
 
-	size_t n_buffers = full_buffers;
+	return chain_sink::process(m_converted, converted_frames);
+}
 
-	std::unique_ptr<float[]> converted = std::make_unique<float[]>(full_buffers * m_target_samplerate * ch);
-	float* cur_converted = converted.get();
-	if (m_frames_in_buffer) {
-		m_frames_in_buffer = 0;
-		const float* buffer = m_buffer.get();
-		convert(cur_converted, buffer);
-		--n_buffers;
-	}
+void wascap::sink::samplerate_convert_sink::flush()
+{
+	if (m_frames_in_history > m_read_index + m_half_taps - 1) {
+		size_t ch = channels();
 
-	while (n_buffers > 0) {
-		convert(cur_converted, samples);
-		frames -= m_source_samplerate;
-		--n_buffers;
+		// Pad with half a filter of silence, so that the last input frames get their output frames.
+		for (size_t c = 0; c < ch; ++c) {
+			memset(&m_history[(c * m_history_capacity) + m_frames_in_history], 0, m_half_taps * sizeof(float));
+		}
+		m_frames_in_history += m_half_taps;
+
+		size_t converted_frames = convert();
+		if (converted_frames > 0) {
+			next().process(m_converted, converted_frames);
+		}
 	}
+	reset_history();
 
-	fill_sink_buffer(m_buffer.get(), m_source_samplerate, m_frames_in_buffer, samples, frames, ch);
+	chain_sink::flush();
+}
 
-	return chain_sink::process(converted.get(), full_buffers * m_target_samplerate);
+wascap::sink::drift_compensation_sink::drift_compensation_sink(std::unique_ptr<sink> next, size_t samplerate, resampler_quality quality)
+	: samplerate_convert_sink(std::move(next), samplerate, quality, true), m_target_level(0.0), m_filtered_level(0.0), m_integral(0.0), m_adjustment(0.0), m_tracking(false), m_silence(nullptr)
+{
 }
 
-void wascap::sink::samplerate_convert_sink::flush()
+void wascap::sink::drift_compensation_sink::prepare(buffer_pool& pool, size_t max_frames)
 {
-	if (m_frames_in_buffer) {
-		size_t ch = channels();
+	samplerate_convert_sink::prepare(pool, max_frames);
 
-		for (size_t i = m_frames_in_buffer; i < m_source_samplerate; ++i) {
-			for (size_t c = 0; c < ch; ++c) {
-				m_buffer[(i * ch) + c] = 0.0f;
+	m_silence = pool.allocate(next().max_frames() * next().channels());
+}
+
+bool wascap::sink::drift_compensation_sink::process(const float* samples, size_t frames)
+{
+	size_t queued_frames;
+	size_t capacity_frames;
+	if (frames > 0 && next().buffer_level(queued_frames, capacity_frames)) {
+		double output_samplerate = (double)next().samplerate();
+		double level = queued_frames / output_samplerate;
+		double elapsed = frames / (double)samplerate();
+
+		if (!m_tracking) {
+			// Keep the downstream buffer half full, which leaves equal headroom for both clocks to wander.
+			// It is primed with silence so that the loop only has to learn the clock offset.
+			size_t target_frames = capacity_frames / 2;
+			if (queued_frames < target_frames) {
+				for (size_t silent_frames = target_frames - queued_frames; silent_frames > 0; ) {
+					size_t packet_frames = min(silent_frames, next().max_frames());
+					next().process(m_silence, packet_frames);
+					silent_frames -= packet_frames;
+				}
+				level = target_frames / output_samplerate;
 			}
+			m_target_level = target_frames / output_samplerate;
+			m_filtered_level = level;
+			m_tracking = true;
 		}
 
-		std::unique_ptr<float[]> converted = std::make_unique<float[]>(m_target_samplerate * ch);
-		{
-			float* cur_converted = converted.get();
-			const float* buffer = m_buffer.get();
-			convert(cur_converted, buffer);
-		}
+		// The raw level is a sawtooth at the downstream device period, so only its slow component steers the ratio.
+		m_filtered_level += (level - m_filtered_level) * min(1.0, elapsed / DRIFT_LEVEL_SMOOTHING);
 
-		next().process(converted.get(), (m_frames_in_buffer * m_target_samplerate + m_source_samplerate - 1) / m_source_samplerate);
-		m_frames_in_buffer = 0;
+		double error = m_filtered_level - m_target_level;
+		m_integral = max(-DRIFT_MAX_ADJUSTMENT, min(DRIFT_MAX_ADJUSTMENT, m_integral + DRIFT_INTEGRAL_GAIN * error * elapsed));
+		m_adjustment = max(-DRIFT_MAX_ADJUSTMENT, min(DRIFT_MAX_ADJUSTMENT, DRIFT_PROPORTIONAL_GAIN * error + m_integral));
+
+		set_ratio_adjustment(m_adjustment);
 	}
 
-	chain_sink::flush();
+	return samplerate_convert_sink::process(samples, frames);
+}
+
+void wascap::sink::drift_compensation_sink::flush()
+{
+	// The integral term holds the learned clock offset, which stays valid across runs; the level target does not.
+	m_tracking = false;
+
+	samplerate_convert_sink::flush();
 }
 
 wascap::sink::channel_convert_sink::channel_convert_sink(std::unique_ptr<sink> next, DWORD channel_mask)
-	: chain_sink(std::move(next), channel_mask)
+	: channel_convert_sink(std::move(next), channel_mask, std::vector<float>())
 {
-	unsigned long target_channels[MAX_CHANNELS];
-	size_t n_target_channels = util::unpack_channel_mask(target_channels, this->next().channels(), this->next().channel_mask());
+}
 
-	unsigned long source_channels[MAX_CHANNELS];
-	size_t n_source_channels = util::unpack_channel_mask(source_channels, __popcnt(channel_mask), channel_mask);
+wascap::sink::channel_convert_sink::channel_convert_sink(std::unique_ptr<sink> next, DWORD channel_mask, const std::vector<float>& coefficients)
+	: chain_sink(std::move(next), channel_mask), m_source_channels(channels()), m_target_channels(this->next().channels()), m_columns(nullptr), m_kernel(nullptr), m_plane_kernels(dsp::select_kernels(1)), m_converted(nullptr)
+{
+	m_columns = mixing_columns(channel_mask, this->next().channel_mask(), coefficients);
+	m_kernel = mix::select_kernel(m_source_channels, m_target_channels);
+}
 
-	for (size_t i = 0; i < n_target_channels; ++i) {
-		size_t raw_mapping = std::find(source_channels, source_channels + n_source_channels, target_channels[i]) - source_channels;
-		if (raw_mapping == n_source_channels && MAX_CHANNELS != fallback_channels[target_channels[i]]) {
-			raw_mapping = std::find(source_channels, source_channels + n_source_channels, fallback_channels[target_channels[i]]) - source_channels;
-		}
-		if (raw_mapping != n_source_channels) {
-			m_mappings[i * 2] = raw_mapping;
-			m_mappings[(i * 2) + 1] = SIZE_MAX;
-			continue;
+std::unique_ptr<float[]> wascap::sink::channel_convert_sink::mixing_columns(DWORD source_channel_mask, DWORD target_channel_mask, const std::vector<float>& coefficients)
+{
+	size_t n_source_channels = __popcnt(source_channel_mask);
+	size_t n_target_channels = __popcnt(target_channel_mask);
+	size_t stride = mix::column_stride(n_target_channels);
+	std::unique_ptr<float[]> columns = std::make_unique<float[]>(n_source_channels * stride);
+
+	if (coefficients.empty()) {
+		unsigned long target_channels[MAX_CHANNELS];
+		util::unpack_channel_mask(target_channels, n_target_channels, target_channel_mask);
+
+		unsigned long source_channels[MAX_CHANNELS];
+		util::unpack_channel_mask(source_channels, n_source_channels, source_channel_mask);
+
+		auto find_source = [&](unsigned long channel) -> size_t {
+			return (MAX_CHANNELS == channel) ? n_source_channels : (std::find(source_channels, source_channels + n_source_channels, channel) - source_channels);
+		};
+
+		for (size_t i = 0; i < n_target_channels; ++i) {
+			size_t mapping = find_source(target_channels[i]);
+			if (mapping == n_source_channels) {
+				mapping = find_source(fallback_channels[target_channels[i]]);
+			}
+			if (mapping != n_source_channels) {
+				columns[(mapping * stride) + i] = 1.0f;
+				continue;
+			}
+
+			size_t mapping1 = find_source(fallback_channels[MAX_CHANNELS + target_channels[i]]);
+			size_t mapping2 = find_source(fallback_channels[(MAX_CHANNELS * 2) + target_channels[i]]);
+			if (mapping1 != n_source_channels && mapping2 != n_source_channels) {
+				columns[(mapping1 * stride) + i] += 0.5f;
+				columns[(mapping2 * stride) + i] += 0.5f;
+			}
+			else if (mapping1 != n_source_channels) {
+				columns[(mapping1 * stride) + i] = 1.0f;
+			}
+			else if (mapping2 != n_source_channels) {
+				columns[(mapping2 * stride) + i] = 1.0f;
+			}
 		}
-		if (MAX_CHANNELS != fallback_channels[MAX_CHANNELS + target_channels[i]]) {
-			raw_mapping = std::find(source_channels, source_channels + n_source_channels, fallback_channels[MAX_CHANNELS + target_channels[i]]) - source_channels;
+	}
+	else {
+		if (coefficients.size() != n_target_channels * n_source_channels) {
+			throw std::runtime_error(util::string_format("Invalid mixing matrix: %d coefficients for %d target and %d source channels", coefficients.size(), n_target_channels, n_source_channels));
 		}
-		size_t raw_mapping2 = n_source_channels;
-		if (MAX_CHANNELS != fallback_channels[(MAX_CHANNELS * 2) + target_channels[i]]) {
-			raw_mapping2 = std::find(source_channels, source_channels + n_source_channels, fallback_channels[(MAX_CHANNELS * 2) + target_channels[i]]) - source_channels;
+
+		for (size_t t = 0; t < n_target_channels; ++t) {
+			for (size_t s = 0; s < n_source_channels; ++s) {
+				columns[(s * stride) + t] = coefficients[(t * n_source_channels) + s];
+			}
 		}
-		m_mappings[i * 2] = (raw_mapping == n_source_channels) ? SIZE_MAX : raw_mapping;
-		m_mappings[(i * 2) + 1] = (raw_mapping2 == n_source_channels) ? SIZE_MAX : raw_mapping2;
-	}
-	for (size_t i = n_target_channels; i < MAX_CHANNELS; ++i) {
-		m_mappings[i * 2] = SIZE_MAX;
-		m_mappings[(i * 2) + 1] = SIZE_MAX;
 	}
+
+	return columns;
+}
+
+void wascap::sink::channel_convert_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	m_converted = pool.allocate(max_frames * m_target_channels);
+
+	chain_sink::prepare(pool, max_frames);
 }
 
 bool wascap::sink::channel_convert_sink::process(const float* samples, size_t frames)
 {
-	size_t target_channels = next().channels();
-	std::vector<float> resamples;
-	resamples.reserve(frames * target_channels);
-	for (size_t i = 0; i < frames; ++i) {
-		for (size_t c = 0; c < target_channels; ++c) {
-			size_t source_c1 = m_mappings[c * 2];
-			size_t source_c2 = m_mappings[(c * 2) + 1];
-			resamples.push_back((SIZE_MAX == source_c1) ?
-				((SIZE_MAX == source_c2) ? 0.0f : samples[(i * channels()) + source_c2]) :
-				((SIZE_MAX == source_c2) ? samples[(i * channels()) + source_c1] : 0.5f * (samples[(i * channels()) + source_c1] + samples[(i * channels()) + source_c2])));
+	require_frames(frames);
+
+	if (frame_layout::planar == layout()) {
+		size_t stride = mix::column_stride(m_target_channels);
+		for (size_t t = 0; t < m_target_channels; ++t) {
+			float* destination = m_converted + (t * frames);
+			bool has_source = false;
+			for (size_t s = 0; s < m_source_channels; ++s) {
+				const float* coefficient = &m_columns[(s * stride) + t];
+				if (0.0f == *coefficient) {
+					continue;
+				}
+				const float* source = samples + (s * frames);
+				if (has_source) {
+					m_plane_kernels.accumulate(destination, source, frames, coefficient, 1);
+				}
+				else {
+					m_plane_kernels.gain(destination, source, frames, coefficient, 1);
+					has_source = true;
+				}
+			}
+			if (!has_source) {
+				memset(destination, 0, frames * sizeof(float));
+			}
 		}
 	}
+	else {
+		m_kernel(m_converted, samples, frames, m_columns.get(), m_source_channels, m_target_channels);
+	}
+
+	return chain_sink::process(m_converted, frames);
+}
+
+bool wascap::sink::channel_convert_sink::process_silence(size_t frames)
+{
+	return next().process_silence(frames);
+}
+
+wascap::sink::interleave_sink::interleave_sink(std::unique_ptr<sink> next)
+	: chain_sink(std::move(next), frame_layout::planar), m_kernels(dsp::select_kernels(channels())), m_converted(nullptr)
+{
+	this->next().require_layout(frame_layout::interleaved);
+}
+
+void wascap::sink::interleave_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	m_converted = pool.allocate(max_frames * channels());
+
+	chain_sink::prepare(pool, max_frames);
+}
+
+bool wascap::sink::interleave_sink::process(const float* samples, size_t frames)
+{
+	require_frames(frames);
 
-	return chain_sink::process(resamples.data(), frames);
-}
\ No newline at end of file
+	m_kernels.interleave(m_converted, samples, frames, frames, channels());
+
+	return chain_sink::process(m_converted, frames);
+}
+
+bool wascap::sink::interleave_sink::process_silence(size_t frames)
+{
+	return next().process_silence(frames);
+}
+
+wascap::sink::deinterleave_sink::deinterleave_sink(std::unique_ptr<sink> next)
+	: chain_sink(std::move(next), frame_layout::interleaved), m_kernels(dsp::select_kernels(channels())), m_converted(nullptr)
+{
+	this->next().require_layout(frame_layout::planar);
+}
+
+void wascap::sink::deinterleave_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	m_converted = pool.allocate(max_frames * channels());
+
+	chain_sink::prepare(pool, max_frames);
+}
+
+bool wascap::sink::deinterleave_sink::process(const float* samples, size_t frames)
+{
+	require_frames(frames);
+
+	m_kernels.deinterleave(m_converted, samples, frames, frames, channels());
+
+	return chain_sink::process(m_converted, frames);
+}
+
+bool wascap::sink::deinterleave_sink::process_silence(size_t frames)
+{
+	return next().process_silence(frames);
+}
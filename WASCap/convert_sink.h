@@ -1,33 +1,80 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "base_sink.h"
+#include "dsp_kernels.h"
+#include "mix_kernels.h"
 
 namespace wascap
 {
 	namespace sink
 	{
-		class samplerate_convert_sink : public chain_sink
+		enum class resampler_quality
 		{
-			struct lerp
-			{
-				size_t first_index;
-				size_t second_index;
-				float first_ratio;
-				float second_ratio;
-			};
+			fast,
+			medium,
+			high,
+		};
 
+		class samplerate_convert_sink : public chain_sink
+		{
 			size_t m_target_samplerate;
 			size_t m_source_samplerate;
-			std::unique_ptr<lerp[]> m_mappings;
-			std::unique_ptr<float[]> m_buffer;
-			size_t m_frames_in_buffer;
+			size_t m_half_taps;
+			size_t m_taps;
+			size_t m_phases;
+			// Shared with every other converter of the same ratio and quality in the process.
+			std::shared_ptr<const float[]> m_coefficients;
+			float* m_history;
+			size_t m_history_capacity;
+			size_t m_frames_in_history;
+			size_t m_read_index;
+			uint64_t m_phase_denominator;
+			uint64_t m_phase_step;
+			uint64_t m_phase;
+			double m_max_adjustment;
+			float* m_converted;
+			dsp::kernels m_kernels;
+
+			void reset_history();
+			size_t convert();
+
+		protected:
+			samplerate_convert_sink(std::unique_ptr<sink> next, size_t samplerate, resampler_quality quality, bool variable_ratio);
+
+			void set_ratio_adjustment(double adjustment);
+
+		public:
+			samplerate_convert_sink(std::unique_ptr<sink> next, size_t samplerate, resampler_quality quality = resampler_quality::medium);
 
-			void convert(float*& destination, const float*& source);
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			// The input frames whose output fits in the room behind, at the current step, so with the drift adjustment,
+			// less those already in the history that have yet to produce theirs.
+			virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const;
+
+			virtual bool process(const float* samples, size_t frames);
+			virtual void flush();
+		};
+
+		class drift_compensation_sink : public samplerate_convert_sink
+		{
+			double m_target_level;
+			double m_filtered_level;
+			double m_integral;
+			double m_adjustment;
+			bool m_tracking;
+			float* m_silence;
 
 		public:
-			samplerate_convert_sink(std::unique_ptr<sink> next, size_t samplerate);
+			drift_compensation_sink(std::unique_ptr<sink> next, size_t samplerate, resampler_quality quality = resampler_quality::medium);
+
+			inline double adjustment() const { return m_adjustment; }
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
 
 			virtual bool process(const float* samples, size_t frames);
 			virtual void flush();
@@ -35,12 +82,58 @@ namespace wascap
 
 		class channel_convert_sink : public chain_sink
 		{
-			size_t m_mappings[MAX_CHANNELS * 2];
+			size_t m_source_channels;
+			size_t m_target_channels;
+			std::unique_ptr<float[]> m_columns;
+			mix::kernel m_kernel;
+			// Planar blocks are mixed one target plane at a time.
+			dsp::kernels m_plane_kernels;
+			float* m_converted;
 
 		public:
 			channel_convert_sink(std::unique_ptr<sink> next, DWORD channel_mask);
+			// Coefficients are given row by row, one row per target channel and one column per source channel.
+			channel_convert_sink(std::unique_ptr<sink> next, DWORD channel_mask, const std::vector<float>& coefficients);
+
+			// Builds the mixing matrix, one column per source channel, each padded to mix::column_stride.
+			// Without coefficients, each target channel is taken from the matching source channel or its fallbacks.
+			static std::unique_ptr<float[]> mixing_columns(DWORD source_channel_mask, DWORD target_channel_mask, const std::vector<float>& coefficients);
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			virtual bool process(const float* samples, size_t frames);
+			// Any mix of silence is silence.
+			virtual bool process_silence(size_t frames);
+		};
+
+		// Receives planar blocks and passes them on interleaved.
+		class interleave_sink : public chain_sink
+		{
+			dsp::kernels m_kernels;
+			float* m_converted;
+
+		public:
+			interleave_sink(std::unique_ptr<sink> next);
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
+		};
+
+		// Receives interleaved blocks and passes them on planar.
+		class deinterleave_sink : public chain_sink
+		{
+			dsp::kernels m_kernels;
+			float* m_converted;
+
+		public:
+			deinterleave_sink(std::unique_ptr<sink> next);
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
 
 			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
 		};
 	}
 	namespace util
@@ -0,0 +1,167 @@
+#include "stdafx.h"
+
+#include <cstdio>
+
+#include "deadline_sink.h"
+#include "latency_meter.h"
+
+namespace
+{
+	// The stage measured on this thread that the current block spent the longest in at once.
+	thread_local const char* heaviest_stage = nullptr;
+	thread_local volatile wascap::shmctl::shm_stage_stats* heaviest_slot = nullptr;
+	thread_local UINT64 heaviest_time = 0;
+
+	void begin_attribution()
+	{
+		heaviest_stage = nullptr;
+		heaviest_slot = nullptr;
+		heaviest_time = 0;
+	}
+}
+
+void wascap::sink::note_stage_time(const char* stage, volatile shmctl::shm_stage_stats* slot, UINT64 busy_time)
+{
+	if (nullptr == heaviest_stage || busy_time > heaviest_time) {
+		heaviest_stage = stage;
+		heaviest_slot = slot;
+		heaviest_time = busy_time;
+	}
+}
+
+wascap::sink::deadline_sink::deadline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl)
+	: chain_sink(std::move(next)), m_shmctl(shmctl), m_recent(), m_recent_index(0), m_recent_misses(0), m_recent_near_misses(0),
+	m_blocks(0), m_misses(0), m_near_misses(0), m_last_miss_time(0), m_last_miss_duration(0), m_last_miss_stage(nullptr), m_last_report(0), m_reported_misses(0),
+	m_report(), m_report_pending(false), m_stopping(false)
+{
+	m_report_thread = std::thread(&deadline_sink::report_proc, this);
+}
+
+wascap::sink::deadline_sink::~deadline_sink()
+{
+	m_stopping = true;
+	m_report_event.set();
+	m_report_thread.join();
+}
+
+void wascap::sink::deadline_sink::record(size_t frames, UINT64 elapsed)
+{
+	if (0 == frames) {
+		return;
+	}
+
+	UINT64 duration = (UINT64)frames * 10000000 / samplerate();
+	outcome result = outcome::met;
+	if (elapsed > duration) {
+		result = outcome::miss;
+	}
+	else if (elapsed * 100 > duration * DEADLINE_NEAR_MISS_PERCENT) {
+		result = outcome::near_miss;
+	}
+
+	// The block leaving the window makes room for this one.
+	outcome& slot = m_recent[m_recent_index];
+	m_recent_misses -= (outcome::miss == slot) ? 1 : 0;
+	m_recent_near_misses -= (outcome::near_miss == slot) ? 1 : 0;
+	slot = result;
+	m_recent_index = (m_recent_index + 1) % DEADLINE_WINDOW_BLOCKS;
+
+	++m_blocks;
+	if (outcome::miss == result) {
+		++m_misses;
+		++m_recent_misses;
+		m_last_miss_time = elapsed;
+		m_last_miss_duration = duration;
+		m_last_miss_stage = heaviest_stage;
+		if (nullptr != heaviest_slot) {
+			shmctl::count(heaviest_slot->deadline_misses, 1);
+		}
+	}
+	else if (outcome::near_miss == result) {
+		++m_near_misses;
+		++m_recent_near_misses;
+	}
+
+	if (m_shmctl) {
+		volatile shmctl::shm_deadline_stats& stats = (*m_shmctl)->stats.deadline;
+		stats.blocks.store(m_blocks, std::memory_order_relaxed);
+		stats.misses.store(m_misses, std::memory_order_relaxed);
+		stats.near_misses.store(m_near_misses, std::memory_order_relaxed);
+		stats.recent_misses.store(m_recent_misses, std::memory_order_relaxed);
+		stats.recent_near_misses.store(m_recent_near_misses, std::memory_order_relaxed);
+		stats.last_miss_time.store(m_last_miss_time, std::memory_order_relaxed);
+		stats.last_miss_duration.store(m_last_miss_duration, std::memory_order_relaxed);
+	}
+}
+
+void wascap::sink::deadline_sink::report(UINT64 now)
+{
+	if (m_misses == m_reported_misses || now - m_last_report < (UINT64)DEADLINE_REPORT_INTERVAL_MS * 10000 || m_report_pending.load(std::memory_order_acquire)) {
+		return;
+	}
+
+	m_report.recent_misses = m_recent_misses;
+	m_report.recent_near_misses = m_recent_near_misses;
+	m_report.window_blocks = min(m_blocks, (UINT64)DEADLINE_WINDOW_BLOCKS);
+	m_report.misses = m_misses;
+	m_report.near_misses = m_near_misses;
+	m_report.blocks = m_blocks;
+	m_report.last_miss_time = m_last_miss_time;
+	m_report.last_miss_duration = m_last_miss_duration;
+	m_report.last_miss_stage = m_last_miss_stage;
+	m_report_pending.store(true, std::memory_order_release);
+	m_report_event.set();
+
+	m_last_report = now;
+	m_reported_misses = m_misses;
+}
+
+// Writing to stderr may block for as long as whatever reads it, which the thread that processes blocks cannot afford.
+void wascap::sink::deadline_sink::report_proc()
+{
+	for (;;) {
+		m_report_event.wait();
+		if (m_stopping) {
+			break;
+		}
+		if (!m_report_pending.load(std::memory_order_acquire)) {
+			continue;
+		}
+
+		const report_counts& r = m_report;
+		fprintf(stderr, "Deadline missed by %llu of the last %llu blocks, and nearly by %llu (%llu and %llu of %llu in all); the last miss took %.2f ms for %.2f ms, most of it in %s\n",
+			(unsigned long long)r.recent_misses, (unsigned long long)r.window_blocks, (unsigned long long)r.recent_near_misses,
+			(unsigned long long)r.misses, (unsigned long long)r.near_misses, (unsigned long long)r.blocks,
+			(double)r.last_miss_time / 10000.0, (double)r.last_miss_duration / 10000.0, (nullptr != r.last_miss_stage) ? r.last_miss_stage : "no measured stage");
+		m_report_pending.store(false, std::memory_order_release);
+	}
+}
+
+bool wascap::sink::deadline_sink::process(const float* samples, size_t frames)
+{
+	begin_attribution();
+	UINT64 start = capture_clock();
+
+	bool played = chain_sink::process(samples, frames);
+
+	UINT64 end = capture_clock();
+	record(frames, end - start);
+	// After the block, so that handing the report over is not part of its time.
+	report(end);
+
+	return played;
+}
+
+bool wascap::sink::deadline_sink::process_silence(size_t frames)
+{
+	begin_attribution();
+	UINT64 start = capture_clock();
+
+	bool played = next().process_silence(frames);
+
+	UINT64 end = capture_clock();
+	record(frames, end - start);
+	report(end);
+
+	return played;
+}
\ No newline at end of file
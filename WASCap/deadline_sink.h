@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "base_sink.h"
+#include "platform.h"
+#include "shmctl_sink.h"
+#include "thread_helper.h"
+
+// How many of the last blocks the rolling counts cover, about 10 s of 10 ms packets.
+#define DEADLINE_WINDOW_BLOCKS 1024
+// A block that takes longer than this share of its duration without missing it is a near miss.
+#define DEADLINE_NEAR_MISS_PERCENT 80
+#define DEADLINE_REPORT_INTERVAL_MS 1000
+
+namespace wascap
+{
+	namespace sink
+	{
+		// Called by the measured stages with the time a block spent in them alone, so that a miss can be blamed on the
+		// stage that took the longest at once. The slot is null for stages that publish no statistics.
+		void note_stage_time(const char* stage, volatile shmctl::shm_stage_stats* slot, UINT64 busy_time);
+
+		// Compares the time each block takes through the chain behind it with how long the block lasts at the samplerate
+		// of the chain, since the source falls behind once blocks take longer than that. Misses and near misses are counted
+		// in all and over the last DEADLINE_WINDOW_BLOCKS blocks, in the control block when there is one, and reported on
+		// stderr at most every DEADLINE_REPORT_INTERVAL_MS, by a thread of its own rather than the one it measures.
+		class deadline_sink : public chain_sink
+		{
+			enum class outcome : unsigned char
+			{
+				met,
+				near_miss,
+				miss,
+			};
+
+			// The counts a report prints, as they were when it was due.
+			struct report_counts
+			{
+				UINT64 recent_misses;
+				UINT64 recent_near_misses;
+				UINT64 window_blocks;
+				UINT64 misses;
+				UINT64 near_misses;
+				UINT64 blocks;
+				UINT64 last_miss_time;
+				UINT64 last_miss_duration;
+				const char* last_miss_stage;
+			};
+
+			std::shared_ptr<shmctl::shmctl> m_shmctl;
+
+			outcome m_recent[DEADLINE_WINDOW_BLOCKS];
+			size_t m_recent_index;
+			UINT64 m_recent_misses;
+			UINT64 m_recent_near_misses;
+
+			UINT64 m_blocks;
+			UINT64 m_misses;
+			UINT64 m_near_misses;
+			// The last block that missed, in 100 ns units, and the stage it spent the longest in, or null when none measured.
+			UINT64 m_last_miss_time;
+			UINT64 m_last_miss_duration;
+			const char* m_last_miss_stage;
+
+			UINT64 m_last_report;
+			UINT64 m_reported_misses;
+
+			report_counts m_report;
+			// Set while the reporting thread owns m_report, and a report that falls due meanwhile waits for the next block.
+			std::atomic<bool> m_report_pending;
+			bool m_stopping;
+			util::auto_reset_event m_report_event;
+			std::thread m_report_thread;
+
+			void record(size_t frames, UINT64 elapsed);
+			// Hands the counts over to the reporting thread, when a report is due.
+			void report(UINT64 now);
+			void report_proc();
+
+		public:
+			// The control block may be null.
+			deadline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl);
+			~deadline_sink();
+
+			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
+		};
+	}
+}
\ No newline at end of file
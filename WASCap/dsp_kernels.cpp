@@ -0,0 +1,404 @@
+#include "stdafx.h"
+
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#include <cstdint>
+
+#include "base_sink.h"
+#include "channel_layouts.h"
+#include "dsp_kernels.h"
+#include "platform.h"
+
+namespace dsp = wascap::sink::dsp;
+
+using wascap::sink::MAX_CHANNELS;
+
+namespace
+{
+	dsp::instruction_set detect_instruction_set()
+	{
+		int info[4];
+
+		wascap::util::cpuid(info, 0, 0);
+		int max_leaf = info[0];
+		if (max_leaf < 1) {
+			return dsp::instruction_set::scalar;
+		}
+
+		wascap::util::cpuid(info, 1, 0);
+		if ((info[3] & (1 << 26)) == 0) {
+			return dsp::instruction_set::scalar;
+		}
+		if (max_leaf < 7 || (info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) {
+			return dsp::instruction_set::sse2;
+		}
+
+		// The OS must save the YMM registers on context switches, or AVX instructions fault.
+		// AVX-512 additionally needs the opmask and ZMM registers to be saved.
+		unsigned long long xcr0 = wascap::util::xgetbv(0);
+		if ((xcr0 & 0x6) != 0x6) {
+			return dsp::instruction_set::sse2;
+		}
+
+		wascap::util::cpuid(info, 7, 0);
+		if ((info[1] & (1 << 5)) == 0) {
+			return dsp::instruction_set::sse2;
+		}
+		if ((info[1] & (1 << 16)) == 0 || (xcr0 & 0xe6) != 0xe6) {
+			return dsp::instruction_set::avx2;
+		}
+
+		return dsp::instruction_set::avx512;
+	}
+
+	void gain_scalar(float* destination, const float* source, size_t frames, const float* gains, size_t channels)
+	{
+		for (size_t i = 0; i < frames; ++i) {
+			for (size_t c = 0; c < channels; ++c) {
+				destination[(i * channels) + c] = source[(i * channels) + c] * gains[c];
+			}
+		}
+	}
+
+	void accumulate_scalar(float* destination, const float* source, size_t frames, const float* gains, size_t channels)
+	{
+		for (size_t i = 0; i < frames; ++i) {
+			for (size_t c = 0; c < channels; ++c) {
+				destination[(i * channels) + c] += source[(i * channels) + c] * gains[c];
+			}
+		}
+	}
+
+	void peak_scalar(float* max_amplitudes, const float* source, size_t frames, size_t channels)
+	{
+		for (size_t i = 0; i < frames; ++i) {
+			for (size_t c = 0; c < channels; ++c) {
+				float sample = source[(i * channels) + c];
+				if (sample > max_amplitudes[c]) {
+					max_amplitudes[c] = sample;
+				}
+				else if (sample < -max_amplitudes[c]) {
+					max_amplitudes[c] = -sample;
+				}
+			}
+		}
+	}
+
+	// The state is rounded to single precision after every frame, so that it can live in a float between blocks.
+	inline void average_channel(float* destination, const float* source, size_t frames, size_t stride, float& last, double weight)
+	{
+		double rest = 1.0 - weight;
+		float average = last;
+		for (size_t i = 0; i < frames; ++i) {
+			average = (float)(weight * average + rest * source[i * stride]);
+			destination[i * stride] = average;
+		}
+		last = average;
+	}
+
+	void average_scalar(float* destination, const float* source, size_t frames, float* last, double weight, size_t channels)
+	{
+		for (size_t c = 0; c < channels; ++c) {
+			average_channel(destination + c, source + c, frames, channels, last[c], weight);
+		}
+	}
+
+	void interleave_scalar(float* destination, const float* source, size_t frames, size_t plane_stride, size_t channels)
+	{
+		for (size_t c = 0; c < channels; ++c) {
+			const float* plane = source + (c * plane_stride);
+			for (size_t i = 0; i < frames; ++i) {
+				destination[(i * channels) + c] = plane[i];
+			}
+		}
+	}
+
+	void deinterleave_scalar(float* destination, const float* source, size_t frames, size_t plane_stride, size_t channels)
+	{
+		for (size_t c = 0; c < channels; ++c) {
+			float* plane = destination + (c * plane_stride);
+			for (size_t i = 0; i < frames; ++i) {
+				plane[i] = source[(i * channels) + c];
+			}
+		}
+	}
+
+	// Same summation order as the vector kernels: eight running sums, folded pairwise.
+	float dot_product_scalar(const float* a, const float* b, size_t n)
+	{
+		float acc[8] = { 0.0f };
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			for (size_t j = 0; j < 8; ++j) {
+				acc[j] += a[i + j] * b[i + j];
+			}
+		}
+		if (i < n) {
+			for (size_t j = 0; j < 4; ++j) {
+				acc[j] += a[i + j] * b[i + j];
+			}
+		}
+		for (size_t j = 0; j < 4; ++j) {
+			acc[j] += acc[j + 4];
+		}
+		acc[0] += acc[2];
+		acc[1] += acc[3];
+
+		return acc[0] + acc[1];
+	}
+
+	// A block of 4 frames spans as many vectors as there are channels, and each vector always meets the same gains.
+	// CH is 0 for kernels that take the channel count at run time.
+	template<size_t CH, bool ACCUMULATE>
+	void gain_sse2(float* destination, const float* source, size_t frames, const float* gains, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+
+		__m128 pattern[(0 == CH) ? MAX_CHANNELS : CH];
+		for (size_t v = 0; v < ch; ++v) {
+			pattern[v] = _mm_setr_ps(gains[(v * 4) % ch], gains[((v * 4) + 1) % ch], gains[((v * 4) + 2) % ch], gains[((v * 4) + 3) % ch]);
+		}
+
+		size_t i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			const float* s = source + (i * ch);
+			float* d = destination + (i * ch);
+			for (size_t v = 0; v < ch; ++v) {
+				__m128 product = _mm_mul_ps(_mm_loadu_ps(s + (v * 4)), pattern[v]);
+				if constexpr (ACCUMULATE) {
+					product = _mm_add_ps(_mm_loadu_ps(d + (v * 4)), product);
+				}
+				_mm_storeu_ps(d + (v * 4), product);
+			}
+		}
+
+		if constexpr (ACCUMULATE) {
+			accumulate_scalar(destination + (i * ch), source + (i * ch), frames - i, gains, ch);
+		}
+		else {
+			gain_scalar(destination + (i * ch), source + (i * ch), frames - i, gains, ch);
+		}
+	}
+
+	template<size_t CH>
+	void peak_sse2(float* max_amplitudes, const float* source, size_t frames, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+		const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		__m128 acc[(0 == CH) ? MAX_CHANNELS : CH];
+		for (size_t v = 0; v < ch; ++v) {
+			acc[v] = _mm_setzero_ps();
+		}
+
+		size_t i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			const float* s = source + (i * ch);
+			for (size_t v = 0; v < ch; ++v) {
+				// MAXPS returns its second operand when the first is NaN.
+				acc[v] = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(s + (v * 4)), abs_mask), acc[v]);
+			}
+		}
+
+		// Lane l of vector v always holds channel (v * 4 + l) % ch.
+		float lanes[4];
+		for (size_t v = 0; v < ch; ++v) {
+			_mm_storeu_ps(lanes, acc[v]);
+			for (size_t l = 0; l < 4; ++l) {
+				size_t c = ((v * 4) + l) % ch;
+				if (lanes[l] > max_amplitudes[c]) {
+					max_amplitudes[c] = lanes[l];
+				}
+			}
+		}
+
+		peak_scalar(max_amplitudes, source + (i * ch), frames - i, ch);
+	}
+
+	inline __m128d load_pair(const float* source)
+	{
+		return _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*)source)));
+	}
+
+	inline void store_pair(float* destination, __m128 value)
+	{
+		_mm_storel_pi((__m64*)destination, value);
+	}
+
+	// Channels are filtered two by two; the state goes through single precision after every frame, as in the scalar kernel.
+	template<size_t CH>
+	void average_sse2(float* destination, const float* source, size_t frames, float* last, double weight, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+		const size_t pairs = ch / 2;
+		const __m128d w = _mm_set1_pd(weight);
+		const __m128d rest = _mm_set1_pd(1.0 - weight);
+
+		__m128d state[(0 == CH) ? (MAX_CHANNELS / 2) : (CH / 2)];
+		for (size_t p = 0; p < pairs; ++p) {
+			state[p] = load_pair(last + (p * 2));
+		}
+
+		for (size_t i = 0; i < frames; ++i) {
+			const float* s = source + (i * ch);
+			float* d = destination + (i * ch);
+			for (size_t p = 0; p < pairs; ++p) {
+				__m128 average = _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(w, state[p]), _mm_mul_pd(rest, load_pair(s + (p * 2)))));
+				store_pair(d + (p * 2), average);
+				state[p] = _mm_cvtps_pd(average);
+			}
+		}
+
+		for (size_t p = 0; p < pairs; ++p) {
+			store_pair(last + (p * 2), _mm_cvtpd_ps(state[p]));
+		}
+
+		if (0 != (ch % 2)) {
+			average_channel(destination + (ch - 1), source + (ch - 1), frames, ch, last[ch - 1], weight);
+		}
+	}
+
+	void interleave_stereo_sse2(float* destination, const float* source, size_t frames, size_t plane_stride, size_t)
+	{
+		const float* left = source;
+		const float* right = source + plane_stride;
+		size_t i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			__m128 l = _mm_loadu_ps(left + i);
+			__m128 r = _mm_loadu_ps(right + i);
+			_mm_storeu_ps(destination + (i * 2), _mm_unpacklo_ps(l, r));
+			_mm_storeu_ps(destination + (i * 2) + 4, _mm_unpackhi_ps(l, r));
+		}
+		for (; i < frames; ++i) {
+			destination[i * 2] = left[i];
+			destination[(i * 2) + 1] = right[i];
+		}
+	}
+
+	void deinterleave_stereo_sse2(float* destination, const float* source, size_t frames, size_t plane_stride, size_t)
+	{
+		float* left = destination;
+		float* right = destination + plane_stride;
+		size_t i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			__m128 lo = _mm_loadu_ps(source + (i * 2));
+			__m128 hi = _mm_loadu_ps(source + (i * 2) + 4);
+			_mm_storeu_ps(left + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps(right + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+		for (; i < frames; ++i) {
+			left[i] = source[i * 2];
+			right[i] = source[(i * 2) + 1];
+		}
+	}
+
+	void interleave_quad_sse2(float* destination, const float* source, size_t frames, size_t plane_stride, size_t)
+	{
+		size_t i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			__m128 r0 = _mm_loadu_ps(source + i);
+			__m128 r1 = _mm_loadu_ps(source + plane_stride + i);
+			__m128 r2 = _mm_loadu_ps(source + (plane_stride * 2) + i);
+			__m128 r3 = _mm_loadu_ps(source + (plane_stride * 3) + i);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(destination + (i * 4), r0);
+			_mm_storeu_ps(destination + (i * 4) + 4, r1);
+			_mm_storeu_ps(destination + (i * 4) + 8, r2);
+			_mm_storeu_ps(destination + (i * 4) + 12, r3);
+		}
+
+		interleave_scalar(destination + (i * 4), source + i, frames - i, plane_stride, 4);
+	}
+
+	void deinterleave_quad_sse2(float* destination, const float* source, size_t frames, size_t plane_stride, size_t)
+	{
+		size_t i = 0;
+		for (; i + 4 <= frames; i += 4) {
+			__m128 r0 = _mm_loadu_ps(source + (i * 4));
+			__m128 r1 = _mm_loadu_ps(source + (i * 4) + 4);
+			__m128 r2 = _mm_loadu_ps(source + (i * 4) + 8);
+			__m128 r3 = _mm_loadu_ps(source + (i * 4) + 12);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(destination + i, r0);
+			_mm_storeu_ps(destination + plane_stride + i, r1);
+			_mm_storeu_ps(destination + (plane_stride * 2) + i, r2);
+			_mm_storeu_ps(destination + (plane_stride * 3) + i, r3);
+		}
+
+		deinterleave_scalar(destination + i, source + (i * 4), frames - i, plane_stride, 4);
+	}
+
+	float dot_product_sse2(const float* a, const float* b, size_t n)
+	{
+		__m128 acc0 = _mm_setzero_ps();
+		__m128 acc1 = _mm_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+			acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+		}
+		if (i < n) {
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		}
+		acc0 = _mm_add_ps(acc0, acc1);
+		acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+		acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, _MM_SHUFFLE(1, 1, 1, 1)));
+
+		return _mm_cvtss_f32(acc0);
+	}
+
+	const dsp::kernels scalar_kernels = { gain_scalar, accumulate_scalar, peak_scalar, average_scalar, interleave_scalar, deinterleave_scalar, dot_product_scalar };
+
+#define SSE2_GAIN_KERNELS(CH) gain_sse2<CH, false>, gain_sse2<CH, true>, peak_sse2<CH>
+	const dsp::kernels sse2_kernels[CHANNEL_LAYOUTS + 1] = {
+		{ SSE2_GAIN_KERNELS(1), average_scalar, interleave_scalar, deinterleave_scalar, dot_product_sse2 },
+		{ SSE2_GAIN_KERNELS(2), average_sse2<2>, interleave_stereo_sse2, deinterleave_stereo_sse2, dot_product_sse2 },
+		{ SSE2_GAIN_KERNELS(4), average_sse2<4>, interleave_quad_sse2, deinterleave_quad_sse2, dot_product_sse2 },
+		{ SSE2_GAIN_KERNELS(6), average_sse2<6>, interleave_scalar, deinterleave_scalar, dot_product_sse2 },
+		{ SSE2_GAIN_KERNELS(8), average_sse2<8>, interleave_scalar, deinterleave_scalar, dot_product_sse2 },
+		{ SSE2_GAIN_KERNELS(0), average_sse2<0>, interleave_scalar, deinterleave_scalar, dot_product_sse2 },
+	};
+#undef SSE2_GAIN_KERNELS
+}
+
+dsp::instruction_set dsp::supported_instruction_set()
+{
+	static const instruction_set isa = detect_instruction_set();
+
+	return isa;
+}
+
+const char* dsp::instruction_set_name(instruction_set isa)
+{
+	switch (isa) {
+	case instruction_set::scalar:
+		return "scalar";
+	case instruction_set::sse2:
+		return "sse2";
+	case instruction_set::avx2:
+		return "avx2";
+	case instruction_set::avx512:
+		return "avx512";
+	default:
+		return "unknown";
+	}
+}
+
+dsp::kernels dsp::select_kernels(size_t channels)
+{
+	return select_kernels(channels, supported_instruction_set());
+}
+
+dsp::kernels dsp::select_kernels(size_t channels, instruction_set isa)
+{
+	switch (isa) {
+	case instruction_set::avx512:
+		return avx512::select_kernels(channels);
+	case instruction_set::avx2:
+		return avx2::select_kernels(channels);
+	case instruction_set::sse2:
+		return sse2_kernels[layout_or_any_index(channels)];
+	default:
+		return scalar_kernels;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+
+namespace wascap
+{
+	namespace sink
+	{
+		namespace dsp
+		{
+			enum class instruction_set
+			{
+				scalar,
+				sse2,
+				avx2,
+				avx512,
+			};
+
+			// The widest instruction set that both the CPU and the OS support, detected once.
+			instruction_set supported_instruction_set();
+
+			const char* instruction_set_name(instruction_set isa);
+
+			// Kernels work on interleaved frames of the given number of channels; a single plane is a one-channel block.
+			// Every variant gives bit-identical results to the scalar one.
+
+			// destination = source * gains[channel]
+			typedef void (*gain_kernel)(float* destination, const float* source, size_t frames, const float* gains, size_t channels);
+			// Raises max_amplitudes[channel] to the largest absolute value in the channel, ignoring NaNs.
+			typedef void (*peak_kernel)(float* max_amplitudes, const float* source, size_t frames, size_t channels);
+			// One-pole low-pass, evaluated in double precision: last[channel] = weight * last[channel] + (1 - weight) * sample.
+			typedef void (*average_kernel)(float* destination, const float* source, size_t frames, float* last, double weight, size_t channels);
+			// Between interleaved frames and planes laid out plane_stride floats apart.
+			typedef void (*interleave_kernel)(float* destination, const float* source, size_t frames, size_t plane_stride, size_t channels);
+			// Both operands must hold a multiple of 4 floats.
+			typedef float (*dot_product_kernel)(const float* a, const float* b, size_t n);
+
+			struct kernels
+			{
+				gain_kernel gain;
+				// destination += source * gains[channel]
+				gain_kernel accumulate;
+				peak_kernel peak;
+				average_kernel average;
+				// Planes to frames.
+				interleave_kernel interleave;
+				// Frames to planes.
+				interleave_kernel deinterleave;
+				dot_product_kernel dot_product;
+			};
+
+			// Kernels for the given channel count, from the widest supported instruction set.
+			kernels select_kernels(size_t channels);
+			// The instruction set must be supported.
+			kernels select_kernels(size_t channels, instruction_set isa);
+
+			namespace avx2
+			{
+				// Starts from the SSE2 kernels and replaces those that have an AVX2 variant.
+				kernels select_kernels(size_t channels);
+			}
+
+			namespace avx512
+			{
+				// Starts from the AVX2 kernels and replaces those that have an AVX-512 variant.
+				kernels select_kernels(size_t channels);
+			}
+		}
+	}
+}
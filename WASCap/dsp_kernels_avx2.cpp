@@ -0,0 +1,247 @@
+#include "stdafx.h"
+
+#include <immintrin.h>
+#include <cstdint>
+
+#include "base_sink.h"
+#include "channel_layouts.h"
+#include "dsp_kernels.h"
+
+// This file is compiled with AVX2 code generation, and must only be entered after checking CPU support.
+// Multiplies and adds must not be fused, so that results match the narrower kernels bit for bit; elsewhere than
+// with MSVC, -ffp-contract=off says so.
+#ifdef _MSC_VER
+#pragma fp_contract(off)
+#endif
+
+namespace dsp = wascap::sink::dsp;
+
+using wascap::sink::MAX_CHANNELS;
+
+namespace
+{
+	// A block of 8 frames spans as many vectors as there are channels, and each vector always meets the same gains.
+	// CH is 0 for kernels that take the channel count at run time.
+	template<size_t CH, bool ACCUMULATE>
+	void gain_avx2(float* destination, const float* source, size_t frames, const float* gains, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+
+		__m256 pattern[(0 == CH) ? MAX_CHANNELS : CH];
+		for (size_t v = 0; v < ch; ++v) {
+			float lanes[8];
+			for (size_t l = 0; l < 8; ++l) {
+				lanes[l] = gains[((v * 8) + l) % ch];
+			}
+			pattern[v] = _mm256_loadu_ps(lanes);
+		}
+
+		size_t i = 0;
+		for (; i + 8 <= frames; i += 8) {
+			const float* s = source + (i * ch);
+			float* d = destination + (i * ch);
+			for (size_t v = 0; v < ch; ++v) {
+				__m256 product = _mm256_mul_ps(_mm256_loadu_ps(s + (v * 8)), pattern[v]);
+				if constexpr (ACCUMULATE) {
+					product = _mm256_add_ps(_mm256_loadu_ps(d + (v * 8)), product);
+				}
+				_mm256_storeu_ps(d + (v * 8), product);
+			}
+		}
+
+		for (size_t n = i * ch; n < frames * ch; ++n) {
+			if constexpr (ACCUMULATE) {
+				destination[n] += source[n] * gains[n % ch];
+			}
+			else {
+				destination[n] = source[n] * gains[n % ch];
+			}
+		}
+	}
+
+	template<size_t CH>
+	void peak_avx2(float* max_amplitudes, const float* source, size_t frames, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+		const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+		__m256 acc[(0 == CH) ? MAX_CHANNELS : CH];
+		for (size_t v = 0; v < ch; ++v) {
+			acc[v] = _mm256_setzero_ps();
+		}
+
+		size_t i = 0;
+		for (; i + 8 <= frames; i += 8) {
+			const float* s = source + (i * ch);
+			for (size_t v = 0; v < ch; ++v) {
+				// VMAXPS returns its second operand when the first is NaN.
+				acc[v] = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(s + (v * 8)), abs_mask), acc[v]);
+			}
+		}
+
+		// Lane l of vector v always holds channel (v * 8 + l) % ch.
+		float lanes[8];
+		for (size_t v = 0; v < ch; ++v) {
+			_mm256_storeu_ps(lanes, acc[v]);
+			for (size_t l = 0; l < 8; ++l) {
+				size_t c = ((v * 8) + l) % ch;
+				if (lanes[l] > max_amplitudes[c]) {
+					max_amplitudes[c] = lanes[l];
+				}
+			}
+		}
+
+		for (size_t n = i * ch; n < frames * ch; ++n) {
+			float& max_amplitude = max_amplitudes[n % ch];
+			if (source[n] > max_amplitude) {
+				max_amplitude = source[n];
+			}
+			else if (source[n] < -max_amplitude) {
+				max_amplitude = -source[n];
+			}
+		}
+	}
+
+	// Channels are filtered four by four, then two by two, then one by one.
+	// The state goes through single precision after every frame, as in the scalar kernel.
+	template<size_t CH>
+	void average_avx2(float* destination, const float* source, size_t frames, float* last, double weight, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+		const size_t quads = ch / 4;
+		const bool has_pair = (ch % 4) >= 2;
+		const bool has_single = 0 != (ch % 2);
+		const size_t pair = quads * 4;
+		const size_t single = ch - 1;
+		const double rest = 1.0 - weight;
+		const __m256d w4 = _mm256_set1_pd(weight);
+		const __m256d rest4 = _mm256_set1_pd(rest);
+		const __m128d w2 = _mm_set1_pd(weight);
+		const __m128d rest2 = _mm_set1_pd(rest);
+
+		__m256d quad_state[(0 == CH) ? (MAX_CHANNELS / 4) : ((CH >= 4) ? (CH / 4) : 1)];
+		for (size_t q = 0; q < quads; ++q) {
+			quad_state[q] = _mm256_cvtps_pd(_mm_loadu_ps(last + (q * 4)));
+		}
+		__m128d pair_state = _mm_setzero_pd();
+		if (has_pair) {
+			pair_state = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*)(last + pair))));
+		}
+		float single_state = has_single ? last[single] : 0.0f;
+
+		for (size_t i = 0; i < frames; ++i) {
+			const float* s = source + (i * ch);
+			float* d = destination + (i * ch);
+			for (size_t q = 0; q < quads; ++q) {
+				__m128 average = _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(w4, quad_state[q]), _mm256_mul_pd(rest4, _mm256_cvtps_pd(_mm_loadu_ps(s + (q * 4))))));
+				_mm_storeu_ps(d + (q * 4), average);
+				quad_state[q] = _mm256_cvtps_pd(average);
+			}
+			if (has_pair) {
+				__m128d samples = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*)(s + pair))));
+				__m128 average = _mm_cvtpd_ps(_mm_add_pd(_mm_mul_pd(w2, pair_state), _mm_mul_pd(rest2, samples)));
+				_mm_storel_pi((__m64*)(d + pair), average);
+				pair_state = _mm_cvtps_pd(average);
+			}
+			if (has_single) {
+				single_state = (float)(weight * single_state + rest * s[single]);
+				d[single] = single_state;
+			}
+		}
+
+		for (size_t q = 0; q < quads; ++q) {
+			_mm_storeu_ps(last + (q * 4), _mm256_cvtpd_ps(quad_state[q]));
+		}
+		if (has_pair) {
+			_mm_storel_pi((__m64*)(last + pair), _mm_cvtpd_ps(pair_state));
+		}
+		if (has_single) {
+			last[single] = single_state;
+		}
+	}
+
+	void interleave_stereo_avx2(float* destination, const float* source, size_t frames, size_t plane_stride, size_t)
+	{
+		const float* left = source;
+		const float* right = source + plane_stride;
+		size_t i = 0;
+		for (; i + 8 <= frames; i += 8) {
+			__m256 l = _mm256_loadu_ps(left + i);
+			__m256 r = _mm256_loadu_ps(right + i);
+			// Unpacking works within 128-bit lanes, so the halves are swapped back in place afterwards.
+			__m256 lo = _mm256_unpacklo_ps(l, r);
+			__m256 hi = _mm256_unpackhi_ps(l, r);
+			_mm256_storeu_ps(destination + (i * 2), _mm256_permute2f128_ps(lo, hi, 0x20));
+			_mm256_storeu_ps(destination + (i * 2) + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+		}
+		for (; i < frames; ++i) {
+			destination[i * 2] = left[i];
+			destination[(i * 2) + 1] = right[i];
+		}
+	}
+
+	void deinterleave_stereo_avx2(float* destination, const float* source, size_t frames, size_t plane_stride, size_t)
+	{
+		float* left = destination;
+		float* right = destination + plane_stride;
+		size_t i = 0;
+		for (; i + 8 <= frames; i += 8) {
+			__m256 a = _mm256_loadu_ps(source + (i * 2));
+			__m256 b = _mm256_loadu_ps(source + (i * 2) + 8);
+			__m256 lo = _mm256_permute2f128_ps(a, b, 0x20);
+			__m256 hi = _mm256_permute2f128_ps(a, b, 0x31);
+			_mm256_storeu_ps(left + i, _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm256_storeu_ps(right + i, _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+		for (; i < frames; ++i) {
+			left[i] = source[i * 2];
+			right[i] = source[(i * 2) + 1];
+		}
+	}
+
+	// One 8-lane sum is the pair of 4-lane sums of the SSE2 kernel, so both fold in the same order.
+	float dot_product_avx2(const float* a, const float* b, size_t n)
+	{
+		__m256 acc = _mm256_setzero_ps();
+		size_t i = 0;
+		for (; i + 8 <= n; i += 8) {
+			acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		}
+		__m128 acc0 = _mm256_castps256_ps128(acc);
+		__m128 acc1 = _mm256_extractf128_ps(acc, 1);
+		if (i < n) {
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		}
+		acc0 = _mm_add_ps(acc0, acc1);
+		acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+		acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, _MM_SHUFFLE(1, 1, 1, 1)));
+
+		return _mm_cvtss_f32(acc0);
+	}
+
+	const dsp::gain_kernel gain_kernels[CHANNEL_LAYOUTS + 1] = { gain_avx2<1, false>, gain_avx2<2, false>, gain_avx2<4, false>, gain_avx2<6, false>, gain_avx2<8, false>, gain_avx2<0, false> };
+	const dsp::gain_kernel accumulate_kernels[CHANNEL_LAYOUTS + 1] = { gain_avx2<1, true>, gain_avx2<2, true>, gain_avx2<4, true>, gain_avx2<6, true>, gain_avx2<8, true>, gain_avx2<0, true> };
+	const dsp::peak_kernel peak_kernels[CHANNEL_LAYOUTS + 1] = { peak_avx2<1>, peak_avx2<2>, peak_avx2<4>, peak_avx2<6>, peak_avx2<8>, peak_avx2<0> };
+	// Mono and stereo have no more than one pair of channels to filter, and keep the SSE2 kernels.
+	const dsp::average_kernel average_kernels[CHANNEL_LAYOUTS + 1] = { nullptr, nullptr, average_avx2<4>, average_avx2<6>, average_avx2<8>, average_avx2<0> };
+}
+
+dsp::kernels dsp::avx2::select_kernels(size_t channels)
+{
+	kernels k = dsp::select_kernels(channels, instruction_set::sse2);
+
+	size_t index = layout_or_any_index(channels);
+	k.gain = gain_kernels[index];
+	k.accumulate = accumulate_kernels[index];
+	k.peak = peak_kernels[index];
+	if (nullptr != average_kernels[index]) {
+		k.average = average_kernels[index];
+	}
+	if (2 == channels) {
+		k.interleave = interleave_stereo_avx2;
+		k.deinterleave = deinterleave_stereo_avx2;
+	}
+	k.dot_product = dot_product_avx2;
+
+	return k;
+}
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+
+#include <immintrin.h>
+#include <cstdint>
+
+#include "base_sink.h"
+#include "channel_layouts.h"
+#include "dsp_kernels.h"
+
+// This file is compiled with AVX-512 code generation, and must only be entered after checking CPU support.
+// Only the kernels that stream through whole blocks gain from the wider vectors; the others stay on AVX2.
+// Multiplies and adds must not be fused, so that results match the narrower kernels bit for bit.
+#ifdef _MSC_VER
+#pragma fp_contract(off)
+#endif
+
+namespace dsp = wascap::sink::dsp;
+
+using wascap::sink::MAX_CHANNELS;
+
+namespace
+{
+	// A block of 16 frames spans as many vectors as there are channels, and each vector always meets the same gains.
+	// CH is 0 for kernels that take the channel count at run time.
+	template<size_t CH, bool ACCUMULATE>
+	void gain_avx512(float* destination, const float* source, size_t frames, const float* gains, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+
+		__m512 pattern[(0 == CH) ? MAX_CHANNELS : CH];
+		for (size_t v = 0; v < ch; ++v) {
+			float lanes[16];
+			for (size_t l = 0; l < 16; ++l) {
+				lanes[l] = gains[((v * 16) + l) % ch];
+			}
+			pattern[v] = _mm512_loadu_ps(lanes);
+		}
+
+		size_t i = 0;
+		for (; i + 16 <= frames; i += 16) {
+			const float* s = source + (i * ch);
+			float* d = destination + (i * ch);
+			for (size_t v = 0; v < ch; ++v) {
+				__m512 product = _mm512_mul_ps(_mm512_loadu_ps(s + (v * 16)), pattern[v]);
+				if constexpr (ACCUMULATE) {
+					product = _mm512_add_ps(_mm512_loadu_ps(d + (v * 16)), product);
+				}
+				_mm512_storeu_ps(d + (v * 16), product);
+			}
+		}
+
+		for (size_t n = i * ch; n < frames * ch; ++n) {
+			if constexpr (ACCUMULATE) {
+				destination[n] += source[n] * gains[n % ch];
+			}
+			else {
+				destination[n] = source[n] * gains[n % ch];
+			}
+		}
+	}
+
+	template<size_t CH>
+	void peak_avx512(float* max_amplitudes, const float* source, size_t frames, size_t channels)
+	{
+		const size_t ch = (0 == CH) ? channels : CH;
+
+		__m512 acc[(0 == CH) ? MAX_CHANNELS : CH];
+		for (size_t v = 0; v < ch; ++v) {
+			acc[v] = _mm512_setzero_ps();
+		}
+
+		size_t i = 0;
+		for (; i + 16 <= frames; i += 16) {
+			const float* s = source + (i * ch);
+			for (size_t v = 0; v < ch; ++v) {
+				// VMAXPS returns its second operand when the first is NaN.
+				acc[v] = _mm512_max_ps(_mm512_abs_ps(_mm512_loadu_ps(s + (v * 16))), acc[v]);
+			}
+		}
+
+		// Lane l of vector v always holds channel (v * 16 + l) % ch.
+		float lanes[16];
+		for (size_t v = 0; v < ch; ++v) {
+			_mm512_storeu_ps(lanes, acc[v]);
+			for (size_t l = 0; l < 16; ++l) {
+				size_t c = ((v * 16) + l) % ch;
+				if (lanes[l] > max_amplitudes[c]) {
+					max_amplitudes[c] = lanes[l];
+				}
+			}
+		}
+
+		for (size_t n = i * ch; n < frames * ch; ++n) {
+			float& max_amplitude = max_amplitudes[n % ch];
+			if (source[n] > max_amplitude) {
+				max_amplitude = source[n];
+			}
+			else if (source[n] < -max_amplitude) {
+				max_amplitude = -source[n];
+			}
+		}
+	}
+
+	const dsp::gain_kernel gain_kernels[CHANNEL_LAYOUTS + 1] = { gain_avx512<1, false>, gain_avx512<2, false>, gain_avx512<4, false>, gain_avx512<6, false>, gain_avx512<8, false>, gain_avx512<0, false> };
+	const dsp::gain_kernel accumulate_kernels[CHANNEL_LAYOUTS + 1] = { gain_avx512<1, true>, gain_avx512<2, true>, gain_avx512<4, true>, gain_avx512<6, true>, gain_avx512<8, true>, gain_avx512<0, true> };
+	const dsp::peak_kernel peak_kernels[CHANNEL_LAYOUTS + 1] = { peak_avx512<1>, peak_avx512<2>, peak_avx512<4>, peak_avx512<6>, peak_avx512<8>, peak_avx512<0> };
+}
+
+dsp::kernels dsp::avx512::select_kernels(size_t channels)
+{
+	kernels k = dsp::select_kernels(channels, instruction_set::avx2);
+
+	size_t index = layout_or_any_index(channels);
+	k.gain = gain_kernels[index];
+	k.accumulate = accumulate_kernels[index];
+	k.peak = peak_kernels[index];
+
+	return k;
+}
@@ -1,19 +1,24 @@
 #pragma once
 
 #include <system_error>
+
+#ifdef _WIN32
 #include <Windows.h>
 
 #define WIN32_CHECK(win32_op) (::wascap::util::win32_check((win32_op), #win32_op))
+#define COM_CHECK(com_op) (::wascap::util::com_check((com_op), #com_op))
+#else
+#include <cerrno>
+#endif
 
 #define WSA_CHECK(wsa_op) (::wascap::util::wsa_check((wsa_op), #wsa_op))
 #define WSA_CHECK_U(wsa_op) (::wascap::util::wsa_check_u((wsa_op), #wsa_op))
 
-#define COM_CHECK(com_op) (::wascap::util::com_check((com_op), #com_op))
-
 namespace wascap
 {
 	namespace util
 	{
+#ifdef _WIN32
 		const std::error_category& win32_category() noexcept;
 		std::error_code win32_last_error() noexcept;
 		std::error_code wsa_last_error() noexcept;
@@ -30,6 +35,15 @@ namespace wascap
 
 			return retval;
 		}
+#else
+		typedef int INT;
+
+		// Sockets report their errors in errno.
+		inline std::error_code wsa_last_error() noexcept
+		{
+			return std::error_code(errno, std::generic_category());
+		}
+#endif
 
 		inline void wsa_check(INT retval, const char* op)
 		{
@@ -47,6 +61,7 @@ namespace wascap
 			return retval;
 		}
 
+#ifdef _WIN32
 		inline HRESULT com_check(HRESULT hr, const char* op)
 		{
 			if (FAILED(hr)) {
@@ -55,5 +70,6 @@ namespace wascap
 
 			return hr;
 		}
+#endif
 	}
 }
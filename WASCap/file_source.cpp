@@ -0,0 +1,420 @@
+#include "stdafx.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include "errors.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "file_source.h"
+#include "string_format.h"
+
+// Packets of 10 ms, like a shared-mode capture device gives.
+#define FILE_SOURCE_PACKETS_PER_SECOND 100
+// Played frames of the mapping are given back in steps of this many bytes, a multiple of the page size,
+// so that a long file does not end up resident as a whole.
+#define FILE_SOURCE_RELEASE_BYTES (1 << 20)
+
+#define WAVE_FORMAT_TAG_PCM 0x0001
+#define WAVE_FORMAT_TAG_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_TAG_EXTENSIBLE 0xFFFE
+
+namespace
+{
+	// The speakers a WAV file without a channel mask stands for, by channel count.
+	DWORD default_channel_mask(size_t channels)
+	{
+		switch (channels) {
+		case 1:
+			return 0x4;
+		case 2:
+			return 0x3;
+		case 4:
+			return 0x33;
+		case 6:
+			return 0x3f;
+		case 8:
+			return 0x63f;
+		default:
+			return (channels >= 32) ? 0xffffffff : (((DWORD)1 << channels) - 1);
+		}
+	}
+
+	inline UINT32 read_u16(const unsigned char* p)
+	{
+		return (UINT32)p[0] | ((UINT32)p[1] << 8);
+	}
+
+	inline UINT32 read_u32(const unsigned char* p)
+	{
+		return (UINT32)p[0] | ((UINT32)p[1] << 8) | ((UINT32)p[2] << 16) | ((UINT32)p[3] << 24);
+	}
+}
+
+wascap::source::file_source::file_source(const std::string& path, size_t samplerate, DWORD channel_mask, bool real_time)
+	: m_samplerate(samplerate), m_channel_mask(channel_mask), m_channels(__popcnt(channel_mask)), m_format(sample_format::float32), m_packet_frames(0), m_real_time(real_time),
+	m_mapping(nullptr), m_mapping_size(0), m_stream(nullptr), m_read_offset(0), m_data_end(SIZE_MAX), m_released_offset(0),
+	m_packet_samples(nullptr), m_packet_size(0), m_position(0), m_packet_offset(0), m_start_ms(0), m_capturing(false), m_shall_flush(false)
+{
+	open(path);
+	try {
+		if (0 == samplerate) {
+			parse_wav_header();
+		}
+		if (0 == m_samplerate || 0 == m_channel_mask) {
+			throw std::invalid_argument("File source without frames");
+		}
+
+		m_packet_frames = max(1, m_samplerate / FILE_SOURCE_PACKETS_PER_SECOND);
+		size_t sample_bytes = (sample_format::float32 == m_format) ? sizeof(float) : sizeof(short);
+		m_raw_packet = std::make_unique<unsigned char[]>(m_packet_frames * m_channels * sample_bytes);
+		m_packet = std::make_unique<float[]>(m_packet_frames * m_channels);
+	}
+	catch (...) {
+		close();
+		throw;
+	}
+}
+
+wascap::source::file_source::~file_source()
+{
+	close();
+}
+
+void wascap::source::file_source::open(const std::string& path)
+{
+	if (path == "-") {
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		m_stream = stdin;
+		return;
+	}
+
+#ifdef _WIN32
+	// The view keeps the file mapped once the handles are closed.
+	HANDLE hfile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (INVALID_HANDLE_VALUE == hfile) {
+		throw std::system_error(util::win32_last_error(), "CreateFileA");
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hfile, &size)) {
+		std::error_code error = util::win32_last_error();
+		CloseHandle(hfile);
+		throw std::system_error(error, "GetFileSizeEx");
+	}
+	m_mapping_size = (size_t)size.QuadPart;
+	if (m_mapping_size > 0) {
+		HANDLE hmapping = CreateFileMappingA(hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (nullptr != hmapping) {
+			m_mapping = (const unsigned char*)MapViewOfFile(hmapping, FILE_MAP_READ, 0, 0, 0);
+		}
+		std::error_code error = util::win32_last_error();
+		if (nullptr != hmapping) {
+			CloseHandle(hmapping);
+		}
+		CloseHandle(hfile);
+		if (nullptr == m_mapping) {
+			throw std::system_error(error, "MapViewOfFile");
+		}
+	}
+	else {
+		CloseHandle(hfile);
+	}
+#else
+	// The mapping outlives the descriptor.
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::system_error(errno, std::generic_category(), util::string_format("Cannot open %s", path));
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int error = errno;
+		::close(fd);
+		throw std::system_error(error, std::generic_category(), "fstat");
+	}
+	m_mapping_size = (size_t)st.st_size;
+	if (m_mapping_size > 0) {
+		void* mapping = mmap(nullptr, m_mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		int error = errno;
+		::close(fd);
+		if (MAP_FAILED == mapping) {
+			throw std::system_error(error, std::generic_category(), "mmap");
+		}
+		madvise(mapping, m_mapping_size, MADV_SEQUENTIAL);
+		m_mapping = (const unsigned char*)mapping;
+	}
+	else {
+		::close(fd);
+	}
+#endif
+	m_data_end = m_mapping_size;
+}
+
+void wascap::source::file_source::close()
+{
+	if (nullptr != m_mapping) {
+#ifdef _WIN32
+		UnmapViewOfFile(m_mapping);
+#else
+		munmap((void*)m_mapping, m_mapping_size);
+#endif
+		m_mapping = nullptr;
+	}
+	m_stream = nullptr;
+}
+
+size_t wascap::source::file_source::read(void* buffer, size_t bytes)
+{
+	size_t available = (m_data_end > m_read_offset) ? (m_data_end - m_read_offset) : 0;
+	bytes = min(bytes, available);
+
+	if (nullptr != m_stream) {
+		bytes = fread(buffer, 1, bytes, m_stream);
+	}
+	else {
+		memcpy(buffer, m_mapping + m_read_offset, bytes);
+	}
+	m_read_offset += bytes;
+
+	return bytes;
+}
+
+void wascap::source::file_source::parse_wav_header()
+{
+	unsigned char header[40];
+	if (read(header, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+		throw std::runtime_error("Not a WAV file");
+	}
+
+	bool has_format = false;
+	UINT32 format_tag = 0;
+	UINT32 bits_per_sample = 0;
+	for (;;) {
+		if (read(header, 8) != 8) {
+			throw std::runtime_error("WAV file without data");
+		}
+		UINT32 chunk_size = read_u32(header + 4);
+
+		if (0 == memcmp(header, "data", 4)) {
+			if (!has_format) {
+				throw std::runtime_error("WAV data ahead of its format");
+			}
+			// Streams that could not seek back to write the size leave it at 0 or all ones.
+			if (0 != chunk_size && 0xffffffff != chunk_size) {
+				m_data_end = min(m_data_end, m_read_offset + chunk_size);
+			}
+			break;
+		}
+
+		size_t skip = chunk_size + (chunk_size & 1);
+		if (0 == memcmp(header, "fmt ", 4)) {
+			if (chunk_size < 16) {
+				throw std::runtime_error("Truncated WAV format");
+			}
+			size_t format_bytes = min(chunk_size, sizeof(header));
+			if (read(header, format_bytes) != format_bytes) {
+				throw std::runtime_error("Truncated WAV format");
+			}
+			skip -= format_bytes;
+
+			format_tag = read_u16(header);
+			m_channels = read_u16(header + 2);
+			m_samplerate = read_u32(header + 4);
+			bits_per_sample = read_u16(header + 14);
+			m_channel_mask = default_channel_mask(m_channels);
+			if (WAVE_FORMAT_TAG_EXTENSIBLE == format_tag && format_bytes >= 40) {
+				m_channel_mask = read_u32(header + 20);
+				// The sub-format GUIDs of PCM and IEEE float start with their format tag.
+				format_tag = read_u16(header + 24);
+			}
+			has_format = true;
+		}
+
+		while (skip > 0) {
+			unsigned char discard[256];
+			size_t bytes = read(discard, min(skip, sizeof(discard)));
+			if (0 == bytes) {
+				throw std::runtime_error("Truncated WAV file");
+			}
+			skip -= bytes;
+		}
+	}
+
+	if (WAVE_FORMAT_TAG_IEEE_FLOAT == format_tag && 32 == bits_per_sample) {
+		m_format = sample_format::float32;
+	}
+	else if (WAVE_FORMAT_TAG_PCM == format_tag && 16 == bits_per_sample) {
+		m_format = sample_format::int16;
+	}
+	else {
+		throw std::runtime_error(util::string_format("Unsupported WAV format %u with %u bits per sample", format_tag, bits_per_sample));
+	}
+	if (__popcnt(m_channel_mask) != m_channels) {
+		throw std::runtime_error(util::string_format("WAV channel mask 0x%x does not match %zu channels", m_channel_mask, m_channels));
+	}
+}
+
+size_t wascap::source::file_source::next_packet()
+{
+	size_t sample_bytes = (sample_format::float32 == m_format) ? sizeof(float) : sizeof(short);
+	size_t frame_bytes = m_channels * sample_bytes;
+
+	const unsigned char* raw;
+	size_t frames;
+	if (nullptr != m_stream) {
+		size_t bytes = 0;
+		size_t wanted = m_packet_frames * frame_bytes;
+		while (bytes < wanted) {
+			size_t read_bytes = read(m_raw_packet.get() + bytes, wanted - bytes);
+			if (0 == read_bytes) {
+				break;
+			}
+			bytes += read_bytes;
+		}
+		// A frame cut short by the end of the input is dropped.
+		raw = m_raw_packet.get();
+		frames = bytes / frame_bytes;
+	}
+	else {
+		// The packets before this one are played, and the pages behind them can be read again from the file if need be.
+		size_t release_end = (m_read_offset / FILE_SOURCE_RELEASE_BYTES) * FILE_SOURCE_RELEASE_BYTES;
+		if (release_end > m_released_offset) {
+#ifdef _WIN32
+			// Unlocking pages that are not locked takes them out of the working set, and fails for that reason.
+			VirtualUnlock((LPVOID)(m_mapping + m_released_offset), release_end - m_released_offset);
+#else
+			madvise((void*)(m_mapping + m_released_offset), release_end - m_released_offset, MADV_DONTNEED);
+#endif
+			m_released_offset = release_end;
+		}
+
+		size_t available = (m_data_end > m_read_offset) ? (m_data_end - m_read_offset) : 0;
+		raw = m_mapping + m_read_offset;
+		frames = min(m_packet_frames, available / frame_bytes);
+		m_read_offset += frames * frame_bytes;
+	}
+
+	if (sample_format::int16 == m_format) {
+		for (size_t i = 0; i < frames * m_channels; ++i) {
+			m_packet[i] = (float)(short)read_u16(raw + (i * sizeof(short))) / 32768.0f;
+		}
+		m_packet_samples = m_packet.get();
+	}
+	else if (nullptr == m_stream && 0 == ((uintptr_t)raw % alignof(float))) {
+		// Floats that sit aligned in the mapping go to the sink where they are.
+		m_packet_samples = (const float*)raw;
+	}
+	else {
+		memcpy(m_packet.get(), raw, frames * frame_bytes);
+		m_packet_samples = m_packet.get();
+	}
+	m_packet_size = frames;
+
+	return frames;
+}
+
+size_t wascap::source::file_source::samplerate() const
+{
+	return m_samplerate;
+}
+
+DWORD wascap::source::file_source::channel_mask() const
+{
+	return m_channel_mask;
+}
+
+size_t wascap::source::file_source::max_packet_frames() const
+{
+	return m_packet_frames;
+}
+
+DWORD wascap::source::file_source::poll_interval_ms() const
+{
+	return m_real_time ? (DWORD)(1000 / FILE_SOURCE_PACKETS_PER_SECOND) : 0;
+}
+
+bool wascap::source::file_source::is_capturing() const
+{
+	return m_capturing;
+}
+
+void wascap::source::file_source::start(sink::sink& sink)
+{
+	if (sink.samplerate() != m_samplerate || sink.channel_mask() != m_channel_mask || sink.layout() != sink::frame_layout::interleaved) {
+		throw std::runtime_error("Incompatible sink");
+	}
+
+	m_start_ms = GetTickCount64() - ((ULONGLONG)m_position * 1000 / m_samplerate);
+	m_capturing = true;
+	m_shall_flush = false;
+}
+
+bool wascap::source::file_source::poll(sink::sink& sink, size_t& stop_after_frames, DWORD& wait_ms)
+{
+	if (!sink.is_open() || !sink.is_playing() || 0 == stop_after_frames) {
+		return false;
+	}
+
+	if (0 == m_packet_offset && 0 == next_packet()) {
+		return false;
+	}
+
+	sink::block_info info;
+	info.capture_time = 0;
+	info.stream_position = m_position + m_packet_offset;
+	info.discontinuity = false;
+	info.silent = false;
+
+	size_t frames = min(m_packet_size - m_packet_offset, stop_after_frames);
+	sink::process_result result = sink.try_process(m_packet_samples + (m_packet_offset * m_channels), frames, info);
+	if (result.played) {
+		m_shall_flush = true;
+	}
+	m_packet_offset += result.consumed_frames;
+	stop_after_frames -= result.consumed_frames;
+	if (m_packet_offset == m_packet_size) {
+		m_position += m_packet_size;
+		m_packet_offset = 0;
+	}
+
+	if (result.would_block) {
+		wait_ms = max(1, result.retry_after_ms);
+	}
+	else if (m_real_time) {
+		// Waits until the frames given so far have had time to play.
+		ULONGLONG due_ms = m_start_ms + ((ULONGLONG)m_position * 1000 / m_samplerate);
+		ULONGLONG now_ms = GetTickCount64();
+		wait_ms = (due_ms > now_ms) ? (DWORD)(due_ms - now_ms) : 0;
+	}
+	else {
+		wait_ms = 0;
+	}
+
+	return true;
+}
+
+void wascap::source::file_source::stop(sink::sink& sink)
+{
+	m_capturing = false;
+
+	if (m_shall_flush) {
+		sink.flush();
+	}
+}
+
+void wascap::source::file_source::abort()
+{
+	m_capturing = false;
+}
\ No newline at end of file
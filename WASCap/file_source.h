@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "base_sink.h"
+#include "source.h"
+
+namespace wascap
+{
+	namespace source
+	{
+		// Plays frames from a file, mapped into memory, or from standard input when the path is "-".
+		// The frames are either raw 32-bit floats in a format given by the caller, or a WAV file of 32-bit floats or 16-bit integers.
+		// In real time, packets go out at the pace of the samplerate; otherwise as fast as the sink takes them.
+		class file_source : public source
+		{
+			enum class sample_format
+			{
+				float32,
+				int16,
+			};
+
+			size_t m_samplerate;
+			DWORD m_channel_mask;
+			size_t m_channels;
+			sample_format m_format;
+			size_t m_packet_frames;
+			bool m_real_time;
+
+			// The mapped file, or null when reading from standard input.
+			const unsigned char* m_mapping;
+			size_t m_mapping_size;
+			std::FILE* m_stream;
+
+			// Bytes read so far, and where the frames end, or SIZE_MAX when they run to the end of the input.
+			size_t m_read_offset;
+			size_t m_data_end;
+			// Where the mapped bytes the process still holds start; those before it were played and given back.
+			size_t m_released_offset;
+
+			// Frames decoded for the sink when they cannot be passed straight from the mapping.
+			std::unique_ptr<unsigned char[]> m_raw_packet;
+			std::unique_ptr<float[]> m_packet;
+			const float* m_packet_samples;
+			size_t m_packet_size;
+
+			// Frames given so far, including the packet the sink has not finished taking.
+			size_t m_position;
+			size_t m_packet_offset;
+			ULONGLONG m_start_ms;
+			bool m_capturing;
+			bool m_shall_flush;
+
+			void open(const std::string& path);
+			void close();
+			size_t read(void* buffer, size_t bytes);
+			void parse_wav_header();
+			// Makes the next packet ready, and returns its size in frames, or 0 at the end of the input.
+			size_t next_packet();
+
+		public:
+			// Reads a WAV file when samplerate is 0, and raw floats in the given format otherwise.
+			file_source(const std::string& path, size_t samplerate, DWORD channel_mask, bool real_time);
+			virtual ~file_source();
+
+			// Frames given so far.
+			inline size_t position() const { return m_position; }
+
+			virtual size_t samplerate() const;
+			virtual DWORD channel_mask() const;
+
+			virtual size_t max_packet_frames() const;
+			virtual DWORD poll_interval_ms() const;
+
+			virtual bool is_capturing() const;
+
+			virtual void start(sink::sink& sink);
+			// Gives at most one packet. Returns false at the end of the input as well.
+			virtual bool poll(sink::sink& sink, size_t& stop_after_frames, DWORD& wait_ms);
+			virtual void stop(sink::sink& sink);
+			virtual void abort();
+		};
+	}
+}
\ No newline at end of file
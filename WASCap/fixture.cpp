@@ -0,0 +1,102 @@
+#include "stdafx.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "fixture.h"
+#include "string_format.h"
+
+wascap::fixture::control_block::control_block(size_t tap_bytes)
+	: m_memory(std::make_unique<char[]>(sizeof(shmctl::shm_contents) + tap_bytes)), m_shmctl(std::make_shared<shmctl::shmctl>((volatile shmctl::shm_contents*)m_memory.get()))
+{
+	volatile shmctl::shm_contents* shmblock = m_shmctl->get();
+	shmblock->flags = SHMCTL_FLAG_INITIALIZED | SHMCTL_FLAG_ENABLED;
+	shmblock->tap_offset = sizeof(shmctl::shm_contents);
+	shmblock->tap_write_cursor = 0;
+	shmblock->tap_capacity = (int)tap_bytes;
+	shmblock->master_volume = 0.5f;
+	for (size_t c = 0; c < sink::MAX_CHANNELS; ++c) {
+		shmblock->channel_volumes[c] = 1.0f;
+	}
+	shmblock->saturation_threshold = 1.0f;
+	shmblock->silence_threshold = 0.0f;
+	shmblock->averaging_weight = 0.5f;
+	shmblock->saturation_debounce_factor = 2.0f;
+	shmblock->saturation_recovery_factor = 1.001f;
+	shmblock->saturation_debounce_volume = 1.0f;
+	shmblock->saturation_effective_volume = 1.0f;
+}
+
+wascap::fixture::pseudo_random::pseudo_random()
+	: m_state(1)
+{
+}
+
+unsigned int wascap::fixture::pseudo_random::next()
+{
+	m_state = m_state * 1103515245 + 12345;
+
+	return m_state;
+}
+
+float wascap::fixture::pseudo_random::next_sample()
+{
+	return ((float)((next() >> 8) & 0xffff) / 32768.0f) - 1.0f;
+}
+
+size_t wascap::fixture::pseudo_random::next_frames(size_t max_frames)
+{
+	return 1 + ((next() >> 16) % max_frames);
+}
+
+wascap::fixture::result_table::result_table(const char* header)
+	: m_failures(0)
+{
+	printf("%s\n", header);
+}
+
+void wascap::fixture::result_table::row(bool passed, const std::string& line)
+{
+	printf("%s\n", line.c_str());
+	if (!passed) {
+		++m_failures;
+	}
+}
+
+void wascap::fixture::result_table::fail(const std::string& message)
+{
+	printf("%s\n", message.c_str());
+	++m_failures;
+}
+
+int wascap::fixture::result_table::exit_code() const
+{
+	return (0 == m_failures) ? 0 : 1;
+}
+
+size_t wascap::fixture::parse_number(const std::string& word)
+{
+	size_t end;
+	unsigned long long value = std::stoull(word, &end, 0);
+	if (end != word.size()) {
+		throw std::invalid_argument(util::string_format("Not a number: %s", word));
+	}
+
+	return (size_t)value;
+}
+
+wascap::sink::resampler_quality wascap::fixture::parse_resampler_quality(const std::string& word)
+{
+	if (word == "fast") {
+		return sink::resampler_quality::fast;
+	}
+	else if (word == "medium") {
+		return sink::resampler_quality::medium;
+	}
+	else if (word == "high") {
+		return sink::resampler_quality::high;
+	}
+	else {
+		throw std::invalid_argument(util::string_format("Unrecognized resampler quality: %s", word));
+	}
+}
\ No newline at end of file
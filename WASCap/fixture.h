@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "convert_sink.h"
+#include "no_copy.h"
+#include "shmctl_sink.h"
+
+// What the checks and the benchmarks share: a control block that no other process sees, the same pseudo-random
+// blocks on every run, their results as tab-separated values, and the words of their command lines.
+
+namespace wascap
+{
+	namespace fixture
+	{
+		// A control block in memory, with settings that keep every shmctl stage on its processing path:
+		// a gain to apply, averaging, saturation tracking, no silence threshold, and a tap to write.
+		// Callers change the settings they need otherwise through contents.
+		class control_block : util::no_copy_no_move
+		{
+			std::unique_ptr<char[]> m_memory;
+			std::shared_ptr<shmctl::shmctl> m_shmctl;
+
+		public:
+			explicit control_block(size_t tap_bytes);
+
+			inline const std::shared_ptr<shmctl::shmctl>& get() const { return m_shmctl; }
+			inline volatile shmctl::shm_contents* contents() const { return m_shmctl->get(); }
+		};
+
+		// The same sequence on every run, so that a failure can be reproduced.
+		class pseudo_random
+		{
+			unsigned int m_state;
+
+			unsigned int next();
+
+		public:
+			pseudo_random();
+
+			// Between -1 and 1.
+			float next_sample();
+			// Between 1 and max_frames.
+			size_t next_frames(size_t max_frames);
+		};
+
+		// Prints results as tab-separated values under a header line, and counts the rows that failed.
+		class result_table
+		{
+			size_t m_failures;
+
+		public:
+			explicit result_table(const char* header);
+
+			inline size_t failures() const { return m_failures; }
+
+			void row(bool passed, const std::string& line);
+			// A failure that has no row of its own.
+			void fail(const std::string& message);
+			// What the check returns: 0 when nothing failed.
+			int exit_code() const;
+		};
+
+		// Decimal, or hexadecimal with 0x; throws std::invalid_argument otherwise.
+		size_t parse_number(const std::string& word);
+		// fast, medium or high; throws std::invalid_argument otherwise.
+		sink::resampler_quality parse_resampler_quality(const std::string& word);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "stdafx.h"
+
+#include "idle_backoff.h"
+
+// Idle polls at a given wait before it doubles.
+#define IDLE_POLLS_PER_STEP 8
+
+wascap::util::idle_backoff::idle_backoff(DWORD min_wait_ms, DWORD max_wait_ms)
+	: m_min_wait_ms(max(1, min_wait_ms)), m_max_wait_ms(max(m_min_wait_ms, max_wait_ms)), m_wait_ms(m_min_wait_ms), m_idle_polls(0)
+{
+}
+
+void wascap::util::idle_backoff::reset()
+{
+	m_wait_ms = m_min_wait_ms;
+	m_idle_polls = 0;
+}
+
+DWORD wascap::util::idle_backoff::idle_wait()
+{
+	DWORD wait_ms = m_wait_ms;
+
+	if (++m_idle_polls >= IDLE_POLLS_PER_STEP) {
+		m_wait_ms = min(m_wait_ms * 2, m_max_wait_ms);
+		m_idle_polls = 0;
+	}
+
+	return wait_ms;
+}
+
+void wascap::util::idle_backoff::idle()
+{
+	Sleep(idle_wait());
+}
\ No newline at end of file
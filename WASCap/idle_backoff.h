@@ -0,0 +1,30 @@
+#pragma once
+
+#include "platform.h"
+
+namespace wascap
+{
+	namespace util
+	{
+		// Polling cadence for a loop that waits for audio: the wait doubles after every few idle polls, up to a ceiling,
+		// and drops back to the floor as soon as there is something to do.
+		class idle_backoff
+		{
+			DWORD m_min_wait_ms;
+			DWORD m_max_wait_ms;
+			DWORD m_wait_ms;
+			size_t m_idle_polls;
+
+		public:
+			idle_backoff(DWORD min_wait_ms, DWORD max_wait_ms);
+
+			inline DWORD wait_ms() const { return m_wait_ms; }
+
+			void reset();
+			// Returns the current wait, then lengthens it if the loop has been idle long enough.
+			DWORD idle_wait();
+			// Sleeps for idle_wait.
+			void idle();
+		};
+	}
+}
\ No newline at end of file
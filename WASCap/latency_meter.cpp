@@ -0,0 +1,66 @@
+#include "stdafx.h"
+
+#include "latency_meter.h"
+
+namespace
+{
+	const LONGLONG performance_frequency = []() {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+
+		return frequency.QuadPart;
+	}();
+}
+
+UINT64 wascap::sink::capture_clock()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	return (UINT64)(((counter.QuadPart / performance_frequency) * 10000000) + (((counter.QuadPart % performance_frequency) * 10000000) / performance_frequency));
+}
+
+wascap::sink::latency_meter::latency_meter(const char* name)
+	: m_name(name), m_capture_time(0), m_blocks(0), m_last(0), m_min(UINT64_MAX), m_max(0), m_sum(0)
+{
+}
+
+void wascap::sink::latency_meter::begin_block(const block_info& info)
+{
+	m_capture_time = info.capture_time;
+}
+
+double wascap::sink::latency_meter::record()
+{
+	if (0 == m_capture_time) {
+		return -1.0;
+	}
+
+	UINT64 now = capture_clock();
+	UINT64 latency = (now > m_capture_time) ? (now - m_capture_time) : 0;
+	m_capture_time = 0;
+
+	m_last.store(latency, std::memory_order_relaxed);
+	if (latency < m_min.load(std::memory_order_relaxed)) {
+		m_min.store(latency, std::memory_order_relaxed);
+	}
+	if (latency > m_max.load(std::memory_order_relaxed)) {
+		m_max.store(latency, std::memory_order_relaxed);
+	}
+	m_sum.fetch_add(latency, std::memory_order_relaxed);
+	m_blocks.fetch_add(1, std::memory_order_relaxed);
+
+	return latency / 10000.0;
+}
+
+wascap::sink::latency_stats wascap::sink::latency_meter::stats() const
+{
+	latency_stats stats;
+	stats.blocks = m_blocks.load(std::memory_order_relaxed);
+	stats.last_ms = m_last.load(std::memory_order_relaxed) / 10000.0;
+	stats.min_ms = (stats.blocks > 0) ? (m_min.load(std::memory_order_relaxed) / 10000.0) : 0.0;
+	stats.mean_ms = (stats.blocks > 0) ? (m_sum.load(std::memory_order_relaxed) / 10000.0 / stats.blocks) : 0.0;
+	stats.max_ms = m_max.load(std::memory_order_relaxed) / 10000.0;
+
+	return stats;
+}
\ No newline at end of file
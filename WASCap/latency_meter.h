@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+
+#include "base_sink.h"
+#include "no_copy.h"
+#include "platform.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		struct latency_stats
+		{
+			size_t blocks;
+			double last_ms;
+			double min_ms;
+			double mean_ms;
+			double max_ms;
+		};
+
+		// Measures how long blocks take from their capture to an output.
+		// Updated on the thread that runs the output, and read from any thread.
+		class latency_meter : util::no_copy_no_move
+		{
+			const char* m_name;
+			UINT64 m_capture_time;
+
+			std::atomic<size_t> m_blocks;
+			std::atomic<UINT64> m_last;
+			std::atomic<UINT64> m_min;
+			std::atomic<UINT64> m_max;
+			std::atomic<UINT64> m_sum;
+
+		public:
+			explicit latency_meter(const char* name);
+
+			inline const char* name() const { return m_name; }
+
+			void begin_block(const block_info& info);
+			// Called as the frames of the current block leave. Only the first call for a block counts.
+			// Returns the latency in milliseconds, or a negative value when the block has no capture time.
+			double record();
+
+			latency_stats stats() const;
+		};
+
+		// The performance counter, in the 100 ns units of capture timestamps.
+		UINT64 capture_clock();
+	}
+}
\ No newline at end of file
@@ -3,21 +3,40 @@
 #include <windows.h>
 #include <audioclient.h>
 #include <mmdeviceapi.h>
+#include <atomic>
+#include <cmath>
 #include <sstream>
 #include <memory>
 
 #include "convert_sink.h"
+#include "capture_session.h"
+#include "chain_planner.h"
 #include "com_helper.h"
+#include "control_pipe.h"
+#include "deadline_sink.h"
 #include "errors.h"
+#include "idle_backoff.h"
+#include "latency_meter.h"
 #include "main.h"
 #include "mm_device.h"
 #include "network_sink.h"
+#include "queue_sink.h"
 #include "shmctl_sink.h"
 #include "stdout_sink.h"
+#include "switch_sink.h"
+#include "tee_sink.h"
+#include "trace.h"
 #include "was_source.h"
 #include "was_sink.h"
 #include "string_format.h"
 
+// How long a paused capture may sleep, which bounds how late it notices being resumed.
+#define MAX_PAUSED_WAIT_MS 100
+// How often serve cancels the wait of its control thread, until the thread notices that it must stop.
+#define CONTROL_CANCEL_RETRY_MS 10
+// How often a capture that follows the default device checks whether it changed.
+#define DEFAULT_DEVICE_CHECK_MS 1000
+
 namespace
 {
 	const char* stringify_flow(EDataFlow flow)
@@ -82,6 +101,383 @@ namespace
 
 		return defs.str();
 	}
+
+	// The render device, behind the conversions from the given frames to its own format.
+	std::unique_ptr<wascap::sink::sink> was_output(const wascap::was::mm_enumerator& enumerator, const wascap::command_line_arguments& arguments, const std::string& device, ERole role, size_t samplerate, DWORD channel_mask)
+	{
+		namespace sink = wascap::sink;
+
+		wascap::was::mm_device sink_dev = device.empty()
+			? enumerator.default_device(eRender, role)
+			: enumerator.device_by_id(device);
+		size_t sink_samplerate = sink_dev.samplerate();
+		DWORD sink_channel_mask = sink_dev.channel_mask();
+
+		std::unique_ptr<sink::sink> s = std::make_unique<sink::null_sink>(sink_samplerate, sink_channel_mask);
+		s = std::make_unique<sink::was_sink>(std::move(s), sink_dev);
+		if (arguments.with_drift_compensation) {
+			s = std::make_unique<sink::drift_compensation_sink>(std::move(s), samplerate, arguments.resampler_quality);
+		}
+		else if (samplerate != s->samplerate()) {
+			s = std::make_unique<sink::samplerate_convert_sink>(std::move(s), samplerate, arguments.resampler_quality);
+		}
+		if (channel_mask != s->channel_mask()) {
+			s = std::make_unique<sink::channel_convert_sink>(std::move(s), channel_mask);
+		}
+
+		return s;
+	}
+
+	struct stream_format
+	{
+		size_t samplerate;
+		DWORD channel_mask;
+	};
+
+	// Everything the graph planner needs besides the graph itself.
+	struct graph_context
+	{
+		const wascap::was::mm_enumerator& enumerator;
+		const wascap::command_line_arguments& arguments;
+		const std::shared_ptr<wascap::shmctl::shmctl>& shmctl;
+		std::vector<wascap::sink::queue_sink*>& queues;
+	};
+
+	// Converts from the given frames to those s takes. When there are fewer channels on the way out, they are mapped
+	// first, so that the resampler runs on as few of them as it can.
+	std::unique_ptr<wascap::sink::sink> convert_from(std::unique_ptr<wascap::sink::sink> s, const wascap::command_line_arguments& arguments, const std::shared_ptr<wascap::shmctl::shmctl>& shmctl, const stream_format& from)
+	{
+		namespace sink = wascap::sink;
+
+		bool map_first = __popcnt(from.channel_mask) > __popcnt(s->channel_mask());
+		if (map_first && from.samplerate != s->samplerate()) {
+			s = sink::measured(std::make_unique<sink::samplerate_convert_sink>(std::move(s), from.samplerate, arguments.resampler_quality), shmctl, "samplerate");
+		}
+		if (from.channel_mask != s->channel_mask()) {
+			s = sink::measured(std::make_unique<sink::channel_convert_sink>(std::move(s), from.channel_mask), shmctl, "channels");
+		}
+		if (from.samplerate != s->samplerate()) {
+			s = sink::measured(std::make_unique<sink::samplerate_convert_sink>(std::move(s), from.samplerate, arguments.resampler_quality), shmctl, "samplerate");
+		}
+
+		return s;
+	}
+
+	// Builds the graph from the given stage on, for frames in the actual format.
+	// Format stages only change the pending format, which the frames take just before the next stage that depends on
+	// it: the tap, the standard output and the network. Successive format stages thus cost a single conversion, one
+	// that the network would make anyway costs nothing more, and the stages in between run on the frames as they are.
+	std::unique_ptr<wascap::sink::sink> build_graph(const graph_context& context, const wascap::graph_sequence& graph, size_t index, stream_format actual, stream_format pending)
+	{
+		namespace sink = wascap::sink;
+
+		if (index == graph.size()) {
+			return std::make_unique<sink::null_sink>(actual.samplerate, actual.channel_mask);
+		}
+
+		const wascap::graph_node& node = graph[index];
+		std::unique_ptr<sink::sink> s;
+		switch (node.stage) {
+		case wascap::graph_stage::samplerate:
+			pending.samplerate = node.samplerate;
+			return build_graph(context, graph, index + 1, actual, pending);
+		case wascap::graph_stage::channels:
+			pending.channel_mask = node.channel_mask;
+			return build_graph(context, graph, index + 1, actual, pending);
+		case wascap::graph_stage::flow_control:
+			return sink::measured(std::make_unique<sink::shmctl_flow_control_sink>(build_graph(context, graph, index + 1, actual, pending), context.shmctl), context.shmctl, "flow-control");
+		case wascap::graph_stage::averaging:
+			return sink::measured(std::make_unique<sink::shmctl_averaging_sink>(build_graph(context, graph, index + 1, actual, pending), context.shmctl), context.shmctl, "averaging");
+		case wascap::graph_stage::volume:
+			return sink::measured(std::make_unique<sink::shmctl_volume_sink>(build_graph(context, graph, index + 1, actual, pending), context.shmctl), context.shmctl, "volume");
+		case wascap::graph_stage::queue:
+			return sink::queued_output(build_graph(context, graph, index + 1, actual, pending), (node.queue_ms < 0.0f) ? context.arguments.output_queue_ms : node.queue_ms, context.arguments, context.queues);
+		case wascap::graph_stage::tap:
+			s = sink::measured(std::make_unique<sink::shmctl_tap_sink>(build_graph(context, graph, index + 1, pending, pending), context.shmctl), context.shmctl, "tap");
+			break;
+		case wascap::graph_stage::to_stdout:
+			s = sink::measured(std::make_unique<sink::stdout_sink>(build_graph(context, graph, index + 1, pending, pending)), context.shmctl, "stdout");
+			break;
+		case wascap::graph_stage::network:
+		{
+			stream_format network_format = { sink::network_sink::adjust_samplerate(pending.samplerate), pending.channel_mask };
+			s = sink::network_output(build_graph(context, graph, index + 1, network_format, network_format), context.arguments.bind_address, node.peer_address, node.peer_service, context.shmctl);
+			break;
+		}
+		case wascap::graph_stage::was:
+			// The render device converts to its own format, whatever the pending one.
+			return sink::measured(was_output(context.enumerator, context.arguments, node.device, node.role, actual.samplerate, actual.channel_mask), context.shmctl, "was");
+		case wascap::graph_stage::tee:
+		{
+			std::vector<std::unique_ptr<sink::sink>> branches;
+			for (const wascap::graph_sequence& branch : node.branches) {
+				branches.push_back(build_graph(context, branch, 0, actual, pending));
+			}
+
+			return std::make_unique<sink::tee_sink>(std::move(branches), context.shmctl);
+		}
+		default:
+			throw std::logic_error("Graph stage not implemented (in planner)");
+		}
+
+		return convert_from(std::move(s), context.arguments, context.shmctl, actual);
+	}
+
+	// Maps the control block of the arguments, if any. The statistics region is cleared once per mapping, so chains
+	// that replace one another on the same block share the mapping.
+	std::shared_ptr<wascap::shmctl::shmctl> open_shmctl(const wascap::command_line_arguments& arguments)
+	{
+		if (arguments.shm_name.empty()) {
+			return nullptr;
+		}
+
+		return std::make_shared<wascap::shmctl::shmctl>(arguments.shm_name);
+	}
+
+	// The chain that takes the frames of the source, as the arguments describe it, on the control block open_shmctl
+	// mapped for them. Output queues go to queues.
+	std::unique_ptr<wascap::sink::sink> capture_chain(const wascap::was::mm_enumerator& enumerator, const wascap::command_line_arguments& arguments, const std::shared_ptr<wascap::shmctl::shmctl>& shmctl, size_t source_samplerate, DWORD source_channel_mask, std::vector<wascap::sink::queue_sink*>& queues)
+	{
+		namespace sink = wascap::sink;
+
+		std::unique_ptr<sink::sink> s;
+
+		if (!arguments.graph.empty()) {
+			size_t chain_samplerate = (arguments.samplerate != SIZE_MAX) ? arguments.samplerate : source_samplerate;
+			DWORD chain_channel_mask = (arguments.channel_mask != 0) ? arguments.channel_mask : source_channel_mask;
+
+			graph_context context = { enumerator, arguments, shmctl, queues };
+			stream_format source_format = { source_samplerate, source_channel_mask };
+			stream_format chain_format = { chain_samplerate, chain_channel_mask };
+			if (arguments.mixing_matrix.empty()) {
+				s = build_graph(context, arguments.graph, 0, source_format, chain_format);
+			}
+			else {
+				// The matrix maps the source channels to those of the chain, as the frames enter the graph.
+				stream_format mapped_format = { source_samplerate, chain_channel_mask };
+				s = build_graph(context, arguments.graph, 0, mapped_format, chain_format);
+				s = sink::measured(std::make_unique<sink::channel_convert_sink>(std::move(s), source_channel_mask, arguments.mixing_matrix), shmctl, "channels");
+			}
+		}
+		else {
+			sink::render_output_factory render_output = [&enumerator, &arguments](size_t samplerate, DWORD channel_mask) {
+				return was_output(enumerator, arguments, arguments.sink_device, arguments.sink_role, samplerate, channel_mask);
+			};
+			s = sink::plan_chain(arguments, render_output, shmctl, source_samplerate, source_channel_mask, queues);
+		}
+
+		// At the head, so that each block is timed through the whole chain of the capture thread.
+		return std::make_unique<sink::deadline_sink>(std::move(s), shmctl);
+	}
+
+	// Two chains only mix cleanly where render devices play them both, and each runs the volume stage of its own.
+	bool can_fade(const wascap::command_line_arguments& arguments)
+	{
+		return arguments.graph.empty() && arguments.shm_name.empty() && arguments.with_was_sink && !arguments.with_network_sink && !arguments.with_stdout_sink;
+	}
+
+	// What the control thread of serve shares with the capture thread.
+	struct serve_control
+	{
+		// The options of the current chain, only ever used on the control thread once it runs.
+		wascap::command_line_arguments arguments;
+		// The control block of the current chain, which the next one reuses when it names the same.
+		std::shared_ptr<wascap::shmctl::shmctl> shmctl;
+		size_t source_samplerate;
+		DWORD source_channel_mask;
+		wascap::sink::switch_sink* root;
+		wascap::util::control_pipe* pipe;
+		std::atomic<bool> stopping;
+		// Set by the control thread once it stops taking commands.
+		wascap::util::unique_handle stopped_event;
+		// Set by the capture thread once the chains are gone, which the control thread may have built.
+		wascap::util::unique_handle done_event;
+	};
+
+	std::string serve_command(serve_control& control, const wascap::was::mm_enumerator& enumerator, const std::string& line)
+	{
+		namespace sink = wascap::sink;
+
+		std::string::size_type split = line.find(' ');
+		std::string command = line.substr(0, split);
+		std::string options = (split != std::string::npos) ? line.substr(split + 1) : std::string();
+		if (command == "stop") {
+			control.root->stop();
+
+			return "ok";
+		}
+		if (command == "trace") {
+			// Writes the spans so far without stopping, to the trace file of the command line unless given another.
+			std::string path = options.empty() ? control.arguments.trace_path : options;
+			if (path.empty()) {
+				throw wascap::bad_arguments("Expected trace file path");
+			}
+
+			return wascap::util::string_format("ok %zu", wascap::trace::dump(path));
+		}
+		if (command != "configure") {
+			throw wascap::bad_arguments(wascap::util::string_format("Unrecognized command: %s", command));
+		}
+
+		UINT64 start = sink::capture_clock();
+
+		wascap::command_line_arguments arguments = control.arguments;
+		wascap::parse_chain_arguments(arguments, options);
+
+		std::unique_ptr<sink::switch_chain> chain = std::make_unique<sink::switch_chain>();
+		std::vector<sink::queue_sink*> queues;
+		// The chain it replaces may still count in the statistics of the same block.
+		std::shared_ptr<wascap::shmctl::shmctl> shmctl = (arguments.shm_name == control.arguments.shm_name) ? control.shmctl : open_shmctl(arguments);
+		chain->head = capture_chain(enumerator, arguments, shmctl, control.source_samplerate, control.source_channel_mask, queues);
+		if (!chain->head->can_play()) {
+			throw wascap::bad_arguments("Unable to play");
+		}
+		chain->can_fade = can_fade(arguments);
+
+		UINT64 built = sink::capture_clock();
+		// The chain it replaces goes away here, off the capture thread.
+		control.root->switch_to(std::move(chain));
+		UINT64 switched = sink::capture_clock();
+
+		control.arguments = std::move(arguments);
+		control.shmctl = std::move(shmctl);
+
+		double build_ms = (built - start) / 10000.0;
+		double switch_ms = (switched - built) / 10000.0;
+		fprintf(stderr, "Switched chains in %.2f ms: %.2f ms to build, %.2f ms to switch\n", build_ms + switch_ms, build_ms, switch_ms);
+
+		return wascap::util::string_format("ok %.2f %.2f", build_ms, switch_ms);
+	}
+
+	// Captures as source::run does, for an hour at most, and lets the switch happen between polls while nothing plays.
+	void serve_capture(wascap::source::source& source, wascap::sink::switch_sink& s)
+	{
+		size_t stop_after_frames = source.samplerate() * 3600;
+
+		source.start(s);
+		try {
+			DWORD wait_ms;
+			while (source.poll(s, stop_after_frames, wait_ms)) {
+				s.switch_if_idle();
+				Sleep(wait_ms);
+			}
+		}
+		catch (...) {
+			source.abort();
+			throw;
+		}
+
+		source.stop(s);
+	}
+
+	// Takes commands from the control pipe, and answers each with a line that starts with ok or error.
+	DWORD WINAPI serve_control_thread(LPVOID parameter)
+	{
+		serve_control& control = *(serve_control*)parameter;
+
+		try {
+			// Chains built here are released on this thread or after it is done with them, while COM is still up.
+			wascap::util::shared_com com = wascap::util::make_shared_com();
+			wascap::was::mm_enumerator enumerator(com);
+
+			std::string line;
+			while (!control.stopping && control.pipe->read_line(line)) {
+				try {
+					control.pipe->write_line(serve_command(control, enumerator, line));
+				}
+				catch (const std::exception& e) {
+					control.pipe->write_line(wascap::util::string_format("error %s", e.what()));
+				}
+			}
+
+			SetEvent(control.stopped_event.get());
+			WaitForSingleObject(control.done_event.get(), INFINITE);
+		}
+		catch (const std::exception& e) {
+			fprintf(stderr, "Control thread failed: %s\n", e.what());
+			SetEvent(control.stopped_event.get());
+		}
+
+		return 0;
+	}
+
+	// Opens the source device of the arguments. When that is the default device, the source follows it as it changes.
+	class was_source_provider : public wascap::source::source_provider
+	{
+		const wascap::was::mm_enumerator& m_enumerator;
+		EDataFlow m_flow;
+		ERole m_role;
+		// Empty when following the default device.
+		std::string m_device_id;
+		std::string m_opened_id;
+		ULONGLONG m_next_check;
+
+	public:
+		was_source_provider(const wascap::was::mm_enumerator& enumerator, const wascap::command_line_arguments& arguments)
+			: m_enumerator(enumerator), m_flow(arguments.source_flow), m_role(arguments.source_role), m_device_id(arguments.source_device), m_opened_id(), m_next_check(0)
+		{
+		}
+
+		virtual std::unique_ptr<wascap::source::source> open()
+		{
+			wascap::was::mm_device device = m_device_id.empty()
+				? m_enumerator.default_device(m_flow, m_role)
+				: m_enumerator.device_by_id(m_device_id);
+
+			std::unique_ptr<wascap::source::source> source = std::make_unique<wascap::source::was_source>(device);
+			m_opened_id = device.id();
+			m_next_check = GetTickCount64() + DEFAULT_DEVICE_CHECK_MS;
+
+			return source;
+		}
+
+		virtual bool is_stale()
+		{
+			if (!m_device_id.empty()) {
+				return false;
+			}
+
+			ULONGLONG now = GetTickCount64();
+			if (now < m_next_check) {
+				return false;
+			}
+			m_next_check = now + DEFAULT_DEVICE_CHECK_MS;
+
+			// Without a default device for now, the current one stays until it is lost.
+			try {
+				return m_enumerator.default_device(m_flow, m_role).id() != m_opened_id;
+			}
+			catch (const std::exception&) {
+				return false;
+			}
+		}
+	};
+
+	// The session keeps the chain in its own format whatever source attaches, so the chain takes the frames in that
+	// format, and the conversions from each source, with the mixing matrix, go in front of it.
+	std::unique_ptr<wascap::source::capture_session> make_session(const std::string& name, const wascap::was::mm_enumerator& enumerator, const wascap::command_line_arguments& arguments, std::vector<wascap::sink::queue_sink*>& queues)
+	{
+		namespace sink = wascap::sink;
+		namespace source = wascap::source;
+
+		std::unique_ptr<source::source_provider> provider = std::make_unique<was_source_provider>(enumerator, arguments);
+		std::unique_ptr<source::source> first = provider->open();
+		DWORD first_channel_mask = first->channel_mask();
+
+		size_t chain_samplerate = (arguments.samplerate != SIZE_MAX) ? arguments.samplerate : first->samplerate();
+		DWORD chain_channel_mask = (arguments.channel_mask != 0) ? arguments.channel_mask : first_channel_mask;
+		wascap::command_line_arguments chain_arguments = arguments;
+		chain_arguments.mixing_matrix.clear();
+		std::unique_ptr<sink::sink> s = capture_chain(enumerator, chain_arguments, open_shmctl(arguments), chain_samplerate, chain_channel_mask, queues);
+
+		if (!s->can_play()) {
+			throw wascap::bad_arguments("Unable to play");
+		}
+
+		size_t stop_after_frames = (arguments.duration == INFINITY) ? SIZE_MAX : (size_t)(chain_samplerate * arguments.duration);
+
+		return std::make_unique<source::capture_session>(name, std::move(provider), std::move(first), std::move(s), stop_after_frames, arguments.resampler_quality, first_channel_mask, arguments.mixing_matrix);
+	}
 }
 
 DWORD WINAPI wascap::bind_lifetime(HANDLE hProcess)
@@ -186,99 +582,177 @@ int wascap::capture_main(const command_line_arguments& arguments)
 
 	was::mm_enumerator enumerator(com);
 
-	was::mm_device source_dev = arguments.source_device.empty()
-		? enumerator.default_device(arguments.source_flow, arguments.source_role)
-		: enumerator.device_by_id(arguments.source_device);
+	// Owned by the chain.
+	std::vector<sink::queue_sink*> queues;
+	std::unique_ptr<source::capture_session> session = make_session("capture", enumerator, arguments, queues);
 
-	source::was_source source(source_dev);
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
 
-	const WAVEFORMATEX& format = source.wave_format();
-	DWORD channel_mask = was::channel_mask(format);
+	fprintf(stderr, "WASCap capture initialized\n");
 
-	size_t chain_samplerate = (arguments.samplerate != SIZE_MAX) ? arguments.samplerate : format.nSamplesPerSec;
-	DWORD chain_channel_mask = (arguments.channel_mask != 0) ? arguments.channel_mask : channel_mask;
+	session->run();
 
-	size_t before_was_samplerate = arguments.with_network_sink ? sink::network_sink::adjust_samplerate(chain_samplerate) : chain_samplerate;
+	std::vector<const sink::latency_meter*> meters;
+	session->chain().latency_meters(meters);
+	for (const sink::latency_meter* meter : meters) {
+		sink::latency_stats stats = meter->stats();
+		fprintf(stderr, "Latency to %s: %zu blocks, %.2f ms min, %.2f ms mean, %.2f ms max\n", meter->name(), stats.blocks, stats.min_ms, stats.mean_ms, stats.max_ms);
+	}
 
-	std::unique_ptr<sink::sink> s;
+	for (sink::queue_sink* queue : queues) {
+		sink::queue_stats stats = queue->stats();
+		fprintf(stderr, "Output queue: %zu/%zu frames, peak %zu, %zu dropped, %zu waits\n", stats.queued_frames, stats.capacity_frames, stats.peak_frames, stats.dropped_frames, stats.blocked_waits);
+	}
 
-	if (arguments.with_was_sink) {
-		was::mm_device sink_dev = arguments.sink_device.empty()
-			? enumerator.default_device(eRender, arguments.sink_role)
-			: enumerator.device_by_id(arguments.sink_device);
-		size_t sink_samplerate = sink_dev.samplerate();
-		DWORD sink_channel_mask = sink_dev.channel_mask();
+	return 0;
+}
 
-		s = std::make_unique<sink::null_sink>(sink_samplerate, sink_channel_mask);
-		s = std::make_unique<sink::was_sink>(std::move(s), sink_dev);
-		if (before_was_samplerate != s->samplerate()) {
-			s = std::make_unique<sink::samplerate_convert_sink>(std::move(s), before_was_samplerate);
-		}
-		if (chain_channel_mask != s->channel_mask()) {
-			s = std::make_unique<sink::channel_convert_sink>(std::move(s), chain_channel_mask);
-		}
+int wascap::serve_main(const command_line_arguments& arguments)
+{
+	if (arguments.use_message_box) {
+		MessageBoxA(nullptr, util::string_format("Initializing WASCap serve (PID %d)", GetCurrentProcessId()).c_str(), "WASCap", MB_ICONINFORMATION);
 	}
 	else {
-		s = std::make_unique<sink::null_sink>(before_was_samplerate, chain_channel_mask);
+		fprintf(stderr, "Initializing WASCap serve (PID %d)\n", GetCurrentProcessId());
 	}
 
-	if (arguments.with_network_sink) {
-		util::shared_wsa wsa = util::make_shared_wsa();
-
-		s = std::make_unique<sink::network_sink>(std::move(s), wsa, arguments.bind_address, arguments.peer_address, arguments.peer_service);
-	}
+	util::shared_com com = util::make_shared_com();
 
-	if (chain_samplerate != s->samplerate()) {
-		s = std::make_unique<sink::samplerate_convert_sink>(std::move(s), chain_samplerate);
-	}
+	was::mm_enumerator enumerator(com);
 
-	if (arguments.with_stdout_sink) {
-		s = std::make_unique<sink::stdout_sink>(std::move(s));
-	}
+	was::mm_device source_dev = arguments.source_device.empty()
+		? enumerator.default_device(arguments.source_flow, arguments.source_role)
+		: enumerator.device_by_id(arguments.source_device);
 
-	if (!arguments.shm_name.empty()) {
-		std::shared_ptr<shmctl::shmctl> shmctl = std::make_shared<shmctl::shmctl>(arguments.shm_name);
+	source::was_source source(source_dev);
 
-		if (arguments.with_shm_tap_sink) {
-			s = std::make_unique<sink::shmctl_tap_sink>(std::move(s), shmctl);
-		}
-		s = std::make_unique<sink::shmctl_volume_sink>(std::move(s), shmctl);
-		if (arguments.with_shm_averaging_sink) {
-			s = std::make_unique<sink::shmctl_averaging_sink>(std::move(s), shmctl);
-		}
-		s = std::make_unique<sink::shmctl_flow_control_sink>(std::move(s), shmctl);
-	}
+	const WAVEFORMATEX& format = source.wave_format();
+	DWORD channel_mask = was::channel_mask(format);
 
-	if (format.nSamplesPerSec != s->samplerate()) {
-		s = std::make_unique<sink::samplerate_convert_sink>(std::move(s), format.nSamplesPerSec);
-	}
-	if (channel_mask != s->channel_mask()) {
-		s = std::make_unique<sink::channel_convert_sink>(std::move(s), channel_mask);
-	}
+	util::control_pipe pipe(arguments.control_pipe);
 
-	if (!s->can_play()) {
+	std::unique_ptr<sink::switch_chain> chain = std::make_unique<sink::switch_chain>();
+	std::vector<sink::queue_sink*> queues;
+	std::shared_ptr<shmctl::shmctl> shmctl = open_shmctl(arguments);
+	chain->head = capture_chain(enumerator, arguments, shmctl, format.nSamplesPerSec, channel_mask, queues);
+	if (!chain->head->can_play()) {
 		throw bad_arguments("Unable to play");
 	}
+	chain->can_fade = can_fade(arguments);
+
+	// Declared before the switch, which borrows its buffers; each chain has a pool of its own.
+	sink::buffer_pool pool;
+	std::unique_ptr<sink::switch_sink> s = std::make_unique<sink::switch_sink>(std::move(chain), (size_t)(format.nSamplesPerSec * arguments.crossfade_ms / 1000.0));
+	s->prepare(pool, source.max_packet_frames());
+
+	serve_control control;
+	control.arguments = arguments;
+	control.shmctl = std::move(shmctl);
+	control.source_samplerate = format.nSamplesPerSec;
+	control.source_channel_mask = channel_mask;
+	control.root = s.get();
+	control.pipe = &pipe;
+	control.stopping = false;
+	control.stopped_event.reset(WIN32_CHECK(CreateEventW(nullptr, true, false, nullptr)));
+	control.done_event.reset(WIN32_CHECK(CreateEventW(nullptr, true, false, nullptr)));
+	util::unique_handle control_thread(WIN32_CHECK(CreateThread(nullptr, 0, serve_control_thread, &control, 0, nullptr)));
 
 	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
 
-	fprintf(stderr, "WASCap capture initialized\n");
+	fprintf(stderr, "WASCap serve initialized\n");
 
-	if (arguments.duration == INFINITY) {
+	std::exception_ptr failure;
+	try {
+		// Switches wait for the next block, or happen between polls while no block comes, or here while nothing captures.
+		util::idle_backoff backoff(source.poll_interval_ms(), MAX_PAUSED_WAIT_MS);
 		while (s->is_open()) {
 			if (s->is_playing()) {
-				source.run(*s, format.nSamplesPerSec * 3600);
+				serve_capture(source, *s);
+				backoff.reset();
 			}
 			else {
-				Sleep(6);
+				s->switch_idle();
+				backoff.idle();
 			}
 		}
 	}
-	else {
-		if (s->is_open() && s->is_playing()) {
-			source.run(*s, (size_t)(format.nSamplesPerSec * arguments.duration));
-		}
+	catch (...) {
+		failure = std::current_exception();
+	}
+
+	s->stop();
+	control.stopping = true;
+	// The control thread may be between two calls when cancelled, so cancelling goes on until it stops.
+	do {
+		CancelSynchronousIo(control_thread.get());
+	} while (WAIT_TIMEOUT == WaitForSingleObject(control.stopped_event.get(), CONTROL_CANCEL_RETRY_MS));
+
+	std::vector<const sink::latency_meter*> meters;
+	s->latency_meters(meters);
+	for (const sink::latency_meter* meter : meters) {
+		sink::latency_stats stats = meter->stats();
+		fprintf(stderr, "Latency to %s: %zu blocks, %.2f ms min, %.2f ms mean, %.2f ms max\n", meter->name(), stats.blocks, stats.min_ms, stats.mean_ms, stats.max_ms);
+	}
+
+	s.reset();
+	SetEvent(control.done_event.get());
+	WaitForSingleObject(control_thread.get(), INFINITE);
+
+	if (failure) {
+		std::rethrow_exception(failure);
 	}
 
 	return 0;
 }
+
+int wascap::host_main(const command_line_arguments& arguments)
+{
+	if (arguments.use_message_box) {
+		MessageBoxA(nullptr, util::string_format("Initializing WASCap host (PID %d)", GetCurrentProcessId()).c_str(), "WASCap", MB_ICONINFORMATION);
+	}
+	else {
+		fprintf(stderr, "Initializing WASCap host (PID %d)\n", GetCurrentProcessId());
+	}
+
+	util::shared_com com = util::make_shared_com();
+
+	was::mm_enumerator enumerator(com);
+
+	std::vector<std::unique_ptr<source::capture_session>> sessions;
+	// Owned by the chains.
+	std::vector<std::vector<sink::queue_sink*>> queues(arguments.sessions.size());
+	for (size_t i = 0; i < arguments.sessions.size(); ++i) {
+		sessions.push_back(make_session(util::string_format("%zu", i + 1), enumerator, arguments.sessions[i], queues[i]));
+	}
+
+	size_t workers = arguments.host_workers;
+	if (0 == workers) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		workers = min((size_t)info.dwNumberOfProcessors, sessions.size());
+	}
+
+	fprintf(stderr, "WASCap host initialized: %zu sessions on %zu threads\n", sessions.size(), min(workers, sessions.size()));
+
+	std::vector<source::capture_session*> running;
+	for (const std::unique_ptr<source::capture_session>& session : sessions) {
+		running.push_back(session.get());
+	}
+	size_t failures = source::run_sessions(running, workers);
+
+	for (size_t i = 0; i < sessions.size(); ++i) {
+		std::vector<const sink::latency_meter*> meters;
+		sessions[i]->chain().latency_meters(meters);
+		for (const sink::latency_meter* meter : meters) {
+			sink::latency_stats stats = meter->stats();
+			fprintf(stderr, "Session %s latency to %s: %zu blocks, %.2f ms min, %.2f ms mean, %.2f ms max\n", sessions[i]->name().c_str(), meter->name(), stats.blocks, stats.min_ms, stats.mean_ms, stats.max_ms);
+		}
+
+		for (sink::queue_sink* queue : queues[i]) {
+			sink::queue_stats stats = queue->stats();
+			fprintf(stderr, "Session %s output queue: %zu/%zu frames, peak %zu, %zu dropped, %zu waits\n", sessions[i]->name().c_str(), stats.queued_frames, stats.capacity_frames, stats.peak_frames, stats.dropped_frames, stats.blocked_waits);
+		}
+	}
+
+	return (0 == failures) ? 0 : 1;
+}
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include <string>
 #include <vector>
 
+#include "chain_planner.h"
+
 namespace wascap
 {
 	class bad_arguments : public std::runtime_error
@@ -19,24 +21,59 @@ namespace wascap
 		help,
 		list,
 		capture,
+		serve,
+		host,
+	};
+
+	// The kinds of stage a sink graph is made of, in the words of its description.
+	enum class graph_stage
+	{
+		flow_control,
+		averaging,
+		volume,
+		tap,
+		samplerate,
+		channels,
+		queue,
+		network,
+		to_stdout,
+		was,
+		tee,
 	};
 
-	struct command_line_arguments
+	struct graph_node;
+	// Stages in the order the frames go through them, from the source on.
+	typedef std::vector<graph_node> graph_sequence;
+
+	// One stage of a sink graph; the parameters its kind does not use keep their defaults.
+	struct graph_node
+	{
+		graph_stage stage;
+
+		size_t samplerate = SIZE_MAX;
+		DWORD channel_mask = 0;
+		// Negative for the output queue length of the command line.
+		float queue_ms = -1.0f;
+		std::string peer_address = "";
+		std::string peer_service = "";
+		std::string device = "";
+		ERole role = eConsole;
+
+		// Tee only: each branch takes the frames that reach the tee.
+		std::vector<graph_sequence> branches;
+	};
+
+	// The chain options are those of a capture without a sink graph.
+	struct command_line_arguments : sink::chain_options
 	{
 		std::string executable = "";
 
 		verb verb = help;
 
 		std::string shm_name = "";
-		std::string bind_address = "";
-		std::string peer_address = "";
-		std::string peer_service = "";
 		std::string sink_device = "";
 		std::string source_device = "";
 
-		size_t samplerate = SIZE_MAX;
-		DWORD channel_mask = 0;
-
 		ERole sink_role = eConsole;
 
 		EDataFlow source_flow = eRender;
@@ -45,22 +82,36 @@ namespace wascap
 		EDataFlow list_flow = eAll;
 		DWORD list_state_mask = 0;
 
-		bool with_network_sink = false;
-		bool with_stdout_sink = false;
-		bool with_was_sink = false;
-		bool with_shm_tap_sink = true;
-		bool with_shm_averaging_sink = true;
+		bool with_drift_compensation = false;
+		// When not empty, replaces the output and shared memory stage options.
+		graph_sequence graph;
 
 		float duration = INFINITY;
 		HANDLE lifetime_process = nullptr;
 		bool use_message_box = false;
+		// When not empty, stages record spans that are written there as Chrome trace events on exit.
+		std::string trace_path = "";
+
+		std::string control_pipe = "";
+		// Between chains that only play to render devices, without a control block; other switches are immediate.
+		float crossfade_ms = 20.0f;
+
+		// Capture options of each session that host runs.
+		std::vector<command_line_arguments> sessions;
+		// Threads that poll the sessions, or 0 for one per processor up to one per session.
+		size_t host_workers = 0;
 	};
 
 	void parse_arguments(wascap::command_line_arguments& arguments, const std::vector<std::string>& args);
+	// Replaces the chain options with those of a line of capture options, the way serve reconfigures its capture.
+	// The source and the lifetime of the process stay as they are.
+	void parse_chain_arguments(wascap::command_line_arguments& arguments, const std::string& line);
 
 	DWORD WINAPI bind_lifetime(HANDLE hProcess);
 
 	int help_main(const wascap::command_line_arguments& arguments, const std::exception* exception);
 	int list_main(const wascap::command_line_arguments& arguments);
 	int capture_main(const wascap::command_line_arguments& arguments);
+	int serve_main(const wascap::command_line_arguments& arguments);
+	int host_main(const wascap::command_line_arguments& arguments);
 }
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "stdafx.h"
+
+#include <xmmintrin.h>
+#include <cstdint>
+
+#include "base_sink.h"
+#include "channel_layouts.h"
+#include "dsp_kernels.h"
+#include "mix_kernels.h"
+
+namespace dsp = wascap::sink::dsp;
+namespace mix = wascap::sink::mix;
+
+namespace
+{
+	template<size_t LANES>
+	inline void store_lanes(float* destination, __m128 value)
+	{
+		if constexpr (LANES == 4) {
+			_mm_storeu_ps(destination, value);
+		}
+		else if constexpr (LANES == 3) {
+			_mm_storel_pi((__m64*)destination, value);
+			_mm_store_ss(destination + 2, _mm_movehl_ps(value, value));
+		}
+		else if constexpr (LANES == 2) {
+			_mm_storel_pi((__m64*)destination, value);
+		}
+		else if constexpr (LANES == 1) {
+			_mm_store_ss(destination, value);
+		}
+	}
+
+	template<size_t SRC, size_t DST>
+	void mix_sse(float* destination, const float* source, size_t frames, const float* columns, size_t, size_t)
+	{
+		constexpr size_t VECTORS = (DST + 3) / 4;
+		constexpr size_t STRIDE = (DST + 7) & ~(size_t)7;
+
+		__m128 matrix[SRC][VECTORS];
+		for (size_t s = 0; s < SRC; ++s) {
+			for (size_t v = 0; v < VECTORS; ++v) {
+				matrix[s][v] = _mm_loadu_ps(columns + (s * STRIDE) + (v * 4));
+			}
+		}
+
+		for (size_t i = 0; i < frames; ++i) {
+			__m128 acc[VECTORS];
+			{
+				__m128 sample = _mm_set1_ps(source[0]);
+				for (size_t v = 0; v < VECTORS; ++v) {
+					acc[v] = _mm_mul_ps(sample, matrix[0][v]);
+				}
+			}
+			for (size_t s = 1; s < SRC; ++s) {
+				__m128 sample = _mm_set1_ps(source[s]);
+				for (size_t v = 0; v < VECTORS; ++v) {
+					acc[v] = _mm_add_ps(acc[v], _mm_mul_ps(sample, matrix[s][v]));
+				}
+			}
+			for (size_t v = 0; v + 1 < VECTORS; ++v) {
+				_mm_storeu_ps(destination + (v * 4), acc[v]);
+			}
+			store_lanes<DST - (VECTORS - 1) * 4>(destination + ((VECTORS - 1) * 4), acc[VECTORS - 1]);
+
+			source += SRC;
+			destination += DST;
+		}
+	}
+
+	void mix_sse_any(float* destination, const float* source, size_t frames, const float* columns, size_t source_channels, size_t target_channels)
+	{
+		size_t vectors = (target_channels + 3) / 4;
+		size_t stride = mix::column_stride(target_channels);
+
+		__m128 acc[wascap::sink::MAX_CHANNELS / 4];
+		for (size_t i = 0; i < frames; ++i) {
+			for (size_t v = 0; v < vectors; ++v) {
+				acc[v] = _mm_setzero_ps();
+			}
+			for (size_t s = 0; s < source_channels; ++s) {
+				__m128 sample = _mm_set1_ps(source[s]);
+				const float* column = columns + (s * stride);
+				for (size_t v = 0; v < vectors; ++v) {
+					acc[v] = _mm_add_ps(acc[v], _mm_mul_ps(sample, _mm_loadu_ps(column + (v * 4))));
+				}
+			}
+			for (size_t v = 0; v + 1 < vectors; ++v) {
+				_mm_storeu_ps(destination + (v * 4), acc[v]);
+			}
+			switch (target_channels - (vectors - 1) * 4) {
+			case 1:
+				store_lanes<1>(destination + ((vectors - 1) * 4), acc[vectors - 1]);
+				break;
+			case 2:
+				store_lanes<2>(destination + ((vectors - 1) * 4), acc[vectors - 1]);
+				break;
+			case 3:
+				store_lanes<3>(destination + ((vectors - 1) * 4), acc[vectors - 1]);
+				break;
+			default:
+				store_lanes<4>(destination + ((vectors - 1) * 4), acc[vectors - 1]);
+				break;
+			}
+
+			source += source_channels;
+			destination += target_channels;
+		}
+	}
+
+#define MIX_SSE_ROW(SRC) { mix_sse<SRC, 1>, mix_sse<SRC, 2>, mix_sse<SRC, 4>, mix_sse<SRC, 6>, mix_sse<SRC, 8> }
+	const mix::kernel sse_kernels[CHANNEL_LAYOUTS][CHANNEL_LAYOUTS] = {
+		MIX_SSE_ROW(1),
+		MIX_SSE_ROW(2),
+		MIX_SSE_ROW(4),
+		MIX_SSE_ROW(6),
+		MIX_SSE_ROW(8),
+	};
+#undef MIX_SSE_ROW
+}
+
+mix::kernel mix::select_kernel(size_t source_channels, size_t target_channels)
+{
+	if (dsp::supported_instruction_set() >= dsp::instruction_set::avx2) {
+		kernel avx2_kernel = avx2::select_kernel(source_channels, target_channels);
+		if (nullptr != avx2_kernel) {
+			return avx2_kernel;
+		}
+	}
+
+	size_t source_index = layout_index(source_channels);
+	size_t target_index = layout_index(target_channels);
+	if (SIZE_MAX != source_index && SIZE_MAX != target_index) {
+		return sse_kernels[source_index][target_index];
+	}
+
+	return mix_sse_any;
+}
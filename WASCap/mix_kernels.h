@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+namespace wascap
+{
+	namespace sink
+	{
+		namespace mix
+		{
+			// Mixing matrices are stored as one column per source channel, each padded to a whole number of 8-float vectors.
+			inline size_t column_stride(size_t target_channels) { return (target_channels + 7) & ~(size_t)7; }
+
+			typedef void (*kernel)(float* destination, const float* source, size_t frames, const float* columns, size_t source_channels, size_t target_channels);
+
+			kernel select_kernel(size_t source_channels, size_t target_channels);
+
+			namespace avx2
+			{
+				// Returns nullptr when there is no AVX2 kernel for this layout pair.
+				kernel select_kernel(size_t source_channels, size_t target_channels);
+			}
+		}
+	}
+}
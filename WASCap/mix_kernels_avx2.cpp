@@ -0,0 +1,70 @@
+#include "stdafx.h"
+
+#include <immintrin.h>
+#include <cstdint>
+
+#include "channel_layouts.h"
+#include "mix_kernels.h"
+
+// This file is compiled with AVX2 code generation, and must only be entered after checking CPU support.
+// Multiplies and adds must not be fused, so that results match the narrower kernels bit for bit; other compilers
+// are told so on their command line.
+#ifdef _MSC_VER
+#pragma fp_contract(off)
+#endif
+
+namespace mix = wascap::sink::mix;
+
+namespace
+{
+	template<size_t SRC, size_t DST>
+	void mix_avx2(float* destination, const float* source, size_t frames, const float* columns, size_t, size_t)
+	{
+		__m256 matrix[SRC];
+		for (size_t s = 0; s < SRC; ++s) {
+			matrix[s] = _mm256_loadu_ps(columns + (s * 8));
+		}
+
+		const __m256i store_mask = _mm256_setr_epi32(
+			(DST > 0) ? -1 : 0, (DST > 1) ? -1 : 0, (DST > 2) ? -1 : 0, (DST > 3) ? -1 : 0,
+			(DST > 4) ? -1 : 0, (DST > 5) ? -1 : 0, (DST > 6) ? -1 : 0, (DST > 7) ? -1 : 0);
+
+		for (size_t i = 0; i < frames; ++i) {
+			// Same operation order as the SSE kernels, so that both produce identical results.
+			__m256 acc = _mm256_mul_ps(_mm256_set1_ps(source[0]), matrix[0]);
+			for (size_t s = 1; s < SRC; ++s) {
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(source[s]), matrix[s]));
+			}
+			if constexpr (DST == 8) {
+				_mm256_storeu_ps(destination, acc);
+			}
+			else {
+				_mm256_maskstore_ps(destination, store_mask, acc);
+			}
+
+			source += SRC;
+			destination += DST;
+		}
+	}
+
+#define MIX_AVX2_ROW(SRC) { mix_avx2<SRC, 1>, mix_avx2<SRC, 2>, mix_avx2<SRC, 4>, mix_avx2<SRC, 6>, mix_avx2<SRC, 8> }
+	const mix::kernel avx2_kernels[CHANNEL_LAYOUTS][CHANNEL_LAYOUTS] = {
+		MIX_AVX2_ROW(1),
+		MIX_AVX2_ROW(2),
+		MIX_AVX2_ROW(4),
+		MIX_AVX2_ROW(6),
+		MIX_AVX2_ROW(8),
+	};
+#undef MIX_AVX2_ROW
+}
+
+mix::kernel mix::avx2::select_kernel(size_t source_channels, size_t target_channels)
+{
+	size_t source_index = layout_index(source_channels);
+	size_t target_index = layout_index(target_channels);
+	if (SIZE_MAX == source_index || SIZE_MAX == target_index) {
+		return nullptr;
+	}
+
+	return avx2_kernels[source_index][target_index];
+}
@@ -1,13 +1,23 @@
 #include "stdafx.h"
 
+#ifdef _WIN32
 #include <windows.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#endif
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #include "network_sink.h"
+#include "shmctl_sink.h"
 #include "wsa_helper.h"
 #include "errors.h"
 #include "string_format.h"
+#include "trace.h"
 
 #define DEFAULT_PEER_ADDRESS "239.255.77.77"
 #define DEFAULT_PEER_SERVICE "4010"
@@ -38,55 +48,93 @@ namespace
 			throw std::domain_error(wascap::util::string_format("Invalid samplerate %d (unrecognized base rate)\n", samplerate));
 		}
 	}
+
+	// UDP sockets by address family, type, protocol and bind address. Every datagram names its peer,
+	// so the senders of all the sessions in a process can share one socket instead of holding one each.
+	typedef std::tuple<int, int, int, std::string> socket_key;
+
+	std::mutex socket_cache_lock;
+	std::map<socket_key, std::weak_ptr<wascap::util::wsa_socket>> socket_cache;
+
+	std::shared_ptr<wascap::util::wsa_socket> shared_socket(wascap::util::shared_wsa wsa, const addrinfo& peer_addr, const std::string& bind_address, const addrinfo& hints)
+	{
+		std::lock_guard<std::mutex> lock(socket_cache_lock);
+
+		socket_key key(peer_addr.ai_family, peer_addr.ai_socktype, peer_addr.ai_protocol, bind_address);
+		std::shared_ptr<wascap::util::wsa_socket> socket = socket_cache[key].lock();
+		if (!socket) {
+			for (auto i = socket_cache.begin(); i != socket_cache.end();) {
+				i = i->second.expired() ? socket_cache.erase(i) : std::next(i);
+			}
+			socket = std::make_shared<wascap::util::wsa_socket>(wsa, peer_addr.ai_family, peer_addr.ai_socktype, peer_addr.ai_protocol);
+			if (!bind_address.empty()) {
+				wascap::util::wsa_addrinfo bind_addr(wsa, bind_address.c_str(), "0", hints);
+				socket->bind(bind_addr.addr());
+			}
+			socket_cache[key] = socket;
+		}
+
+		return socket;
+	}
 }
 
-wascap::sink::network_sink::network_sink(std::unique_ptr<sink> next, util::shared_wsa wsa, const std::string& bind_address, const std::string& peer_address, const std::string& peer_service)
-	: chain_sink(std::move(next)), m_wsa(wsa), m_socket(wsa), m_peername()
+wascap::sink::network_sender::network_sender(util::shared_wsa wsa, size_t samplerate, DWORD channel_mask, const std::string& bind_address, const std::string& peer_address, const std::string& peer_service)
+	: m_wsa(wsa), m_socket(), m_peername(), m_channels(__popcnt(channel_mask)), m_latency("network"), m_shmctl(), m_stats(nullptr)
 {
-	m_header[0] = samplerate_header(samplerate());
+	m_header[0] = samplerate_header(samplerate);
 	m_header[1] = 32;
-	m_header[2] = (char)channels();
-	m_header[3] = (char)(channel_mask() >> 8);
-	m_header[4] = (char)channel_mask();
+	m_header[2] = (char)m_channels;
+	m_header[3] = (char)(channel_mask >> 8);
+	m_header[4] = (char)channel_mask;
 
-	struct addrinfo hints = { 0 };
+	struct addrinfo hints = {};
 
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_DGRAM;
 	hints.ai_protocol = IPPROTO_UDP;
 
-	{
-		util::wsa_addrinfo peer_addr(wsa, peer_address.empty() ? DEFAULT_PEER_ADDRESS : peer_address.c_str(), peer_service.empty() ? DEFAULT_PEER_SERVICE : peer_service.c_str(), hints);
-		m_socket = util::wsa_socket(wsa, peer_addr->ai_family, peer_addr->ai_socktype, peer_addr->ai_protocol);
-		m_peername << peer_addr.addr();
-	}
-
-	if (!bind_address.empty()) {
-		util::wsa_addrinfo bind_addr(wsa, bind_address.c_str(), "0", hints);
-		m_socket.bind(bind_addr.addr());
-	}
+	util::wsa_addrinfo peer_addr(wsa, peer_address.empty() ? DEFAULT_PEER_ADDRESS : peer_address.c_str(), peer_service.empty() ? DEFAULT_PEER_SERVICE : peer_service.c_str(), hints);
+	m_socket = shared_socket(wsa, *peer_addr, bind_address, hints);
+	m_peername << peer_addr.addr();
 }
 
-void wascap::sink::network_sink::send(const util::span<const char>& data)
+void wascap::sink::network_sender::send(const util::span<const char>& data)
 {
-	m_socket.sendto(data, 0, util::make_span(m_peername));
+	WASCAP_TRACE_SPAN("network", "sendto");
+
+	if (nullptr == m_stats) {
+		m_socket->sendto(data, 0, util::make_span(m_peername));
+		return;
+	}
+
+	try {
+		m_socket->sendto(data, 0, util::make_span(m_peername));
+	}
+	catch (...) {
+		m_stats->send_errors.fetch_add(1, std::memory_order_relaxed);
+		throw;
+	}
+	// Senders of several branches may share the counters, each on its own thread.
+	m_stats->packets.fetch_add(1, std::memory_order_relaxed);
+	m_stats->bytes.fetch_add(data.size(), std::memory_order_relaxed);
 }
 
-bool wascap::sink::network_sink::can_play() const
+void wascap::sink::network_sender::publish_stats(const std::shared_ptr<shmctl::shmctl>& shmctl)
 {
-	return true;
+	m_shmctl = shmctl;
+	m_stats = &shmctl->get()->stats.network;
 }
 
-bool wascap::sink::network_sink::is_playing() const
+void wascap::sink::network_sender::begin_block(const block_info& info)
 {
-	return true;
+	m_latency.begin_block(info);
 }
 
-bool wascap::sink::network_sink::process(const float* samples, size_t frames)
+void wascap::sink::network_sender::send(const float* samples, size_t frames)
 {
-	size_t max_samples = MAX_PAYLOAD_SAMPLES - MAX_PAYLOAD_SAMPLES % channels();
+	size_t max_samples = MAX_PAYLOAD_SAMPLES - MAX_PAYLOAD_SAMPLES % m_channels;
 	const float* cur_samples = samples;
-	size_t n_samples = frames * channels();
+	size_t n_samples = frames * m_channels;
 
 	char buffer[sizeof(m_header) + (MAX_PAYLOAD_SAMPLES << 2)];
 	memcpy(buffer, m_header, sizeof(m_header));
@@ -101,6 +149,43 @@ bool wascap::sink::network_sink::process(const float* samples, size_t frames)
 		send(util::make_span(buffer, sizeof(m_header) + (n_samples << 2)));
 	}
 
+	m_latency.record();
+}
+
+wascap::sink::network_sink::network_sink(std::unique_ptr<sink> next, util::shared_wsa wsa, const std::string& bind_address, const std::string& peer_address, const std::string& peer_service)
+	: chain_sink(std::move(next)), m_sender(wsa, samplerate(), channel_mask(), bind_address, peer_address, peer_service)
+{
+	require_layout(frame_layout::interleaved);
+}
+
+bool wascap::sink::network_sink::can_play() const
+{
+	return true;
+}
+
+bool wascap::sink::network_sink::is_playing() const
+{
+	return true;
+}
+
+void wascap::sink::network_sink::latency_meters(std::vector<const latency_meter*>& meters) const
+{
+	meters.push_back(&m_sender.latency());
+
+	chain_sink::latency_meters(meters);
+}
+
+void wascap::sink::network_sink::begin_block(const block_info& info)
+{
+	m_sender.begin_block(info);
+
+	chain_sink::begin_block(info);
+}
+
+bool wascap::sink::network_sink::process(const float* samples, size_t frames)
+{
+	m_sender.send(samples, frames);
+
 	return chain_sink::process(samples, frames);
 }
 
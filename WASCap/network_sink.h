@@ -4,21 +4,52 @@
 #include <vector>
 
 #include "base_sink.h"
+#include "latency_meter.h"
+#include "no_copy.h"
 #include "wsa_helper.h"
 
 namespace wascap
 {
+	namespace shmctl
+	{
+		class shmctl;
+		struct shm_network_stats;
+	}
+
 	namespace sink
 	{
-		class network_sink : public chain_sink
+		// Sends frames to a peer as UDP datagrams, each with a header describing the format.
+		class network_sender : public util::no_copy_no_move
 		{
 			util::shared_wsa m_wsa;
-			util::wsa_socket m_socket;
+			// Shared with the other senders of the process that use the same address family and bind address.
+			std::shared_ptr<util::wsa_socket> m_socket;
 			std::vector<char> m_peername;
 			char m_header[5];
+			size_t m_channels;
+			latency_meter m_latency;
+			// Where the datagrams sent are counted, when a control block publishes them.
+			std::shared_ptr<shmctl::shmctl> m_shmctl;
+			volatile shmctl::shm_network_stats* m_stats;
 
 			void send(const util::span<const char>& data);
 
+		public:
+			network_sender(util::shared_wsa wsa, size_t samplerate, DWORD channel_mask, const std::string& bind_address, const std::string& peer_address, const std::string& peer_service);
+
+			inline const latency_meter& latency() const { return m_latency; }
+
+			// Counts the datagrams sent from now on in the statistics of the control block.
+			void publish_stats(const std::shared_ptr<shmctl::shmctl>& shmctl);
+
+			void begin_block(const block_info& info);
+			void send(const float* samples, size_t frames);
+		};
+
+		class network_sink : public chain_sink
+		{
+			network_sender m_sender;
+
 		public:
 			network_sink(std::unique_ptr<sink> next, util::shared_wsa wsa, const std::string& bind_address, const std::string& peer_address, const std::string& peer_service);
 
@@ -26,8 +57,13 @@ namespace wascap
 
 			virtual bool is_playing() const;
 
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			virtual void begin_block(const block_info& info);
 			virtual bool process(const float* samples, size_t frames);
 
+			inline void publish_stats(const std::shared_ptr<shmctl::shmctl>& shmctl) { m_sender.publish_stats(shmctl); }
+
 			static size_t adjust_samplerate(size_t samplerate);
 		};
 	}
@@ -0,0 +1,171 @@
+#include "stdafx.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "attach_point.h"
+#include "base_sink.h"
+#include "convert_sink.h"
+#include "file_source.h"
+#include "fixture.h"
+#include "stdout_sink.h"
+#include "string_format.h"
+
+// The largest packet that reaches the chain, whatever the file.
+#define OFFLINE_MAX_FRAMES 1024
+
+namespace
+{
+	// Plays whatever reaches it, so that the source keeps going when no other output does.
+	class discard_sink : public wascap::sink::chain_sink
+	{
+	public:
+		discard_sink(std::unique_ptr<sink> next)
+			: chain_sink(std::move(next))
+		{
+		}
+
+		virtual bool can_play() const
+		{
+			return true;
+		}
+
+		virtual bool is_playing() const
+		{
+			return true;
+		}
+	};
+
+	struct offline_arguments
+	{
+		std::string input;
+		size_t raw_samplerate = 0;
+		DWORD raw_channel_mask = 0;
+		size_t samplerate = 0;
+		DWORD channel_mask = 0;
+		wascap::sink::resampler_quality resampler_quality = wascap::sink::resampler_quality::medium;
+		bool to_stdout = false;
+		bool real_time = false;
+		size_t repeat = 1;
+	};
+
+	const char* usage =
+		"Usage: wascap_offline <file|-> [raw <samplerate> <channel-mask>] [samplerate <n>] [channel-mask <mask>]\n"
+		"                      [resampler fast|medium|high] [stdout] [real-time] [repeat <n>]\n"
+		"\n"
+		"Plays a WAV file, or raw 32-bit floats in the given format, through the conversion stages to the given format,\n"
+		"as fast as they go unless real-time is given, and reports the throughput on stderr.\n"
+		"With stdout, the converted frames are written to stdout as raw 32-bit floats.\n";
+
+	void parse_offline_arguments(offline_arguments& arguments, const std::vector<std::string>& args)
+	{
+		auto current = args.begin() + 1;
+		if (current == args.end()) {
+			throw std::invalid_argument("Missing input");
+		}
+		arguments.input = *current++;
+
+		auto next = [&](const char* what) -> const std::string& {
+			if (current == args.end()) {
+				throw std::invalid_argument(wascap::util::string_format("Missing %s", what));
+			}
+			return *current++;
+		};
+
+		while (current != args.end()) {
+			std::string word = *current++;
+			if (word == "raw") {
+				arguments.raw_samplerate = wascap::fixture::parse_number(next("raw samplerate"));
+				arguments.raw_channel_mask = (DWORD)wascap::fixture::parse_number(next("raw channel mask"));
+				if (0 == arguments.raw_samplerate || 0 == arguments.raw_channel_mask) {
+					throw std::invalid_argument("Raw input without frames");
+				}
+			}
+			else if (word == "samplerate") {
+				arguments.samplerate = wascap::fixture::parse_number(next("samplerate"));
+			}
+			else if (word == "channel-mask") {
+				arguments.channel_mask = (DWORD)wascap::fixture::parse_number(next("channel mask"));
+			}
+			else if (word == "resampler") {
+				arguments.resampler_quality = wascap::fixture::parse_resampler_quality(next("resampler quality"));
+			}
+			else if (word == "stdout") {
+				arguments.to_stdout = true;
+			}
+			else if (word == "real-time") {
+				arguments.real_time = true;
+			}
+			else if (word == "repeat") {
+				arguments.repeat = wascap::fixture::parse_number(next("repeat count"));
+				if (0 == arguments.repeat) {
+					throw std::invalid_argument("Repeat count must be positive");
+				}
+			}
+			else {
+				throw std::invalid_argument(wascap::util::string_format("Unrecognized argument: %s", word));
+			}
+		}
+
+		if (arguments.repeat > 1 && arguments.input == "-") {
+			throw std::invalid_argument("Standard input cannot be repeated");
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	namespace sink = wascap::sink;
+	namespace source = wascap::source;
+
+	offline_arguments arguments;
+	try {
+		parse_offline_arguments(arguments, std::vector<std::string>(argv, argv + argc));
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n\n%s", e.what(), usage);
+		return 2;
+	}
+
+	try {
+		std::unique_ptr<source::file_source> file = std::make_unique<source::file_source>(arguments.input, arguments.raw_samplerate, arguments.raw_channel_mask, arguments.real_time);
+		size_t samplerate = (0 == arguments.samplerate) ? file->samplerate() : arguments.samplerate;
+		DWORD channel_mask = (0 == arguments.channel_mask) ? file->channel_mask() : arguments.channel_mask;
+
+		std::unique_ptr<sink::sink> chain = std::make_unique<sink::null_sink>(samplerate, channel_mask);
+		if (arguments.to_stdout) {
+			chain = std::make_unique<sink::stdout_sink>(std::move(chain));
+		}
+		else {
+			chain = std::make_unique<discard_sink>(std::move(chain));
+		}
+		sink::attach_point attach_point(std::move(chain), OFFLINE_MAX_FRAMES, arguments.resampler_quality);
+
+		// Each pass plays the whole file from a fresh source, through the same chain.
+		size_t frames = 0;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t pass = 0; pass < arguments.repeat; ++pass) {
+			if (pass > 0) {
+				file = std::make_unique<source::file_source>(arguments.input, arguments.raw_samplerate, arguments.raw_channel_mask, arguments.real_time);
+			}
+			sink::sink& head = attach_point.attach(file->samplerate(), file->channel_mask(), file->max_packet_frames());
+			file->run(head, SIZE_MAX);
+			frames += file->position();
+		}
+		double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double audio_s = (double)frames / (double)file->samplerate();
+		fprintf(stderr, "%zu frames at %zu Hz 0x%x -> %zu Hz 0x%x\n", frames, file->samplerate(), (unsigned int)file->channel_mask(), samplerate, (unsigned int)channel_mask);
+		fprintf(stderr, "%.3f s of audio in %.3f s: %.1fx real time, %.0f frames/s\n", audio_s, elapsed_s, (elapsed_s > 0.0) ? (audio_s / elapsed_s) : 0.0, (elapsed_s > 0.0) ? ((double)frames / elapsed_s) : 0.0);
+	}
+	catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "stdafx.h"
 
 #include <intrin.h>
+#include <cctype>
+#include <fstream>
+#include <set>
 #include <sstream>
 
 #include "main.h"
@@ -34,6 +37,12 @@ namespace
 		else if (word == "capture") {
 			return wascap::capture;
 		}
+		else if (word == "serve") {
+			return wascap::serve;
+		}
+		else if (word == "host") {
+			return wascap::host;
+		}
 		else {
 			throw wascap::bad_arguments(wascap::util::string_format("Unrecognized verb: %s", word));
 		}
@@ -93,6 +102,259 @@ namespace
 		}
 	}
 
+	wascap::sink::resampler_quality parse_resampler_quality(const std::string& word)
+	{
+		if (word == "fast") {
+			return wascap::sink::resampler_quality::fast;
+		}
+		else if (word == "medium") {
+			return wascap::sink::resampler_quality::medium;
+		}
+		else if (word == "high") {
+			return wascap::sink::resampler_quality::high;
+		}
+		else {
+			throw wascap::bad_arguments(wascap::util::string_format("Unrecognized resampler quality: %s", word));
+		}
+	}
+
+	wascap::sink::overflow_policy parse_overflow_policy(const std::string& word)
+	{
+		if (word == "drop-oldest") {
+			return wascap::sink::overflow_policy::drop_oldest;
+		}
+		else if (word == "drop-newest") {
+			return wascap::sink::overflow_policy::drop_newest;
+		}
+		else if (word == "block") {
+			return wascap::sink::overflow_policy::block;
+		}
+		else {
+			throw wascap::bad_arguments(wascap::util::string_format("Unrecognized queue overflow policy: %s", word));
+		}
+	}
+
+	std::vector<float> parse_mixing_matrix(const std::string& word)
+	{
+		std::vector<float> coefficients;
+		size_t columns = 0;
+
+		std::istringstream rows(word);
+		std::string row;
+		while (std::getline(rows, row, ';')) {
+			std::istringstream values(row);
+			std::string value;
+			size_t n_values = 0;
+			while (std::getline(values, value, ',')) {
+				coefficients.push_back(std::stof(value));
+				++n_values;
+			}
+			parse_assert(n_values > 0, "Empty mixing matrix row");
+			parse_assert(columns == 0 || columns == n_values, "Mixing matrix rows have different lengths");
+			columns = n_values;
+		}
+		parse_assert(!coefficients.empty(), "Empty mixing matrix");
+
+		return coefficients;
+	}
+
+	DWORD parse_channels(const std::string& word)
+	{
+		int channels = std::stoi(word);
+		parse_assert(0 < channels, wascap::util::string_format("Too few channels: %d", channels));
+		parse_assert(channels <= wascap::sink::MAX_CHANNELS, wascap::util::string_format("Too many channels: %d", channels));
+
+		return (channels == wascap::sink::MAX_CHANNELS) ? -1 : ((1U << channels) - 1);
+	}
+
+	DWORD parse_channel_mask(const std::string& word)
+	{
+		DWORD channel_mask = std::stoi(word);
+		int channels = __popcnt(channel_mask);
+		parse_assert(0 < channels, wascap::util::string_format("Too few channels: %d", channels));
+		parse_assert(channels <= wascap::sink::MAX_CHANNELS, wascap::util::string_format("Too many channels: %d", channels));
+
+		return channel_mask;
+	}
+
+	// Splits a graph description at white space, with brackets and bars as words of their own, and comments left out.
+	std::vector<std::string> split_graph_words(const std::string& description)
+	{
+		std::vector<std::string> words;
+		std::string word;
+		bool in_comment = false;
+		for (char c : description) {
+			if (in_comment) {
+				in_comment = c != '\n';
+				continue;
+			}
+			if (c == '#' || c == '[' || c == '|' || c == ']' || isspace((unsigned char)c)) {
+				if (!word.empty()) {
+					words.push_back(word);
+					word.clear();
+				}
+				if (c == '#') {
+					in_comment = true;
+				}
+				else if (!isspace((unsigned char)c)) {
+					words.push_back(std::string(1, c));
+				}
+			}
+			else {
+				word.push_back(c);
+			}
+		}
+		if (!word.empty()) {
+			words.push_back(word);
+		}
+
+		return words;
+	}
+
+	wascap::graph_node parse_graph_node(const std::string& word)
+	{
+		size_t equals = word.find('=');
+		std::string name = word.substr(0, equals);
+		bool has_value = equals != std::string::npos;
+		std::string value = has_value ? word.substr(equals + 1) : std::string();
+
+		wascap::graph_node node;
+		if (name == "flow-control" || name == "averaging" || name == "volume" || name == "tap" || name == "stdout") {
+			parse_assert(!has_value, wascap::util::string_format("Graph stage %s takes no parameter", name));
+			node.stage = (name == "flow-control") ? wascap::graph_stage::flow_control
+				: (name == "averaging") ? wascap::graph_stage::averaging
+				: (name == "volume") ? wascap::graph_stage::volume
+				: (name == "tap") ? wascap::graph_stage::tap
+				: wascap::graph_stage::to_stdout;
+		}
+		else if (name == "samplerate") {
+			parse_assert(has_value, "Expected graph sample rate");
+			node.stage = wascap::graph_stage::samplerate;
+			int samplerate = std::stoi(value);
+			parse_assert(0 < samplerate, wascap::util::string_format("Graph sample rate must be positive: %d", samplerate));
+			node.samplerate = samplerate;
+		}
+		else if (name == "channels") {
+			parse_assert(has_value, "Expected graph channel count");
+			node.stage = wascap::graph_stage::channels;
+			node.channel_mask = parse_channels(value);
+		}
+		else if (name == "channel-mask") {
+			parse_assert(has_value, "Expected graph channel mask");
+			node.stage = wascap::graph_stage::channels;
+			node.channel_mask = parse_channel_mask(value);
+		}
+		else if (name == "queue") {
+			node.stage = wascap::graph_stage::queue;
+			if (has_value) {
+				node.queue_ms = std::stof(value);
+				parse_assert(0.0f <= node.queue_ms, "Negative graph queue length");
+			}
+		}
+		else if (name == "network") {
+			node.stage = wascap::graph_stage::network;
+			if (has_value) {
+				size_t comma = value.rfind(',');
+				parse_assert(comma != std::string::npos, "Expected graph network peer as address,service");
+				node.peer_address = value.substr(0, comma);
+				node.peer_service = value.substr(comma + 1);
+			}
+		}
+		else if (name == "was") {
+			node.stage = wascap::graph_stage::was;
+			if (has_value) {
+				node.role = parse_role(value);
+			}
+		}
+		else if (name == "was-dev") {
+			parse_assert(has_value, "Expected graph WAS sink device ID");
+			node.stage = wascap::graph_stage::was;
+			node.device = value;
+		}
+		else {
+			throw wascap::bad_arguments(wascap::util::string_format("Unrecognized graph stage: %s", name));
+		}
+
+		return node;
+	}
+
+	// Parses stages up to the end of the branch, which is the next bar or closing bracket at this level.
+	wascap::graph_sequence parse_graph_sequence(std::vector<std::string>::const_iterator& current, std::vector<std::string>::const_iterator end, std::set<wascap::graph_stage>& unique_stages)
+	{
+		wascap::graph_sequence sequence;
+		while (current != end && *current != "|" && *current != "]") {
+			parse_assert(sequence.empty() || (sequence.back().stage != wascap::graph_stage::was && sequence.back().stage != wascap::graph_stage::tee), "Graph branches end at a WAS sink or a tee");
+
+			if (*current == "[") {
+				wascap::graph_node node;
+				node.stage = wascap::graph_stage::tee;
+				do {
+					++current;
+					node.branches.push_back(parse_graph_sequence(current, end, unique_stages));
+				} while (current != end && *current == "|");
+				parse_assert(current != end, "Expected ] at the end of graph branches");
+				++current;
+				parse_assert(node.branches.size() > 1, "A tee takes at least two graph branches");
+				sequence.push_back(std::move(node));
+			}
+			else {
+				sequence.push_back(parse_graph_node(*current++));
+			}
+
+			switch (sequence.back().stage) {
+			case wascap::graph_stage::flow_control:
+			case wascap::graph_stage::averaging:
+			case wascap::graph_stage::volume:
+			case wascap::graph_stage::tap:
+			case wascap::graph_stage::to_stdout:
+				// These share the shared memory block or the standard output, so each may only appear once.
+				parse_assert(unique_stages.insert(sequence.back().stage).second, "Duplicate graph stage");
+				break;
+			default:
+				break;
+			}
+		}
+		parse_assert(!sequence.empty(), "Empty graph branch");
+
+		return sequence;
+	}
+
+	wascap::graph_sequence parse_graph(const std::string& description)
+	{
+		std::vector<std::string> words = split_graph_words(description);
+		std::vector<std::string>::const_iterator current = words.cbegin();
+		std::set<wascap::graph_stage> unique_stages;
+
+		wascap::graph_sequence graph = parse_graph_sequence(current, words.cend(), unique_stages);
+		parse_assert(current == words.cend(), wascap::util::string_format("Unexpected %s in graph", (current != words.cend()) ? *current : std::string()));
+
+		return graph;
+	}
+
+	bool graph_uses_shm(const wascap::graph_sequence& graph)
+	{
+		for (const wascap::graph_node& node : graph) {
+			switch (node.stage) {
+			case wascap::graph_stage::flow_control:
+			case wascap::graph_stage::averaging:
+			case wascap::graph_stage::volume:
+			case wascap::graph_stage::tap:
+				return true;
+			case wascap::graph_stage::tee:
+				for (const wascap::graph_sequence& branch : node.branches) {
+					if (graph_uses_shm(branch)) {
+						return true;
+					}
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		return false;
+	}
+
 	void parse_list_arguments(wascap::command_line_arguments& arguments, std::vector<std::string>::const_iterator& current, std::vector<std::string>::const_iterator end)
 	{
 		if (current != end) {
@@ -110,13 +372,31 @@ namespace
 		}
 	}
 
-	void parse_capture_arguments(wascap::command_line_arguments& arguments, std::vector<std::string>::const_iterator& current, std::vector<std::string>::const_iterator end)
+	// With chain_only, rejects the options that a running capture cannot change.
+	HANDLE parse_handle(const std::string& word)
+	{
+		static_assert(sizeof(HANDLE) == 8 || sizeof(HANDLE) == 4);
+		if constexpr (sizeof(HANDLE) == 8) {
+			return (HANDLE)std::stoll(word);
+		}
+		else if constexpr (sizeof(HANDLE) == 4) {
+			return (HANDLE)std::stoi(word);
+		}
+	}
+
+	void parse_capture_arguments(wascap::command_line_arguments& arguments, std::vector<std::string>::const_iterator& current, std::vector<std::string>::const_iterator end, bool chain_only)
 	{
 		bool explicit_source = false;
+		bool explicit_resampler = false;
+		bool explicit_output_queue = false;
+		bool explicit_queue_overflow = false;
 
 		for (; current != end; ++current) {
 			const std::string& word = *current;
-			if (word == "shm") {
+			if (chain_only && (word == "from-was-dev" || word == "from-was" || word == "duration" || word == "lifetime" || word == "trace")) {
+				throw wascap::bad_arguments(wascap::util::string_format("Option cannot change while serving: %s", word));
+			}
+			else if (word == "shm") {
 				parse_assert(arguments.shm_name.empty(), "Duplicate shared memory specification");
 				parse_assert(++current != end, "Expected shared memory name");
 				arguments.shm_name = *current;
@@ -157,21 +437,52 @@ namespace
 				parse_assert(++current != end, "Expected sample rate");
 				arguments.samplerate = std::stoi(*current);
 			}
+			else if (word == "resampler") {
+				parse_assert(!explicit_resampler, "Duplicate resampler specification");
+				explicit_resampler = true;
+				parse_assert(++current != end, "Expected resampler quality");
+				arguments.resampler_quality = parse_resampler_quality(*current);
+			}
+			else if (word == "mixing-matrix") {
+				parse_assert(arguments.mixing_matrix.empty(), "Duplicate mixing matrix specification");
+				parse_assert(++current != end, "Expected mixing matrix");
+				arguments.mixing_matrix = parse_mixing_matrix(*current);
+			}
+			else if (word == "planar") {
+				parse_assert(!arguments.planar_frames, "Duplicate planar frames specification");
+				arguments.planar_frames = true;
+			}
+			else if (word == "no-compiled-pipeline") {
+				parse_assert(arguments.with_compiled_pipeline, "Duplicate compiled pipeline specification");
+				arguments.with_compiled_pipeline = false;
+			}
 			else if (word == "channels") {
 				parse_assert(arguments.channel_mask == 0, "Duplicate channel specification");
 				parse_assert(++current != end, "Expected channel count");
-				int channels = std::stoi(*current);
-				parse_assert(0 < channels, wascap::util::string_format("Too few channels: %d", channels));
-				parse_assert(channels <= wascap::sink::MAX_CHANNELS, wascap::util::string_format("Too many channels: %d", channels));
-				arguments.channel_mask = (channels == wascap::sink::MAX_CHANNELS) ? -1 : ((1U << channels) - 1);
+				arguments.channel_mask = parse_channels(*current);
 			}
 			else if (word == "channel-mask") {
 				parse_assert(arguments.channel_mask == 0, "Duplicate channel specification");
 				parse_assert(++current != end, "Expected channel mask");
-				arguments.channel_mask = std::stoi(*current);
-				int channels = __popcnt(arguments.channel_mask);
-				parse_assert(0 < channels, wascap::util::string_format("Too few channels: %d", channels));
-				parse_assert(channels <= wascap::sink::MAX_CHANNELS, wascap::util::string_format("Too many channels: %d", channels));
+				arguments.channel_mask = parse_channel_mask(*current);
+			}
+			else if (word == "graph") {
+				parse_assert(arguments.graph.empty(), "Duplicate graph specification");
+				parse_assert(++current != end, "Expected graph description");
+				arguments.graph = parse_graph(*current);
+			}
+			else if (word == "graph-file") {
+				parse_assert(arguments.graph.empty(), "Duplicate graph specification");
+				parse_assert(++current != end, "Expected graph file path");
+				std::ifstream file(*current);
+				parse_assert(!!file, wascap::util::string_format("Unable to read graph file: %s", *current));
+				std::ostringstream description;
+				description << file.rdbuf();
+				arguments.graph = parse_graph(description.str());
+			}
+			else if (word == "compensate-drift") {
+				parse_assert(!arguments.with_drift_compensation, "Duplicate drift compensation specification");
+				arguments.with_drift_compensation = true;
 			}
 			else if (word == "to-network") {
 				parse_assert(!arguments.with_network_sink, "Duplicate network sink specification");
@@ -189,6 +500,23 @@ namespace
 				parse_assert(!arguments.with_stdout_sink, "Duplicate standard output sink specification");
 				arguments.with_stdout_sink = true;
 			}
+			else if (word == "serial-outputs") {
+				parse_assert(arguments.parallel_outputs, "Duplicate serial outputs specification");
+				arguments.parallel_outputs = false;
+			}
+			else if (word == "output-queue") {
+				parse_assert(!explicit_output_queue, "Duplicate output queue specification");
+				explicit_output_queue = true;
+				parse_assert(++current != end, "Expected output queue length in milliseconds");
+				arguments.output_queue_ms = std::stof(*current);
+				parse_assert(0.0f <= arguments.output_queue_ms, "Negative output queue length");
+			}
+			else if (word == "queue-overflow") {
+				parse_assert(!explicit_queue_overflow, "Duplicate queue overflow specification");
+				explicit_queue_overflow = true;
+				parse_assert(++current != end, "Expected queue overflow policy");
+				arguments.queue_overflow = parse_overflow_policy(*current);
+			}
 			else if (word == "no-shm-tap") {
 				parse_assert(arguments.with_shm_tap_sink, "Duplicate shared memory tap specification");
 				arguments.with_shm_tap_sink = false;
@@ -205,13 +533,125 @@ namespace
 			else if (word == "lifetime") {
 				parse_assert(arguments.lifetime_process == nullptr, "Duplicate lifetime process handle specification");
 				parse_assert(++current != end, "Expected process handle");
-				static_assert(sizeof(HANDLE) == 8 || sizeof(HANDLE) == 4);
-				if constexpr (sizeof(HANDLE) == 8) {
-					arguments.lifetime_process = (HANDLE)std::stoll(*current);
+				arguments.lifetime_process = parse_handle(*current);
+			}
+			else if (word == "trace") {
+				parse_assert(arguments.trace_path.empty(), "Duplicate trace specification");
+				parse_assert(++current != end, "Expected trace file path");
+				arguments.trace_path = *current;
+			}
+			else {
+				throw wascap::bad_arguments(wascap::util::string_format("Unrecognized option: %s", word));
+			}
+		}
+
+		if (!arguments.graph.empty()) {
+			parse_assert(!arguments.with_was_sink && !arguments.with_network_sink && !arguments.with_stdout_sink, "Outputs go in the graph when there is one");
+			parse_assert(arguments.with_shm_tap_sink && arguments.with_shm_averaging_sink, "Shared memory stages go in the graph when there is one");
+			parse_assert(arguments.parallel_outputs, "Graph outputs are serial unless in branches");
+			parse_assert(!arguments.planar_frames, "Graphs take interleaved frames");
+			parse_assert(!arguments.shm_name.empty() || !graph_uses_shm(arguments.graph), "Graph stages flow-control, averaging, volume and tap need shared memory");
+		}
+	}
+
+	void parse_serve_arguments(wascap::command_line_arguments& arguments, std::vector<std::string>::const_iterator& current, std::vector<std::string>::const_iterator end)
+	{
+		parse_assert(current != end, "Expected control pipe name");
+		arguments.control_pipe = *current++;
+
+		if (current != end && *current == "crossfade") {
+			parse_assert(++current != end, "Expected crossfade length in milliseconds");
+			arguments.crossfade_ms = std::stof(*current++);
+			parse_assert(0.0f <= arguments.crossfade_ms, "Negative crossfade length");
+		}
+
+		parse_capture_arguments(arguments, current, end, false);
+		parse_assert(arguments.duration == INFINITY, "Serving lasts until stopped");
+	}
+
+	// Splits a line at white space, except between double quotes.
+	std::vector<std::string> split_command_line(const std::string& line)
+	{
+		std::vector<std::string> words;
+		std::string word;
+		bool in_word = false;
+		bool in_quotes = false;
+		for (char c : line) {
+			if (c == '"') {
+				in_quotes = !in_quotes;
+				in_word = true;
+			}
+			else if (!in_quotes && isspace((unsigned char)c)) {
+				if (in_word) {
+					words.push_back(word);
+					word.clear();
+					in_word = false;
 				}
-				else if constexpr (sizeof(HANDLE) == 4) {
-					arguments.lifetime_process = (HANDLE)std::stoi(*current);
+			}
+			else {
+				word.push_back(c);
+				in_word = true;
+			}
+		}
+		parse_assert(!in_quotes, "Unterminated quotes");
+		if (in_word) {
+			words.push_back(word);
+		}
+
+		return words;
+	}
+
+	// Each line of the session file holds the capture options of a session; empty lines and lines starting with # are skipped.
+	void parse_host_arguments(wascap::command_line_arguments& arguments, std::vector<std::string>::const_iterator& current, std::vector<std::string>::const_iterator end)
+	{
+		parse_assert(current != end, "Expected session file path");
+		{
+			std::ifstream file(*current);
+			parse_assert(!!file, wascap::util::string_format("Unable to read session file: %s", *current));
+
+			std::string line;
+			for (size_t line_number = 1; std::getline(file, line); ++line_number) {
+				size_t first = line.find_first_not_of(" \t\r");
+				if (first == std::string::npos || line[first] == '#') {
+					continue;
+				}
+
+				wascap::command_line_arguments session;
+				session.executable = arguments.executable;
+				session.verb = wascap::capture;
+				try {
+					std::vector<std::string> words = split_command_line(line);
+					std::vector<std::string>::const_iterator word = words.cbegin();
+					parse_capture_arguments(session, word, words.cend(), false);
+					parse_assert(session.lifetime_process == nullptr, "Sessions share the lifetime of the host");
+					parse_assert(session.trace_path.empty(), "Sessions share the trace of the host");
 				}
+				catch (const std::exception& e) {
+					throw wascap::bad_arguments(wascap::util::string_format("Session file line %zu: %s", line_number, e.what()));
+				}
+				arguments.sessions.push_back(std::move(session));
+			}
+			parse_assert(!arguments.sessions.empty(), "No session in the session file");
+		}
+
+		for (++current; current != end; ++current) {
+			const std::string& word = *current;
+			if (word == "workers") {
+				parse_assert(arguments.host_workers == 0, "Duplicate worker count specification");
+				parse_assert(++current != end, "Expected worker count");
+				int workers = std::stoi(*current);
+				parse_assert(workers > 0, "Expected at least one worker");
+				arguments.host_workers = workers;
+			}
+			else if (word == "lifetime") {
+				parse_assert(arguments.lifetime_process == nullptr, "Duplicate lifetime process handle specification");
+				parse_assert(++current != end, "Expected process handle");
+				arguments.lifetime_process = parse_handle(*current);
+			}
+			else if (word == "trace") {
+				parse_assert(arguments.trace_path.empty(), "Duplicate trace specification");
+				parse_assert(++current != end, "Expected trace file path");
+				arguments.trace_path = *current;
 			}
 			else {
 				throw wascap::bad_arguments(wascap::util::string_format("Unrecognized option: %s", word));
@@ -244,7 +684,13 @@ void wascap::parse_arguments(command_line_arguments& arguments, const std::vecto
 		parse_list_arguments(arguments, current, end);
 		break;
 	case capture:
-		parse_capture_arguments(arguments, current, end);
+		parse_capture_arguments(arguments, current, end, false);
+		break;
+	case serve:
+		parse_serve_arguments(arguments, current, end);
+		break;
+	case host:
+		parse_host_arguments(arguments, current, end);
 		break;
 	default:
 		throw wascap::bad_arguments("Verb not implemented (in argument parser)");
@@ -253,6 +699,27 @@ void wascap::parse_arguments(command_line_arguments& arguments, const std::vecto
 	parse_assert(current == end, "Extra arguments found");
 }
 
+void wascap::parse_chain_arguments(command_line_arguments& arguments, const std::string& line)
+{
+	std::vector<std::string> args = split_command_line(line);
+	std::vector<std::string>::const_iterator current = args.cbegin();
+
+	// Every other option starts over from its default.
+	command_line_arguments chain;
+	chain.executable = arguments.executable;
+	chain.verb = arguments.verb;
+	chain.source_device = arguments.source_device;
+	chain.source_flow = arguments.source_flow;
+	chain.source_role = arguments.source_role;
+	chain.lifetime_process = arguments.lifetime_process;
+	chain.use_message_box = arguments.use_message_box;
+	chain.control_pipe = arguments.control_pipe;
+	chain.crossfade_ms = arguments.crossfade_ms;
+	parse_capture_arguments(chain, current, args.cend(), true);
+
+	arguments = std::move(chain);
+}
+
 int wascap::help_main(const command_line_arguments& arguments, const std::exception* exception)
 {
 	std::ostringstream message;
@@ -0,0 +1,312 @@
+#include "stdafx.h"
+
+#include <cstdio>
+
+#include "channel_layouts.h"
+#include "convert_sink.h"
+#include "mix_kernels.h"
+#include "pipeline_sink.h"
+#include "string_format.h"
+
+// Mixing and averaging must round exactly as the dynamic stages do, so multiplies and adds are not fused: by the
+// pragma with MSVC, and by -ffp-contract=off with the others.
+#ifdef _MSC_VER
+#pragma fp_contract(off)
+#endif
+
+namespace shmctl = wascap::shmctl;
+
+using wascap::sink::sink;
+using wascap::sink::pipeline_sink;
+using wascap::sink::pipeline_stages;
+
+namespace
+{
+	// SRC and CH are the channel counts on both sides of the mapping, which is skipped unless MIX is set.
+	template<size_t SRC, size_t CH, bool MIX>
+	class fused_pipeline_sink : public pipeline_sink
+	{
+		float m_columns[SRC][CH];
+		float m_last[CH];
+		float* m_block;
+
+		// First pass: mixes the frames as the channel mapping kernels do, and averages them as the averaging kernels do.
+		template<bool AVERAGING>
+		void map_frames(float* destination, const float* source, size_t frames, double weight, float* max_amplitudes)
+		{
+			const double rest = 1.0 - weight;
+
+			float last[CH];
+			for (size_t c = 0; c < CH; ++c) {
+				last[c] = m_last[c];
+			}
+
+			for (size_t i = 0; i < frames; ++i) {
+				const float* s = source + (i * SRC);
+				float* d = destination + (i * CH);
+				for (size_t c = 0; c < CH; ++c) {
+					float sample;
+					if constexpr (MIX) {
+						sample = s[0] * m_columns[0][c];
+						for (size_t k = 1; k < SRC; ++k) {
+							sample += s[k] * m_columns[k][c];
+						}
+					}
+					else {
+						sample = s[c];
+					}
+					if constexpr (AVERAGING) {
+						last[c] = (float)(weight * last[c] + rest * sample);
+						sample = last[c];
+					}
+					d[c] = sample;
+
+					if (sample > max_amplitudes[c]) {
+						max_amplitudes[c] = sample;
+					}
+					else if (sample < -max_amplitudes[c]) {
+						max_amplitudes[c] = -sample;
+					}
+				}
+			}
+
+			if constexpr (AVERAGING) {
+				for (size_t c = 0; c < CH; ++c) {
+					m_last[c] = last[c];
+				}
+			}
+		}
+
+	protected:
+		virtual bool is_average_settled() const
+		{
+			if (!with_averaging() || 0.0f == shmctl()->averaging_weight) {
+				return true;
+			}
+
+			for (size_t c = 0; c < CH; ++c) {
+				if (0.0f != m_last[c]) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+	public:
+		fused_pipeline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD source_channel_mask, const float* columns, pipeline_stages&& stages)
+			: pipeline_sink(std::move(next), shmctl, source_channel_mask, std::move(stages)), m_columns { 0.0f }, m_last { 0.0f }, m_block(nullptr)
+		{
+			if constexpr (MIX) {
+				size_t stride = wascap::sink::mix::column_stride(CH);
+				for (size_t k = 0; k < SRC; ++k) {
+					for (size_t c = 0; c < CH; ++c) {
+						m_columns[k][c] = columns[(k * stride) + c];
+					}
+				}
+			}
+		}
+
+		virtual void prepare(wascap::sink::buffer_pool& pool, size_t max_frames)
+		{
+			m_block = pool.allocate(max_frames * CH);
+
+			pipeline_sink::prepare(pool, max_frames);
+		}
+
+		virtual bool process(const float* samples, size_t frames)
+		{
+			if (!shmctl().is_open() || !shmctl().is_playing()) {
+				return false;
+			}
+
+			require_frames(frames);
+
+			double averaging_weight = (with_averaging() && frames > 0) ? (double)shmctl()->averaging_weight : 0.0;
+			float max_amplitudes[CH] = { 0.0f };
+
+			if (0.0 != averaging_weight) {
+				map_frames<true>(m_block, samples, frames, averaging_weight, max_amplitudes);
+
+				return finish(m_block, m_block, frames, max_amplitudes);
+			}
+
+			if constexpr (MIX) {
+				map_frames<false>(m_block, samples, frames, 0.0, max_amplitudes);
+
+				return finish(m_block, m_block, frames, max_amplitudes);
+			}
+			else {
+				kernels().peak(max_amplitudes, samples, frames, CH);
+
+				return finish(samples, m_block, frames, max_amplitudes);
+			}
+		}
+
+		virtual void flush()
+		{
+			for (size_t c = 0; c < CH; ++c) {
+				m_last[c] = 0.0f;
+			}
+
+			pipeline_sink::flush();
+		}
+	};
+
+	typedef std::unique_ptr<sink> (*pipeline_factory)(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD source_channel_mask, const float* columns, pipeline_stages&& stages);
+
+	template<size_t SRC, size_t CH, bool MIX>
+	std::unique_ptr<sink> make_fused_pipeline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD source_channel_mask, const float* columns, pipeline_stages&& stages)
+	{
+		return std::make_unique<fused_pipeline_sink<SRC, CH, MIX>>(std::move(next), shmctl, source_channel_mask, columns, std::move(stages));
+	}
+
+#define MIXING_PIPELINE_ROW(SRC) { make_fused_pipeline_sink<SRC, 1, true>, make_fused_pipeline_sink<SRC, 2, true>, make_fused_pipeline_sink<SRC, 4, true>, make_fused_pipeline_sink<SRC, 6, true>, make_fused_pipeline_sink<SRC, 8, true> }
+	const pipeline_factory mixing_pipelines[CHANNEL_LAYOUTS][CHANNEL_LAYOUTS] = {
+		MIXING_PIPELINE_ROW(1),
+		MIXING_PIPELINE_ROW(2),
+		MIXING_PIPELINE_ROW(4),
+		MIXING_PIPELINE_ROW(6),
+		MIXING_PIPELINE_ROW(8),
+	};
+#undef MIXING_PIPELINE_ROW
+
+	const pipeline_factory plain_pipelines[CHANNEL_LAYOUTS] = { make_fused_pipeline_sink<1, 1, false>, make_fused_pipeline_sink<2, 2, false>, make_fused_pipeline_sink<4, 4, false>, make_fused_pipeline_sink<6, 6, false>, make_fused_pipeline_sink<8, 8, false> };
+}
+
+wascap::sink::pipeline_sink::pipeline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD channel_mask, pipeline_stages&& stages)
+	: shmctl_sink(std::move(next), shmctl, channel_mask), m_control(*shmctl, samplerate(), this->next().channel_mask()), m_channels(this->next().channels()), m_with_averaging(stages.averaging), m_with_tap(stages.tap), m_with_stdout(stages.to_stdout), m_network(std::move(stages.network)), m_kernels(dsp::select_kernels(m_channels)), m_tap_latency("tap"), m_stdout_latency("stdout")
+{
+	require_layout(frame_layout::interleaved);
+}
+
+bool wascap::sink::pipeline_sink::finish(const float* samples, float* block, size_t frames, const float* max_amplitudes)
+{
+	size_t ch = m_channels;
+
+	float channel_gains[MAX_CHANNELS];
+	if (!m_control.update(shmctl(), max_amplitudes, channel_gains)) {
+		return false;
+	}
+
+	bool has_volume_adjustment = false;
+	for (size_t c = 0; c < ch; ++c) {
+		has_volume_adjustment |= 1.0f != channel_gains[c];
+	}
+
+	if (has_volume_adjustment) {
+		m_kernels.gain(block, samples, frames, channel_gains, ch);
+		samples = block;
+	}
+
+	if (m_with_tap) {
+		shmctl().write_tap(samples, frames * ch);
+		shmctl().record_tap_latency(m_tap_latency);
+	}
+	if (m_with_stdout) {
+		fwrite(samples, sizeof(float), frames * ch, stdout);
+		m_stdout_latency.record();
+	}
+	if (m_network) {
+		m_network->send(samples, frames);
+	}
+
+	return chain_sink::process(samples, frames);
+}
+
+bool wascap::sink::pipeline_sink::can_play() const
+{
+	if (m_with_stdout || m_network || chain_sink::can_play()) {
+		return true;
+	}
+
+	return m_with_tap && shmctl().has_tap();
+}
+
+bool wascap::sink::pipeline_sink::is_open() const
+{
+	return chain_sink::is_open() && shmctl().is_open();
+}
+
+bool wascap::sink::pipeline_sink::is_playing() const
+{
+	if (!shmctl().is_playing()) {
+		return false;
+	}
+
+	if (m_with_stdout || m_network || chain_sink::is_playing()) {
+		return true;
+	}
+
+	return m_with_tap && shmctl().has_tap();
+}
+
+void wascap::sink::pipeline_sink::latency_meters(std::vector<const latency_meter*>& meters) const
+{
+	if (m_with_tap) {
+		meters.push_back(&m_tap_latency);
+	}
+	if (m_with_stdout) {
+		meters.push_back(&m_stdout_latency);
+	}
+	if (m_network) {
+		meters.push_back(&m_network->latency());
+	}
+
+	chain_sink::latency_meters(meters);
+}
+
+void wascap::sink::pipeline_sink::begin_block(const block_info& info)
+{
+	m_tap_latency.begin_block(info);
+	m_stdout_latency.begin_block(info);
+	if (m_network) {
+		m_network->begin_block(info);
+	}
+
+	chain_sink::begin_block(info);
+}
+
+bool wascap::sink::pipeline_sink::process_silence(size_t frames)
+{
+	if (!shmctl().is_open() || !shmctl().is_playing()) {
+		return false;
+	}
+
+	if (shmctl()->silence_threshold <= 0.0f || !is_average_settled()) {
+		return sink::process_silence(frames);
+	}
+
+	return m_control.update_silence(shmctl());
+}
+
+void wascap::sink::pipeline_sink::flush()
+{
+	if (m_with_stdout) {
+		fflush(stdout);
+	}
+
+	chain_sink::flush();
+}
+
+bool wascap::sink::has_compiled_pipeline(size_t source_channels, size_t channels)
+{
+	return SIZE_MAX != layout_index(source_channels) && SIZE_MAX != layout_index(channels);
+}
+
+std::unique_ptr<wascap::sink::sink> wascap::sink::make_pipeline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD source_channel_mask, const std::vector<float>& coefficients, pipeline_stages&& stages)
+{
+	size_t source_index = layout_index(__popcnt(source_channel_mask));
+	size_t target_index = layout_index(next->channels());
+	if (SIZE_MAX == source_index || SIZE_MAX == target_index) {
+		throw std::runtime_error(util::string_format("No compiled pipeline for %d source and %d target channels", __popcnt(source_channel_mask), next->channels()));
+	}
+
+	if (coefficients.empty() && source_channel_mask == next->channel_mask()) {
+		return plain_pipelines[target_index](std::move(next), shmctl, source_channel_mask, nullptr, std::move(stages));
+	}
+
+	std::unique_ptr<float[]> columns = channel_convert_sink::mixing_columns(source_channel_mask, next->channel_mask(), coefficients);
+
+	return mixing_pipelines[source_index][target_index](std::move(next), shmctl, source_channel_mask, columns.get(), std::move(stages));
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "base_sink.h"
+#include "dsp_kernels.h"
+#include "network_sink.h"
+#include "shmctl_sink.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		// The optional stages of a compiled pipeline, which run in the same order as in the dynamic chain.
+		struct pipeline_stages
+		{
+			bool averaging = false;
+			bool tap = false;
+			bool to_stdout = false;
+			// Only when no resampler sits between the network output and the stages above it.
+			std::unique_ptr<network_sender> network;
+		};
+
+		// Channel mapping, flow control, averaging, volume and the outputs, fused into one sink.
+		// The volume depends on the peak of the whole block, so each block goes through two passes: one that maps,
+		// averages and measures it into a single scratch buffer, and one that applies the gains and writes the outputs.
+		class pipeline_sink : public shmctl_sink
+		{
+			volume_control m_control;
+			size_t m_channels;
+			bool m_with_averaging;
+			bool m_with_tap;
+			bool m_with_stdout;
+			std::unique_ptr<network_sender> m_network;
+			dsp::kernels m_kernels;
+			latency_meter m_tap_latency;
+			latency_meter m_stdout_latency;
+
+		protected:
+			pipeline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD channel_mask, pipeline_stages&& stages);
+
+			inline bool with_averaging() const { return m_with_averaging; }
+			inline const dsp::kernels& kernels() const { return m_kernels; }
+
+			// Second pass: gains, then outputs. samples may be block, in which case the gains are applied in place.
+			bool finish(const float* samples, float* block, size_t frames, const float* max_amplitudes);
+
+			// Whether zeros would come out of the averaging stage as zeros.
+			virtual bool is_average_settled() const = 0;
+
+		public:
+			virtual bool can_play() const;
+
+			virtual bool is_open() const;
+			virtual bool is_playing() const;
+
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			virtual void begin_block(const block_info& info);
+			// Silence that the volume stage drops is only measured, once the average has settled.
+			virtual bool process_silence(size_t frames);
+			virtual void flush();
+		};
+
+		// Compiled pipelines exist for mono, stereo, quad, 5.1 and 7.1 on both sides.
+		bool has_compiled_pipeline(size_t source_channels, size_t channels);
+
+		// Without coefficients and with the same mask on both sides, the frames go through unmapped.
+		std::unique_ptr<sink> make_pipeline_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD source_channel_mask, const std::vector<float>& coefficients, pipeline_stages&& stages);
+	}
+}
\ No newline at end of file
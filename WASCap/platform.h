@@ -0,0 +1,132 @@
+#pragma once
+
+// The few Windows types and intrinsics the sink engine relies on. On Windows they come from the SDK;
+// elsewhere they are defined here, so that the engine builds on its own.
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <intrin.h>
+
+namespace wascap
+{
+	namespace util
+	{
+		inline void cpuid(int info[4], int leaf, int subleaf)
+		{
+			__cpuidex(info, leaf, subleaf);
+		}
+
+		inline unsigned long long xgetbv(unsigned int index)
+		{
+			return _xgetbv(index);
+		}
+	}
+}
+
+#else
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <thread>
+#include <type_traits>
+
+typedef int BOOL;
+typedef uint32_t DWORD;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define INFINITE 0xFFFFFFFF
+
+union LARGE_INTEGER
+{
+	LONGLONG QuadPart;
+};
+
+inline unsigned int __popcnt(unsigned int value)
+{
+	return (unsigned int)__builtin_popcount(value);
+}
+
+inline unsigned char _BitScanForward(unsigned long* index, unsigned long mask)
+{
+	if (0 == mask) {
+		return 0;
+	}
+	*index = (unsigned long)__builtin_ctzl(mask);
+
+	return 1;
+}
+
+// Like the SDK macros, these take operands of different types and compare them in their common type.
+template<typename T, typename U>
+inline typename std::common_type<T, U>::type min(T a, U b)
+{
+	typedef typename std::common_type<T, U>::type common;
+
+	return ((common)b < (common)a) ? (common)b : (common)a;
+}
+
+template<typename T, typename U>
+inline typename std::common_type<T, U>::type max(T a, U b)
+{
+	typedef typename std::common_type<T, U>::type common;
+
+	return ((common)a < (common)b) ? (common)b : (common)a;
+}
+
+inline void Sleep(DWORD milliseconds)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+inline ULONGLONG GetTickCount64()
+{
+	return (ULONGLONG)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The monotonic clock stands in for the performance counter, in nanoseconds.
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency)
+{
+	frequency->QuadPart = 1000000000;
+
+	return TRUE;
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* counter)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	counter->QuadPart = ((LONGLONG)now.tv_sec * 1000000000) + now.tv_nsec;
+
+	return TRUE;
+}
+
+namespace wascap
+{
+	namespace util
+	{
+		inline void cpuid(int info[4], int leaf, int subleaf)
+		{
+			__asm__ __volatile__("cpuid" : "=a"(info[0]), "=b"(info[1]), "=c"(info[2]), "=d"(info[3]) : "a"(leaf), "c"(subleaf));
+		}
+
+		inline unsigned long long xgetbv(unsigned int index)
+		{
+			unsigned int eax, edx;
+			__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+
+			return ((unsigned long long)edx << 32) | eax;
+		}
+	}
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,279 @@
+#include "stdafx.h"
+
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#include "queue_sink.h"
+#include "trace.h"
+
+wascap::sink::queue_sink::queue_sink(std::unique_ptr<sink> next, size_t capacity_frames, overflow_policy policy)
+	: chain_sink(std::move(next)), m_capacity_frames(capacity_frames), m_policy(policy), m_channels(channels()), m_ring(nullptr), m_scratch(nullptr),
+	m_read(0), m_write(0), m_time_origin(LLONG_MIN), m_position_origin(0), m_discontinuity(SIZE_MAX), m_next_read(0), m_peak_frames(0), m_dropped_frames(0), m_blocked_waits(0), m_flush_requested(false), m_stopping(false), m_failed(false)
+{
+	require_layout(frame_layout::interleaved);
+
+	if (0 == capacity_frames) {
+		throw std::invalid_argument("Queue without capacity");
+	}
+
+	m_thread = std::thread(&queue_sink::thread_proc, this);
+}
+
+wascap::sink::queue_sink::~queue_sink()
+{
+	m_stopping = true;
+	m_data_event.set();
+	m_thread.join();
+}
+
+void wascap::sink::queue_sink::thread_proc()
+{
+	// The chain behind the queue may end in a WAS sink, and the queue only buys time if its consumer keeps up with
+	// the device it feeds.
+	util::audio_thread_scope audio_thread;
+	trace::register_thread();
+
+	for (;;) {
+		m_data_event.wait();
+		if (m_stopping) {
+			break;
+		}
+
+		try {
+			drain();
+			if (m_flush_requested.exchange(false)) {
+				next().flush();
+				m_flushed_event.set();
+			}
+		}
+		catch (...) {
+			// The producer rethrows on its next call; until then, it must not wait for this thread.
+			m_exception = std::current_exception();
+			m_failed = true;
+			m_space_event.set();
+			m_flushed_event.set();
+			break;
+		}
+	}
+}
+
+void wascap::sink::queue_sink::copy_in(size_t position, const float* samples, size_t frames)
+{
+	size_t offset = position % m_capacity_frames;
+	size_t first_frames = min(frames, m_capacity_frames - offset);
+	if (nullptr == samples) {
+		memset(m_ring + (offset * m_channels), 0, first_frames * m_channels * sizeof(float));
+		memset(m_ring, 0, (frames - first_frames) * m_channels * sizeof(float));
+	}
+	else {
+		memcpy(m_ring + (offset * m_channels), samples, first_frames * m_channels * sizeof(float));
+		memcpy(m_ring, samples + (first_frames * m_channels), (frames - first_frames) * m_channels * sizeof(float));
+	}
+}
+
+void wascap::sink::queue_sink::copy_out(float* samples, size_t position, size_t frames) const
+{
+	size_t offset = position % m_capacity_frames;
+	size_t first_frames = min(frames, m_capacity_frames - offset);
+	memcpy(samples, m_ring + (offset * m_channels), first_frames * m_channels * sizeof(float));
+	memcpy(samples + (first_frames * m_channels), m_ring, (frames - first_frames) * m_channels * sizeof(float));
+}
+
+wascap::sink::block_info wascap::sink::queue_sink::dequeued_block_info(size_t position, size_t frames)
+{
+	block_info info;
+
+	LONGLONG time_origin = m_time_origin.load(std::memory_order_relaxed);
+	info.capture_time = (LLONG_MIN == time_origin) ? 0 : (UINT64)(time_origin + (LONGLONG)(position * 10000000.0 / samplerate()));
+	info.stream_position = (UINT64)(m_position_origin.load(std::memory_order_relaxed) + (LONGLONG)position);
+	info.discontinuity = position != m_next_read || m_discontinuity.load(std::memory_order_relaxed) - position < frames;
+	info.silent = false;
+
+	m_next_read = position + frames;
+
+	return info;
+}
+
+void wascap::sink::queue_sink::drain()
+{
+	for (;;) {
+		size_t read = m_read.load(std::memory_order_acquire);
+		size_t write = m_write.load(std::memory_order_acquire);
+		if (read == write) {
+			return;
+		}
+
+		// The frames are copied out before they are released, and only kept if the producer did not drop them meanwhile:
+		// once it has moved the read index past them, it may be overwriting them.
+		size_t frames = min(write - read, max_frames());
+		copy_out(m_scratch, read, frames);
+		if (!m_read.compare_exchange_strong(read, read + frames, std::memory_order_acq_rel)) {
+			continue;
+		}
+		if (overflow_policy::block == m_policy) {
+			m_space_event.set();
+		}
+
+		next().begin_block(dequeued_block_info(read, frames));
+		next().process(m_scratch, frames);
+	}
+}
+
+void wascap::sink::queue_sink::rethrow_failure() const
+{
+	if (m_failed) {
+		std::rethrow_exception(m_exception);
+	}
+}
+
+wascap::sink::queue_stats wascap::sink::queue_sink::stats() const
+{
+	queue_stats stats;
+	stats.capacity_frames = m_capacity_frames;
+	size_t read = m_read.load(std::memory_order_acquire);
+	stats.queued_frames = m_write.load(std::memory_order_acquire) - read;
+	stats.peak_frames = m_peak_frames.load(std::memory_order_relaxed);
+	stats.dropped_frames = m_dropped_frames.load(std::memory_order_relaxed);
+	stats.blocked_waits = m_blocked_waits.load(std::memory_order_relaxed);
+
+	return stats;
+}
+
+void wascap::sink::queue_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	m_ring = pool.allocate(m_capacity_frames * m_channels);
+	m_scratch = pool.allocate(max_frames * m_channels);
+
+	chain_sink::prepare(pool, max_frames);
+}
+
+bool wascap::sink::queue_sink::writable_frames(size_t& frames, DWORD& retry_after_ms) const
+{
+	if (overflow_policy::drop_oldest == m_policy) {
+		return false;
+	}
+
+	size_t queued_frames = m_write.load(std::memory_order_relaxed) - m_read.load(std::memory_order_acquire);
+	frames = m_capacity_frames - queued_frames;
+
+	// The consumer drains the queue at least as fast as the outputs play it.
+	size_t missing_frames = (max_frames() > frames) ? min(max_frames() - frames, queued_frames) : 0;
+	retry_after_ms = (DWORD)(((missing_frames * 1000) + samplerate() - 1) / samplerate());
+
+	return true;
+}
+
+// The producer publishes the origins before the frames, which the consumer reads after them.
+void wascap::sink::queue_sink::begin_block(const block_info& info)
+{
+	size_t write = m_write.load(std::memory_order_relaxed);
+
+	m_time_origin.store((0 == info.capture_time) ? LLONG_MIN : ((LONGLONG)info.capture_time - (LONGLONG)(write * 10000000.0 / samplerate())), std::memory_order_relaxed);
+	m_position_origin.store((LONGLONG)info.stream_position - (LONGLONG)write, std::memory_order_relaxed);
+	if (info.discontinuity) {
+		m_discontinuity.store(write, std::memory_order_relaxed);
+	}
+}
+
+void wascap::sink::queue_sink::enqueue(const float* samples, size_t frames)
+{
+	rethrow_failure();
+
+	const float* cur_samples = samples;
+	size_t n_frames = frames;
+
+	// Whatever happens, only the last capacity frames of the block can survive.
+	if (overflow_policy::drop_oldest == m_policy && n_frames > m_capacity_frames) {
+		size_t dropped_frames = n_frames - m_capacity_frames;
+		m_dropped_frames.fetch_add(dropped_frames, std::memory_order_relaxed);
+		if (nullptr != cur_samples) {
+			cur_samples += dropped_frames * m_channels;
+		}
+		n_frames = m_capacity_frames;
+
+		// The first frame queued comes that much later in the block.
+		LONGLONG time_origin = m_time_origin.load(std::memory_order_relaxed);
+		if (LLONG_MIN != time_origin) {
+			m_time_origin.store(time_origin + (LONGLONG)(dropped_frames * 10000000.0 / samplerate()), std::memory_order_relaxed);
+		}
+		m_position_origin.fetch_add(dropped_frames, std::memory_order_relaxed);
+		m_discontinuity.store(m_write.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+	while (n_frames > 0) {
+		size_t write = m_write.load(std::memory_order_relaxed);
+		size_t read = m_read.load(std::memory_order_acquire);
+		size_t free_frames = m_capacity_frames - (write - read);
+
+		if (free_frames < n_frames) {
+			switch (m_policy) {
+			case overflow_policy::drop_oldest:
+				// Fails when the consumer released frames meanwhile, in which case there may be enough room already.
+				if (!m_read.compare_exchange_strong(read, read + (n_frames - free_frames), std::memory_order_acq_rel)) {
+					continue;
+				}
+				m_dropped_frames.fetch_add(n_frames - free_frames, std::memory_order_relaxed);
+				free_frames = n_frames;
+				break;
+			case overflow_policy::drop_newest:
+				m_dropped_frames.fetch_add(n_frames - free_frames, std::memory_order_relaxed);
+				n_frames = free_frames;
+				// Whatever is queued next no longer follows.
+				m_discontinuity.store(write + free_frames, std::memory_order_relaxed);
+				break;
+			case overflow_policy::block:
+				if (0 == free_frames) {
+					m_blocked_waits.fetch_add(1, std::memory_order_relaxed);
+					m_space_event.wait();
+					rethrow_failure();
+					continue;
+				}
+				break;
+			}
+			if (0 == n_frames) {
+				break;
+			}
+		}
+
+		size_t chunk_frames = min(free_frames, n_frames);
+		copy_in(write, cur_samples, chunk_frames);
+		m_write.store(write + chunk_frames, std::memory_order_release);
+		m_data_event.set();
+
+		size_t queued_frames = write + chunk_frames - m_read.load(std::memory_order_relaxed);
+		if (queued_frames > m_peak_frames.load(std::memory_order_relaxed)) {
+			m_peak_frames.store(queued_frames, std::memory_order_relaxed);
+		}
+
+		if (nullptr != cur_samples) {
+			cur_samples += chunk_frames * m_channels;
+		}
+		n_frames -= chunk_frames;
+	}
+}
+
+bool wascap::sink::queue_sink::process(const float* samples, size_t frames)
+{
+	enqueue(samples, frames);
+
+	return true;
+}
+
+bool wascap::sink::queue_sink::process_silence(size_t frames)
+{
+	enqueue(nullptr, frames);
+
+	return true;
+}
+
+void wascap::sink::queue_sink::flush()
+{
+	rethrow_failure();
+
+	m_flush_requested = true;
+	m_data_event.set();
+	m_flushed_event.wait();
+
+	rethrow_failure();
+}
\ No newline at end of file
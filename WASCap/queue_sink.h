@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+
+#include "base_sink.h"
+#include "thread_helper.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		// What to do with a block that does not fit in the queue.
+		enum class overflow_policy
+		{
+			// Discards the oldest queued frames to make room, which bounds the latency.
+			drop_oldest,
+			// Discards the frames that do not fit.
+			drop_newest,
+			// Waits for room, as if the queue were not there.
+			block,
+		};
+
+		struct queue_stats
+		{
+			size_t capacity_frames;
+			size_t queued_frames;
+			size_t peak_frames;
+			size_t dropped_frames;
+			// How many times a block had to wait for room.
+			size_t blocked_waits;
+		};
+
+		// Decouples a blocking sink from the capture thread: blocks go into a single-producer, single-consumer ring,
+		// and a thread of its own feeds them to the rest of the chain, which only ever runs on that thread.
+		// Queries pass straight through, so the rest of the chain must answer them while it processes.
+		class queue_sink : public chain_sink
+		{
+			size_t m_capacity_frames;
+			overflow_policy m_policy;
+			size_t m_channels;
+			float* m_ring;
+			float* m_scratch;
+
+			// Frame counts since the start, which only grow; positions in the ring are taken modulo the capacity.
+			// The producer also moves the read index when it drops the oldest frames.
+			std::atomic<size_t> m_read;
+			std::atomic<size_t> m_write;
+
+			// Block information is not queued: the consumer extrapolates it from the last block the producer described,
+			// through the capture time and stream position that frame 0 would have had. Positions are only exact when
+			// the queue runs at the source rate.
+			std::atomic<LONGLONG> m_time_origin;
+			std::atomic<LONGLONG> m_position_origin;
+			// Where the last discontinuity was queued, or SIZE_MAX.
+			std::atomic<size_t> m_discontinuity;
+			// Where the consumer expects the next frames, which tells it about the frames dropped meanwhile.
+			size_t m_next_read;
+
+			std::atomic<size_t> m_peak_frames;
+			std::atomic<size_t> m_dropped_frames;
+			std::atomic<size_t> m_blocked_waits;
+
+			std::atomic<bool> m_flush_requested;
+			std::atomic<bool> m_stopping;
+			std::atomic<bool> m_failed;
+			std::exception_ptr m_exception;
+
+			util::auto_reset_event m_data_event;
+			util::auto_reset_event m_space_event;
+			util::auto_reset_event m_flushed_event;
+			std::thread m_thread;
+
+			void thread_proc();
+
+			void copy_in(size_t position, const float* samples, size_t frames);
+			void copy_out(float* samples, size_t position, size_t frames) const;
+			// Without samples, queues zeros.
+			void enqueue(const float* samples, size_t frames);
+			block_info dequeued_block_info(size_t position, size_t frames);
+			void drain();
+			void rethrow_failure() const;
+
+		public:
+			queue_sink(std::unique_ptr<sink> next, size_t capacity_frames, overflow_policy policy);
+			~queue_sink();
+
+			queue_stats stats() const;
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			// The room left in the queue, unless it drops the oldest frames, in which case it never blocks.
+			virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const;
+
+			virtual void begin_block(const block_info& info);
+
+			// Returns once the block is queued, or dropped according to the overflow policy.
+			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
+			// Waits for the queue to drain, then flushes the rest of the chain on its own thread.
+			virtual void flush();
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,294 @@
+#include "stdafx.h"
+
+#ifdef WASCAP_REALTIME_CHECK
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#endif
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <typeinfo>
+
+#include "realtime_check.h"
+
+#ifdef WASCAP_REALTIME_CHECK
+#define REALTIME_BACKTRACE_FRAMES 32
+// Violations past the first of each stage, call and kind are only counted.
+#define REALTIME_MAX_REPORTS 256
+
+namespace
+{
+	std::atomic<size_t> violation_count(0);
+	std::atomic<size_t> allocation_count(0);
+
+	// The innermost stage on the audio path of the thread, and what it was called for.
+	thread_local const wascap::sink::sink* current_stage = nullptr;
+	thread_local const char* current_call = nullptr;
+	// Reports allocate and lock in turn, which must not be reported again.
+	thread_local bool reporting = false;
+
+	struct report_key
+	{
+		const std::type_info* stage;
+		const char* call;
+		const char* what;
+	};
+
+	std::mutex reports_lock;
+	report_key reports[REALTIME_MAX_REPORTS];
+	size_t report_count = 0;
+
+	// Remembers the key, and returns whether it was new and there was room for it.
+	bool first_report(const report_key& key)
+	{
+		std::lock_guard<std::mutex> lock(reports_lock);
+		for (size_t i = 0; i < report_count; ++i) {
+			if (*reports[i].stage == *key.stage && reports[i].call == key.call && reports[i].what == key.what) {
+				return false;
+			}
+		}
+		if (report_count == REALTIME_MAX_REPORTS) {
+			return false;
+		}
+		reports[report_count++] = key;
+
+		return true;
+	}
+
+	void print_stage_name(const std::type_info& type)
+	{
+#ifdef _WIN32
+		fputs(type.name(), stderr);
+#else
+		int status;
+		char* name = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+		fputs((0 == status) ? name : type.name(), stderr);
+		free(name);
+#endif
+	}
+
+	// Without the frames of the report itself.
+	void print_backtrace()
+	{
+		void* frames[REALTIME_BACKTRACE_FRAMES];
+#ifdef _WIN32
+		USHORT count = CaptureStackBackTrace(2, REALTIME_BACKTRACE_FRAMES, frames, nullptr);
+		for (USHORT i = 0; i < count; ++i) {
+			fprintf(stderr, "\t#%u %p\n", (unsigned int)i, frames[i]);
+		}
+#else
+		int count = backtrace(frames, REALTIME_BACKTRACE_FRAMES);
+		if (count > 2) {
+			backtrace_symbols_fd(frames + 2, count - 2, fileno(stderr));
+		}
+#endif
+	}
+}
+
+wascap::realtime::scope::scope(const sink::sink& stage, const char* call)
+	: m_previous_stage(current_stage), m_previous_call(current_call)
+{
+	current_stage = &stage;
+	current_call = call;
+}
+
+wascap::realtime::scope::~scope()
+{
+	current_stage = m_previous_stage;
+	current_call = m_previous_call;
+}
+
+void wascap::realtime::report_violation(const char* what)
+{
+	if (nullptr == current_stage || reporting) {
+		return;
+	}
+
+	reporting = true;
+	violation_count.fetch_add(1, std::memory_order_relaxed);
+
+	report_key key = { &typeid(*current_stage), current_call, what };
+	if (first_report(key)) {
+		fprintf(stderr, "Real-time violation: %s in ", what);
+		print_stage_name(*key.stage);
+		fprintf(stderr, "::%s\n", current_call);
+		print_backtrace();
+	}
+	reporting = false;
+}
+
+size_t wascap::realtime::violations()
+{
+	return violation_count.load(std::memory_order_relaxed);
+}
+
+bool wascap::realtime::is_checking()
+{
+	return true;
+}
+
+size_t wascap::realtime::allocations()
+{
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
+wascap::sink::realtime_check_sink::realtime_check_sink(std::unique_ptr<sink> next)
+	: chain_sink(std::move(next))
+{
+}
+
+void wascap::sink::realtime_check_sink::begin_block(const block_info& info)
+{
+	realtime::scope scope(next(), "begin_block");
+	chain_sink::begin_block(info);
+}
+
+bool wascap::sink::realtime_check_sink::process(const float* samples, size_t frames)
+{
+	realtime::scope scope(next(), "process");
+	return chain_sink::process(samples, frames);
+}
+
+bool wascap::sink::realtime_check_sink::process_silence(size_t frames)
+{
+	realtime::scope scope(next(), "process_silence");
+	return next().process_silence(frames);
+}
+
+void wascap::sink::realtime_check_sink::flush()
+{
+	realtime::scope scope(next(), "flush");
+	chain_sink::flush();
+}
+
+std::unique_ptr<wascap::sink::sink> wascap::sink::realtime_checked(std::unique_ptr<sink> stage)
+{
+	return std::make_unique<realtime_check_sink>(std::move(stage));
+}
+
+// The default forms of new and delete for arrays and without exceptions go through these.
+void* operator new(size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	wascap::realtime::report_violation("allocation");
+
+	void* p = malloc((0 == size) ? 1 : size);
+	if (nullptr == p) {
+		throw std::bad_alloc();
+	}
+
+	return p;
+}
+
+namespace
+{
+	void release(void* p)
+	{
+		if (nullptr != p) {
+			wascap::realtime::report_violation("deallocation");
+		}
+
+		free(p);
+	}
+}
+
+void operator delete(void* p) noexcept
+{
+	release(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	release(p);
+}
+
+#ifndef _WIN32
+// The calls that may block, taken over from the C library for the whole process. Windows has no such interposition.
+namespace
+{
+	void* next_function(std::atomic<void*>& cache, const char* name)
+	{
+		void* f = cache.load(std::memory_order_relaxed);
+		if (nullptr == f) {
+			f = dlsym(RTLD_NEXT, name);
+			cache.store(f, std::memory_order_relaxed);
+		}
+
+		return f;
+	}
+}
+
+#define REALTIME_INTERPOSE(name, ...) \
+	static std::atomic<void*> next_##name(nullptr); \
+	wascap::realtime::report_violation(#name); \
+	return ((decltype(&name))next_function(next_##name, #name))(__VA_ARGS__)
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+{
+	REALTIME_INTERPOSE(pthread_mutex_lock, mutex);
+}
+
+extern "C" int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+	REALTIME_INTERPOSE(pthread_cond_wait, cond, mutex);
+}
+
+extern "C" int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime)
+{
+	REALTIME_INTERPOSE(pthread_cond_timedwait, cond, mutex, abstime);
+}
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 30)
+// What condition variables of the C++ library wait with.
+extern "C" int pthread_cond_clockwait(pthread_cond_t* cond, pthread_mutex_t* mutex, clockid_t clock, const struct timespec* abstime)
+{
+	REALTIME_INTERPOSE(pthread_cond_clockwait, cond, mutex, clock, abstime);
+}
+#endif
+
+extern "C" int nanosleep(const struct timespec* duration, struct timespec* remaining)
+{
+	REALTIME_INTERPOSE(nanosleep, duration, remaining);
+}
+
+extern "C" int clock_nanosleep(clockid_t clock, int flags, const struct timespec* duration, struct timespec* remaining)
+{
+	REALTIME_INTERPOSE(clock_nanosleep, clock, flags, duration, remaining);
+}
+
+extern "C" int usleep(useconds_t microseconds)
+{
+	REALTIME_INTERPOSE(usleep, microseconds);
+}
+#endif
+#else
+size_t wascap::realtime::violations()
+{
+	return 0;
+}
+
+bool wascap::realtime::is_checking()
+{
+	return false;
+}
+
+size_t wascap::realtime::allocations()
+{
+	return 0;
+}
+
+std::unique_ptr<wascap::sink::sink> wascap::sink::realtime_checked(std::unique_ptr<sink> stage)
+{
+	return stage;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+
+#include "base_sink.h"
+#include "no_copy.h"
+
+// Building with WASCAP_REALTIME_CHECK makes every allocation and deallocation, and on Linux every lock, condition wait
+// and sleep, a violation when it happens under a stage that realtime_checked put a check in front of. Each violation
+// is counted, and reported on stderr with the stage and a backtrace the first time it happens there.
+// Other builds check nothing, and the stages run as they are.
+
+namespace wascap
+{
+	namespace realtime
+	{
+#ifdef WASCAP_REALTIME_CHECK
+		// Runs the stage on the audio path of the calling thread until the scope ends, and blames it for violations.
+		class scope : util::no_copy_no_move
+		{
+			const sink::sink* m_previous_stage;
+			const char* m_previous_call;
+
+		public:
+			scope(const sink::sink& stage, const char* call);
+			~scope();
+		};
+
+		// Counts and reports a call that may block or allocate, when a stage is on the audio path of the calling thread.
+		void report_violation(const char* what);
+#endif
+
+		// Violations so far, or 0 when the build does not check.
+		size_t violations();
+		// Whether the build checks, so that harnesses can tell a clean run from an unchecked one.
+		bool is_checking();
+		// Calls to operator new so far, on any thread, or 0 when the build does not check.
+		size_t allocations();
+	}
+
+	namespace sink
+	{
+#ifdef WASCAP_REALTIME_CHECK
+		// Puts the stage behind it on the audio path for each call the sources make on the real-time thread.
+		class realtime_check_sink : public chain_sink
+		{
+		public:
+			realtime_check_sink(std::unique_ptr<sink> next);
+
+			virtual void begin_block(const block_info& info);
+			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
+			virtual void flush();
+		};
+#endif
+
+		// Puts a check in front of the stage in WASCAP_REALTIME_CHECK builds, and returns the stage as it is otherwise.
+		std::unique_ptr<sink> realtime_checked(std::unique_ptr<sink> stage);
+	}
+}
\ No newline at end of file
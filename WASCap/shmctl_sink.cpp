@@ -1,9 +1,11 @@
 #include "stdafx.h"
 
-#include <windows.h>
-#include <vector>
+#include <cstddef>
+#include <cstring>
 
 #include "convert_sink.h"
+#include "deadline_sink.h"
+#include "latency_meter.h"
 #include "shmctl_sink.h"
 #include "errors.h"
 #include "string_format.h"
@@ -12,21 +14,7 @@ namespace shmctl = wascap::shmctl;
 
 namespace
 {
-	float update_weighted_average(float& average, float sample, double alpha)
-	{
-		return average = (float)(alpha * average + (1 - alpha) * sample);
-	}
-
-	void update_max_amplitude(float& max_amplitude, float sample)
-	{
-		if (sample > max_amplitude) {
-			max_amplitude = sample;
-		}
-		else if (sample < -max_amplitude) {
-			max_amplitude = -sample;
-		}
-	}
-
+	// Writes zeros when data is null.
 	void circular_write(char* buffer, size_t capacity, volatile int& cursor, const char* data, size_t length)
 	{
 		size_t cursor_snapshot = cursor;
@@ -35,15 +23,37 @@ namespace
 			if (!segment_length) {
 				break;
 			}
-			memcpy(buffer + cursor_snapshot, data, segment_length);
+			if (nullptr != data) {
+				memcpy(buffer + cursor_snapshot, data, segment_length);
+				data += segment_length;
+			}
+			else {
+				memset(buffer + cursor_snapshot, 0, segment_length);
+			}
 			cursor_snapshot = (cursor_snapshot + segment_length) % capacity;
-			data += segment_length;
 			length -= segment_length;
 		}
 		cursor = cursor_snapshot;
 	}
+
+	// Time the stages measured inside the one running on this thread spent, which is not its own.
+	thread_local UINT64 nested_busy_time = 0;
+
+	size_t time_bucket(UINT64 busy_time)
+	{
+		UINT64 us = busy_time / 10;
+		size_t bucket = 0;
+		while (bucket < SHMCTL_TIME_BUCKETS - 1 && 0 != (us >> bucket)) {
+			++bucket;
+		}
+
+		return bucket;
+	}
 }
 
+static_assert(0 == (offsetof(shmctl::shm_contents, stats) % 8), "The statistics must be aligned for their counters to be atomic");
+
+#ifdef _WIN32
 wascap::shmctl::shmctl::shmctl(const std::string& shm_name)
 	: m_hshm(nullptr), m_shmblock(nullptr)
 {
@@ -63,12 +73,30 @@ wascap::shmctl::shmctl::shmctl(const std::string& shm_name)
 		CloseHandle(m_hshm);
 		throw;
 	}
+
+	reset_stats();
+}
+
+#endif
+
+wascap::shmctl::shmctl::shmctl(volatile shm_contents* shmblock)
+	:
+#ifdef _WIN32
+	m_hshm(nullptr),
+#endif
+	m_shmblock(shmblock)
+{
+	reset_stats();
 }
 
 wascap::shmctl::shmctl::~shmctl()
 {
-	UnmapViewOfFile((LPCVOID)m_shmblock);
-	CloseHandle(m_hshm);
+#ifdef _WIN32
+	if (nullptr != m_hshm) {
+		UnmapViewOfFile((LPCVOID)m_shmblock);
+		CloseHandle(m_hshm);
+	}
+#endif
 }
 
 bool wascap::shmctl::shmctl::is_open() const
@@ -81,11 +109,88 @@ bool wascap::shmctl::shmctl::is_playing() const
 	return (m_shmblock->flags & (SHMCTL_FLAG_INITIALIZED | SHMCTL_FLAG_ENABLED)) == (SHMCTL_FLAG_INITIALIZED | SHMCTL_FLAG_ENABLED) && m_shmblock->master_volume != 0.0f;
 }
 
+bool wascap::shmctl::shmctl::has_tap() const
+{
+	return m_shmblock->tap_capacity > 0;
+}
+
+void wascap::shmctl::shmctl::write_tap(const float* samples, size_t count) const
+{
+	size_t tap_capacity = m_shmblock->tap_capacity;
+	if (tap_capacity > 0) {
+		char* tap_buffer = ((char*)m_shmblock) + m_shmblock->tap_offset;
+		circular_write(tap_buffer, tap_capacity, m_shmblock->tap_write_cursor, (const char*)samples, count * sizeof(float));
+	}
+}
+
+void wascap::shmctl::shmctl::write_tap_silence(size_t count) const
+{
+	size_t tap_capacity = m_shmblock->tap_capacity;
+	if (tap_capacity > 0) {
+		char* tap_buffer = ((char*)m_shmblock) + m_shmblock->tap_offset;
+		circular_write(tap_buffer, tap_capacity, m_shmblock->tap_write_cursor, nullptr, count * sizeof(float));
+	}
+}
+
+void wascap::shmctl::shmctl::record_tap_latency(sink::latency_meter& latency) const
+{
+	double latency_ms = latency.record();
+	if (latency_ms >= 0.0) {
+		m_shmblock->last_frame_latency = (float)latency_ms;
+	}
+}
+
+void wascap::shmctl::shmctl::reset_stats() const
+{
+	volatile shm_stats& stats = m_shmblock->stats;
+	stats.version.store(0, std::memory_order_relaxed);
+	memset((void*)&stats.network, 0, sizeof(stats) - offsetof(shm_stats, network));
+	stats.stage_count.store(0, std::memory_order_relaxed);
+	stats.version.store(SHMCTL_STATS_VERSION, std::memory_order_release);
+}
+
+// Only the thread that builds and destroys chains takes and releases slots, so the free ones stay free meanwhile.
+volatile wascap::shmctl::shm_stage_stats* wascap::shmctl::shmctl::add_stage_stats(const char* name) const
+{
+	volatile shm_stats& stats = m_shmblock->stats;
+	int count = stats.stage_count.load(std::memory_order_relaxed);
+	int index = 0;
+	while (index < count && '\0' != stats.stages[index].name[0]) {
+		++index;
+	}
+	if (index >= SHMCTL_MAX_STAGES) {
+		return nullptr;
+	}
+
+	volatile shm_stage_stats* stage = &stats.stages[index];
+	size_t length = min(strlen(name), (size_t)SHMCTL_STAGE_NAME_LENGTH - 1);
+	memcpy((void*)stage->name, name, length);
+	stage->name[length] = '\0';
+	if (index == count) {
+		stats.stage_count.store(count + 1, std::memory_order_release);
+	}
+
+	return stage;
+}
+
+void wascap::shmctl::shmctl::release_stage_stats(volatile shm_stage_stats* stage) const
+{
+	// The counters first, so that whoever takes the slot next starts from zero.
+	memset((void*)&stage->blocks, 0, sizeof(shm_stage_stats) - offsetof(shm_stage_stats, blocks));
+	std::atomic_thread_fence(std::memory_order_release);
+	memset((void*)stage->name, 0, SHMCTL_STAGE_NAME_LENGTH);
+}
+
 wascap::sink::shmctl_sink::shmctl_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl)
 	: chain_sink(std::move(next)), m_shmctl(shmctl)
 {
 }
 
+wascap::sink::shmctl_sink::shmctl_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD channel_mask)
+	: chain_sink(std::move(next), channel_mask), m_shmctl(shmctl)
+{
+}
+
 wascap::sink::shmctl_flow_control_sink::shmctl_flow_control_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl)
 	: shmctl_sink(std::move(next), shmctl)
 {
@@ -110,9 +215,25 @@ bool wascap::sink::shmctl_flow_control_sink::process(const float* samples, size_
 	return chain_sink::process(samples, frames);
 }
 
+bool wascap::sink::shmctl_flow_control_sink::process_silence(size_t frames)
+{
+	if (!shmctl().is_open() || !shmctl().is_playing()) {
+		return false;
+	}
+
+	return next().process_silence(frames);
+}
+
 wascap::sink::shmctl_averaging_sink::shmctl_averaging_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl)
-	: shmctl_sink(std::move(next), shmctl), m_last { 0.0f }
+	: shmctl_sink(std::move(next), shmctl), m_last { 0.0f }, m_kernels(dsp::select_kernels((frame_layout::planar == layout()) ? 1 : channels())), m_averaged(nullptr)
+{
+}
+
+void wascap::sink::shmctl_averaging_sink::prepare(buffer_pool& pool, size_t max_frames)
 {
+	m_averaged = pool.allocate(max_frames * channels());
+
+	chain_sink::prepare(pool, max_frames);
 }
 
 bool wascap::sink::shmctl_averaging_sink::process(const float* samples, size_t frames)
@@ -122,21 +243,41 @@ bool wascap::sink::shmctl_averaging_sink::process(const float* samples, size_t f
 
 		double averaging_weight = shmblock->averaging_weight;
 		if (0.0 != averaging_weight) {
-			std::vector<float> resamples;
-			resamples.reserve(frames * channels());
-			for (size_t i = 0; i < frames; ++i) {
-				for (size_t c = 0; c < channels(); ++c) {
-					resamples.push_back(update_weighted_average(m_last[c], samples[(i * channels()) + c], averaging_weight));
+			require_frames(frames);
+
+			size_t ch = channels();
+			float* averaged = m_averaged;
+			if (frame_layout::planar == layout()) {
+				for (size_t c = 0; c < ch; ++c) {
+					m_kernels.average(averaged + (c * frames), samples + (c * frames), frames, &m_last[c], averaging_weight, 1);
 				}
 			}
+			else {
+				m_kernels.average(averaged, samples, frames, m_last, averaging_weight, ch);
+			}
 
-			return chain_sink::process(resamples.data(), frames);
+			return chain_sink::process(averaged, frames);
 		}
 	}
 
 	return chain_sink::process(samples, frames);
 }
 
+bool wascap::sink::shmctl_averaging_sink::process_silence(size_t frames)
+{
+	if (0.0f == shmctl()->averaging_weight) {
+		return next().process_silence(frames);
+	}
+
+	for (size_t c = 0; c < channels(); ++c) {
+		if (0.0f != m_last[c]) {
+			return sink::process_silence(frames);
+		}
+	}
+
+	return next().process_silence(frames);
+}
+
 void wascap::sink::shmctl_averaging_sink::flush()
 {
 	for (size_t c = 0; c < MAX_CHANNELS; ++c) {
@@ -146,31 +287,24 @@ void wascap::sink::shmctl_averaging_sink::flush()
 	chain_sink::flush();
 }
 
-wascap::sink::shmctl_volume_sink::shmctl_volume_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl)
-	: shmctl_sink(std::move(next), shmctl)
+wascap::sink::volume_control::volume_control(const shmctl::shmctl& shmctl, size_t samplerate, DWORD channel_mask)
+	: m_channels(__popcnt(channel_mask))
 {
-	for (size_t c = util::unpack_channel_mask(m_channel_mappings, channels(), channel_mask()); c < MAX_CHANNELS; ++c) {
+	for (size_t c = util::unpack_channel_mask(m_channel_mappings, m_channels, channel_mask); c < MAX_CHANNELS; ++c) {
 		m_channel_mappings[c] = MAX_CHANNELS;
 	}
 
-	volatile shmctl::shm_contents* shmblock = shmctl->get();
+	volatile shmctl::shm_contents* shmblock = shmctl.get();
 
-	shmblock->samplerate = samplerate();
-	shmblock->channel_mask = channel_mask();
+	shmblock->samplerate = samplerate;
+	shmblock->channel_mask = channel_mask;
 }
 
-bool wascap::sink::shmctl_volume_sink::process(const float* samples, size_t frames)
+bool wascap::sink::volume_control::update(const shmctl::shmctl& shmctl, const float* max_amplitudes, float* channel_gains) const
 {
-	volatile shmctl::shm_contents* shmblock = shmctl().get();
+	volatile shmctl::shm_contents* shmblock = shmctl.get();
 
-	size_t ch = channels();
-	float max_amplitudes[MAX_CHANNELS] = { 0.0f };
-
-	for (size_t i = 0; i < frames; ++i) {
-		for (size_t c = 0; c < ch; ++c) {
-			update_max_amplitude(max_amplitudes[c], samples[(i * ch) + c]);
-		}
-	}
+	size_t ch = m_channels;
 
 	float channel_volumes[MAX_CHANNELS];
 	for (size_t c = 0; c < ch; ++c) {
@@ -214,7 +348,7 @@ bool wascap::sink::shmctl_volume_sink::process(const float* samples, size_t fram
 		return false;
 	}
 
-	float final_master_volume = shmctl().is_playing()
+	float final_master_volume = shmctl.is_playing()
 		? shmblock->master_volume * saturation_effective_volume
 		: 0.0f;
 
@@ -222,31 +356,172 @@ bool wascap::sink::shmctl_volume_sink::process(const float* samples, size_t fram
 		return false;
 	}
 
+	for (size_t c = 0; c < ch; ++c) {
+		channel_gains[c] = final_master_volume * channel_volumes[c];
+	}
+
+	return true;
+}
+
+bool wascap::sink::volume_control::update_silence(const shmctl::shmctl& shmctl) const
+{
+	float max_amplitudes[MAX_CHANNELS] = { 0.0f };
+	float channel_gains[MAX_CHANNELS];
+
+	return update(shmctl, max_amplitudes, channel_gains);
+}
+
+wascap::sink::shmctl_volume_sink::shmctl_volume_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl)
+	: shmctl_sink(std::move(next), shmctl), m_control(*shmctl, samplerate(), channel_mask()), m_kernels(dsp::select_kernels((frame_layout::planar == layout()) ? 1 : channels())), m_adjusted(nullptr)
+{
+}
+
+void wascap::sink::shmctl_volume_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	m_adjusted = pool.allocate(max_frames * channels());
+
+	chain_sink::prepare(pool, max_frames);
+}
+
+bool wascap::sink::shmctl_volume_sink::process(const float* samples, size_t frames)
+{
+	size_t ch = channels();
+	float max_amplitudes[MAX_CHANNELS] = { 0.0f };
+
+	if (frame_layout::planar == layout()) {
+		for (size_t c = 0; c < ch; ++c) {
+			m_kernels.peak(&max_amplitudes[c], samples + (c * frames), frames, 1);
+		}
+	}
+	else {
+		m_kernels.peak(max_amplitudes, samples, frames, ch);
+	}
+
 	float final_channel_volumes[MAX_CHANNELS];
+	if (!m_control.update(shmctl(), max_amplitudes, final_channel_volumes)) {
+		return false;
+	}
+
 	bool has_volume_adjustment = false;
 	for (size_t c = 0; c < ch; ++c) {
-		final_channel_volumes[c] = final_master_volume * channel_volumes[c];
 		has_volume_adjustment |= 1.0f != final_channel_volumes[c];
 	}
 
 	if (has_volume_adjustment) {
-		std::vector<float> resamples;
-		resamples.reserve(frames * ch);
-		for (size_t i = 0; i < frames; ++i) {
+		require_frames(frames);
+
+		float* adjusted = m_adjusted;
+		if (frame_layout::planar == layout()) {
 			for (size_t c = 0; c < ch; ++c) {
-				resamples.push_back(samples[(i * ch) + c] * final_channel_volumes[c]);
+				m_kernels.gain(adjusted + (c * frames), samples + (c * frames), frames, &final_channel_volumes[c], 1);
 			}
 		}
+		else {
+			m_kernels.gain(adjusted, samples, frames, final_channel_volumes, ch);
+		}
 
-		return chain_sink::process(resamples.data(), frames);
+		return chain_sink::process(adjusted, frames);
 	}
 
 	return chain_sink::process(samples, frames);
 }
 
+bool wascap::sink::shmctl_volume_sink::process_silence(size_t frames)
+{
+	if (!m_control.update_silence(shmctl())) {
+		return false;
+	}
+
+	return next().process_silence(frames);
+}
+
+wascap::sink::shmctl_stats_sink::shmctl_stats_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, const char* stage)
+	: shmctl_sink(std::move(next), shmctl), m_stage(stage), m_stats(shmctl->add_stage_stats(stage))
+{
+}
+
+wascap::sink::shmctl_stats_sink::~shmctl_stats_sink()
+{
+	if (nullptr != m_stats) {
+		shmctl().release_stage_stats(m_stats);
+	}
+}
+
+void wascap::sink::record_stage_time(volatile shmctl::shm_stage_stats* slot, const char* stage, size_t frames, UINT64 busy_time)
+{
+	note_stage_time(stage, slot, busy_time);
+	nested_busy_time += busy_time;
+
+	if (nullptr == slot) {
+		return;
+	}
+
+	shmctl::count(slot->blocks, 1);
+	shmctl::count(slot->frames, frames);
+	shmctl::count(slot->busy_time, busy_time);
+	shmctl::count(slot->busy_time_histogram[time_bucket(busy_time)], 1);
+}
+
+void wascap::sink::shmctl_stats_sink::record(size_t frames, bool played, UINT64 busy_time)
+{
+	note_stage_time(m_stage, m_stats, busy_time);
+
+	if (nullptr == m_stats) {
+		return;
+	}
+
+	shmctl::count(m_stats->blocks, 1);
+	shmctl::count(m_stats->frames, frames);
+	if (!played) {
+		shmctl::count(m_stats->dropped_blocks, 1);
+	}
+	shmctl::count(m_stats->busy_time, busy_time);
+	shmctl::count(m_stats->busy_time_histogram[time_bucket(busy_time)], 1);
+}
+
+void wascap::sink::shmctl_stats_sink::begin_block(const block_info& info)
+{
+	if (nullptr != m_stats && info.discontinuity) {
+		shmctl::count(m_stats->discontinuities, 1);
+	}
+
+	chain_sink::begin_block(info);
+}
+
+bool wascap::sink::shmctl_stats_sink::process(const float* samples, size_t frames)
+{
+	UINT64 outer_busy_time = nested_busy_time;
+	nested_busy_time = 0;
+	UINT64 start = capture_clock();
+
+	bool played = chain_sink::process(samples, frames);
+
+	UINT64 elapsed = capture_clock() - start;
+	record(frames, played, elapsed - min(elapsed, nested_busy_time));
+	nested_busy_time = outer_busy_time + elapsed;
+
+	return played;
+}
+
+bool wascap::sink::shmctl_stats_sink::process_silence(size_t frames)
+{
+	UINT64 outer_busy_time = nested_busy_time;
+	nested_busy_time = 0;
+	UINT64 start = capture_clock();
+
+	bool played = next().process_silence(frames);
+
+	UINT64 elapsed = capture_clock() - start;
+	record(frames, played, elapsed - min(elapsed, nested_busy_time));
+	nested_busy_time = outer_busy_time + elapsed;
+
+	return played;
+}
+
 wascap::sink::shmctl_tap_sink::shmctl_tap_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl)
-	: shmctl_sink(std::move(next), shmctl)
+	: shmctl_sink(std::move(next), shmctl), m_latency("tap")
 {
+	require_layout(frame_layout::interleaved);
 }
 
 bool wascap::sink::shmctl_tap_sink::can_play() const
@@ -255,9 +530,7 @@ bool wascap::sink::shmctl_tap_sink::can_play() const
 		return true;
 	}
 
-	volatile shmctl::shm_contents* shmblock = shmctl().get();
-
-	return shmblock->tap_capacity > 0;
+	return shmctl().has_tap();
 }
 
 bool wascap::sink::shmctl_tap_sink::is_playing() const
@@ -266,20 +539,35 @@ bool wascap::sink::shmctl_tap_sink::is_playing() const
 		return true;
 	}
 
-	volatile shmctl::shm_contents* shmblock = shmctl().get();
+	return shmctl().has_tap();
+}
+
+void wascap::sink::shmctl_tap_sink::latency_meters(std::vector<const latency_meter*>& meters) const
+{
+	meters.push_back(&m_latency);
+
+	chain_sink::latency_meters(meters);
+}
+
+void wascap::sink::shmctl_tap_sink::begin_block(const block_info& info)
+{
+	m_latency.begin_block(info);
 
-	return shmblock->tap_capacity > 0;
+	chain_sink::begin_block(info);
 }
 
 bool wascap::sink::shmctl_tap_sink::process(const float* samples, size_t frames)
 {
-	volatile shmctl::shm_contents* shmblock = shmctl().get();
-
-	size_t tap_capacity = shmblock->tap_capacity;
-	if (tap_capacity > 0) {
-		char* tap_buffer = ((char*)shmblock) + shmblock->tap_offset;
-		circular_write(tap_buffer, tap_capacity, shmblock->tap_write_cursor, (const char*)samples, frames * sizeof(float) * channels());
-	}
+	shmctl().write_tap(samples, frames * channels());
+	shmctl().record_tap_latency(m_latency);
 
 	return chain_sink::process(samples, frames);
+}
+
+bool wascap::sink::shmctl_tap_sink::process_silence(size_t frames)
+{
+	shmctl().write_tap_silence(frames * channels());
+	shmctl().record_tap_latency(m_latency);
+
+	return next().process_silence(frames);
 }
\ No newline at end of file
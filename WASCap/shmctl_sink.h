@@ -1,19 +1,81 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <string>
 
 #include "base_sink.h"
+#include "dsp_kernels.h"
+#include "latency_meter.h"
 #include "no_copy.h"
 
 #define SHMCTL_FLAG_INITIALIZED 1
 #define SHMCTL_FLAG_ENABLED 2
 #define SHMCTL_FLAG_ABORT_REQUESTED 4
 
+// Bumped whenever the layout of the statistics region changes; readers ignore a region of another version.
+#define SHMCTL_STATS_VERSION 2
+#define SHMCTL_MAX_STAGES 24
+#define SHMCTL_STAGE_NAME_LENGTH 16
+// Bucket 0 counts blocks under 1 us, bucket n those from 2^(n-1) us to 2^n us, and the last one all the longer ones.
+#define SHMCTL_TIME_BUCKETS 16
+
 namespace wascap
 {
 	namespace shmctl
 	{
+		// What a stage of the chain has been through, from the thread that runs it alone.
+		// The counters grow with relaxed stores, which readers may observe in any order.
+		struct shm_stage_stats
+		{
+			char name[SHMCTL_STAGE_NAME_LENGTH];
+			std::atomic<UINT64> blocks;
+			std::atomic<UINT64> frames;
+			// Blocks that no output behind the stage played.
+			std::atomic<UINT64> dropped_blocks;
+			std::atomic<UINT64> discontinuities;
+			// Time spent in the stage itself and not in the stages measured after it, in 100 ns units. It is wall clock
+			// time, not processor time: a thread preempted in the stage counts the time it waited too.
+			std::atomic<UINT64> busy_time;
+			std::atomic<UINT64> busy_time_histogram[SHMCTL_TIME_BUCKETS];
+			// Blocks that missed their deadline while this stage was the one they spent the longest in.
+			std::atomic<UINT64> deadline_misses;
+		};
+
+		// What the network outputs of the chain sent, added up from all of their threads.
+		struct shm_network_stats
+		{
+			std::atomic<UINT64> packets;
+			std::atomic<UINT64> bytes;
+			std::atomic<UINT64> send_errors;
+		};
+
+		// How the blocks kept up with their duration at the head of the chain, as deadline_sink measures it.
+		struct shm_deadline_stats
+		{
+			std::atomic<UINT64> blocks;
+			std::atomic<UINT64> misses;
+			std::atomic<UINT64> near_misses;
+			// Over the last blocks only.
+			std::atomic<UINT64> recent_misses;
+			std::atomic<UINT64> recent_near_misses;
+			// How long the last block that missed took, and how long it lasted, in 100 ns units.
+			std::atomic<UINT64> last_miss_time;
+			std::atomic<UINT64> last_miss_duration;
+		};
+
+		struct shm_stats
+		{
+			// SHMCTL_STATS_VERSION once the region is set up, and 0 while it is being reset.
+			std::atomic<int> version;
+			// The slots handed out so far, from the end of each chain towards its head. Each is named before it is counted,
+			// and a slot whose name is empty belongs to a stage that went away, and is free for the next chain.
+			std::atomic<int> stage_count;
+			shm_network_stats network;
+			shm_deadline_stats deadline;
+			shm_stage_stats stages[SHMCTL_MAX_STAGES];
+		};
+
 #pragma pack(push, 4)
 		struct shm_contents
 		{
@@ -34,16 +96,32 @@ namespace wascap
 			DWORD channel_mask;
 			ULONGLONG last_frame_tick_count;
 			float last_frame_max_amplitude;
+			// Milliseconds between the capture of the last block and its arrival in the tap.
+			float last_frame_latency;
+			// Written by the chain only, for the controlling process to read at any time.
+			shm_stats stats;
 		};
 #pragma pack(pop)
 
+		// Adds to a counter that only the calling thread writes, without a locked instruction.
+		inline void count(volatile std::atomic<UINT64>& counter, UINT64 value)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
 		class shmctl : public util::no_copy_no_move
 		{
+#ifdef _WIN32
 			HANDLE m_hshm;
+#endif
 			volatile shm_contents* m_shmblock;
 
 		public:
+#ifdef _WIN32
 			shmctl(const std::string& shm_name);
+#endif
+			// Controls the chain through a block the caller owns and keeps alive, with no controlling process behind it.
+			explicit shmctl(volatile shm_contents* shmblock);
 			~shmctl();
 
 			inline volatile shm_contents* get() const { return m_shmblock; }
@@ -51,6 +129,22 @@ namespace wascap
 			bool is_open() const;
 			bool is_playing() const;
 
+			bool has_tap() const;
+			// Appends samples to the tap ring buffer, when the controlling process has set one up.
+			void write_tap(const float* samples, size_t count) const;
+			// Appends zeros in place of a silent block.
+			void write_tap_silence(size_t count) const;
+			// Records the latency of the block just written to the tap, when it has a capture time.
+			void record_tap_latency(sink::latency_meter& latency) const;
+
+			// Clears the statistics region, once per mapping: the chains built on it afterwards share the mapping, and
+			// take and release slots while the others count in theirs.
+			void reset_stats() const;
+			// Takes a free slot of the statistics region for a stage, or returns null when there is none left.
+			volatile shm_stage_stats* add_stage_stats(const char* name) const;
+			// Clears a slot once its stage is gone, for the stages of a later chain.
+			void release_stage_stats(volatile shm_stage_stats* stage) const;
+
 			inline volatile shm_contents& operator *() const { return *m_shmblock; }
 			inline volatile shm_contents* operator ->() const { return m_shmblock; }
 		};
@@ -64,6 +158,7 @@ namespace wascap
 
 		protected:
 			shmctl_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl);
+			shmctl_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, DWORD channel_mask);
 
 			inline const shmctl::shmctl& shmctl() const { return *m_shmctl; }
 		};
@@ -77,31 +172,85 @@ namespace wascap
 			virtual bool is_playing() const;
 
 			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
 		};
 
 		class shmctl_averaging_sink : public shmctl_sink
 		{
 			float m_last[MAX_CHANNELS];
+			dsp::kernels m_kernels;
+			float* m_averaged;
 
 		public:
 			shmctl_averaging_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl);
 
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
 			virtual bool process(const float* samples, size_t frames);
+			// Silence stays silence once the average has decayed to zero, which takes one block of actual zeros.
+			virtual bool process_silence(size_t frames);
 			virtual void flush();
 		};
 
-		class shmctl_volume_sink : public shmctl_sink
+		// The control block side of the volume stage: saturation limiting, silence detection and per-channel gains.
+		class volume_control
 		{
 			unsigned long m_channel_mappings[MAX_CHANNELS];
+			size_t m_channels;
+
+		public:
+			// Publishes the format of the adjusted stream in the control block.
+			volume_control(const shmctl::shmctl& shmctl, size_t samplerate, DWORD channel_mask);
+
+			// Feeds the peak amplitude of each channel in a block to the limiter, then computes the gain of each channel.
+			// Returns false when the block is under the silence threshold and must be dropped.
+			bool update(const shmctl::shmctl& shmctl, const float* max_amplitudes, float* channel_gains) const;
+			// Same as update for a block of zeros, which is dropped unless the silence threshold is 0.
+			bool update_silence(const shmctl::shmctl& shmctl) const;
+		};
+
+		class shmctl_volume_sink : public shmctl_sink
+		{
+			volume_control m_control;
+			dsp::kernels m_kernels;
+			float* m_adjusted;
 
 		public:
 			shmctl_volume_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl);
 
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
 			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
+		};
+
+		// For time the calling thread spends on a stage that no shmctl_stats_sink measures, such as the tee waiting for
+		// its workers: publishes it in the slot, when there is one, blames deadline misses on the stage, and leaves the
+		// time out of the stage measured around it.
+		void record_stage_time(volatile shmctl::shm_stage_stats* slot, const char* stage, size_t frames, UINT64 busy_time);
+
+		// Publishes what goes through the stage behind it in a slot of the statistics region. Stages measured on the
+		// same thread further down the chain are left out of its time, so that each slot only counts its own stage.
+		class shmctl_stats_sink : public shmctl_sink
+		{
+			const char* m_stage;
+			volatile shmctl::shm_stage_stats* m_stats;
+
+			void record(size_t frames, bool played, UINT64 busy_time);
+
+		public:
+			shmctl_stats_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl, const char* stage);
+			~shmctl_stats_sink();
+
+			virtual void begin_block(const block_info& info);
+			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
 		};
 
 		class shmctl_tap_sink : public shmctl_sink
 		{
+			latency_meter m_latency;
+
 		public:
 			shmctl_tap_sink(std::unique_ptr<sink> next, const std::shared_ptr<shmctl::shmctl>& shmctl);
 
@@ -109,7 +258,11 @@ namespace wascap
 
 			virtual bool is_playing() const;
 
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			virtual void begin_block(const block_info& info);
 			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
 		};
 	}
 }
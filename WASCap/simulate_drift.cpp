@@ -0,0 +1,140 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "base_sink.h"
+#include "buffer_pool.h"
+#include "check.h"
+#include "convert_sink.h"
+
+#define SIMULATION_PERIOD_MS 10
+#define SIMULATION_BUFFER_MS 100
+#define SIMULATION_REPORT_MS 60000
+
+namespace
+{
+	// Stands in for a WAS render device: holds a fixed-size buffer, which is drained in whole device periods at the device's own clock rate.
+	class simulated_render_sink : public wascap::sink::chain_sink
+	{
+		size_t m_capacity_frames;
+		size_t m_queued_frames;
+		size_t m_overflow_frames;
+		size_t m_underflow_frames;
+
+	public:
+		simulated_render_sink(std::unique_ptr<sink> next)
+			: chain_sink(std::move(next)), m_capacity_frames(samplerate() * SIMULATION_BUFFER_MS / 1000), m_queued_frames(0), m_overflow_frames(0), m_underflow_frames(0)
+		{
+		}
+
+		inline size_t queued_frames() const { return m_queued_frames; }
+		inline size_t overflow_frames() const { return m_overflow_frames; }
+		inline size_t underflow_frames() const { return m_underflow_frames; }
+
+		void drain(size_t frames)
+		{
+			if (frames > m_queued_frames) {
+				m_underflow_frames += frames - m_queued_frames;
+				m_queued_frames = 0;
+			}
+			else {
+				m_queued_frames -= frames;
+			}
+		}
+
+		virtual bool can_play() const
+		{
+			return true;
+		}
+
+		virtual bool is_playing() const
+		{
+			return true;
+		}
+
+		virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const
+		{
+			queued_frames = m_queued_frames;
+			capacity_frames = m_capacity_frames;
+
+			return true;
+		}
+
+		virtual bool process(const float* samples, size_t frames)
+		{
+			// The real sink would block until the device catches up, which a simulation cannot do.
+			m_queued_frames += frames;
+			if (m_queued_frames > m_capacity_frames) {
+				m_overflow_frames += m_queued_frames - m_capacity_frames;
+				m_queued_frames = m_capacity_frames;
+			}
+
+			return chain_sink::process(samples, frames);
+		}
+	};
+}
+
+int wascap::check::simulate_drift_main(const drift_options& options)
+{
+	size_t samplerate = options.samplerate;
+	double duration = options.duration;
+
+	sink::buffer_pool pool;
+	std::unique_ptr<sink::sink> s = std::make_unique<sink::null_sink>(samplerate, 1);
+	s = std::make_unique<simulated_render_sink>(std::move(s));
+	simulated_render_sink& render = (simulated_render_sink&)*s;
+	s = std::make_unique<sink::drift_compensation_sink>(std::move(s), samplerate, options.resampler_quality);
+	sink::drift_compensation_sink& compensation = (sink::drift_compensation_sink&)*s;
+
+	size_t period_frames = samplerate * SIMULATION_PERIOD_MS / 1000;
+	s->prepare(pool, period_frames);
+	std::vector<float> packet(period_frames, 0.0f);
+
+	// Both clocks are expressed in capture clock milliseconds; the render clock runs drift_ppm faster.
+	double render_period = SIMULATION_PERIOD_MS / (1.0 + options.drift_ppm * 1e-6);
+	double next_render_time = 0.0;
+
+	size_t periods = (size_t)(duration * 1000.0 / SIMULATION_PERIOD_MS);
+	size_t periods_per_report = SIMULATION_REPORT_MS / SIMULATION_PERIOD_MS;
+	size_t min_level = SIZE_MAX;
+	size_t max_level = 0;
+	double sum_level = 0.0;
+	double sum_adjustment = 0.0;
+
+	printf("time_s\tmin_level_ms\tmean_level_ms\tmax_level_ms\tmean_adjustment_ppm\tunderflow_frames\toverflow_frames\n");
+
+	for (size_t period = 0; period < periods; ++period) {
+		double time = (double)period * SIMULATION_PERIOD_MS;
+		s->process(packet.data(), period_frames);
+		while (next_render_time < time + SIMULATION_PERIOD_MS) {
+			render.drain(period_frames);
+			next_render_time += render_period;
+		}
+
+		size_t level = render.queued_frames();
+		min_level = min(min_level, level);
+		max_level = max(max_level, level);
+		sum_level += level;
+		sum_adjustment += compensation.adjustment();
+
+		if ((period + 1) % periods_per_report == 0 || period + 1 == periods) {
+			size_t n = (period % periods_per_report) + 1;
+			printf("%.0f\t%.2f\t%.2f\t%.2f\t%.3f\t%zu\t%zu\n",
+				(time + SIMULATION_PERIOD_MS) / 1000.0,
+				min_level * 1000.0 / samplerate,
+				sum_level * 1000.0 / samplerate / n,
+				max_level * 1000.0 / samplerate,
+				sum_adjustment * 1e6 / n,
+				render.underflow_frames(),
+				render.overflow_frames());
+			min_level = SIZE_MAX;
+			max_level = 0;
+			sum_level = 0.0;
+			sum_adjustment = 0.0;
+		}
+	}
+
+	return 0;
+}
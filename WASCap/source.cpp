@@ -0,0 +1,28 @@
+#include "stdafx.h"
+
+#include "source.h"
+
+wascap::source::source::~source()
+{
+}
+
+void wascap::source::source::run(sink::sink& sink, size_t stop_after_frames)
+{
+	start(sink);
+	try {
+		DWORD wait_ms;
+		while (poll(sink, stop_after_frames, wait_ms)) {
+			Sleep(wait_ms);
+		}
+	}
+	catch (...) {
+		abort();
+		throw;
+	}
+
+	stop(sink);
+}
+
+wascap::source::source_provider::~source_provider()
+{
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "base_sink.h"
+#include "no_copy.h"
+
+namespace wascap
+{
+	namespace source
+	{
+		// The device behind a source went away, as when it is unplugged. Another source may take over its chain.
+		class source_lost : public std::runtime_error
+		{
+		public:
+			inline source_lost(const std::string& what) : std::runtime_error(what) { }
+		};
+
+		// Captures frames in its own format and hands them to a sink, polled by the thread that captures.
+		class source : public util::no_copy_no_move
+		{
+		public:
+			virtual ~source();
+
+			virtual size_t samplerate() const = 0;
+			virtual DWORD channel_mask() const = 0;
+
+			// The largest packet the source will ever give.
+			virtual size_t max_packet_frames() const = 0;
+			// How often packets show up.
+			virtual DWORD poll_interval_ms() const = 0;
+
+			virtual bool is_capturing() const = 0;
+
+			// Starts capturing; the packets then go to the sink as poll finds them.
+			virtual void start(sink::sink& sink) = 0;
+			// Hands over the packets that are ready, without waiting for more. Returns false once the sink closes or pauses,
+			// or has taken the frames that stop_after_frames counts down; otherwise sets how long to wait before polling again.
+			// Throws source_lost when the source cannot go on.
+			virtual bool poll(sink::sink& sink, size_t& stop_after_frames, DWORD& wait_ms) = 0;
+			// Flushes the sink if it played anything, then stops capturing.
+			virtual void stop(sink::sink& sink) = 0;
+			// Stops capturing without flushing the sink, after a failure or to hand the chain over to another source.
+			virtual void abort() = 0;
+
+			// Captures on the calling thread until poll returns false.
+			void run(sink::sink& sink, size_t stop_after_frames);
+		};
+
+		// Opens the source a chain captures from, and again whenever the one it opened is lost or stale.
+		class source_provider : public util::no_copy_no_move
+		{
+		public:
+			virtual ~source_provider();
+
+			virtual std::unique_ptr<source> open() = 0;
+			// Whether the source last opened should give way to a new one, as when it follows the default device
+			// and the default changed. Called between polls, so it must be cheap most of the time.
+			virtual bool is_stale() = 0;
+		};
+	}
+}
\ No newline at end of file
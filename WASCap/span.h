@@ -90,7 +90,7 @@ namespace wascap
 		}
 
 		template<typename T, std::enable_if_t<std::is_trivially_copyable_v<T>, bool> = true>
-		inline span<T>& operator <<(span<T>& dest, const span<T>& source)
+		inline const span<T>& operator <<(const span<T>& dest, const span<T>& source)
 		{
 			if (source.size() != dest.size()) {
 				throw std::logic_error(string_format("Span size mismatch (dest size = %d, source size = %d)", dest.size(), source.size()));
@@ -102,7 +102,7 @@ namespace wascap
 		}
 
 		template<typename T, std::enable_if_t<!std::is_trivially_copyable_v<T>, bool> = true>
-		inline span<T>& operator <<(span<T>& dest, const span<T>& source)
+		inline const span<T>& operator <<(const span<T>& dest, const span<T>& source)
 		{
 			if (source.size() != dest.size()) {
 				throw std::logic_error(string_format("Span size mismatch (dest size = %d, source size = %d)", dest.size(), source.size()));
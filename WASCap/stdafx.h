@@ -5,11 +5,15 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
+#endif
 
 #define WIN32_LEAN_AND_MEAN
 
 #include <stdio.h>
+#ifdef _WIN32
 #include <tchar.h>
+#endif
 
 // TODO: faites rfrence ici aux en-ttes supplmentaires ncessaires au programme
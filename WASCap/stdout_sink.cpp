@@ -3,8 +3,9 @@
 #include "stdout_sink.h"
 
 wascap::sink::stdout_sink::stdout_sink(std::unique_ptr<sink> next)
-	: chain_sink(std::move(next))
+	: chain_sink(std::move(next)), m_latency("stdout")
 {
+	require_layout(frame_layout::interleaved);
 }
 
 bool wascap::sink::stdout_sink::can_play() const
@@ -17,9 +18,24 @@ bool wascap::sink::stdout_sink::is_playing() const
 	return true;
 }
 
+void wascap::sink::stdout_sink::latency_meters(std::vector<const latency_meter*>& meters) const
+{
+	meters.push_back(&m_latency);
+
+	chain_sink::latency_meters(meters);
+}
+
+void wascap::sink::stdout_sink::begin_block(const block_info& info)
+{
+	m_latency.begin_block(info);
+
+	chain_sink::begin_block(info);
+}
+
 bool wascap::sink::stdout_sink::process(const float* samples, size_t frames)
 {
 	fwrite(samples, sizeof(float), frames * channels(), stdout);
+	m_latency.record();
 
 	return chain_sink::process(samples, frames);
 }
@@ -3,6 +3,7 @@
 #include <memory>
 
 #include "base_sink.h"
+#include "latency_meter.h"
 
 namespace wascap
 {
@@ -10,6 +11,8 @@ namespace wascap
 	{
 		class stdout_sink : public chain_sink
 		{
+			latency_meter m_latency;
+
 		public:
 			stdout_sink(std::unique_ptr<sink> next);
 
@@ -17,6 +20,9 @@ namespace wascap
 
 			virtual bool is_playing() const;
 
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			virtual void begin_block(const block_info& info);
 			virtual bool process(const float* samples, size_t frames);
 			virtual void flush();
 		};
@@ -12,7 +12,7 @@ namespace wascap
 		namespace internal
 		{
 			template<typename T, std::enable_if_t<std::is_pointer_v<T> || std::is_fundamental_v<T>, bool> = true>
-			inline typename T string_format_convert(T value)
+			inline T string_format_convert(T value)
 			{
 				return value;
 			}
@@ -0,0 +1,229 @@
+#include "stdafx.h"
+
+#include <windows.h>
+#include <cstring>
+#include <stdexcept>
+
+#include "switch_sink.h"
+#include "errors.h"
+#include "latency_meter.h"
+
+wascap::sink::switch_sink::switch_sink(std::unique_ptr<switch_chain> chain, size_t fade_frames)
+	: sink(chain->head->samplerate(), chain->head->channel_mask(), frame_layout::interleaved), m_current(std::move(chain)), m_fade_frames(fade_frames), m_faded_frames(0), m_last_block_time(capture_clock()), m_fade_in(nullptr), m_fade_out(nullptr),
+	m_offered(nullptr), m_retired(nullptr), m_stopping(false)
+{
+	m_current->head->require_layout(frame_layout::interleaved);
+
+	m_retired_event.reset(WIN32_CHECK(CreateEventW(nullptr, false, false, nullptr)));
+}
+
+wascap::sink::switch_sink::~switch_sink()
+{
+	delete m_offered.exchange(nullptr);
+	delete m_retired.exchange(nullptr);
+}
+
+void wascap::sink::switch_sink::take_offered(bool fade)
+{
+	switch_chain* offered = m_offered.exchange(nullptr, std::memory_order_acquire);
+	if (nullptr == offered) {
+		return;
+	}
+
+	std::unique_ptr<switch_chain> previous = std::move(m_current);
+	m_current.reset(offered);
+	if (fade && m_fade_frames > 0 && previous->can_fade && m_current->can_fade) {
+		m_fading = std::move(previous);
+		m_faded_frames = 0;
+	}
+	else {
+		retire(std::move(previous));
+	}
+}
+
+void wascap::sink::switch_sink::retire(std::unique_ptr<switch_chain> chain)
+{
+	m_retired.store(chain.release(), std::memory_order_release);
+	SetEvent(m_retired_event.get());
+}
+
+void wascap::sink::switch_sink::advance_fade(size_t frames)
+{
+	m_faded_frames += frames;
+	if (m_faded_frames == m_fade_frames) {
+		retire(std::move(m_fading));
+	}
+}
+
+std::unique_ptr<wascap::sink::switch_chain> wascap::sink::switch_sink::switch_to(std::unique_ptr<switch_chain> chain)
+{
+	if (chain->head->samplerate() != samplerate() || chain->head->channel_mask() != channel_mask()) {
+		throw std::invalid_argument("Switching to a chain that takes other frames");
+	}
+	chain->head->require_layout(frame_layout::interleaved);
+	chain->head->prepare(chain->pool, max_frames());
+
+	m_offered.store(chain.release(), std::memory_order_release);
+	for (;;) {
+		WaitForSingleObject(m_retired_event.get(), INFINITE);
+
+		std::unique_ptr<switch_chain> retired(m_retired.exchange(nullptr, std::memory_order_acquire));
+		if (retired) {
+			retired->head->flush();
+
+			return retired;
+		}
+		if (m_stopping) {
+			// Unless the capture took it meanwhile, the chain never runs.
+			delete m_offered.exchange(nullptr, std::memory_order_acquire);
+
+			throw std::runtime_error("Capture stopped before the switch");
+		}
+	}
+}
+
+void wascap::sink::switch_sink::switch_idle()
+{
+	if (m_fading) {
+		retire(std::move(m_fading));
+	}
+
+	take_offered(false);
+}
+
+void wascap::sink::switch_sink::switch_if_idle()
+{
+	// Longer than the gap between two packets, so that a fade is never cut short while frames still come.
+	if (capture_clock() - m_last_block_time < (UINT64)(max_frames() + m_fade_frames) * 10000000 / samplerate()) {
+		return;
+	}
+
+	switch_idle();
+}
+
+void wascap::sink::switch_sink::stop()
+{
+	m_stopping = true;
+	SetEvent(m_retired_event.get());
+}
+
+bool wascap::sink::switch_sink::can_play() const
+{
+	return m_current->head->can_play();
+}
+
+bool wascap::sink::switch_sink::is_open() const
+{
+	return !m_stopping && m_current->head->is_open();
+}
+
+bool wascap::sink::switch_sink::is_playing() const
+{
+	return m_current->head->is_playing();
+}
+
+bool wascap::sink::switch_sink::buffer_level(size_t& queued_frames, size_t& capacity_frames) const
+{
+	return m_current->head->buffer_level(queued_frames, capacity_frames);
+}
+
+void wascap::sink::switch_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	sink::prepare(pool, max_frames);
+
+	m_fade_in = pool.allocate(max_frames * channels());
+	m_fade_out = pool.allocate(max_frames * channels());
+
+	m_current->head->prepare(m_current->pool, max_frames);
+}
+
+bool wascap::sink::switch_sink::writable_frames(size_t& frames, DWORD& retry_after_ms) const
+{
+	if (!m_fading) {
+		return m_current->head->writable_frames(frames, retry_after_ms);
+	}
+
+	size_t fading_frames;
+	DWORD fading_retry_after_ms;
+	if (!m_fading->head->writable_frames(fading_frames, fading_retry_after_ms)) {
+		return m_current->head->writable_frames(frames, retry_after_ms);
+	}
+	if (m_current->head->writable_frames(frames, retry_after_ms)) {
+		frames = min(frames, fading_frames);
+		retry_after_ms = max(retry_after_ms, fading_retry_after_ms);
+	}
+	else {
+		frames = fading_frames;
+		retry_after_ms = fading_retry_after_ms;
+	}
+
+	return true;
+}
+
+void wascap::sink::switch_sink::latency_meters(std::vector<const latency_meter*>& meters) const
+{
+	m_current->head->latency_meters(meters);
+}
+
+void wascap::sink::switch_sink::begin_block(const block_info& info)
+{
+	m_last_block_time = capture_clock();
+
+	if (!m_fading) {
+		take_offered(true);
+	}
+
+	if (m_fading) {
+		m_fading->head->begin_block(info);
+	}
+	m_current->head->begin_block(info);
+}
+
+bool wascap::sink::switch_sink::process(const float* samples, size_t frames)
+{
+	if (!m_fading) {
+		return m_current->head->process(samples, frames);
+	}
+
+	// Both chains take the same frames, so gains that add up to one keep the level steady where their outputs meet.
+	size_t channels = this->channels();
+	size_t fade_frames = min(frames, m_fade_frames - m_faded_frames);
+	for (size_t f = 0; f < fade_frames; ++f) {
+		float gain = (float)(m_faded_frames + f + 1) / (float)m_fade_frames;
+		for (size_t c = 0; c < channels; ++c) {
+			size_t i = (f * channels) + c;
+			m_fade_in[i] = samples[i] * gain;
+			m_fade_out[i] = samples[i] - m_fade_in[i];
+		}
+	}
+	memcpy(m_fade_in + (fade_frames * channels), samples + (fade_frames * channels), (frames - fade_frames) * channels * sizeof(float));
+
+	m_fading->head->process(m_fade_out, fade_frames);
+	bool played = m_current->head->process(m_fade_in, frames);
+	advance_fade(fade_frames);
+
+	return played;
+}
+
+bool wascap::sink::switch_sink::process_silence(size_t frames)
+{
+	if (!m_fading) {
+		return m_current->head->process_silence(frames);
+	}
+
+	size_t fade_frames = min(frames, m_fade_frames - m_faded_frames);
+	m_fading->head->process_silence(fade_frames);
+	bool played = m_current->head->process_silence(frames);
+	advance_fade(fade_frames);
+
+	return played;
+}
+
+void wascap::sink::switch_sink::flush()
+{
+	if (m_fading) {
+		retire(std::move(m_fading));
+	}
+
+	m_current->head->flush();
+}
\ No newline at end of file
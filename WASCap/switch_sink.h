@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "base_sink.h"
+#include "buffer_pool.h"
+#include "win32_helper.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		// A chain along with the pool its buffers come from, so that both go away together.
+		struct switch_chain
+		{
+			buffer_pool pool;
+			std::unique_ptr<sink> head;
+			// Whether the chain may run alongside another during a fade: only render devices mix what two chains play,
+			// where the network, stdout and the tap would take both, and a control block would see its state updated twice.
+			bool can_fade = false;
+		};
+
+		// Runs one chain at a time, and switches to another at a block boundary, fading between them when both can so that
+		// their outputs overlap for a moment instead of leaving a gap. Another thread builds and prepares the chains, offers
+		// them and gets the retired ones back, so that the capture thread never constructs or destroys one.
+		class switch_sink : public sink
+		{
+			std::unique_ptr<switch_chain> m_current;
+			// The chain that fades out, during a switch.
+			std::unique_ptr<switch_chain> m_fading;
+			size_t m_fade_frames;
+			size_t m_faded_frames;
+			// When the last block began, in capture_clock units.
+			UINT64 m_last_block_time;
+			float* m_fade_in;
+			float* m_fade_out;
+
+			std::atomic<switch_chain*> m_offered;
+			std::atomic<switch_chain*> m_retired;
+			std::atomic<bool> m_stopping;
+			util::unique_handle m_retired_event;
+
+			void take_offered(bool fade);
+			void retire(std::unique_ptr<switch_chain> chain);
+			void advance_fade(size_t frames);
+
+		public:
+			// The chain is prepared along with the switch.
+			switch_sink(std::unique_ptr<switch_chain> chain, size_t fade_frames);
+			~switch_sink();
+
+			// Prepares a chain that takes the same frames, offers it, and waits for the one it replaces, which it flushes
+			// and returns. Only one thread may switch, and only once the switch is prepared.
+			std::unique_ptr<switch_chain> switch_to(std::unique_ptr<switch_chain> chain);
+			// For the capture thread while it captures nothing: switches at once, without a fade.
+			void switch_idle();
+			// For the capture thread between polls. No block comes while nothing plays, so once none has come for longer
+			// than a packet and a fade last, there is nothing to fade between, and a switch waiting for the next block
+			// happens at once.
+			void switch_if_idle();
+			// Closes the switch, which ends the capture and any switch still waiting.
+			void stop();
+
+			virtual bool can_play() const;
+
+			virtual bool is_open() const;
+			virtual bool is_playing() const;
+
+			virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const;
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const;
+
+			// Reports the meters of the current chain.
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			virtual void begin_block(const block_info& info);
+			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
+			virtual void flush();
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "stdafx.h"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "synthetic_source.h"
+
+wascap::source::synthetic_source::synthetic_source(size_t samplerate, DWORD channel_mask, size_t packet_frames, size_t lost_after_frames, double frequency, float amplitude)
+	: m_samplerate(samplerate), m_channel_mask(channel_mask), m_packet_frames(packet_frames), m_lost_after_frames(lost_after_frames), m_frequency(frequency), m_amplitude(amplitude),
+	m_packet(std::make_unique<float[]>(packet_frames * __popcnt(channel_mask))), m_position(0), m_packet_offset(0), m_capturing(false), m_shall_flush(false)
+{
+	if (0 == packet_frames || 0 == channel_mask) {
+		throw std::invalid_argument("Synthetic source without frames");
+	}
+}
+
+void wascap::source::synthetic_source::generate()
+{
+	const double PI = 3.14159265358979323846;
+
+	size_t channels = __popcnt(m_channel_mask);
+	for (size_t f = 0; f < m_packet_frames; ++f) {
+		float sample = (float)(m_amplitude * sin(2.0 * PI * m_frequency * (double)(m_position + f) / (double)m_samplerate));
+		for (size_t c = 0; c < channels; ++c) {
+			m_packet[f * channels + c] = sample;
+		}
+	}
+}
+
+size_t wascap::source::synthetic_source::samplerate() const
+{
+	return m_samplerate;
+}
+
+DWORD wascap::source::synthetic_source::channel_mask() const
+{
+	return m_channel_mask;
+}
+
+size_t wascap::source::synthetic_source::max_packet_frames() const
+{
+	return m_packet_frames;
+}
+
+DWORD wascap::source::synthetic_source::poll_interval_ms() const
+{
+	return 1;
+}
+
+bool wascap::source::synthetic_source::is_capturing() const
+{
+	return m_capturing;
+}
+
+void wascap::source::synthetic_source::start(sink::sink& sink)
+{
+	if (sink.samplerate() != m_samplerate || sink.channel_mask() != m_channel_mask || sink.layout() != sink::frame_layout::interleaved) {
+		throw std::runtime_error("Incompatible sink");
+	}
+
+	m_capturing = true;
+	m_shall_flush = false;
+}
+
+bool wascap::source::synthetic_source::poll(sink::sink& sink, size_t& stop_after_frames, DWORD& wait_ms)
+{
+	if (!sink.is_open() || !sink.is_playing() || 0 == stop_after_frames) {
+		return false;
+	}
+
+	if (0 == m_packet_offset) {
+		if (m_position >= m_lost_after_frames) {
+			throw source_lost("Synthetic source lost");
+		}
+		generate();
+	}
+
+	sink::block_info info;
+	info.capture_time = 0;
+	info.stream_position = m_position + m_packet_offset;
+	info.discontinuity = false;
+	info.silent = false;
+
+	size_t frames = min(m_packet_frames - m_packet_offset, stop_after_frames);
+	sink::process_result result = sink.try_process(m_packet.get() + (m_packet_offset * __popcnt(m_channel_mask)), frames, info);
+	if (result.played) {
+		m_shall_flush = true;
+	}
+	m_packet_offset += result.consumed_frames;
+	stop_after_frames -= result.consumed_frames;
+	if (m_packet_offset == m_packet_frames) {
+		m_position += m_packet_frames;
+		m_packet_offset = 0;
+	}
+
+	wait_ms = result.would_block ? max(1, result.retry_after_ms) : 0;
+
+	return true;
+}
+
+void wascap::source::synthetic_source::stop(sink::sink& sink)
+{
+	m_capturing = false;
+
+	if (m_shall_flush) {
+		sink.flush();
+	}
+}
+
+void wascap::source::synthetic_source::abort()
+{
+	m_capturing = false;
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+
+#include "base_sink.h"
+#include "source.h"
+
+namespace wascap
+{
+	namespace source
+	{
+		// Plays a sine on every channel, a packet of a fixed size each time it is polled, as fast as it is polled.
+		// After a given number of frames, it is lost, the way a device is when it is unplugged.
+		class synthetic_source : public source
+		{
+			size_t m_samplerate;
+			DWORD m_channel_mask;
+			size_t m_packet_frames;
+			size_t m_lost_after_frames;
+			double m_frequency;
+			float m_amplitude;
+			std::unique_ptr<float[]> m_packet;
+
+			// Frames generated so far, including the packet the sink has not finished taking.
+			size_t m_position;
+			size_t m_packet_offset;
+			bool m_capturing;
+			bool m_shall_flush;
+
+			void generate();
+
+		public:
+			synthetic_source(size_t samplerate, DWORD channel_mask, size_t packet_frames, size_t lost_after_frames, double frequency, float amplitude);
+
+			// Frames given so far.
+			inline size_t position() const { return m_position; }
+
+			virtual size_t samplerate() const;
+			virtual DWORD channel_mask() const;
+
+			virtual size_t max_packet_frames() const;
+			virtual DWORD poll_interval_ms() const;
+
+			virtual bool is_capturing() const;
+
+			virtual void start(sink::sink& sink);
+			// Gives at most one packet, and never asks to wait unless the sink would block.
+			virtual bool poll(sink::sink& sink, size_t& stop_after_frames, DWORD& wait_ms);
+			virtual void stop(sink::sink& sink);
+			virtual void abort();
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,248 @@
+#include "stdafx.h"
+
+#include <stdexcept>
+
+#include "latency_meter.h"
+#include "tee_sink.h"
+#include "trace.h"
+
+namespace
+{
+	const wascap::sink::sink& first_branch(const std::vector<std::unique_ptr<wascap::sink::sink>>& branches)
+	{
+		if (branches.empty()) {
+			throw std::invalid_argument("Tee without branches");
+		}
+
+		return *branches.front();
+	}
+}
+
+wascap::sink::tee_sink::branch_worker::branch_worker(sink& branch)
+	: m_branch(branch), m_samples(nullptr), m_frames(0), m_stopping(false), m_played(false)
+{
+	m_thread = std::thread(&branch_worker::thread_proc, this);
+}
+
+wascap::sink::tee_sink::branch_worker::~branch_worker()
+{
+	m_stopping = true;
+	m_start_event.set();
+	m_thread.join();
+}
+
+void wascap::sink::tee_sink::branch_worker::thread_proc()
+{
+	// Branches may end in a WAS sink, and workers stand in for the capture thread.
+	util::audio_thread_scope audio_thread;
+	trace::register_thread();
+
+	// The events order every access to the block and the results: the capture thread only touches them between
+	// setting the start event and waiting for the done event, and the worker only the other way around.
+	for (;;) {
+		m_start_event.wait();
+		if (m_stopping) {
+			break;
+		}
+
+		try {
+			m_played = (nullptr != m_samples) ? m_branch.process(m_samples, m_frames) : m_branch.process_silence(m_frames);
+		}
+		catch (...) {
+			m_exception = std::current_exception();
+		}
+
+		m_done_event.set();
+	}
+}
+
+void wascap::sink::tee_sink::branch_worker::start(const float* samples, size_t frames)
+{
+	m_samples = samples;
+	m_frames = frames;
+	m_played = false;
+	m_exception = nullptr;
+
+	m_start_event.set();
+}
+
+bool wascap::sink::tee_sink::branch_worker::finish()
+{
+	m_done_event.wait();
+
+	if (m_exception) {
+		std::rethrow_exception(m_exception);
+	}
+
+	return m_played;
+}
+
+wascap::sink::tee_sink::tee_sink(std::vector<std::unique_ptr<sink>> branches, const std::shared_ptr<shmctl::shmctl>& shmctl)
+	: sink(first_branch(branches).samplerate(), first_branch(branches).channel_mask(), first_branch(branches).layout()), m_branches(std::move(branches)), m_shmctl(shmctl), m_wait_stats(nullptr)
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		if (branch->samplerate() != samplerate() || branch->channel_mask() != channel_mask() || branch->layout() != layout()) {
+			throw std::runtime_error("Tee branches take different frames");
+		}
+	}
+
+	m_workers.reserve(m_branches.size() - 1);
+	for (size_t i = 1; i < m_branches.size(); ++i) {
+		m_workers.push_back(std::make_unique<branch_worker>(*m_branches[i]));
+	}
+
+	if (m_shmctl && !m_workers.empty()) {
+		m_wait_stats = m_shmctl->add_stage_stats("tee-wait");
+	}
+}
+
+wascap::sink::tee_sink::~tee_sink()
+{
+	if (nullptr != m_wait_stats) {
+		m_shmctl->release_stage_stats(m_wait_stats);
+	}
+}
+
+bool wascap::sink::tee_sink::can_play() const
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		if (branch->can_play()) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool wascap::sink::tee_sink::is_open() const
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		if (!branch->is_open()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool wascap::sink::tee_sink::is_playing() const
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		if (branch->is_playing()) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool wascap::sink::tee_sink::buffer_level(size_t& queued_frames, size_t& capacity_frames) const
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		if (branch->buffer_level(queued_frames, capacity_frames)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void wascap::sink::tee_sink::prepare(buffer_pool& pool, size_t max_frames)
+{
+	sink::prepare(pool, max_frames);
+
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		branch->prepare(pool, max_frames);
+	}
+}
+
+bool wascap::sink::tee_sink::writable_frames(size_t& frames, DWORD& retry_after_ms) const
+{
+	bool may_block = false;
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		size_t branch_frames;
+		DWORD branch_retry_after_ms;
+		if (!branch->writable_frames(branch_frames, branch_retry_after_ms)) {
+			continue;
+		}
+
+		if (!may_block || branch_frames < frames) {
+			frames = branch_frames;
+		}
+		retry_after_ms = may_block ? max(retry_after_ms, branch_retry_after_ms) : branch_retry_after_ms;
+		may_block = true;
+	}
+
+	return may_block;
+}
+
+void wascap::sink::tee_sink::latency_meters(std::vector<const latency_meter*>& meters) const
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		branch->latency_meters(meters);
+	}
+}
+
+// Called on the capture thread between blocks, while the workers wait.
+void wascap::sink::tee_sink::begin_block(const block_info& info)
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		branch->begin_block(info);
+	}
+}
+
+bool wascap::sink::tee_sink::process_branches(const float* samples, size_t frames)
+{
+	for (const std::unique_ptr<branch_worker>& worker : m_workers) {
+		worker->start(samples, frames);
+	}
+
+	// The workers read the block until they are done with it, so they are waited for even when a branch fails.
+	std::exception_ptr exception;
+	bool played = false;
+	try {
+		played = (nullptr != samples) ? m_branches.front()->process(samples, frames) : m_branches.front()->process_silence(frames);
+	}
+	catch (...) {
+		exception = std::current_exception();
+	}
+
+	// Once the first branch is done, the rest is time the workers take beyond it.
+	UINT64 wait_start = capture_clock();
+	for (const std::unique_ptr<branch_worker>& worker : m_workers) {
+		try {
+			played |= worker->finish();
+		}
+		catch (...) {
+			if (!exception) {
+				exception = std::current_exception();
+			}
+		}
+	}
+	if (!m_workers.empty()) {
+		record_stage_time(m_wait_stats, "tee-wait", frames, capture_clock() - wait_start);
+	}
+
+	if (exception) {
+		std::rethrow_exception(exception);
+	}
+
+	return played;
+}
+
+bool wascap::sink::tee_sink::process(const float* samples, size_t frames)
+{
+	return process_branches(samples, frames);
+}
+
+bool wascap::sink::tee_sink::process_silence(size_t frames)
+{
+	return process_branches(nullptr, frames);
+}
+
+void wascap::sink::tee_sink::flush()
+{
+	for (const std::unique_ptr<sink>& branch : m_branches) {
+		branch->flush();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "base_sink.h"
+#include "no_copy.h"
+#include "shmctl_sink.h"
+#include "thread_helper.h"
+
+namespace wascap
+{
+	namespace sink
+	{
+		// Feeds every block to several branches, each a chain of its own that ends in an output.
+		// The first branch runs on the calling thread, the others each on a worker thread, all over the same read-only block.
+		// The branches run side by side rather than in turn, but process returns once every branch is done with the block,
+		// so the tee takes as long as its slowest branch. A branch that may block belongs behind a queue_sink.
+		// The time the calling thread then waits for the workers is measured as a stage of its own, tee-wait.
+		class tee_sink : public sink
+		{
+			class branch_worker : util::no_copy_no_move
+			{
+				sink& m_branch;
+				util::auto_reset_event m_start_event;
+				util::auto_reset_event m_done_event;
+				std::thread m_thread;
+				const float* m_samples;
+				size_t m_frames;
+				bool m_stopping;
+				bool m_played;
+				std::exception_ptr m_exception;
+
+				void thread_proc();
+
+			public:
+				branch_worker(sink& branch);
+				~branch_worker();
+
+				// Null samples stand for a silent block.
+				void start(const float* samples, size_t frames);
+				// Waits for the branch to be done with the block, then returns its result or rethrows its exception.
+				bool finish();
+			};
+
+			std::vector<std::unique_ptr<sink>> m_branches;
+			// Declared after the branches, so that the workers stop before their branches go away.
+			std::vector<std::unique_ptr<branch_worker>> m_workers;
+			std::shared_ptr<shmctl::shmctl> m_shmctl;
+			volatile shmctl::shm_stage_stats* m_wait_stats;
+
+			// Processes the block on every branch, or a silent one when the samples are null.
+			bool process_branches(const float* samples, size_t frames);
+
+		public:
+			// Branches must all take the same frames. The control block, if any, publishes the wait for the workers.
+			tee_sink(std::vector<std::unique_ptr<sink>> branches, const std::shared_ptr<shmctl::shmctl>& shmctl = nullptr);
+			~tee_sink();
+
+			virtual bool can_play() const;
+
+			virtual bool is_open() const;
+			virtual bool is_playing() const;
+
+			virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const;
+
+			virtual void prepare(buffer_pool& pool, size_t max_frames);
+
+			// Every branch takes the same frames, so the tee takes no more than the fullest branch can.
+			virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const;
+
+			virtual void latency_meters(std::vector<const latency_meter*>& meters) const;
+
+			virtual void begin_block(const block_info& info);
+			virtual bool process(const float* samples, size_t frames);
+			// Each branch takes the silence as one, so that its own stages can skip it.
+			virtual bool process_silence(size_t frames);
+			virtual void flush();
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include "stdafx.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <objbase.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "errors.h"
+#include "thread_helper.h"
+
+#ifdef _WIN32
+wascap::util::auto_reset_event::auto_reset_event()
+	: m_handle(WIN32_CHECK(CreateEventW(nullptr, false, false, nullptr)))
+{
+}
+
+wascap::util::auto_reset_event::~auto_reset_event()
+{
+	CloseHandle(m_handle);
+}
+
+void wascap::util::auto_reset_event::set()
+{
+	WIN32_CHECK(SetEvent(m_handle));
+}
+
+void wascap::util::auto_reset_event::wait()
+{
+	WaitForSingleObject(m_handle, INFINITE);
+}
+#elif defined(__linux__)
+wascap::util::auto_reset_event::auto_reset_event()
+	: m_signaled(0)
+{
+}
+
+wascap::util::auto_reset_event::~auto_reset_event()
+{
+}
+
+void wascap::util::auto_reset_event::set()
+{
+	if (0 == m_signaled.exchange(1, std::memory_order_release)) {
+		syscall(SYS_futex, (int*)&m_signaled, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+	}
+}
+
+void wascap::util::auto_reset_event::wait()
+{
+	// The futex only sleeps while the event is still clear, so a set between the exchange and the wait is not lost.
+	while (1 != m_signaled.exchange(0, std::memory_order_acquire)) {
+		syscall(SYS_futex, (int*)&m_signaled, FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+	}
+}
+#else
+wascap::util::auto_reset_event::auto_reset_event()
+	: m_signaled(false)
+{
+}
+
+wascap::util::auto_reset_event::~auto_reset_event()
+{
+}
+
+void wascap::util::auto_reset_event::set()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_signaled = true;
+	m_condition.notify_one();
+}
+
+void wascap::util::auto_reset_event::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_condition.wait(lock, [this] { return m_signaled; });
+	m_signaled = false;
+}
+#endif
+
+wascap::util::audio_thread_scope::audio_thread_scope()
+{
+#ifdef _WIN32
+	m_co_initialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#endif
+}
+
+wascap::util::audio_thread_scope::~audio_thread_scope()
+{
+#ifdef _WIN32
+	if (m_co_initialized) {
+		CoUninitialize();
+	}
+#endif
+}
\ No newline at end of file
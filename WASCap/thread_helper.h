@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#if !defined(_WIN32) && !defined(__linux__)
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#include "no_copy.h"
+#include "platform.h"
+
+namespace wascap
+{
+	namespace util
+	{
+		// Wakes one waiting thread and resets itself, like an auto-reset Windows event. On Linux it waits on a futex,
+		// so that setting it takes no lock on the audio path; other systems fall back to a condition variable.
+		class auto_reset_event : no_copy_no_move
+		{
+#ifdef _WIN32
+			HANDLE m_handle;
+#elif defined(__linux__)
+			std::atomic<int> m_signaled;
+#else
+			std::mutex m_mutex;
+			std::condition_variable m_condition;
+			bool m_signaled;
+#endif
+
+		public:
+			auto_reset_event();
+			~auto_reset_event();
+
+			void set();
+			// Returns once the event is set, and resets it.
+			void wait();
+		};
+
+		// Makes the calling thread fit to run stages until the scope ends: on Windows, it joins the multithreaded COM
+		// apartment, since WAS sinks hold free-threaded audio clients, and runs at the priority of the capture thread.
+		class audio_thread_scope : no_copy_no_move
+		{
+#ifdef _WIN32
+			bool m_co_initialized;
+#endif
+
+		public:
+			audio_thread_scope();
+			~audio_thread_scope();
+		};
+	}
+}
\ No newline at end of file
@@ -0,0 +1,217 @@
+#include "stdafx.h"
+
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "string_format.h"
+#include "trace.h"
+
+#ifndef WASCAP_NO_TRACING
+namespace
+{
+	// Each field is stored on its own, so that a dump that reads an event as it is being overwritten is only wrong,
+	// which the dump then detects, rather than undefined.
+	struct trace_event
+	{
+		std::atomic<const char*> category;
+		std::atomic<const char*> name;
+		std::atomic<UINT64> start;
+		std::atomic<UINT64> duration;
+		std::atomic<UINT64> frames;
+	};
+
+	struct trace_span
+	{
+		const char* category;
+		const char* name;
+		UINT64 start;
+		UINT64 duration;
+		UINT64 frames;
+	};
+
+	// The spans of one thread, which only that thread writes.
+	struct trace_ring
+	{
+		size_t thread_number;
+		size_t capacity;
+		std::unique_ptr<trace_event[]> events;
+		// Spans recorded so far; the ring holds the last capacity of them.
+		std::atomic<UINT64> written;
+
+		trace_ring(size_t thread_number, size_t capacity)
+			: thread_number(thread_number), capacity(capacity), events(std::make_unique<trace_event[]>(capacity)), written(0)
+		{
+		}
+	};
+
+	std::mutex rings_lock;
+	// Kept until the process ends, so that the spans of the threads that are gone can still be dumped.
+	std::vector<std::shared_ptr<trace_ring>> rings;
+	size_t ring_capacity = 0;
+
+	thread_local trace_ring* current_ring = nullptr;
+
+	trace_ring& thread_ring()
+	{
+		if (nullptr == current_ring) {
+			std::lock_guard<std::mutex> lock(rings_lock);
+			rings.push_back(std::make_shared<trace_ring>(rings.size() + 1, ring_capacity));
+			current_ring = rings.back().get();
+		}
+
+		return *current_ring;
+	}
+}
+
+std::atomic<bool> wascap::trace::enabled(false);
+
+void wascap::trace::record(const char* category, const char* name, UINT64 start, UINT64 frames)
+{
+	UINT64 end = sink::capture_clock();
+
+	trace_ring& ring = thread_ring();
+	UINT64 index = ring.written.load(std::memory_order_relaxed);
+	trace_event& event = ring.events[index % ring.capacity];
+	event.category.store(category, std::memory_order_relaxed);
+	event.name.store(name, std::memory_order_relaxed);
+	event.start.store(start, std::memory_order_relaxed);
+	event.duration.store(end - start, std::memory_order_relaxed);
+	event.frames.store(frames, std::memory_order_relaxed);
+	ring.written.store(index + 1, std::memory_order_release);
+}
+
+void wascap::trace::enable(size_t events_per_thread)
+{
+	if (0 == events_per_thread) {
+		throw std::invalid_argument("Trace rings need room for at least one span");
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(rings_lock);
+		ring_capacity = events_per_thread;
+	}
+	enabled.store(true, std::memory_order_relaxed);
+
+	register_thread();
+}
+
+void wascap::trace::register_thread()
+{
+	if (is_enabled()) {
+		thread_ring();
+	}
+}
+
+size_t wascap::trace::dump(const std::string& path)
+{
+	if (!is_enabled()) {
+		throw std::logic_error("Tracing is not enabled");
+	}
+
+	std::vector<std::shared_ptr<trace_ring>> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(rings_lock);
+		snapshot = rings;
+	}
+
+	std::ofstream file(path, std::ios::out | std::ios::trunc);
+	if (!file) {
+		throw std::runtime_error(util::string_format("Unable to write trace file: %s", path));
+	}
+
+	size_t spans = 0;
+	bool first = true;
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	for (const std::shared_ptr<trace_ring>& ring : snapshot) {
+		file << util::string_format("%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}",
+			first ? "" : ",", ring->thread_number, ring->thread_number);
+		first = false;
+
+		UINT64 written = ring->written.load(std::memory_order_acquire);
+		UINT64 oldest = (written > ring->capacity) ? (written - ring->capacity) : 0;
+		std::vector<trace_span> copies((size_t)(written - oldest));
+		for (UINT64 i = oldest; i < written; ++i) {
+			const trace_event& event = ring->events[i % ring->capacity];
+			trace_span& copy = copies[(size_t)(i - oldest)];
+			copy.category = event.category.load(std::memory_order_relaxed);
+			copy.name = event.name.load(std::memory_order_relaxed);
+			copy.start = event.start.load(std::memory_order_relaxed);
+			copy.duration = event.duration.load(std::memory_order_relaxed);
+			copy.frames = event.frames.load(std::memory_order_relaxed);
+		}
+
+		// The spans recorded meanwhile overwrote the oldest ones, and the one being recorded the next after them.
+		UINT64 rewritten = ring->written.load(std::memory_order_acquire);
+		UINT64 intact = (rewritten >= ring->capacity) ? (rewritten - ring->capacity + 1) : 0;
+		for (UINT64 i = max(oldest, intact); i < written; ++i) {
+			const trace_span& copy = copies[(size_t)(i - oldest)];
+			// The capture clock counts 100 ns units, and Chrome traces count microseconds.
+			file << util::string_format(",\n{\"cat\":\"%s\",\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%llu.%llu,\"dur\":%llu.%llu",
+				copy.category, copy.name, ring->thread_number, copy.start / 10, copy.start % 10, copy.duration / 10, copy.duration % 10);
+			if (0 != copy.frames) {
+				file << util::string_format(",\"args\":{\"frames\":%llu}", copy.frames);
+			}
+			file << "}";
+			++spans;
+		}
+	}
+	file << "\n]}\n";
+
+	if (!file) {
+		throw std::runtime_error(util::string_format("Unable to write trace file: %s", path));
+	}
+
+	return spans;
+}
+#else
+void wascap::trace::enable(size_t)
+{
+	throw std::logic_error("Tracing was left out of this build");
+}
+
+void wascap::trace::register_thread()
+{
+}
+
+size_t wascap::trace::dump(const std::string&)
+{
+	throw std::logic_error("Tracing was left out of this build");
+}
+#endif
+
+wascap::sink::trace_sink::trace_sink(std::unique_ptr<sink> next, const char* stage)
+	: chain_sink(std::move(next)), m_stage(stage)
+{
+}
+
+bool wascap::sink::trace_sink::process(const float* samples, size_t frames)
+{
+#ifndef WASCAP_NO_TRACING
+	if (trace::is_enabled()) {
+		UINT64 start = capture_clock();
+		bool played = chain_sink::process(samples, frames);
+		trace::record("sink", m_stage, start, frames);
+
+		return played;
+	}
+#endif
+
+	return chain_sink::process(samples, frames);
+}
+
+bool wascap::sink::trace_sink::process_silence(size_t frames)
+{
+#ifndef WASCAP_NO_TRACING
+	if (trace::is_enabled()) {
+		UINT64 start = capture_clock();
+		bool played = next().process_silence(frames);
+		trace::record("silence", m_stage, start, frames);
+
+		return played;
+	}
+#endif
+
+	return next().process_silence(frames);
+}
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "base_sink.h"
+#include "latency_meter.h"
+#include "no_copy.h"
+#include "platform.h"
+
+// Building with WASCAP_NO_TRACING leaves no trace of the spans in the code; otherwise they cost a relaxed load
+// until tracing is enabled.
+#ifdef WASCAP_NO_TRACING
+#define WASCAP_TRACE_SPAN(category, name)
+#else
+#define WASCAP_TRACE_CONCAT_(a, b) a##b
+#define WASCAP_TRACE_CONCAT(a, b) WASCAP_TRACE_CONCAT_(a, b)
+// Records a span from here to the end of the enclosing scope, on the ring of the calling thread.
+#define WASCAP_TRACE_SPAN(category, name) wascap::trace::span WASCAP_TRACE_CONCAT(wascap_trace_span_, __LINE__)(category, name)
+#endif
+
+namespace wascap
+{
+	namespace trace
+	{
+#ifdef WASCAP_NO_TRACING
+		inline bool is_enabled() { return false; }
+#else
+		extern std::atomic<bool> enabled;
+
+		inline bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+
+		// Called when a span ends, with the capture clock at its start.
+		void record(const char* category, const char* name, UINT64 start, UINT64 frames);
+
+		class span : util::no_copy_no_move
+		{
+			const char* m_category;
+			const char* m_name;
+			UINT64 m_start;
+
+		public:
+			inline span(const char* category, const char* name)
+				: m_category(category), m_name(name), m_start(is_enabled() ? sink::capture_clock() : 0)
+			{
+			}
+
+			inline ~span()
+			{
+				if (0 != m_start) {
+					record(m_category, m_name, m_start, 0);
+				}
+			}
+		};
+#endif
+
+		// Starts recording spans. Each thread keeps the last events_per_thread of its own, in a ring that outlives it
+		// until the process ends. The calling thread gets its ring at once.
+		void enable(size_t events_per_thread);
+
+		// Gives the calling thread its ring now when tracing is enabled, rather than on its first span, which would
+		// then take a lock and allocate. Threads that process blocks call it as they start.
+		void register_thread();
+
+		// Writes what the rings hold as Chrome trace events, which Perfetto opens as well, and returns how many spans
+		// it wrote. Threads go on recording meanwhile; the spans they overwrite during the dump are left out.
+		size_t dump(const std::string& path);
+	}
+
+	namespace sink
+	{
+		// Records a span for each block that the stage behind it processes, named after the stage.
+		class trace_sink : public chain_sink
+		{
+			const char* m_stage;
+
+		public:
+			trace_sink(std::unique_ptr<sink> next, const char* stage);
+
+			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
+		};
+	}
+}
\ No newline at end of file
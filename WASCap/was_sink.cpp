@@ -2,10 +2,13 @@
 
 #include "was_sink.h"
 #include "string_format.h"
+#include "trace.h"
 
 wascap::sink::was_sink::was_sink(std::unique_ptr<sink> next, const was::mm_device& device)
 	: chain_sink(std::move(next))
 {
+	require_layout(frame_layout::interleaved);
+
 	if (device.data_flow() != eRender) {
 		throw std::runtime_error(util::string_format("Cannot create WAS sink from capture device %s (%s)", device.id(), device.friendly_name()));
 	}
@@ -33,6 +36,21 @@ wascap::sink::was_sink::was_sink(std::unique_ptr<sink> next, const was::mm_devic
 	COM_CHECK(m_audio_client->Start());
 }
 
+DWORD wascap::sink::was_sink::refill_wait_ms(size_t padding, size_t frames) const
+{
+	// Never waits for more than half the buffer to drain, so that the device does not run dry meanwhile.
+	frames = min(frames, (size_t)(m_buffer_frame_count / 2));
+
+	size_t available_frames = m_buffer_frame_count - padding;
+	if (frames <= available_frames) {
+		return 0;
+	}
+
+	size_t missing_frames = min(frames - available_frames, padding);
+
+	return (DWORD)(((missing_frames * 1000) + samplerate() - 1) / samplerate());
+}
+
 bool wascap::sink::was_sink::can_play() const
 {
 	return true;
@@ -43,7 +61,29 @@ bool wascap::sink::was_sink::is_playing() const
 	return true;
 }
 
-bool wascap::sink::was_sink::process(const float* samples, size_t frames)
+bool wascap::sink::was_sink::buffer_level(size_t& queued_frames, size_t& capacity_frames) const
+{
+	UINT32 padding;
+	COM_CHECK(m_audio_client->GetCurrentPadding(&padding));
+
+	queued_frames = padding;
+	capacity_frames = m_buffer_frame_count;
+
+	return true;
+}
+
+bool wascap::sink::was_sink::writable_frames(size_t& frames, DWORD& retry_after_ms) const
+{
+	UINT32 padding;
+	COM_CHECK(m_audio_client->GetCurrentPadding(&padding));
+
+	frames = m_buffer_frame_count - padding;
+	retry_after_ms = refill_wait_ms(padding, max_frames());
+
+	return true;
+}
+
+void wascap::sink::was_sink::write(const float* samples, size_t frames)
 {
 	const float* cur_samples = samples;
 	size_t n_frames = frames;
@@ -56,7 +96,8 @@ bool wascap::sink::was_sink::process(const float* samples, size_t frames)
 			if (available_frames > 0) {
 				break;
 			}
-			Sleep(6);
+			WASCAP_TRACE_SPAN("was", "wait");
+			Sleep(max(1, refill_wait_ms(padding, n_frames)));
 		}
 
 		size_t actual_frames = min(available_frames, n_frames);
@@ -65,12 +106,26 @@ bool wascap::sink::was_sink::process(const float* samples, size_t frames)
 		BYTE* data;
 		COM_CHECK(m_render_client->GetBuffer(actual_frames, &data));
 
-		memcpy(data, cur_samples, actual_samples * sizeof(float));
-		cur_samples += actual_samples;
+		if (nullptr != cur_samples) {
+			memcpy(data, cur_samples, actual_samples * sizeof(float));
+			cur_samples += actual_samples;
+		}
 		n_frames -= actual_frames;
 
-		COM_CHECK(m_render_client->ReleaseBuffer(actual_frames, 0));
+		COM_CHECK(m_render_client->ReleaseBuffer(actual_frames, (nullptr != cur_samples) ? 0 : AUDCLNT_BUFFERFLAGS_SILENT));
 	}
+}
+
+bool wascap::sink::was_sink::process(const float* samples, size_t frames)
+{
+	write(samples, frames);
 
 	return chain_sink::process(samples, frames);
+}
+
+bool wascap::sink::was_sink::process_silence(size_t frames)
+{
+	write(nullptr, frames);
+
+	return next().process_silence(frames);
 }
\ No newline at end of file
@@ -18,6 +18,11 @@ namespace wascap
 			WAVEFORMATEXTENSIBLE m_wave_format;
 			UINT32 m_buffer_frame_count;
 
+			// How long the device needs to play enough of what is queued to make room for the given frames.
+			DWORD refill_wait_ms(size_t padding, size_t frames) const;
+			// Without samples, lets the audio engine fill the buffer with silence.
+			void write(const float* samples, size_t frames);
+
 		public:
 			was_sink(std::unique_ptr<sink> next, const was::mm_device& device);
 
@@ -25,7 +30,12 @@ namespace wascap
 
 			virtual bool is_playing() const;
 
+			virtual bool buffer_level(size_t& queued_frames, size_t& capacity_frames) const;
+
+			virtual bool writable_frames(size_t& frames, DWORD& retry_after_ms) const;
+
 			virtual bool process(const float* samples, size_t frames);
+			virtual bool process_silence(size_t frames);
 		};
 	}
 }
\ No newline at end of file
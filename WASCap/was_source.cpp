@@ -2,8 +2,29 @@
 
 #include "was_source.h"
 #include "errors.h"
+#include "idle_backoff.h"
+#include "trace.h"
+
+// How long the capture loop may sleep during silence, which bounds how late it notices audio coming back.
+#define MAX_IDLE_WAIT_MS 64
+
+// Like COM_CHECK, except that an invalidated device, which is gone for good, makes the source lost.
+#define CAPTURE_CHECK(com_op) (capture_check((com_op), #com_op))
+
+namespace
+{
+	HRESULT capture_check(HRESULT hr, const char* op)
+	{
+		if (AUDCLNT_E_DEVICE_INVALIDATED == hr) {
+			throw wascap::source::source_lost(op);
+		}
+
+		return wascap::util::com_check(hr, op);
+	}
+}
 
 wascap::source::was_source::was_source(const was::mm_device& device)
+	: m_buffer_frame_count(0), m_poll_interval_ms(1), m_max_wait_ms(1), m_backoff(1, MAX_IDLE_WAIT_MS), m_shall_flush(false), m_packet_offset(0)
 {
 	m_audio_client = device.activate<IAudioClient>(CLSCTX_ALL, nullptr);
 
@@ -24,43 +45,125 @@ wascap::source::was_source::was_source(const was::mm_device& device)
 	COM_CHECK(m_audio_client->Initialize(AUDCLNT_SHAREMODE_SHARED,
 		(device.data_flow() == eRender) ? AUDCLNT_STREAMFLAGS_LOOPBACK : 0,
 		10000000, 0, m_wave_format.get(), nullptr));
+
+	COM_CHECK(m_audio_client->GetBufferSize(&m_buffer_frame_count));
+
+	{
+		REFERENCE_TIME default_period;
+		COM_CHECK(m_audio_client->GetDevicePeriod(&default_period, nullptr));
+		m_poll_interval_ms = max(1, (DWORD)(default_period / 20000));
+	}
+
+	m_max_wait_ms = max(1, (DWORD)((m_buffer_frame_count * 250ULL) / wave_format().nSamplesPerSec));
+	m_backoff = util::idle_backoff(m_poll_interval_ms, MAX_IDLE_WAIT_MS);
+}
+
+size_t wascap::source::was_source::samplerate() const
+{
+	return wave_format().nSamplesPerSec;
+}
+
+DWORD wascap::source::was_source::channel_mask() const
+{
+	return was::channel_mask(wave_format());
+}
+
+size_t wascap::source::was_source::max_packet_frames() const
+{
+	return m_buffer_frame_count;
+}
+
+DWORD wascap::source::was_source::poll_interval_ms() const
+{
+	return m_poll_interval_ms;
+}
+
+bool wascap::source::was_source::is_capturing() const
+{
+	return m_capture_client;
 }
 
-void wascap::source::was_source::run(sink::sink& sink, size_t stop_after_frames)
+void wascap::source::was_source::start(sink::sink& sink)
 {
 	{
 		const WAVEFORMATEX& format = wave_format();
 
-		if (sink.samplerate() != format.nSamplesPerSec || sink.channel_mask() != was::channel_mask(format)) {
+		if (sink.samplerate() != format.nSamplesPerSec || sink.channel_mask() != was::channel_mask(format) || sink.layout() != sink::frame_layout::interleaved) {
 			throw std::runtime_error("Incompatible sink");
 		}
 	}
 
 	util::com_ptr<IAudioCaptureClient> capture_client;
-	COM_CHECK(m_audio_client->GetService(__uuidof(IAudioCaptureClient), capture_client.ppv()));
+	CAPTURE_CHECK(m_audio_client->GetService(__uuidof(IAudioCaptureClient), capture_client.ppv()));
 
-	COM_CHECK(m_audio_client->Start());
-	try {
-		UINT32 packetLength;
-		BYTE* pData;
-		UINT32 numFramesAvailable;
-		DWORD flags;
-
-		bool shall_flush = false;
-		while (sink.is_open() && sink.is_playing() && stop_after_frames > 0) {
-			COM_CHECK(capture_client->GetNextPacketSize(&packetLength));
-			if (0 == packetLength) {
-				Sleep(6);
-				continue;
-			}
-			COM_CHECK(capture_client->GetBuffer(&pData, &numFramesAvailable, &flags, nullptr, nullptr));
-			if (sink.process((const float*)pData, numFramesAvailable)) {
-				shall_flush = true;
+	CAPTURE_CHECK(m_audio_client->Start());
+
+	m_capture_client = std::move(capture_client);
+	m_backoff.reset();
+	m_shall_flush = false;
+}
+
+bool wascap::source::was_source::poll(sink::sink& sink, size_t& stop_after_frames, DWORD& wait_ms)
+{
+	UINT32 packetLength;
+	BYTE* pData;
+	UINT32 numFramesAvailable;
+	DWORD flags;
+	UINT64 devicePosition;
+	UINT64 qpcPosition;
+
+	size_t channels = sink.channels();
+	size_t samplerate = sink.samplerate();
+
+	while (sink.is_open() && sink.is_playing() && stop_after_frames > 0) {
+		CAPTURE_CHECK(m_capture_client->GetNextPacketSize(&packetLength));
+		if (0 == packetLength) {
+			wait_ms = m_backoff.idle_wait();
+			return true;
+		}
+		{
+			WASCAP_TRACE_SPAN("source", "GetBuffer");
+			CAPTURE_CHECK(m_capture_client->GetBuffer(&pData, &numFramesAvailable, &flags, &devicePosition, &qpcPosition));
+		}
+
+		// The rest of a packet is described as a block of its own, that follows what the sink already took.
+		sink::block_info info;
+		info.capture_time = (0 != (flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR)) ? 0 : (qpcPosition + ((m_packet_offset * 10000000) / samplerate));
+		info.stream_position = devicePosition + m_packet_offset;
+		info.discontinuity = 0 == m_packet_offset && 0 != (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY);
+		info.silent = 0 != (flags & AUDCLNT_BUFFERFLAGS_SILENT);
+		if (!info.silent) {
+			m_backoff.reset();
+		}
+
+		sink::process_result result = sink.try_process((const float*)pData + (m_packet_offset * channels), numFramesAvailable - m_packet_offset, info);
+		if (result.played) {
+			m_shall_flush = true;
+		}
+		m_packet_offset += result.consumed_frames;
+		stop_after_frames = (stop_after_frames > result.consumed_frames) ? (stop_after_frames - result.consumed_frames) : 0;
+		if (m_packet_offset == numFramesAvailable) {
+			CAPTURE_CHECK(m_capture_client->ReleaseBuffer(numFramesAvailable));
+			m_packet_offset = 0;
+		}
+		else {
+			CAPTURE_CHECK(m_capture_client->ReleaseBuffer(0));
+			if (result.would_block) {
+				wait_ms = min(max(1, result.retry_after_ms), m_max_wait_ms);
+				return true;
 			}
-			COM_CHECK(capture_client->ReleaseBuffer(numFramesAvailable));
-			stop_after_frames = (stop_after_frames > numFramesAvailable) ? (stop_after_frames - numFramesAvailable) : 0;
 		}
-		if (shall_flush) {
+	}
+
+	return false;
+}
+
+void wascap::source::was_source::stop(sink::sink& sink)
+{
+	m_capture_client.reset();
+
+	try {
+		if (m_shall_flush) {
 			sink.flush();
 		}
 	}
@@ -70,4 +173,10 @@ void wascap::source::was_source::run(sink::sink& sink, size_t stop_after_frames)
 	}
 
 	COM_CHECK(m_audio_client->Stop());
+}
+
+void wascap::source::was_source::abort()
+{
+	m_capture_client.reset();
+	m_audio_client->Stop();
 }
\ No newline at end of file
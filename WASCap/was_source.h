@@ -3,25 +3,54 @@
 #include <audioclient.h>
 
 #include "com_helper.h"
+#include "idle_backoff.h"
 #include "no_copy.h"
 #include "mm_device.h"
 #include "base_sink.h"
+#include "source.h"
 
 namespace wascap
 {
 	namespace source
 	{
-		class was_source : public util::no_copy_no_move
+		class was_source : public source
 		{
 			util::com_ptr<IAudioClient> m_audio_client;
 			util::co_task_unique_ptr<WAVEFORMATEX> m_wave_format;
+			UINT32 m_buffer_frame_count;
+			DWORD m_poll_interval_ms;
+			// A quarter of the capture buffer, so that waiting for the outputs never lets it overflow.
+			DWORD m_max_wait_ms;
+
+			// Only while capturing.
+			util::com_ptr<IAudioCaptureClient> m_capture_client;
+			util::idle_backoff m_backoff;
+			bool m_shall_flush;
+			// Frames of the current packet that the sink already took. A packet that is not released is given again,
+			// after a stop as well.
+			size_t m_packet_offset;
 
 		public:
 			explicit was_source(const was::mm_device& device);
 
 			inline const WAVEFORMATEX& wave_format() const { return *m_wave_format; }
 
-			void run(sink::sink& sink, size_t stop_after_frames);
+			virtual size_t samplerate() const;
+			virtual DWORD channel_mask() const;
+
+			// No packet is larger than the capture buffer.
+			virtual size_t max_packet_frames() const;
+
+			// Half the device period, which is how often packets show up.
+			virtual DWORD poll_interval_ms() const;
+
+			virtual bool is_capturing() const;
+
+			virtual void start(sink::sink& sink);
+			// Throws source_lost once the device is invalidated.
+			virtual bool poll(sink::sink& sink, size_t& stop_after_frames, DWORD& wait_ms);
+			virtual void stop(sink::sink& sink);
+			virtual void abort();
 		};
 	}
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Windows.h>
+#include <memory>
 
 namespace wascap
 {
@@ -17,5 +18,12 @@ namespace wascap
 		{
 			inline void operator()(T* ptr) { if (nullptr != ptr) { LocalFree(ptr); } }
 		};
+
+		struct handle_deleter
+		{
+			inline void operator()(HANDLE handle) { if (nullptr != handle) { CloseHandle(handle); } }
+		};
+
+		typedef std::unique_ptr<void, handle_deleter> unique_handle;
 	}
 }
\ No newline at end of file
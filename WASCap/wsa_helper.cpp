@@ -1,20 +1,39 @@
 #include "stdafx.h"
 
+#ifdef _WIN32
 #include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#endif
+#include <stdexcept>
 
 #include "wsa_helper.h"
 #include "errors.h"
 
+#ifdef _WIN32
 #pragma comment (lib, "ws2_32.lib")
+#else
+namespace
+{
+	inline int closesocket(SOCKET socket)
+	{
+		return close(socket);
+	}
+}
+#endif
 
 wascap::util::wsa::wsa() : m_wsa_data()
 {
+#ifdef _WIN32
 	WSA_CHECK(WSAStartup(MAKEWORD(2, 2), &m_wsa_data));
+#endif
 }
 
 wascap::util::wsa::~wsa()
 {
+#ifdef _WIN32
 	WSACleanup();
+#endif
 }
 
 wascap::util::shared_wsa wascap::util::make_shared_wsa()
@@ -27,7 +46,15 @@ wascap::util::shared_wsa wascap::util::make_shared_wsa()
 wascap::util::wsa_addrinfo::wsa_addrinfo(shared_wsa wsa, const char* node_name, const char* service_name, const addrinfo& hints)
 	: m_wsa(wsa), m_info(nullptr)
 {
+#ifdef _WIN32
 	WSA_CHECK(getaddrinfo(node_name, service_name, &hints, &m_info));
+#else
+	// Resolution errors have codes of their own rather than errno.
+	int error = getaddrinfo(node_name, service_name, &hints, &m_info);
+	if (0 != error) {
+		throw std::runtime_error(std::string("getaddrinfo: ") + gai_strerror(error));
+	}
+#endif
 }
 
 wascap::util::wsa_addrinfo::~wsa_addrinfo()
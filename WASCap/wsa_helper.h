@@ -1,6 +1,11 @@
 #pragma once
 
+#ifdef _WIN32
 #include <WinSock2.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#endif
 #include <memory>
 #include <vector>
 
@@ -8,6 +13,15 @@
 #include "no_copy.h"
 #include "span.h"
 
+#ifndef _WIN32
+// Sockets are plain descriptors, and need no library to be started.
+typedef int SOCKET;
+
+struct WSADATA
+{
+};
+#endif
+
 namespace wascap
 {
 	namespace util